@@ -0,0 +1,675 @@
+/*
+ * nf_bench - time the module's name parser, lookups and list loading in
+ * userspace, built with "make bench" from kernel/.
+ *
+ *   nf_bench [-p capture.pcap] [-l domains.txt] [-i list.img]
+ *            [-s 1000,100000,1000000] [-q queries] [-r rounds] [-v]
+ *
+ * For each list size a fresh table is loaded through load_domain_frame(),
+ * the path binary frames take (its shards run inline in the shim), and the queries are parsed with
+ * parse_query_name() and looked up with is_domain_blocked(), as the
+ * netfilter hooks do. Queries come from the DNS packets of a pcap
+ * (Ethernet, raw IP, Linux cooked or loopback captures) or are made up:
+ * a quarter are subdomains of listed names, the rest are not listed.
+ * Lists are the first lines of -l, padded with made-up names, plus a
+ * share of the capture's names so real traffic gets hits. -i adds a row
+ * for a blocklist image built by the server.
+ *
+ * Columns: load time of the list and per entry, the cost per entry of
+ * scanning it as the server's JSON, memory per entry as counted by the
+ * shim (kshim.h), time per parse and per lookup, the share of lookups
+ * that blocked and the table probes per lookup past the prefilter.
+ *
+ * Before any timing, image_parse() must refuse malformed images, such
+ * as a slot naming more bytes than the pool holds, a few listed names
+ * must block when queried and invalid overlay names must be refused.
+ */
+#include "cache.h"
+#include "dns_name.h"
+#include "json_parser.h"
+#include "stats.h"
+
+#include <getopt.h>
+
+DEFINE_PER_CPU_ALIGNED(struct nf_stats, nf_stats);
+
+#define DEFAULT_QUERIES         65536
+#define DEFAULT_ROUNDS          5
+#define QUESTION_MAX            (MAX_DOMAIN_LENGTH + 4)
+
+/* Query questions back to back, each a wire-format name and its QTYPE/QCLASS */
+struct queries {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    u32 *off;
+    u16 *qlen;
+    size_t count;
+    size_t max;
+};
+
+/* Domain records in the binary frame layout, see frame_for_each_domain() */
+struct domain_list {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t count;
+};
+
+static volatile u64 sink;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fprintf(stderr, "nf_bench: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static u64 now_ns(void)
+{
+    return local_clock();
+}
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void queries_add(struct queries *q, const unsigned char *question, size_t len)
+{
+    if (q->count == q->max)
+        return;
+    len = min_t(size_t, len, QUESTION_MAX);
+    if (q->len + len > q->cap) {
+        q->cap = max_t(size_t, q->cap * 2, q->len + len + 4096);
+        q->data = xrealloc(q->data, q->cap);
+    }
+    if (!(q->count & (q->count - 1))) {
+        q->off = xrealloc(q->off, max_t(size_t, q->count * 2, 1) * sizeof(*q->off));
+        q->qlen = xrealloc(q->qlen, max_t(size_t, q->count * 2, 1) * sizeof(*q->qlen));
+    }
+    memcpy(q->data + q->len, question, len);
+    q->off[q->count] = q->len;
+    q->qlen[q->count] = len;
+    q->len += len;
+    q->count++;
+}
+
+static void list_add(struct domain_list *list, const char *domain, size_t len)
+{
+    if (!len || len >= MAX_DOMAIN_LENGTH)
+        return;
+    if (list->len + len + 1 > list->cap) {
+        list->cap = max_t(size_t, list->cap * 2, 1 << 16);
+        list->data = xrealloc(list->data, list->cap);
+    }
+    list->data[list->len++] = len;
+    memcpy(list->data + list->len, domain, len);
+    list->len += len;
+    list->count++;
+}
+
+/* Wire format of a dotted name plus QTYPE A and QCLASS IN */
+static size_t encode_question(const char *name, unsigned char *out)
+{
+    size_t n = 0, len;
+
+    while (*name) {
+        len = strcspn(name, ".");
+        out[n++] = len;
+        memcpy(out + n, name, len);
+        n += len;
+        name += len;
+        if (*name)
+            name++;
+    }
+    out[n++] = 0;
+    memcpy(out + n, "\0\1\0\1", 4);
+    return n + 4;
+}
+
+static const char *const tlds[] = { "com", "net", "org", "io", "de", "co.uk", "info", "tv" };
+static const char *const words[] = {
+    "ads", "track", "cdn", "pixel", "stats", "media", "metrics", "static",
+    "click", "beacon", "promo", "video", "shop", "news", "mail", "cloud",
+};
+
+/* Made-up name number @i, distinct for every @i */
+static int made_up_name(u64 i, char *out, size_t size)
+{
+    u64 state = i * 0x9e3779b97f4a7c15ULL + 1;
+    u64 r = next_random(&state);
+
+    return snprintf(out, size, "%s%llx.%s", words[r % 16], (unsigned long long)i,
+                    tlds[(r >> 8) % 8]);
+}
+
+/* A query of made-up traffic, the list holds made-up names 0 to @listed - 1 */
+static void made_up_query(u64 *state, size_t listed, char *out, size_t size)
+{
+    static const char *const sub[] = { "www.", "api.", "img.", "eu.cdn." };
+    char name[64];
+    u64 r = next_random(state);
+
+    if (r % 4 == 0 && listed) {
+        made_up_name(next_random(state) % listed, name, sizeof(name));
+        snprintf(out, size, "%s%s", sub[(r >> 4) % 4], name);
+    } else {
+        made_up_name(listed + next_random(state) % (listed * 4 + 1024), name, sizeof(name));
+        snprintf(out, size, "%s%s", r & 0x10 ? "www." : "", name);
+    }
+    /* Resolvers pass case through, some stub resolvers randomize it */
+    if ((r >> 8) % 8 == 0)
+        out[0] = toupper((unsigned char)out[0]);
+}
+
+static u32 read32(const unsigned char *p, bool swap)
+{
+    u32 v = get_unaligned_le32(p);
+
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* UDP payload of a DNS packet at @ip, questions of port 53 traffic only */
+static void add_dns_packet(struct queries *q, const unsigned char *ip, size_t len)
+{
+    const unsigned char *udp;
+    size_t hlen;
+
+    if (len < 1)
+        return;
+    if ((ip[0] >> 4) == 4) {
+        hlen = (ip[0] & 0xf) * 4;
+        if (len < hlen + 8 || ip[9] != 17 || ((ip[6] & 0x3f) | ip[7]))
+            return;
+    } else if ((ip[0] >> 4) == 6) {
+        hlen = 40;
+        if (len < hlen + 8 || ip[6] != 17)
+            return;
+    } else {
+        return;
+    }
+    udp = ip + hlen;
+    len -= hlen;
+    if (((udp[0] << 8 | udp[1]) != 53 && (udp[2] << 8 | udp[3]) != 53) || len < 8 + 12)
+        return;
+    /* One question or more */
+    if (!(udp[8 + 4] | udp[8 + 5]))
+        return;
+    queries_add(q, udp + 8 + 12, len - 8 - 12);
+}
+
+static int read_pcap(const char *path, struct queries *q)
+{
+    unsigned char header[24], record[16], *packet = NULL;
+    const unsigned char *ip;
+    size_t cap = 0, len, skip;
+    u32 magic, linktype;
+    bool swap;
+    FILE *f = fopen(path, "rb");
+
+    if (!f || fread(header, 1, sizeof(header), f) != sizeof(header)) {
+        fprintf(stderr, "nf_bench: cannot read %s\n", path);
+        return -1;
+    }
+    magic = get_unaligned_le32(header);
+    swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d) {
+        fprintf(stderr, "nf_bench: %s is not a pcap file (pcapng is not supported)\n", path);
+        fclose(f);
+        return -1;
+    }
+    linktype = read32(header + 20, swap) & 0xffff;
+
+    while (fread(record, 1, sizeof(record), f) == sizeof(record)) {
+        len = read32(record + 8, swap);
+        if (len > cap) {
+            cap = len;
+            packet = xrealloc(packet, cap);
+        }
+        if (fread(packet, 1, len, f) != len)
+            break;
+
+        switch (linktype) {
+        case 1:         /* Ethernet, with up to two VLAN tags */
+            skip = 12;
+            while (len >= skip + 2 && (packet[skip] << 8 | packet[skip + 1]) == 0x8100)
+                skip += 4;
+            skip += 2;
+            break;
+        case 0:         /* BSD loopback */
+            skip = 4;
+            break;
+        case 113:       /* Linux cooked */
+            skip = 16;
+            break;
+        case 276:       /* Linux cooked v2 */
+            skip = 20;
+            break;
+        case 12: case 14: case 101:     /* Raw IP */
+            skip = 0;
+            break;
+        default:
+            fprintf(stderr, "nf_bench: link type %u is not supported\n", linktype);
+            fclose(f);
+            free(packet);
+            return -1;
+        }
+        if (len <= skip)
+            continue;
+        ip = packet + skip;
+        add_dns_packet(q, ip, len - skip);
+    }
+    fclose(f);
+    free(packet);
+    return 0;
+}
+
+static void read_list_file(const char *path, struct domain_list *list, size_t max)
+{
+    char line[1024], *name;
+    size_t len;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        fprintf(stderr, "nf_bench: cannot read %s\n", path);
+        exit(1);
+    }
+    while (list->count < max && fgets(line, sizeof(line), f)) {
+        /* Plain names or hosts file lines */
+        name = strtok(line, " \t\r\n");
+        if (name && (!strcmp(name, "0.0.0.0") || !strcmp(name, "127.0.0.1")))
+            name = strtok(NULL, " \t\r\n");
+        if (!name || *name == '#')
+            continue;
+        for (len = 0; name[len]; len++)
+            name[len] = tolower((unsigned char)name[len]);
+        list_add(list, name, len);
+    }
+    fclose(f);
+}
+
+/*
+ * List of @size names: the file's, a share of the capture's, then
+ * made-up ones. Return: how many made-up names, numbered from 0.
+ */
+static size_t build_list(struct domain_list *list, size_t size, const char *path,
+                       const struct queries *q)
+{
+    struct dns_name name;
+    char made_up[MAX_DOMAIN_LENGTH];
+    size_t i;
+    int len;
+
+    list->len = 0;
+    list->count = 0;
+    if (path)
+        read_list_file(path, list, size);
+    for (i = 0; i < q->count && list->count < size / 10 + 1; i += 4) {
+        if (parse_query_name(&name, q->data + q->off[i], q->qlen[i]) > 0)
+            list_add(list, name.domain, name.len);
+    }
+    for (i = 0; list->count < size; i++) {
+        len = made_up_name(i, made_up, sizeof(made_up));
+        list_add(list, made_up, len);
+    }
+    return i;
+}
+
+static int count_domain(void *ctx, const char *domain, size_t len)
+{
+    (*(size_t *)ctx)++;
+    return 0;
+}
+
+static void count_message(void *ctx, const struct json_stream *js)
+{
+}
+
+static const struct json_stream_ops count_ops = {
+    .domain  = count_domain,
+    .message = count_message,
+};
+
+/* ns per domain to scan @list as the server's JSON message */
+static double time_json(const struct domain_list *list)
+{
+    struct json_stream *js = malloc(sizeof(*js));
+    char *json = xrealloc(NULL, list->len * 2 + 64), *p = json;
+    const char *rec = list->data, *end = list->data + list->len;
+    size_t len, count = 0, used;
+    u64 start;
+
+    p += sprintf(p, "{\"code\": \"%s\", \"domains\": [", CODE_DOMAIN_LIST_UPDATE);
+    while (rec < end) {
+        len = (u8)*rec++;
+        p += sprintf(p, "%s\"%.*s\"", rec == list->data + 1 ? "" : ", ", (int)len, rec);
+        rec += len;
+    }
+    p += sprintf(p, "]}\n");
+
+    json_stream_init(js, &count_ops, &count);
+    start = now_ns();
+    for (len = 0; len < (size_t)(p - json); len += used)
+        used = json_stream_feed(js, json + len, p - json - len);
+    start = now_ns() - start;
+
+    free(json);
+    free(js);
+    return count ? (double)start / count : 0;
+}
+
+struct lookup_result {
+    double parse_ns;
+    double lookup_ns;
+    double hit_rate;
+    double probes;
+};
+
+static void time_lookups(const struct queries *q, struct dns_name *names, int rounds,
+                         struct lookup_result *res)
+{
+    struct domain_table __rcu *overlay = NULL;
+    size_t i, hits = 0, parsed = 0;
+    u64 start, parse = 0, lookup = 0;
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+        start = now_ns();
+        for (i = 0; i < q->count; i++) {
+            if (parse_query_name(&names[i], q->data + q->off[i], q->qlen[i]) <= 0)
+                names[i].nr_labels = 0;
+        }
+        parse += now_ns() - start;
+    }
+
+    memset(&nf_stats, 0, sizeof(nf_stats));
+    for (r = 0; r < rounds; r++) {
+        hits = 0;
+        parsed = 0;
+        start = now_ns();
+        for (i = 0; i < q->count; i++) {
+            if (!names[i].nr_labels)
+                continue;
+            parsed++;
+            hits += is_domain_blocked(&names[i], &overlay, BIT(PROFILE_DEFAULT));
+        }
+        lookup += now_ns() - start;
+    }
+    sink += hits;
+
+    res->parse_ns = (double)parse / ((u64)rounds * q->count);
+    res->lookup_ns = parsed ? (double)lookup / ((u64)rounds * parsed) : 0;
+    res->hit_rate = parsed ? 100.0 * hits / parsed : 0;
+    res->probes = parsed ? (double)nf_stats.items[STAT_PROBES] / ((u64)rounds * parsed) : 0;
+}
+
+static void print_row(const char *what, size_t entries, double load_ms, double json_ns,
+                      double bytes, const struct lookup_result *res)
+{
+    char json[16] = "-";
+
+    if (json_ns)
+        snprintf(json, sizeof(json), "%.1f", json_ns);
+    printf("%-6s %9zu %9.1f %9.1f %9s %9.1f %9.1f %9.1f %7.1f %7.2f\n", what, entries,
+           load_ms, entries ? load_ms * 1e6 / entries : 0, json, bytes, res->parse_ns,
+           res->lookup_ns, res->hit_rate, res->probes);
+}
+
+static void bench_image(const char *path, const struct queries *q, struct dns_name *names,
+                        int rounds)
+{
+    struct lookup_result res;
+    size_t before, size;
+    void *data;
+    long end;
+    u64 start;
+    int count;
+    FILE *f = fopen(path, "rb");
+
+    if (!f || fseek(f, 0, SEEK_END) < 0 || (end = ftell(f)) <= 0) {
+        fprintf(stderr, "nf_bench: cannot read %s\n", path);
+        exit(1);
+    }
+    size = end;
+    rewind(f);
+
+    load_domain_list(frame_for_each_domain, NULL, 0);
+    before = kshim_allocated;
+    data = kvmalloc(size, GFP_KERNEL);
+    if (!data || fread(data, 1, size, f) != size) {
+        fprintf(stderr, "nf_bench: cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    start = now_ns();
+    count = load_domain_image(data, size);
+    start = now_ns() - start;
+    if (count < 0) {
+        fprintf(stderr, "nf_bench: %s was rejected: %d\n", path, count);
+        exit(1);
+    }
+
+    time_lookups(q, names, rounds, &res);
+    print_row("image", count, start / 1e6, 0,
+              count ? (double)(kshim_allocated - before) / count : 0, &res);
+}
+
+/*
+ * One-slot image whose name is @name_len bytes of a @pool_len byte pool,
+ * with a valid crc so only the slot bounds decide. Returns image_parse().
+ */
+static int parse_one_slot_image(u8 name_len, u32 pool_len)
+{
+    struct {
+        struct image_header header;
+        __le16 pilots[4];
+        struct image_slot slot;
+        char pool[16];
+    } __attribute__((packed)) img = { 0 };
+    struct blocklist_image image;
+    size_t size = offsetof(typeof(img), pool) + pool_len;
+
+    img.header.magic = cpu_to_le32(IMAGE_MAGIC);
+    img.header.version = cpu_to_le16(IMAGE_FORMAT_VERSION);
+    img.header.header_len = cpu_to_le16(sizeof(img.header));
+    img.header.count = cpu_to_le32(1);
+    img.header.slots = cpu_to_le32(1);
+    img.header.buckets = cpu_to_le32(1);
+    img.header.pool_len = cpu_to_le32(pool_len);
+    img.header.total_len = cpu_to_le64(size);
+    img.slot.len = name_len;
+    img.slot.categories = BIT(CATEGORY_CUSTOM);
+    memset(img.pool, 'a', pool_len);
+    img.header.crc = cpu_to_le32(~crc32_le(~0, (const u8 *)&img + sizeof(img.header),
+                                           size - sizeof(img.header)));
+    return image_parse(&image, &img, size);
+}
+
+/* Malformed images the parser must refuse before any timing runs */
+static void check_image_parse(void)
+{
+    if (parse_one_slot_image(4, 4) != 0 || parse_one_slot_image(10, 4) != -EINVAL) {
+        fprintf(stderr, "nf_bench: image_parse() accepts a slot past its pool\n");
+        exit(1);
+    }
+}
+
+/* Parse a dotted name as a query and look it up for the default profile */
+static bool query_blocked(const char *domain)
+{
+    struct domain_table __rcu *overlay = NULL;
+    unsigned char question[MAX_DOMAIN_LENGTH + 8];
+    struct dns_name name;
+
+    encode_question(domain, question);
+    if (parse_query_name(&name, question, sizeof(question)) <= 0)
+        return false;
+    return is_domain_blocked(&name, &overlay, BIT(PROFILE_DEFAULT));
+}
+
+/*
+ * Listed names that must block when queried: names past the kept
+ * labels once a local suffix is stripped, and names listed in another
+ * case or with a trailing dot.
+ */
+static void check_lookups(void)
+{
+    static const struct {
+        const char *listed, *query;
+    } cases[] = {
+        { "a.b.c.d.e.f.g.h.i", "a.b.c.d.e.f.g.h.i" },
+        { "a.b.c.d.e.f.g.h.i", "a.b.c.d.e.f.g.h.i.local" },
+        { "a.b.c.d.e.f.g.h.i", "q.a.b.c.d.e.f.g.h.i.local" },
+        { "Ads.Example.com", "ads.example.com" },
+        { "ads.example.com.", "www.Ads.example.com" },
+    };
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        add_domain_to_cache(cases[i].listed);
+        if (!query_blocked(cases[i].query)) {
+            fprintf(stderr, "nf_bench: %s is not blocked by %s\n", cases[i].query, cases[i].listed);
+            exit(1);
+        }
+        remove_domain_from_cache(cases[i].listed);
+    }
+}
+
+/* Overlay names are taken in any case and refused if no query could carry them */
+static void check_overlay_names(void)
+{
+    static const char *const invalid[] = { "", ".", "a..b", "ads example.com", "a.com..",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa.com" };
+    struct domain_table __rcu *overlay = NULL;
+    unsigned char question[MAX_DOMAIN_LENGTH + 8];
+    struct dns_name name;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(invalid); i++) {
+        if (overlay_add_domain(&overlay, invalid[i], strlen(invalid[i])) != -EINVAL) {
+            fprintf(stderr, "nf_bench: overlay took \"%s\"\n", invalid[i]);
+            exit(1);
+        }
+    }
+
+    encode_question("www.ads.example.com", question);
+    if (overlay_add_domain(&overlay, "Ads.Example.com.", 16) < 0 ||
+        parse_query_name(&name, question, sizeof(question)) <= 0 ||
+        !is_domain_blocked(&name, &overlay, BIT(PROFILE_DEFAULT))) {
+        fprintf(stderr, "nf_bench: overlay name Ads.Example.com. does not block\n");
+        exit(1);
+    }
+    overlay_release(&overlay);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: nf_bench [-p capture.pcap] [-l domains.txt] [-i list.img]\n"
+            "                [-s sizes] [-q queries] [-r rounds] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *pcap = NULL, *list_path = NULL, *image = NULL;
+    char sizes_arg[256] = "1000,100000,1000000", *size_str;
+    struct queries q = { .max = DEFAULT_QUERIES };
+    struct domain_list list = { 0 };
+    struct lookup_result res;
+    struct dns_name *names;
+    bool queries_given = false;
+    int rounds = DEFAULT_ROUNDS, opt, ret;
+    size_t size, made_up, before;
+    u64 start;
+
+    while ((opt = getopt(argc, argv, "p:l:i:s:q:r:v")) != -1) {
+        switch (opt) {
+        case 'p': pcap = optarg; break;
+        case 'l': list_path = optarg; break;
+        case 'i': image = optarg; break;
+        case 's': snprintf(sizes_arg, sizeof(sizes_arg), "%s", optarg); break;
+        case 'q': q.max = strtoul(optarg, NULL, 0); queries_given = true; break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'v': kshim_verbose = true; break;
+        default: usage();
+        }
+    }
+    if (rounds < 1 || !q.max)
+        usage();
+    if (pcap && !queries_given)
+        q.max = SIZE_MAX;
+
+    if (init_cache() < 0 || init_dns_name() < 0) {
+        fprintf(stderr, "nf_bench: cache setup failed\n");
+        return 1;
+    }
+    check_image_parse();
+    check_lookups();
+    check_overlay_names();
+    if (pcap && read_pcap(pcap, &q) < 0)
+        return 1;
+    if (pcap && !q.count) {
+        fprintf(stderr, "nf_bench: no DNS questions in %s\n", pcap);
+        return 1;
+    }
+
+    printf("%-6s %9s %9s %9s %9s %9s %9s %9s %7s %7s\n", "list", "entries", "load ms",
+           "ns/entry", "json ns", "B/entry", "ns/parse", "ns/lookup", "hit %", "probes");
+
+    names = xrealloc(NULL, max_t(size_t, q.max == SIZE_MAX ? q.count : q.max, 1) * sizeof(*names));
+    for (size_str = strtok(sizes_arg, ","); size_str; size_str = strtok(NULL, ",")) {
+        size = strtoul(size_str, NULL, 0);
+        /* Made-up traffic is made again for every list */
+        if (!pcap) {
+            q.len = 0;
+            q.count = 0;
+        }
+        made_up = build_list(&list, size, list_path, &q);
+
+        if (!pcap) {
+            unsigned char question[QUESTION_MAX + 8];
+            char name[MAX_DOMAIN_LENGTH];
+            u64 state = 0x853c49e6748fea9bULL ^ size;
+
+            while (q.count < q.max) {
+                made_up_query(&state, made_up, name, sizeof(name));
+                queries_add(&q, question, encode_question(name, question));
+            }
+        }
+
+        /* An empty generation first, so only this list is counted */
+        load_domain_list(frame_for_each_domain, NULL, 0);
+        before = kshim_allocated;
+        start = now_ns();
+        ret = load_domain_frame(list.data, list.len);
+        start = now_ns() - start;
+        if (ret < 0) {
+            fprintf(stderr, "nf_bench: loading %zu domains failed: %d\n", size, ret);
+            return 1;
+        }
+
+        time_lookups(&q, names, rounds, &res);
+        print_row("table", ret, start / 1e6, time_json(&list),
+                  ret ? (double)(kshim_allocated - before) / ret : 0, &res);
+    }
+
+    if (image)
+        bench_image(image, &q, names, rounds);
+
+    free(names);
+    free(list.data);
+    free(q.data);
+    free(q.off);
+    free(q.qlen);
+    cleanup_cache();
+    return 0;
+}
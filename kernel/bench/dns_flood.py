@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+Inputs of the packets-per-second benchmark (pps.sh).
+
+"image" writes a blocklist image of the first N benchmark names, built by
+the server's image.py. "trafgen" writes a trafgen configuration of DNS
+responses to replay: a share of them answer for listed names, the rest
+for names on no list, and the names follow a Zipf distribution.
+"""
+
+import argparse
+import importlib
+import random
+import struct
+import sys
+from pathlib import Path
+from typing import List
+
+ROOT = Path(__file__).resolve().parents[2]
+sys.path.insert(0, str(ROOT.parent))
+image = importlib.import_module(f"{ROOT.name}.server.src.image")
+
+WORDS = ("ads", "track", "cdn", "pixel", "stats", "media", "metrics", "static")
+SUBDOMAINS = ("", "www.", "api.", "img.")
+
+def listed_name(index: int) -> str:
+    """Name number @index of every benchmark list."""
+    return f"blk{index}.{WORDS[index % len(WORDS)]}.example"
+
+def unlisted_name(index: int) -> str:
+    """Name number @index that no benchmark list holds."""
+    return f"pass{index}.{WORDS[index % len(WORDS)]}.example"
+
+def write_image(path: Path, entries: int) -> None:
+    """Write an image of the first @entries listed names."""
+    path.write_bytes(image.build_image(listed_name(i) for i in range(entries)))
+
+def checksum(data: bytes) -> int:
+    """Internet checksum of @data."""
+    if len(data) % 2:
+        data += b'\0'
+    total = sum(struct.unpack(f"!{len(data) // 2}H", data))
+    while total >> 16:
+        total = (total & 0xFFFF) + (total >> 16)
+    return ~total & 0xFFFF
+
+def dns_response(name: str, query_id: int) -> bytes:
+    """A response with one question and one A record, as resolvers send them."""
+    question = b''.join(bytes([len(label)]) + label.encode() for label in name.split('.'))
+    question += b'\0' + struct.pack("!HH", 1, 1)
+    answer = struct.pack("!HHHIH4s", 0xC00C, 1, 1, 300, 4, bytes([192, 0, 2, 1]))
+    return struct.pack("!HHHHHH", query_id, 0x8180, 1, 1, 0, 0) + question + answer
+
+def frame(args: argparse.Namespace, payload: bytes, port: int) -> bytes:
+    """Ethernet, IPv4 and UDP around @payload, UDP checksum left out."""
+    udp = struct.pack("!HHHH", 53, port, 8 + len(payload), 0) + payload
+    ip = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + len(udp), 0, 0x4000, 64, 17, 0,
+                     bytes(map(int, args.src_ip.split('.'))),
+                     bytes(map(int, args.dst_ip.split('.'))))
+    ip = ip[:10] + struct.pack("!H", checksum(ip)) + ip[12:]
+    eth = bytes.fromhex(args.dst_mac.replace(':', '')) + \
+          bytes.fromhex(args.src_mac.replace(':', '')) + b'\x08\x00'
+    return eth + ip + udp
+
+def zipf_weights(count: int, exponent: float) -> List[float]:
+    """Weight of each rank, exponent 0 is a uniform distribution."""
+    return [1.0 / (rank ** exponent) for rank in range(1, count + 1)]
+
+def write_trafgen(args: argparse.Namespace) -> None:
+    """Write the trafgen configuration, one block per packet."""
+    rng = random.Random(args.seed)
+    hit_names = max(1, round(args.names * args.hit_ratio))
+    miss_names = max(1, args.names - hit_names)
+    if args.listed < hit_names:
+        sys.exit(f"dns_flood: {hit_names} listed names needed, the smallest list has {args.listed}")
+    hit_weights = zipf_weights(hit_names, args.zipf)
+    miss_weights = zipf_weights(miss_names, args.zipf)
+
+    blocks = []
+    for packet in range(args.packets):
+        if rng.random() < args.hit_ratio:
+            rank = rng.choices(range(hit_names), hit_weights)[0]
+            name = SUBDOMAINS[rank % len(SUBDOMAINS)] + listed_name(rank)
+        else:
+            rank = rng.choices(range(miss_names), miss_weights)[0]
+            name = SUBDOMAINS[rank % len(SUBDOMAINS)] + unlisted_name(rank)
+        data = frame(args, dns_response(name, packet & 0xFFFF), 10000 + packet % 50000)
+        blocks.append("{ " + ", ".join(f"0x{byte:02x}" for byte in data) + " }")
+    args.output.write_text("\n".join(blocks) + "\n")
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    img = sub.add_parser("image", help="write a blocklist image")
+    img.add_argument("entries", type=int)
+    img.add_argument("output", type=Path)
+
+    gen = sub.add_parser("trafgen", help="write a trafgen configuration")
+    gen.add_argument("output", type=Path)
+    gen.add_argument("--hit-ratio", type=float, default=0.1, help="share of listed names")
+    gen.add_argument("--names", type=int, default=10000, help="distinct names in the flood")
+    gen.add_argument("--zipf", type=float, default=1.0, help="name popularity exponent")
+    gen.add_argument("--listed", type=int, required=True, help="entries of the smallest list")
+    gen.add_argument("--packets", type=int, default=4096, help="distinct frames to cycle")
+    gen.add_argument("--seed", type=int, default=1)
+    gen.add_argument("--src-mac", required=True)
+    gen.add_argument("--dst-mac", required=True)
+    gen.add_argument("--src-ip", required=True)
+    gen.add_argument("--dst-ip", required=True)
+
+    args = parser.parse_args()
+    if args.command == "image":
+        write_image(args.output, args.entries)
+    else:
+        if not 0 <= args.hit_ratio <= 1:
+            sys.exit("dns_flood: --hit-ratio must be between 0 and 1")
+        write_trafgen(args)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,240 @@
+#include <malloc.h>
+#include <time.h>
+#include <sys/random.h>
+#include "kshim.h"
+
+bool kshim_verbose;
+size_t kshim_allocated;
+
+u64 local_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *kmalloc(size_t size, gfp_t flags)
+{
+    void *ptr = malloc(size);
+
+    if (ptr)
+        kshim_allocated += malloc_usable_size(ptr);
+    return ptr;
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+    void *ptr = calloc(1, size);
+
+    if (ptr)
+        kshim_allocated += malloc_usable_size(ptr);
+    return ptr;
+}
+
+void *kvmemdup(const void *src, size_t len, gfp_t flags)
+{
+    void *ptr = kmalloc(len, flags);
+
+    if (ptr)
+        memcpy(ptr, src, len);
+    return ptr;
+}
+
+void kfree(const void *ptr)
+{
+    if (!ptr)
+        return;
+    kshim_allocated -= malloc_usable_size((void *)ptr);
+    free((void *)ptr);
+}
+
+/* SLAB_HWCACHE_ALIGN halves the cache line while the object fits twice */
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void *))
+{
+    struct kmem_cache *cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+    size_t line = 64;
+
+    if (!cache)
+        return NULL;
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        while (size <= line / 2)
+            line /= 2;
+        align = max_t(size_t, align, line);
+    }
+    cache->align = max_t(size_t, align, sizeof(void *));
+    cache->size = (size + cache->align - 1) & ~(cache->align - 1);
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    kfree(cache);
+}
+
+/* Objects are carved from slabs in the kernel, count only their size here */
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t flags)
+{
+    void *ptr = aligned_alloc(cache->align, cache->size);
+
+    if (ptr)
+        kshim_allocated += cache->size;
+    return ptr;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *ptr)
+{
+    if (!ptr)
+        return;
+    kshim_allocated -= cache->size;
+    free(ptr);
+}
+
+u32 get_random_u32(void)
+{
+    u32 value = 0;
+
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+        value = (u32)local_clock();
+    return value;
+}
+
+u32 crc32_le(u32 crc, const unsigned char *data, size_t len)
+{
+    static u32 table[256];
+    size_t i;
+    u32 c;
+    int k;
+
+    if (!table[1]) {
+        for (i = 0; i < 256; i++) {
+            c = i;
+            for (k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    for (i = 0; i < len; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags, int max_active)
+{
+    static struct workqueue_struct wq;
+
+    return &wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+}
+
+static struct rhash_head **alloc_buckets(unsigned int size)
+{
+    return kzalloc(size * sizeof(struct rhash_head *), GFP_KERNEL);
+}
+
+int rhashtable_init(struct rhashtable *ht, const struct rhashtable_params *params)
+{
+    memset(ht, 0, sizeof(*ht));
+    ht->p = *params;
+    ht->size = roundup_pow_of_two(max_t(unsigned int, params->min_size, 4));
+    ht->seed = get_random_u32();
+    ht->buckets = alloc_buckets(ht->size);
+    return ht->buckets ? 0 : -ENOMEM;
+}
+
+static u32 obj_bucket(const struct rhashtable *ht, const struct rhash_head *obj, unsigned int size)
+{
+    return ht->p.obj_hashfn((const char *)obj - ht->p.head_offset, ht->p.key_len, ht->seed) &
+           (size - 1);
+}
+
+/* Rehash into @size buckets, kept as is if the new array cannot be had */
+static void rehash(struct rhashtable *ht, unsigned int size)
+{
+    struct rhash_head **buckets = alloc_buckets(size);
+    struct rhash_head *he, *next;
+    unsigned int i;
+    u32 bucket;
+
+    if (!buckets)
+        return;
+    for (i = 0; i < ht->size; i++) {
+        for (he = ht->buckets[i]; he; he = next) {
+            next = he->next;
+            bucket = obj_bucket(ht, he, size);
+            he->next = buckets[bucket];
+            buckets[bucket] = he;
+        }
+    }
+    kfree(ht->buckets);
+    ht->buckets = buckets;
+    ht->size = size;
+}
+
+int kshim_rht_insert(struct rhashtable *ht, struct rhash_head *obj)
+{
+    u32 bucket = obj_bucket(ht, obj, ht->size);
+
+    obj->next = ht->buckets[bucket];
+    ht->buckets[bucket] = obj;
+    if (++ht->nelems.counter > ht->size / 4 * 3)
+        rehash(ht, ht->size * 2);
+    return 0;
+}
+
+void kshim_rht_remove(struct rhashtable *ht, struct rhash_head *obj)
+{
+    struct rhash_head **pprev = &ht->buckets[obj_bucket(ht, obj, ht->size)];
+
+    for (; *pprev; pprev = &(*pprev)->next) {
+        if (*pprev != obj)
+            continue;
+        *pprev = obj->next;
+        ht->nelems.counter--;
+        break;
+    }
+    if (ht->p.automatic_shrinking && ht->size > ht->p.min_size &&
+        ht->nelems.counter < ht->size * 3 / 10)
+        rehash(ht, ht->size / 2);
+}
+
+void rhashtable_free_and_destroy(struct rhashtable *ht, void (*free_fn)(void *ptr, void *arg),
+                                 void *arg)
+{
+    struct rhash_head *he, *next;
+    unsigned int i;
+
+    for (i = 0; i < ht->size; i++) {
+        for (he = ht->buckets[i]; he; he = next) {
+            next = he->next;
+            free_fn((char *)he - ht->p.head_offset, arg);
+        }
+    }
+    kfree(ht->buckets);
+    ht->buckets = NULL;
+}
+
+void rhashtable_walk_enter(struct rhashtable *ht, struct rhashtable_iter *iter)
+{
+    iter->ht = ht;
+    iter->bucket = 0;
+    iter->next = ht->size ? ht->buckets[0] : NULL;
+}
+
+void *rhashtable_walk_next(struct rhashtable_iter *iter)
+{
+    struct rhash_head *he;
+
+    while (!iter->next) {
+        if (++iter->bucket >= iter->ht->size)
+            return NULL;
+        iter->next = iter->ht->buckets[iter->bucket];
+    }
+    he = iter->next;
+    iter->next = he->next;
+    return (char *)he - iter->ht->p.head_offset;
+}
@@ -0,0 +1,167 @@
+#!/bin/bash
+#
+# Packets-per-second benchmark of the PRE_ROUTING hook, run as root.
+#
+# A veth pair joins two scratch network namespaces. trafgen floods DNS
+# responses from one end, the other end delivers them to an unbound UDP
+# port, so every packet that makes it past the hook is counted by the
+# receiver's Udp NoPorts. The flood is measured with the module unloaded,
+# loaded with an empty list and loaded with lists of each size, and one
+# JSON object per run is printed on stdout.
+#
+# Usage: bench/pps.sh [-t seconds] [-s sizes] [-r hit_ratio] [-n names]
+#                     [-z zipf] [-c cpu] [-w workdir]
+
+set -euo pipefail
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+KERNEL_DIR=$(dirname "$BENCH_DIR")
+MODULE_NAME=$(grep "define MODULE_NAME" "$KERNEL_DIR/src/utils.h" | cut -d'"' -f2)
+MODULE="$KERNEL_DIR/$MODULE_NAME.ko"
+FLOOD="$BENCH_DIR/dns_flood.py"
+
+DURATION=10
+SIZES="1000,100000,1000000"
+HIT_RATIO=0.1
+NAMES=10000
+ZIPF=1.0
+CPU=0
+WORKDIR=/tmp/nf_pps
+
+GEN_NS=nfb_gen
+RX_NS=nfb_rx
+GEN_IP=198.18.0.2
+RX_IP=198.18.0.1
+
+usage() {
+    echo "usage: $0 [-t seconds] [-s sizes] [-r hit_ratio] [-n names] [-z zipf] [-c cpu] [-w workdir]" >&2
+    exit 2
+}
+
+while getopts "t:s:r:n:z:c:w:h" opt; do
+    case $opt in
+        t) DURATION=$OPTARG ;;
+        s) SIZES=$OPTARG ;;
+        r) HIT_RATIO=$OPTARG ;;
+        n) NAMES=$OPTARG ;;
+        z) ZIPF=$OPTARG ;;
+        c) CPU=$OPTARG ;;
+        w) WORKDIR=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+die() {
+    echo "pps.sh: $*" >&2
+    exit 1
+}
+
+[ "$(id -u)" -eq 0 ] || die "must run as root"
+command -v trafgen > /dev/null || die "trafgen (netsniff-ng) is required"
+[ -f "$MODULE" ] || die "$MODULE not found, run make first"
+# Unloading a filter that is in use would let the host's traffic through unfiltered
+! grep -q "^$MODULE_NAME " /proc/modules || die "$MODULE_NAME is loaded, remove it first"
+
+TRAFGEN_PID=
+cleanup() {
+    [ -z "$TRAFGEN_PID" ] || kill "$TRAFGEN_PID" 2> /dev/null || true
+    ip netns del "$GEN_NS" 2> /dev/null || true
+    ip netns del "$RX_NS" 2> /dev/null || true
+    ! grep -q "^$MODULE_NAME " /proc/modules || rmmod "$MODULE_NAME"
+}
+trap cleanup EXIT
+
+setup_link() {
+    ip netns add "$GEN_NS"
+    ip netns add "$RX_NS"
+    ip link add nfb1 netns "$GEN_NS" type veth peer name nfb0 netns "$RX_NS"
+    ip -n "$GEN_NS" addr add "$GEN_IP/30" dev nfb1
+    ip -n "$RX_NS" addr add "$RX_IP/30" dev nfb0
+    ip -n "$GEN_NS" link set nfb1 up
+    ip -n "$RX_NS" link set nfb0 up
+}
+
+# Udp NoPorts of the receiving namespace, the packets that passed the hook
+delivered() {
+    ip netns exec "$RX_NS" awk '/^Udp:/ { if (++n == 1) for (i = 1; i <= NF; i++) col[$i] = i;
+                               else print $col["NoPorts"] }' /proc/net/snmp
+}
+
+received() {
+    ip netns exec "$RX_NS" cat /sys/class/net/nfb0/statistics/rx_packets
+}
+
+# Softirq time of all CPUs in USER_HZ ticks
+softirq_ticks() {
+    awk '/^cpu / { print $8 }' /proc/stat
+}
+
+# Counter @1 of the module's debugfs stats, 0 while it is not loaded
+module_stat() {
+    local file="/sys/kernel/debug/$MODULE_NAME/stats"
+
+    [ -r "$file" ] && awk -v key="$1" '$1 == key { print $2 }' "$file" || echo 0
+}
+
+measure() {
+    local scenario=$1 entries=$2
+    local d0 r0 s0 b0 p0 d1 r1 s1 b1 p1 hz
+
+    ip netns exec "$GEN_NS" taskset -c "$CPU" \
+        trafgen --dev nfb1 --conf "$WORKDIR/flood.cfg" --cpus 1 --silent > /dev/null 2>&1 &
+    TRAFGEN_PID=$!
+    sleep 2
+
+    d0=$(delivered); r0=$(received); s0=$(softirq_ticks)
+    b0=$(module_stat blocked); p0=$(module_stat dns_responses)
+    sleep "$DURATION"
+    d1=$(delivered); r1=$(received); s1=$(softirq_ticks)
+    b1=$(module_stat blocked); p1=$(module_stat dns_responses)
+
+    kill "$TRAFGEN_PID"
+    wait "$TRAFGEN_PID" 2> /dev/null || true
+    TRAFGEN_PID=
+    hz=$(getconf CLK_TCK)
+
+    awk -v scenario="$scenario" -v entries="$entries" -v t="$DURATION" -v hz="$hz" \
+        -v ratio="$HIT_RATIO" -v names="$NAMES" -v zipf="$ZIPF" -v kernel="$(uname -r)" \
+        -v offered=$((r1 - r0)) -v passed=$((d1 - d0)) -v soft=$((s1 - s0)) \
+        -v blocked=$((b1 - b0)) -v responses=$((p1 - p0)) 'BEGIN {
+        cpu = soft / hz / t
+        printf "{\"scenario\": \"%s\", \"entries\": %d, \"hit_ratio\": %s, \"names\": %d, ", \
+               scenario, entries, ratio, names
+        printf "\"zipf\": %s, \"seconds\": %d, \"offered_pps\": %.0f, \"pps\": %.0f, ", \
+               zipf, t, offered / t, passed / t
+        printf "\"softirq_cpu\": %.3f, \"softirq_ns_per_packet\": %.1f, ", \
+               cpu, passed ? cpu * 1e9 * t / passed : 0
+        printf "\"blocked_ratio\": %.3f, \"kernel\": \"%s\"}\n", \
+               responses ? blocked / responses : 0, kernel
+    }'
+}
+
+mkdir -p "$WORKDIR"
+setup_link
+
+SMALLEST=${SIZES%%,*}
+for size in ${SIZES//,/ }; do
+    [ "$size" -ge "$SMALLEST" ] || SMALLEST=$size
+    # Building a million-entry image takes a while, keep them between runs
+    [ -s "$WORKDIR/list_$size.img" ] ||
+        python3 "$FLOOD" image "$size" "$WORKDIR/list_$size.img"
+done
+
+python3 "$FLOOD" trafgen "$WORKDIR/flood.cfg" --hit-ratio "$HIT_RATIO" --names "$NAMES" \
+    --zipf "$ZIPF" --listed "$SMALLEST" \
+    --src-mac "$(ip netns exec "$GEN_NS" cat /sys/class/net/nfb1/address)" \
+    --dst-mac "$(ip netns exec "$RX_NS" cat /sys/class/net/nfb0/address)" \
+    --src-ip "$GEN_IP" --dst-ip "$RX_IP"
+
+measure unloaded 0
+
+insmod "$MODULE"
+measure empty 0
+
+for size in ${SIZES//,/ }; do
+    cat "$WORKDIR/list_$size.img" > "/sys/devices/$MODULE_NAME/image"
+    measure list "$size"
+done
@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * XDP fast path for DNS queries on a gateway's LAN interface.
+ *
+ * Blocked queries are answered with NXDOMAIN (or dropped) before the
+ * stack allocates an skb for them. The server attaches the program and
+ * keeps nf_domains in sync with the list it sends the module, see
+ * server/src/xdp_filter.py. Anything this program cannot decide on,
+ * such as IPv6 extension headers, names with compression or more than
+ * XDP_MAX_LABELS labels, goes up the stack to the module's netfilter
+ * hooks, which stay authoritative: a name missing from the map is only
+ * checked later, never let through.
+ *
+ * Names are matched by their 64-bit label-chained hash, the one
+ * blocklist images use (image_hash_label() in ../src/image.h), so
+ * every parent domain is one more map lookup. Labels are folded to
+ * lower case and hashed in 8-byte words like dns_label_hash(), byte by
+ * byte here since the verifier wants constant-size loads. Two names sharing a hash
+ * is unlikely enough at 64 bits that the map stores no strings.
+ */
+#include <linux/bpf.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#define DNS_PORT            53
+#define DNS_RESPONSE        0x8000
+#define DNS_OPCODE_MASK     0x7800
+#define DNS_RD              0x0100
+#define DNS_RA              0x0080
+#define DNS_NXDOMAIN        0x0003
+
+#define XDP_MAX_LABELS      16
+#define XDP_MAX_LABEL_LEN   63
+#define XDP_MAX_NAME        253     /* Wire-format name without the root label */
+#define XDP_MAX_DOMAINS     (1 << 20)
+
+#define LABEL_HASH_MUL      0x9e3779b97f4a7c15ULL
+#define IMAGE_CHAIN_MUL     0xc2b2ae3d27d4eb4fULL
+
+#define IP_MF               0x2000
+#define IP_OFFSET           0x1fff
+
+/* nf_config flags, written by the server */
+#define NF_XDP_ENABLED      0x1     /* Off passes every packet to the stack */
+#define NF_XDP_ANSWER       0x2     /* Answer blocked queries, drop them otherwise */
+
+struct nf_xdp_config {
+    __u64 seed;                     /* Seed of the name hash */
+    __u32 flags;
+    __u32 reserved;
+};
+
+enum nf_xdp_stat {
+    NF_XDP_QUERIES,                 /* Queries this program looked at */
+    NF_XDP_ANSWERED,
+    NF_XDP_DROPPED,
+    NF_XDP_FALLBACK,                /* Blocked but left to the netfilter hook */
+    NF_XDP_UNPARSED,                /* Queries left to the stack undecided */
+    __NF_XDP_STAT_MAX,
+};
+
+struct dns_hdr {
+    __be16 id;
+    __be16 flags;
+    __be16 qdcount;
+    __be16 ancount;
+    __be16 nscount;
+    __be16 arcount;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, XDP_MAX_DOMAINS);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, __u64);
+    __type(value, __u8);
+} nf_domains SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct nf_xdp_config);
+} nf_config SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, __NF_XDP_STAT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} nf_xdp_stats SEC(".maps");
+
+static __always_inline void stat_inc(__u32 item)
+{
+    __u64 *value = bpf_map_lookup_elem(&nf_xdp_stats, &item);
+
+    if (value)
+        (*value)++;
+}
+
+static __always_inline __u64 mix64(__u64 hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static __always_inline __u16 csum_fold(__u32 sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+/* RFC 1624 update of a checksum for one changed 16-bit word */
+static __always_inline void csum_replace2(__sum16 *check, __be16 from, __be16 to)
+{
+    *check = csum_fold((__u16)~*check + (__u16)~from + (__u16)to);
+}
+
+static __always_inline void swap_bytes(void *a, void *b, int len)
+{
+    __u8 *x = a, *y = b, t;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        t = x[i];
+        x[i] = y[i];
+        y[i] = t;
+    }
+}
+
+static __always_inline __u64 label_hash_step(__u64 hash, __u64 word)
+{
+    hash = (hash ^ word) * LABEL_HASH_MUL;
+    return hash ^ (hash >> 32);
+}
+
+static __always_inline bool label_char_is(__u8 c, char lower)
+{
+    return (c | 0x20) == lower;
+}
+
+/*
+ * The module drops a trailing "home" or "local" label before its lookup
+ * (its default local_suffixes), leave such names to it. Other suffixes
+ * it was given are simply not in the map, so those names go up too.
+ */
+static __always_inline bool is_local_label(const __u8 *label, __u8 len, const void *end)
+{
+    if (len == 4 && (const void *)(label + 4) <= end &&
+        label_char_is(label[0], 'h') && label_char_is(label[1], 'o') &&
+        label_char_is(label[2], 'm') && label_char_is(label[3], 'e'))
+        return true;
+    if (len == 5 && (const void *)(label + 5) <= end &&
+        label_char_is(label[0], 'l') && label_char_is(label[1], 'o') &&
+        label_char_is(label[2], 'c') && label_char_is(label[3], 'a') &&
+        label_char_is(label[4], 'l'))
+        return true;
+    return false;
+}
+
+/*
+ * Walk the question name and look up each suffix from the top-level
+ * label down. Returns 1 if blocked, 0 if not and -1 to leave the
+ * query to the stack. @name_len gets the wire length including the
+ * root label.
+ */
+static __always_inline int match_question(const __u8 *qname, const void *end,
+                                          __u64 seed, __u32 *name_len)
+{
+    __u16 starts[XDP_MAX_LABELS];
+    __u8 lens[XDP_MAX_LABELS];
+    __u32 off = 0, labels = 0;
+    __u64 hash = 0, state, word;
+    const __u8 *p;
+    __u8 c;
+    int i, j;
+
+    for (i = 0; i < XDP_MAX_LABELS + 1; i++) {
+        p = qname + off;
+        if ((const void *)(p + 1) > end)
+            return -1;
+        if (!*p)
+            break;
+        if (*p > XDP_MAX_LABEL_LEN || i == XDP_MAX_LABELS)
+            return -1;
+        starts[i] = off + 1;
+        lens[i] = *p;
+        off += *p + 1;
+        if (off > XDP_MAX_NAME)
+            return -1;
+        labels++;
+    }
+    if (!labels)
+        return -1;
+    i = (labels - 1) & (XDP_MAX_LABELS - 1);
+    if (labels > 1 && is_local_label(qname + (starts[i] & 0xff), lens[i], end))
+        return -1;
+    *name_len = off + 1;
+
+    for (i = XDP_MAX_LABELS - 1; i >= 0; i--) {
+        if (i >= labels)
+            continue;
+        state = seed ^ lens[i];
+        word = 0;
+        for (j = 0; j < XDP_MAX_LABEL_LEN; j++) {
+            if (j >= lens[i])
+                break;
+            p = qname + (starts[i] & 0xff) + j;
+            if ((const void *)(p + 1) > end)
+                return -1;
+            c = *p;
+            if (c >= 'A' && c <= 'Z')
+                c |= 0x20;
+            word |= (__u64)c << ((j & 7) * 8);
+            if ((j & 7) == 7) {
+                state = label_hash_step(state, word);
+                word = 0;
+            }
+        }
+        if (lens[i] & 7)
+            state = label_hash_step(state, word);
+        hash = mix64(state ^ (hash * IMAGE_CHAIN_MUL));
+        if (bpf_map_lookup_elem(&nf_domains, &hash))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Turn the query into its NXDOMAIN answer in place and send it back out
+ * of the interface. Trailing records (EDNS) are cut off for IPv4, where
+ * the UDP checksum may be left out; IPv6 queries with them fall back.
+ */
+static __always_inline int answer_query(struct xdp_md *ctx, __u32 name_len, bool ipv6)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    __u32 l3_len = ipv6 ? sizeof(struct ipv6hdr) : sizeof(struct iphdr);
+    __u32 udp_len = sizeof(struct udphdr) + sizeof(struct dns_hdr) + name_len + 4;
+    __u32 frame_len = sizeof(struct ethhdr) + l3_len + udp_len;
+    struct ethhdr *eth;
+    struct udphdr *udp;
+    struct dns_hdr *dns;
+    __be16 flags;
+
+    if (data + frame_len > data_end)
+        return -1;
+    if (data + frame_len < data_end) {
+        if (ipv6)
+            return -1;
+        if (bpf_xdp_adjust_tail(ctx, (int)(data + frame_len - data_end)))
+            return -1;
+        data = (void *)(long)ctx->data;
+        data_end = (void *)(long)ctx->data_end;
+    }
+
+    eth = data;
+    if ((void *)(eth + 1) > data_end)
+        return -1;
+    swap_bytes(eth->h_dest, eth->h_source, ETH_ALEN);
+
+    if (ipv6) {
+        struct ipv6hdr *ip6h = (void *)(eth + 1);
+
+        if ((void *)(ip6h + 1) > data_end)
+            return -1;
+        swap_bytes(&ip6h->saddr, &ip6h->daddr, sizeof(ip6h->saddr));
+        udp = (void *)(ip6h + 1);
+    } else {
+        struct iphdr *iph = (void *)(eth + 1);
+        __u16 *word = (void *)iph;
+        __u32 sum = 0;
+        int i;
+
+        if ((void *)(iph + 1) > data_end)
+            return -1;
+        swap_bytes(&iph->saddr, &iph->daddr, sizeof(iph->saddr));
+        iph->tot_len = bpf_htons(l3_len + udp_len);
+        iph->check = 0;
+        for (i = 0; i < sizeof(*iph) / 2; i++)
+            sum += word[i];
+        iph->check = csum_fold(sum);
+        udp = (void *)(iph + 1);
+    }
+
+    dns = (void *)(udp + 1);
+    if ((void *)(dns + 1) > data_end)
+        return -1;
+    swap_bytes(&udp->source, &udp->dest, sizeof(udp->source));
+
+    flags = bpf_htons((bpf_ntohs(dns->flags) & (DNS_OPCODE_MASK | DNS_RD)) |
+                      DNS_RESPONSE | DNS_RA | DNS_NXDOMAIN);
+    if (!ipv6) {
+        /* Length changed with the trim, the checksum is optional over IPv4 */
+        udp->len = bpf_htons(udp_len);
+        udp->check = 0;
+    } else {
+        /* Both header words rewritten below go into the checksum */
+        csum_replace2(&udp->check, dns->flags, flags);
+        csum_replace2(&udp->check, dns->arcount, 0);
+        if (!udp->check)
+            udp->check = 0xffff;
+    }
+    dns->flags = flags;
+    dns->arcount = 0;
+    return 0;
+}
+
+SEC("xdp")
+int nf_xdp_dns(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    struct nf_xdp_config *config;
+    struct ethhdr *eth = data;
+    struct udphdr *udp;
+    struct dns_hdr *dns;
+    __u32 zero = 0, name_len = 0;
+    bool ipv6;
+    int ret;
+
+    if ((void *)(eth + 1) > data_end)
+        return XDP_PASS;
+
+    if (eth->h_proto == bpf_htons(ETH_P_IP)) {
+        struct iphdr *iph = (void *)(eth + 1);
+
+        if ((void *)(iph + 1) > data_end || iph->ihl != 5 ||
+            iph->protocol != IPPROTO_UDP || (iph->frag_off & bpf_htons(IP_MF | IP_OFFSET)))
+            return XDP_PASS;
+        udp = (void *)(iph + 1);
+        ipv6 = false;
+    } else if (eth->h_proto == bpf_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6h = (void *)(eth + 1);
+
+        if ((void *)(ip6h + 1) > data_end || ip6h->nexthdr != IPPROTO_UDP)
+            return XDP_PASS;
+        udp = (void *)(ip6h + 1);
+        ipv6 = true;
+    } else {
+        return XDP_PASS;
+    }
+
+    dns = (void *)(udp + 1);
+    if ((void *)(dns + 1) > data_end || udp->dest != bpf_htons(DNS_PORT))
+        return XDP_PASS;
+    if ((dns->flags & bpf_htons(DNS_RESPONSE)) || dns->qdcount != bpf_htons(1) ||
+        dns->ancount || dns->nscount)
+        return XDP_PASS;
+
+    config = bpf_map_lookup_elem(&nf_config, &zero);
+    if (!config || !(config->flags & NF_XDP_ENABLED))
+        return XDP_PASS;
+
+    stat_inc(NF_XDP_QUERIES);
+    ret = match_question((const __u8 *)(dns + 1), data_end, config->seed, &name_len);
+    if (ret < 0) {
+        stat_inc(NF_XDP_UNPARSED);
+        return XDP_PASS;
+    }
+    if (!ret)
+        return XDP_PASS;
+
+    if (!(config->flags & NF_XDP_ANSWER)) {
+        stat_inc(NF_XDP_DROPPED);
+        return XDP_DROP;
+    }
+    if (answer_query(ctx, name_len, ipv6) < 0) {
+        stat_inc(NF_XDP_FALLBACK);
+        return XDP_PASS;
+    }
+    stat_inc(NF_XDP_ANSWERED);
+    return XDP_TX;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -1,152 +1,1291 @@
 #include "cache.h"
 
 /* Global variables */
-DEFINE_HASHTABLE(domain_cache, __HASH_SIZE);
-DEFINE_SPINLOCK(__cache_lock);
+static struct domain_table __rcu *domain_cache;
+static struct workqueue_struct *cache_wq;
+static struct kmem_cache *domain_short_slab;
+static struct kmem_cache *domain_long_slab;
+static u32 domain_hash_seed __read_mostly;
+DEFINE_MUTEX(__cache_lock);
 
-/* Simple but effective domain hash function */
-static unsigned int hash_domain(const char *domain)
+/* Server list version the live generation matches, under __cache_lock */
+static u32 list_epoch;
+static u64 list_version;
+
+/* Lists lookups enforce, see set_enabled_categories() */
+static u8 enabled_categories __read_mostly = CATEGORIES_DEFAULT;
+
+/* See update_filter_active(), all under __cache_lock */
+DEFINE_STATIC_KEY_FALSE(filter_active);
+static bool filter_paused;
+static unsigned int nr_overlays;
+static void (*filter_watch)(bool active);
+
+/*
+ * Hit counters are written by lookups on every CPU. Each hit counts
+ * until HIT_SAMPLE_FROM, from then on one in HIT_SAMPLE_RATE does, for
+ * HIT_SAMPLE_RATE, so a hot entry's cache line is not written by every
+ * lookup. Racing CPUs may lose an update, the counts rank entries.
+ */
+#define HIT_SAMPLE_FROM         64
+#define HIT_SAMPLE_RATE         16
+
+static DEFINE_PER_CPU(u32, hit_sample);
+
+static inline void count_hit(u32 *counter)
+{
+    u32 hits = READ_ONCE(*counter);
+
+    if (hits < HIT_SAMPLE_FROM) {
+        WRITE_ONCE(*counter, hits + 1);
+        return;
+    }
+    if ((this_cpu_inc_return(hit_sample) & (HIT_SAMPLE_RATE - 1)) ||
+        hits > U32_MAX - HIT_SAMPLE_RATE)
+        return;
+    WRITE_ONCE(*counter, hits + HIT_SAMPLE_RATE);
+}
+
+
+/*
+ * Domain hashes are chained over labels from the rightmost one inward,
+ * so the hash of every parent domain falls out while hashing a name:
+ * hash(a.b.c) = mix(label_hash(a), hash(b.c)). Label hashes do not
+ * depend on the parent's, so parse_dns_name() computes them while
+ * decoding and lookups only chain them, probing each suffix with the
+ * intermediate hash instead of rehashing the string.
+ */
+static inline u32 hash_next_label(u32 label_hash, u32 suffix_hash)
+{
+    return jhash_2words(label_hash, suffix_hash, domain_hash_seed);
+}
+
+static inline u32 cache_label_hash(const char *label, size_t len)
+{
+    return (u32)dns_label_hash(label, len, domain_hash_seed);
+}
+
+/* Step @end back from the end of a label to its first character */
+static inline const char *label_start(const char *domain, const char *end)
+{
+    while (end > domain && end[-1] != '.')
+        end--;
+    return end;
+}
+
+static u32 hash_domain(const char *domain, size_t len)
+{
+    const char *end = domain + len;
+    const char *start;
+    u32 hash = 0;
+
+    for (;;) {
+        start = label_start(domain, end);
+        hash = hash_next_label(cache_label_hash(start, end - start), hash);
+        if (start == domain)
+            return hash;
+        end = start - 1;
+    }
+}
+
+/* The table re-mixes the stored hash with its own per-table seed */
+static u32 domain_key_hashfn(const void *data, u32 len, u32 seed)
+{
+    const struct domain_key *key = data;
+
+    return jhash_1word(key->hash, seed);
+}
+
+static u32 domain_obj_hashfn(const void *data, u32 len, u32 seed)
+{
+    const struct domain_entry *entry = data;
+
+    return jhash_1word(entry->hash, seed);
+}
+
+/* Reject on hash and length first so most mismatches skip memcmp */
+static int domain_obj_cmpfn(struct rhashtable_compare_arg *arg, const void *obj)
+{
+    const struct domain_key *key = arg->key;
+    const struct domain_entry *entry = obj;
+
+    if (entry->hash != key->hash || entry->len != key->len)
+        return 1;
+
+    return memcmp(entry->domain, key->domain, key->len);
+}
+
+static const struct rhashtable_params domain_cache_params = {
+    .head_offset         = offsetof(struct domain_entry, node),
+    .min_size            = CACHE_MIN_SIZE,
+    .automatic_shrinking = true,
+    .hashfn              = domain_key_hashfn,
+    .obj_hashfn          = domain_obj_hashfn,
+    .obj_cmpfn           = domain_obj_cmpfn,
+};
+
+/* Names up to SHORT_DOMAIN_LENGTH come from the small slab, the rest from the large one */
+static inline struct kmem_cache *domain_slab(size_t len)
+{
+    return len < SHORT_DOMAIN_LENGTH ? domain_short_slab : domain_long_slab;
+}
+
+static struct domain_entry *alloc_domain_entry(const struct domain_key *key)
+{
+    struct domain_entry *entry;
+
+    entry = kmem_cache_alloc(domain_slab(key->len), GFP_KERNEL);
+    if (!entry)
+        return NULL;
+
+    entry->hash = key->hash;
+    entry->len = key->len;
+    entry->profiles = PROFILES_ALL;
+    entry->categories = 0;
+    entry->hits = 0;
+    memcpy(entry->domain, key->domain, key->len);
+    entry->domain[key->len] = '\0';
+    return entry;
+}
+
+static void free_domain_entry(struct domain_entry *entry)
+{
+    kmem_cache_free(domain_slab(entry->len), entry);
+}
+
+/* Progress of a bulk operation over a JSON domain array */
+struct domain_load {
+    struct domain_table *table;
+    u32 profiles;               /* Profiles to add or remove the domains for */
+    u8 categories;              /* Other lists to add or remove the domains for */
+    int count;
+    int skipped;
+};
+
+/*
+ * A table that readers never see, filled before it is committed or used
+ * for removal. Shards fill it from cache_wq alongside the owner's own
+ * adds, rhashtable inserts being safe against each other.
+ */
+struct domain_stage {
+    struct domain_load load;
+    atomic_t pending;           /* Shards queued or running */
+    atomic_t count;             /* Shard results, folded into @load once idle */
+    atomic_t skipped;
+    int error;                  /* First shard failure */
+};
+
+/* A run of whole frame records for one worker */
+struct stage_shard {
+    struct work_struct work;
+    struct domain_stage *stage;
+    const char *list;
+    size_t len;
+    void *copy;                 /* Freed with the shard, NULL if the caller owns @list */
+};
+
+/* rhashtable_free_and_destroy() callback, @arg counts the freed entries */
+static void free_domain_entry_cb(void *ptr, void *arg)
+{
+    free_domain_entry(ptr);
+    if (arg)
+        (*(int *)arg)++;
+}
+
+/*
+ * @capacity sizes the prefilter, 0 leaves it unallocated so every probe
+ * goes to the table. Bulk loads pass 0 and build the filter once the
+ * final count is known.
+ */
+static struct domain_table *alloc_domain_table(size_t capacity)
+{
+    struct domain_table *table;
+
+    table = kzalloc(sizeof(*table), GFP_KERNEL);
+    if (!table)
+        return NULL;
+
+    if (rhashtable_init(&table->ht, &domain_cache_params) < 0) {
+        kfree(table);
+        return NULL;
+    }
+    refcount_set(&table->users, 1);
+
+    if (capacity && init_prefilter(&table->filter, capacity) < 0)
+        printk(KERN_WARNING MODULE_NAME ": No prefilter for new domain table\n");
+    return table;
+}
+
+static void destroy_domain_table(struct domain_table *table, int *count)
+{
+    rhashtable_free_and_destroy(&table->ht, free_domain_entry_cb, count);
+    cleanup_prefilter(&table->filter);
+    if (table->image) {
+        kvfree(table->image->hits);
+        kvfree(table->image->data);
+        kfree(table->image);
+    }
+    kfree(table);
+}
+
+/* Size the prefilter of an unpublished table for @count entries and fill it */
+static void build_domain_prefilter(struct domain_table *table, size_t count)
+{
+    struct rhashtable_iter iter;
+    struct domain_entry *entry;
+
+    /* Headroom for single adds until the next bulk load */
+    if (init_prefilter(&table->filter, max_t(size_t, count + count / 4, CACHE_MIN_SIZE)) < 0) {
+        printk(KERN_WARNING MODULE_NAME ": No prefilter for %zu domains\n", count);
+        return;
+    }
+
+    rhashtable_walk_enter(&table->ht, &iter);
+    rhashtable_walk_start(&iter);
+    while ((entry = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(entry))
+            continue;
+        prefilter_add(&table->filter, entry->hash);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+}
+
+/* Runs on cache_wq once every reader of a retired generation has left */
+static void domain_table_free_work(struct work_struct *work)
+{
+    struct domain_table *table = container_of(to_rcu_work(work),
+                                              struct domain_table, free_work);
+
+    destroy_domain_table(table, NULL);
+}
+
+/* Lists of an image name as entry masks, the custom list blocking every profile */
+static void image_entry_lists(u8 listed, u32 *profiles, u8 *categories)
+{
+    *profiles = listed & BIT(CATEGORY_CUSTOM) ? PROFILES_ALL : 0;
+    *categories = listed & ~BIT(CATEGORY_CUSTOM);
+}
+
+static u8 table_image_lookup(struct domain_table *table, const char *domain, size_t len)
+{
+    if (!table->image)
+        return 0;
+    return image_lookup(table->image, image_domain_hash(table->image, domain, len), domain, len);
+}
+
+/*
+ * Copy @domain to @buf in the form lookups compare against: ASCII lower
+ * case, as parse_dns_name() leaves query names, without a trailing dot.
+ * Every name stored in or taken out of a table goes through here, so
+ * callers may pass names in any case. A name that no query could carry
+ * is refused: empty labels, labels over DNS_LABEL_MAX, spaces or
+ * control bytes.
+ *
+ * Return: Length of the copy, -EINVAL if the name is not valid
+ */
+static int canonical_domain(char *buf, const char *domain, size_t len)
 {
-    unsigned int hash = 0;
-    while (*domain) {
-        hash = hash * 31 + *domain;
-        domain++;
+    size_t i, label = 0;
+    char c;
+
+    if (len && domain[len - 1] == '.')
+        len--;
+    if (!len || len >= MAX_DOMAIN_LENGTH)
+        return -EINVAL;
+
+    for (i = 0; i < len; i++) {
+        c = domain[i];
+        if (c == '.') {
+            if (!label)
+                return -EINVAL;
+            label = 0;
+        } else if ((unsigned char)c <= ' ' || c == 0x7f || ++label > DNS_LABEL_MAX) {
+            return -EINVAL;
+        }
+        buf[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    if (!label)
+        return -EINVAL;
+    return len;
+}
+
+/**
+ * domain_table_insert - Insert a domain into a table
+ * @table: Table to insert into
+ * @domain: Domain name, need not be NUL-terminated
+ * @len: Length of @domain
+ * @profiles: Profiles to block the domain for on the custom list, PROFILES_ALL for everyone
+ * @categories: Other lists to put the domain on
+ *
+ * An entry that already exists gets @profiles and @categories added to
+ * its masks. The first change to an image name copies the image's lists
+ * into a new entry, which decides from then on.
+ *
+ * Return: 0 on success, -EEXIST if already on every list given, negative error otherwise
+ */
+static int domain_table_insert(struct domain_table *table, const char *domain, size_t len,
+                               u32 profiles, u8 categories)
+{
+    struct domain_entry *entry;
+    struct domain_key key;
+    char name[MAX_DOMAIN_LENGTH];
+    u32 old_profiles;
+    u8 old_categories;
+    int ret;
+
+    ret = canonical_domain(name, domain, len);
+    if (ret < 0)
+        return ret;
+    domain = name;
+    len = ret;
+
+    key.domain = domain;
+    key.len = len;
+    key.hash = hash_domain(domain, len);
+
+    /* Also how a removed image name comes back, from a tombstone's empty masks */
+    entry = rhashtable_lookup_fast(&table->ht, &key, domain_cache_params);
+    if (entry) {
+        if ((entry->profiles & profiles) == profiles &&
+            (entry->categories & categories) == categories)
+            return -EEXIST;
+        WRITE_ONCE(entry->profiles, entry->profiles | profiles);
+        WRITE_ONCE(entry->categories, entry->categories | categories);
+        return 0;
     }
-    return hash;
+
+    image_entry_lists(table_image_lookup(table, domain, len), &old_profiles, &old_categories);
+    if ((old_profiles & profiles) == profiles && (old_categories & categories) == categories)
+        return -EEXIST;
+
+    entry = alloc_domain_entry(&key);
+    if (!entry)
+        return -ENOMEM;
+    entry->profiles = old_profiles | profiles;
+    entry->categories = old_categories | categories;
+
+    ret = rhashtable_lookup_insert_key(&table->ht, &key, &entry->node,
+                                       domain_cache_params);
+    if (ret < 0) {
+        free_domain_entry(entry);
+        return ret;
+    }
+
+    prefilter_add(&table->filter, key.hash);
+    return 0;
+}
+
+static void free_domain_entry_rcu(struct rcu_head *head)
+{
+    free_domain_entry(container_of(head, struct domain_entry, rcu));
+}
+
+/*
+ * Take a domain in @table off the custom list for @profiles and off the
+ * @categories lists. An entry left on no list is unlinked and freed
+ * after a grace period without waiting for one, so bulk removals cost
+ * only the hash operations. A name in the table's image keeps an entry
+ * with what remains instead, a tombstone once both masks are empty,
+ * since the image is never written. Caller holds __cache_lock.
+ *
+ * Return: 0 on success, -ENOENT if the domain is on none of the lists given
+ */
+static int remove_domain_locked(struct domain_table *table, const char *domain, size_t len,
+                                u32 profiles, u8 categories)
+{
+    struct domain_entry *entry;
+    struct domain_key key;
+    char name[MAX_DOMAIN_LENGTH];
+    u32 old_profiles;
+    u8 old_categories, listed;
+    int ret;
+
+    ret = canonical_domain(name, domain, len);
+    if (ret < 0)
+        return ret;
+    domain = name;
+    len = ret;
+
+    key.domain = domain;
+    key.len = len;
+    key.hash = hash_domain(domain, len);
+
+    entry = rhashtable_lookup_fast(&table->ht, &key, domain_cache_params);
+    listed = table_image_lookup(table, domain, len);
+    if (entry) {
+        old_profiles = entry->profiles;
+        old_categories = entry->categories;
+    } else {
+        image_entry_lists(listed, &old_profiles, &old_categories);
+    }
+    if (!(old_profiles & profiles) && !(old_categories & categories))
+        return -ENOENT;
+
+    profiles = old_profiles & ~profiles;
+    categories = old_categories & ~categories;
+
+    if (entry && (listed || profiles || categories)) {
+        WRITE_ONCE(entry->profiles, profiles);
+        WRITE_ONCE(entry->categories, categories);
+        return 0;
+    }
+    if (entry) {
+        rhashtable_remove_fast(&table->ht, &entry->node, domain_cache_params);
+        call_rcu(&entry->rcu, free_domain_entry_rcu);
+        return 0;
+    }
+
+    entry = alloc_domain_entry(&key);
+    if (!entry)
+        return -ENOMEM;
+    entry->profiles = profiles;
+    entry->categories = categories;
+
+    ret = rhashtable_lookup_insert_key(&table->ht, &key, &entry->node,
+                                       domain_cache_params);
+    if (ret < 0) {
+        free_domain_entry(entry);
+        return ret;
+    }
+    prefilter_add(&table->filter, key.hash);
+    return 0;
+}
+
+/* Drop a reference, the last frees the generation once current readers are done */
+static void put_domain_table(struct domain_table *table)
+{
+    if (!refcount_dec_and_test(&table->users))
+        return;
+
+    INIT_RCU_WORK(&table->free_work, domain_table_free_work);
+    queue_rcu_work(cache_wq, &table->free_work);
+}
+
+/* Drop the reference an unpublished generation held while it was published */
+static void retire_domain_table(struct domain_table *table)
+{
+    if (table)
+        put_domain_table(table);
+}
+
+static bool domain_table_populated(struct domain_table *table)
+{
+    return table->image || atomic_read(&table->ht.nelems);
 }
 
-bool is_domain_blocked(const char *domain) {
-    unsigned int hash = hash_domain(domain);
+/*
+ * Flip filter_active after a change to the lists or the pause: on while
+ * some list holds a name and the server has not paused filtering. The
+ * hooks are a jump to their return while it is off. Caller holds
+ * __cache_lock, never in atomic context since patching the key sleeps.
+ */
+static void update_filter_active(void)
+{
+    struct domain_table *table = rcu_dereference_protected(domain_cache,
+                                                           lockdep_is_held(&__cache_lock));
+    bool active = !filter_paused && (domain_table_populated(table) || nr_overlays);
+
+    if (active == static_key_enabled(&filter_active))
+        return;
+
+    if (active)
+        static_branch_enable(&filter_active);
+    else
+        static_branch_disable(&filter_active);
+    if (filter_watch)
+        filter_watch(active);
+}
+
+/*
+ * Make @table the live generation and retire the previous one. Readers
+ * see either the complete old list or the complete new one. The list
+ * version changes in the same critical section, so get_list_version()
+ * never pairs one generation with another's version. Epoch 0 leaves it
+ * unknown until whoever sent the list follows up with its version.
+ */
+static void publish_domain_table(struct domain_table *table, u32 epoch, u64 version)
+{
+    struct domain_table *old;
+
+    mutex_lock(&__cache_lock);
+    old = rcu_replace_pointer(domain_cache, table, lockdep_is_held(&__cache_lock));
+    list_epoch = epoch;
+    list_version = version;
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    retire_domain_table(old);
+}
+
+/*
+ * One suffix against one table. ht, read only past the prefilter, holds
+ * the changes since the image was loaded and so decides first, a
+ * tombstone hiding the image's entry. The image costs one more probe.
+ * @profile is the client's profile bit, tested against the custom
+ * list's mask, @enabled the lists to enforce.
+ */
+static inline bool probe_domain_table(struct domain_table *table, const struct domain_key *key,
+                                      u32 profile, u8 enabled)
+{
+    const struct image_slot *slot;
     struct domain_entry *entry;
+
+    if (prefilter_test(&table->filter, key->hash)) {
+        stats_inc(STAT_PROBES);
+        entry = rhashtable_lookup(&table->ht, key, domain_cache_params);
+        if (entry) {
+            if (!(READ_ONCE(entry->categories) & enabled) &&
+                !((enabled & BIT(CATEGORY_CUSTOM)) && (READ_ONCE(entry->profiles) & profile)))
+                return false;
+            count_hit(&entry->hits);
+            return true;
+        }
+        stats_inc(STAT_FILTER_FALSE_POSITIVES);
+    } else {
+        stats_inc(STAT_FILTER_NEGATIVES);
+    }
+
+    if (!table->image)
+        return false;
+
+    stats_inc(STAT_PROBES);
+    slot = image_find(table->image, key->image_hash, key->domain, key->len);
+    if (!slot || !(slot->categories & enabled))
+        return false;
+    count_hit(&table->image->hits[slot - table->image->slots]);
+    return true;
+}
+
+/*
+ * Probe the domain and each of its parents, starting from the top-level
+ * label, so an entry for example.com also matches ads.example.com.
+ * The cost is one prefilter test per label, plus one more per label
+ * when the namespace has an overlay; the tables are rarely touched for
+ * names that are not blocked.
+ */
+int parse_query_name(struct dns_name *name, const unsigned char *src, unsigned int src_len) {
+    struct domain_table *table;
+    u64 image_seed;
+
+    rcu_read_lock();
+    table = rcu_dereference(domain_cache);
+    image_seed = table->image ? table->image->seed : 0;
+    rcu_read_unlock();
+
+    return parse_dns_name(name, src, src_len, domain_hash_seed, image_seed);
+}
+
+bool is_domain_blocked(const struct dns_name *name, struct domain_table __rcu **overlay, u32 profile) {
+    const char *domain = name->domain;
+    const char *end = domain + name->len;
+    const char *start = end + 1;
+    struct domain_key key = { .hash = 0, .image_hash = 0 };
+    struct domain_table *table, *extra;
+    const struct dns_label *label;
+    u8 enabled = READ_ONCE(enabled_categories);
     bool found = false;
+    int i;
+
+    stats_inc(STAT_LOOKUPS);
 
     rcu_read_lock();
-    hash_for_each_possible_rcu(domain_cache, entry, node, hash) {
-        if (strcmp(entry->domain, domain) == 0) {
+    table = rcu_dereference(domain_cache);
+    extra = rcu_dereference(*overlay);
+    for (i = name->nr_labels - 1; i >= 0; i--) {
+        const char *label_end = start - 1;
+        u32 label_hash;
+
+        /* Only names deeper than the kept labels are hashed again here */
+        label = dns_name_label(name, i);
+        if (label) {
+            start = domain + label->off;
+            label_hash = label->hash;
+        } else {
+            start = label_start(domain, label_end);
+            label_hash = cache_label_hash(start, label_end - start);
+        }
+        key.hash = hash_next_label(label_hash, key.hash);
+
+        if (table->image) {
+            /* A generation published since parsing has another seed */
+            u64 image_label = label && name->image_seed == table->image->seed ?
+                              label->image_hash :
+                              dns_label_hash(start, label_end - start, table->image->seed);
+
+            key.image_hash = image_hash_label(image_label, key.image_hash);
+        }
+        key.domain = start;
+        key.len = end - start;
+
+        if (probe_domain_table(table, &key, profile, enabled) ||
+            (extra && probe_domain_table(extra, &key, profile, enabled))) {
+            stats_inc(STAT_HITS);
             found = true;
             break;
         }
     }
     rcu_read_unlock();
 
+    trace_nf_cache_lookup(name, key.hash, name->nr_labels - (found ? i : 0), found);
     return found;
 }
 
-void add_domain_to_cache(const char *domain) {
-    struct domain_entry *entry = NULL;
-    unsigned int hash = hash_domain(domain);
+int overlay_add_domain(struct domain_table __rcu **overlay, const char *domain, size_t len) {
+    struct domain_table *table;
+    int ret;
 
-    entry = kmalloc(sizeof(*entry), GFP_KERNEL);
-    if (!entry) {
-        printk(KERN_ERR MODULE_NAME ": Failed to allocate domain entry\n");
-        return;
+    mutex_lock(&__cache_lock);
+    table = rcu_dereference_protected(*overlay, lockdep_is_held(&__cache_lock));
+    if (!table) {
+        table = alloc_domain_table(CACHE_MIN_SIZE);
+        if (!table) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        rcu_assign_pointer(*overlay, table);
+        nr_overlays++;
+        update_filter_active();
     }
+    ret = domain_table_insert(table, domain, len, PROFILES_ALL, 0);
+out:
+    mutex_unlock(&__cache_lock);
+    return ret;
+}
 
-    entry->domain = kstrdup(domain, GFP_KERNEL);
-    if (!entry->domain) {
-        printk(KERN_ERR MODULE_NAME ": Failed to allocate domain string\n");
-        kfree(entry);
-        return;
-    }
+int overlay_remove_domain(struct domain_table __rcu **overlay, const char *domain, size_t len) {
+    struct domain_table *table;
+    int ret = -ENOENT;
 
-    spin_lock(&__cache_lock);
-    hash_add_rcu(domain_cache, &entry->node, hash);
-    spin_unlock(&__cache_lock);
+    if (len >= MAX_DOMAIN_LENGTH)
+        return -EINVAL;
 
-    printk(KERN_INFO MODULE_NAME ": Added domain %s to cache\n", domain);
+    mutex_lock(&__cache_lock);
+    table = rcu_dereference_protected(*overlay, lockdep_is_held(&__cache_lock));
+    if (table)
+        ret = remove_domain_locked(table, domain, len, PROFILES_ALL, 0);
+    mutex_unlock(&__cache_lock);
+    return ret;
 }
 
-void remove_domain_from_cache(const char *domain) {
+void overlay_show(struct seq_file *m, struct domain_table __rcu **overlay) {
+    struct rhashtable_iter iter;
+    struct domain_table *table;
     struct domain_entry *entry;
-    unsigned int hash = hash_domain(domain);
-    struct hlist_node *tmp;
-    struct domain_entry *found_entry = NULL;
-
-    spin_lock(&__cache_lock);
-    hash_for_each_possible_safe(domain_cache, entry, tmp, node, hash) {
-        if (strcmp(entry->domain, domain) == 0) {
-            hash_del_rcu(&entry->node);
-            found_entry = entry;
+
+    /* The mutex keeps overlay_release() from freeing the table during the walk */
+    mutex_lock(&__cache_lock);
+    table = rcu_dereference_protected(*overlay, lockdep_is_held(&__cache_lock));
+    if (!table)
+        goto out;
+
+    rhashtable_walk_enter(&table->ht, &iter);
+    rhashtable_walk_start(&iter);
+    while ((entry = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(entry)) {
+            if (PTR_ERR(entry) == -EAGAIN)
+                continue;
             break;
         }
+        seq_printf(m, "%s\n", entry->domain);
     }
-    spin_unlock(&__cache_lock);
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+out:
+    mutex_unlock(&__cache_lock);
+}
+
+void overlay_release(struct domain_table __rcu **overlay) {
+    struct domain_table *table;
 
-    if (found_entry) {
-        synchronize_rcu();
-        kfree(found_entry->domain);
-        kfree(found_entry);
+    mutex_lock(&__cache_lock);
+    table = rcu_replace_pointer(*overlay, NULL, lockdep_is_held(&__cache_lock));
+    if (table) {
+        nr_overlays--;
+        update_filter_active();
     }
-    printk(KERN_INFO MODULE_NAME ": Removed domain %s from cache\n", domain);
+    mutex_unlock(&__cache_lock);
+
+    retire_domain_table(table);
+}
+
+void add_domain_to_cache(const char *domain) {
+    struct domain_table *table;
+    int ret;
+
+    mutex_lock(&__cache_lock);
+    table = rcu_dereference_protected(domain_cache, lockdep_is_held(&__cache_lock));
+    ret = domain_table_insert(table, domain, strnlen(domain, MAX_DOMAIN_LENGTH), PROFILES_ALL, 0);
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    if (ret < 0) {
+        if (ret != -EEXIST)
+            printk(KERN_ERR MODULE_NAME ": Failed to add domain %s: %d\n", domain, ret);
+        return;
+    }
+
+    pr_debug(MODULE_NAME ": Added domain %s to cache\n", domain);
+}
+
+void remove_domain_from_cache(const char *domain) {
+    struct domain_table *table;
+    int ret;
+
+    mutex_lock(&__cache_lock);
+    table = rcu_dereference_protected(domain_cache, lockdep_is_held(&__cache_lock));
+    ret = remove_domain_locked(table, domain, strnlen(domain, MAX_DOMAIN_LENGTH), PROFILES_ALL, 0);
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    if (ret == 0)
+        pr_debug(MODULE_NAME ": Removed domain %s from cache\n", domain);
 }
 
 int init_cache(void) {
-    hash_init(domain_cache);
+    struct domain_table *table;
+    int ret;
+
+    domain_hash_seed = get_random_u32();
+
+    domain_short_slab = kmem_cache_create(MODULE_NAME "_domain_short",
+                                          sizeof(struct domain_entry) + SHORT_DOMAIN_LENGTH,
+                                          0, SLAB_HWCACHE_ALIGN, NULL);
+    domain_long_slab = kmem_cache_create(MODULE_NAME "_domain_long",
+                                         sizeof(struct domain_entry) + MAX_DOMAIN_LENGTH,
+                                         0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!domain_short_slab || !domain_long_slab) {
+        printk(KERN_ERR MODULE_NAME ": Failed to create domain entry slabs\n");
+        ret = -ENOMEM;
+        goto fail_slab;
+    }
+
+    cache_wq = alloc_workqueue(MODULE_NAME "_cache", WQ_UNBOUND, 0);
+    if (!cache_wq) {
+        ret = -ENOMEM;
+        goto fail_slab;
+    }
+
+    table = alloc_domain_table(CACHE_MIN_SIZE);
+    if (!table) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize cache table\n");
+        ret = -ENOMEM;
+        goto fail_table;
+    }
+    RCU_INIT_POINTER(domain_cache, table);
+
     printk(KERN_INFO MODULE_NAME ": Cache initialized\n");
     return 0;
+
+fail_table:
+    destroy_workqueue(cache_wq);
+fail_slab:
+    kmem_cache_destroy(domain_long_slab);
+    kmem_cache_destroy(domain_short_slab);
+    return ret;
 }
 
 void cleanup_cache(void) {
-    struct domain_entry *entry;
-    struct hlist_node *tmp;
-    unsigned int bkt;
+    struct domain_table *table;
+    int count = 0;
+
+    table = rcu_dereference_protected(domain_cache, 1);
+    RCU_INIT_POINTER(domain_cache, NULL);
+    destroy_domain_table(table, &count);
+
+    /* Let retired generations queued by publish_domain_table() finish */
+    rcu_barrier();
+    destroy_workqueue(cache_wq);
+
+    kmem_cache_destroy(domain_long_slab);
+    kmem_cache_destroy(domain_short_slab);
+    printk(KERN_INFO MODULE_NAME ": Cleaned up %d cache entries\n", count);
+}
+
+/* domain_list_iter callback filling a table, a new generation or the live one */
+static int insert_domain_cb(const char *domain, size_t len, void *ctx)
+{
+    struct domain_load *load = ctx;
+    int ret = domain_table_insert(load->table, domain, len, load->profiles, load->categories);
+
+    if (ret == -ENOMEM)
+        return ret;
+
+    if (ret < 0)
+        load->skipped++;
+    else
+        load->count++;
+    return 0;
+}
+
+/* domain_list_iter callback, runs with __cache_lock held */
+static int remove_domain_cb(const char *domain, size_t len, void *ctx)
+{
+    struct domain_load *load = ctx;
+
+    if (len >= MAX_DOMAIN_LENGTH ||
+        remove_domain_locked(load->table, domain, len, load->profiles, load->categories) < 0)
+        load->skipped++;
+    else
+        load->count++;
+    return 0;
+}
+
+int frame_for_each_domain(const char *list, size_t len,
+                          int (*fn)(const char *domain, size_t len, void *ctx),
+                          void *ctx) {
+    const char *end = list + len;
     int count = 0;
+    int ret;
+
+    while (list < end) {
+        size_t step = (u8)*list++;
 
-    spin_lock(&__cache_lock);
-    hash_for_each_safe(domain_cache, bkt, tmp, entry, node) {
-        hash_del(&entry->node);
-        kfree(entry->domain);
-        kfree(entry);
+        if (step > end - list)
+            return -EINVAL;
+
+        ret = fn(list, step, ctx);
+        if (ret < 0)
+            return ret;
+
+        list += step;
         count++;
     }
-    spin_unlock(&__cache_lock);
-    printk(KERN_INFO MODULE_NAME ": Cleaned up %d cache entries\n", count);
+    return count;
+}
+
+/* frame_for_each_domain() callback that only lets the frame be checked */
+static int skip_domain_cb(const char *domain, size_t len, void *ctx)
+{
+    return 0;
+}
+
+static void stage_shard_work(struct work_struct *work)
+{
+    struct stage_shard *shard = container_of(work, struct stage_shard, work);
+    struct domain_stage *stage = shard->stage;
+    struct domain_load load = {
+        .table    = stage->load.table,
+        .profiles = stage->load.profiles,
+    };
+    int ret;
+
+    ret = frame_for_each_domain(shard->list, shard->len, insert_domain_cb, &load);
+    if (ret < 0)
+        cmpxchg(&stage->error, 0, ret);
+    atomic_add(load.count, &stage->count);
+    atomic_add(load.skipped, &stage->skipped);
+
+    kvfree(shard->copy);
+    kfree(shard);
+
+    /*
+     * Fully ordered, so the owner sees the results once pending drops.
+     * The stage may be gone by then, the wake only uses its address.
+     */
+    atomic_dec_return(&stage->pending);
+    wake_up_var(&stage->pending);
+}
+
+/*
+ * Hand records of @stage to cache_wq. @copy is freed with the shard, or
+ * NULL when the caller keeps @list alive until the stage is idle.
+ */
+static int queue_stage_shard(struct domain_stage *stage, const char *list, size_t len,
+                             void *copy)
+{
+    struct stage_shard *shard;
+
+    shard = kmalloc(sizeof(*shard), GFP_KERNEL);
+    if (!shard) {
+        kvfree(copy);
+        return -ENOMEM;
+    }
+    INIT_WORK(&shard->work, stage_shard_work);
+    shard->stage = stage;
+    shard->list = list;
+    shard->len = len;
+    shard->copy = copy;
+
+    /* Copies queued faster than they are inserted would pile up */
+    wait_var_event(&stage->pending, atomic_read(&stage->pending) <
+                                    num_online_cpus() * STAGE_SHARDS_PER_CPU);
+    atomic_inc(&stage->pending);
+    queue_work(cache_wq, &shard->work);
+    return 0;
+}
+
+/* Wait for the shards of @stage and fold their counts in, returns the first error */
+static int wait_domain_stage(struct domain_stage *stage)
+{
+    wait_var_event(&stage->pending, !atomic_read(&stage->pending));
+    stage->load.count += atomic_xchg(&stage->count, 0);
+    stage->load.skipped += atomic_xchg(&stage->skipped, 0);
+    return stage->error;
+}
+
+struct domain_stage *alloc_domain_stage(void) {
+    struct domain_stage *stage;
+
+    stage = kzalloc(sizeof(*stage), GFP_KERNEL);
+    if (!stage)
+        return NULL;
+
+    stage->load.table = alloc_domain_table(0);
+    if (!stage->load.table) {
+        kfree(stage);
+        return NULL;
+    }
+    stage->load.profiles = PROFILES_ALL;
+    return stage;
+}
+
+void free_domain_stage(struct domain_stage *stage) {
+    if (!stage)
+        return;
+
+    wait_domain_stage(stage);
+    destroy_domain_table(stage->load.table, NULL);
+    kfree(stage);
+}
+
+int domain_stage_add(struct domain_stage *stage, const char *domain, size_t len) {
+    return insert_domain_cb(domain, len, &stage->load);
+}
+
+int domain_stage_add_list(struct domain_stage *stage, domain_list_iter each,
+                          const char *list, size_t len) {
+    return each(list, len, insert_domain_cb, &stage->load);
+}
+
+int domain_stage_add_frame(struct domain_stage *stage, const char *list, size_t len) {
+    void *copy;
+    int ret;
+
+    if (len < STAGE_SHARD_MIN || num_online_cpus() == 1)
+        return frame_for_each_domain(list, len, insert_domain_cb, &stage->load);
+
+    /* A malformed frame fails here, not later in its shard */
+    ret = frame_for_each_domain(list, len, skip_domain_cb, NULL);
+    if (ret < 0)
+        return ret;
+
+    copy = kvmemdup(list, len, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+    return queue_stage_shard(stage, copy, len, copy) ?: ret;
 }
 
-int parse_domains(const char *buffer) {
-    const char *value_start;
-    size_t value_len;
-    int ret = get_json_value(buffer, STR_DOMAINS, &value_start, &value_len);
-    
+int commit_domain_stage(struct domain_stage *stage) {
+    struct domain_load load;
+    int ret;
+
+    ret = wait_domain_stage(stage);
     if (ret < 0) {
-        printk(KERN_WARNING MODULE_NAME ": Failed to find domains array: %d\n", ret);
+        printk(KERN_ERR MODULE_NAME ": Failed to build domain table: %d\n", ret);
+        free_domain_stage(stage);
         return ret;
     }
 
-    char domain[MAX_DOMAIN_LENGTH];
-    value_start++; // Skip the opening bracket '['
-    const char *end;
-    int count_domains = 0;
+    load = stage->load;
+    kfree(stage);
+    build_domain_prefilter(load.table, load.count);
+    publish_domain_table(load.table, 0, 0);
 
-    while (*value_start && *value_start != ']') {
-        // Skip whitespace and commas
-        while (*value_start && (*value_start == ' ' || *value_start == ',' || *value_start == '"')) {
-            value_start++;
-        }
-        
-        // Check if we've reached the end of the array
-        if (*value_start == ']' || *value_start == '\0') {
+    printk(KERN_INFO MODULE_NAME ": Initialized with %d domains (%d skipped)\n",
+           load.count, load.skipped);
+    return load.count;
+}
+
+int remove_domain_stage(struct domain_stage *stage) {
+    struct domain_load removed = { .profiles = PROFILES_ALL };
+    struct rhashtable_iter iter;
+    struct domain_entry *entry;
+
+    wait_domain_stage(stage);
+
+    mutex_lock(&__cache_lock);
+    removed.table = rcu_dereference_protected(domain_cache, lockdep_is_held(&__cache_lock));
+
+    rhashtable_walk_enter(&stage->load.table->ht, &iter);
+    rhashtable_walk_start(&iter);
+    while ((entry = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(entry))
+            continue;
+        /* Tombstones are allocated, the stage is private so its entries stay put */
+        rhashtable_walk_stop(&iter);
+        remove_domain_cb(entry->domain, entry->len, &removed);
+        rhashtable_walk_start(&iter);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    free_domain_stage(stage);
+
+    printk(KERN_INFO MODULE_NAME ": Removed %d domains (%d not found)\n",
+           removed.count, removed.skipped);
+    return removed.count;
+}
+
+int load_domain_image(void *data, size_t size) {
+    const struct image_header *header = data;
+    struct domain_table *table;
+    struct blocklist_image *image;
+    u32 count;
+    int ret;
+
+    image = kzalloc(sizeof(*image), GFP_KERNEL);
+    table = alloc_domain_table(0);
+    if (!image || !table) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    ret = image_parse(image, data, size);
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Rejected blocklist image: %d\n", ret);
+        goto fail;
+    }
+    image->hits = kvcalloc(image->nr_slots, sizeof(*image->hits), GFP_KERNEL);
+    if (!image->hits) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    table->image = image;
+    count = le32_to_cpu(header->count);
+
+    /* Sized for the adds that arrive before the next image */
+    build_domain_prefilter(table, 0);
+    publish_domain_table(table, le32_to_cpu(header->list_epoch),
+                         le64_to_cpu(header->list_version));
+
+    printk(KERN_INFO MODULE_NAME ": Loaded image with %u domains (%zu bytes)\n", count, size);
+    return count;
+
+fail:
+    if (table)
+        destroy_domain_table(table, NULL);
+    kfree(image);
+    kvfree(data);
+    return ret;
+}
+
+int load_domain_list(domain_list_iter each, const char *list, size_t len) {
+    struct domain_stage *stage;
+    int ret;
+
+    /* Build the new generation off to the side, readers keep the old one */
+    stage = alloc_domain_stage();
+    if (!stage) {
+        printk(KERN_ERR MODULE_NAME ": Failed to allocate domain table\n");
+        return -ENOMEM;
+    }
+
+    ret = domain_stage_add_list(stage, each, list, len);
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to load domains: %d\n", ret);
+        free_domain_stage(stage);
+        return ret;
+    }
+
+    return commit_domain_stage(stage);
+}
+
+int load_domain_frame(const char *list, size_t len) {
+    unsigned int shards = clamp_t(size_t, len / STAGE_SHARD_MIN, 1, num_online_cpus());
+    struct domain_stage *stage;
+    size_t start = 0, off = 0;
+    unsigned int next = 1;
+    int ret = 0;
+
+    stage = alloc_domain_stage();
+    if (!stage) {
+        printk(KERN_ERR MODULE_NAME ": Failed to allocate domain table\n");
+        return -ENOMEM;
+    }
+
+    /* Cut after the record that crosses each shards-th of the frame */
+    while (next < shards && off < len) {
+        off += 1 + (u8)list[off];
+        if (off > len) {
+            ret = -EINVAL;
             break;
         }
+        if (off < div_u64((u64)len * next, shards))
+            continue;
+
+        ret = queue_stage_shard(stage, list + start, off - start, NULL);
+        if (ret < 0)
+            break;
+        start = off;
+        next++;
+    }
+
+    /* The last shard is ours, the others insert alongside it */
+    if (!ret)
+        ret = frame_for_each_domain(list + start, len - start, insert_domain_cb, &stage->load);
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to load domains: %d\n", ret);
+        free_domain_stage(stage);
+        return ret;
+    }
+
+    return commit_domain_stage(stage);
+}
+
+int add_domain_list(domain_list_iter each, const char *list, size_t len, u32 profiles,
+                    u8 categories) {
+    struct domain_load load = { .profiles = profiles, .categories = categories };
+    int ret;
 
-        end = strchr(value_start, '"');
-        if (!end) break;
+    mutex_lock(&__cache_lock);
+    load.table = rcu_dereference_protected(domain_cache, lockdep_is_held(&__cache_lock));
+    ret = each(list, len, insert_domain_cb, &load);
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to add domains after %d: %d\n", load.count, ret);
+        return ret;
+    }
+
+    printk(KERN_INFO MODULE_NAME ": Added %d domains (%d skipped)\n", load.count, load.skipped);
+    return load.count;
+}
+
+int remove_domain_list(domain_list_iter each, const char *list, size_t len, u32 profiles,
+                       u8 categories) {
+    struct domain_load load = { .profiles = profiles, .categories = categories };
+    int ret;
+
+    mutex_lock(&__cache_lock);
+    load.table = rcu_dereference_protected(domain_cache, lockdep_is_held(&__cache_lock));
+    ret = each(list, len, remove_domain_cb, &load);
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    if (ret < 0)
+        return ret;
+
+    printk(KERN_INFO MODULE_NAME ": Removed %d domains (%d not found)\n",
+           load.count, load.skipped);
+    return load.count;
+}
+
+void get_list_version(u32 *epoch, u64 *version) {
+    mutex_lock(&__cache_lock);
+    *epoch = list_epoch;
+    *version = list_version;
+    mutex_unlock(&__cache_lock);
+}
+
+void set_list_version(u32 epoch, u64 version) {
+    mutex_lock(&__cache_lock);
+    list_epoch = epoch;
+    list_version = version;
+    mutex_unlock(&__cache_lock);
+
+    printk(KERN_DEBUG MODULE_NAME ": List at version %llu of epoch %08x\n", version, epoch);
+}
 
-        size_t len = end - value_start;
-        if (len >= MAX_DOMAIN_LENGTH) {
-            printk(KERN_WARNING MODULE_NAME ": Domain too long, skipping\n");
-            value_start = end + 1;
+void set_enabled_categories(u8 categories) {
+    WRITE_ONCE(enabled_categories, categories);
+    printk(KERN_INFO MODULE_NAME ": Enforcing categories %#x\n", categories);
+}
+
+void set_filter_paused(bool paused) {
+    mutex_lock(&__cache_lock);
+    filter_paused = paused;
+    update_filter_active();
+    mutex_unlock(&__cache_lock);
+
+    printk(KERN_INFO MODULE_NAME ": Filtering %s\n", paused ? "paused" : "resumed");
+}
+
+void watch_filter_active(void (*fn)(bool active)) {
+    mutex_lock(&__cache_lock);
+    filter_watch = fn;
+    mutex_unlock(&__cache_lock);
+}
+
+/*
+ * cache_for_each_hit() steps this many names between reschedules, the
+ * entry walk leaves its RCU read section for them.
+ */
+#define HIT_WALK_BATCH          4096
+
+int cache_for_each_hit(void (*fn)(const char *domain, size_t len, u32 hits, void *ctx),
+                       void *ctx) {
+    const struct blocklist_image *image;
+    const struct image_slot *slot;
+    struct domain_table *table;
+    struct rhashtable_iter iter;
+    struct domain_entry *entry;
+    unsigned long *shadowed = NULL;
+    u32 i, hits, walked = 0;
+
+    /* A generation whose last reference is gone has been replaced already */
+    rcu_read_lock();
+    do {
+        table = rcu_dereference(domain_cache);
+    } while (table && !refcount_inc_not_zero(&table->users));
+    rcu_read_unlock();
+    if (!table)
+        return 0;
+
+    image = table->image;
+    if (image) {
+        shadowed = kvcalloc(BITS_TO_LONGS(image->nr_slots), sizeof(*shadowed), GFP_KERNEL);
+        if (!shadowed) {
+            put_domain_table(table);
+            return -ENOMEM;
+        }
+    }
+
+    /*
+     * An entry for an image name takes its slot's hits along and marks
+     * the slot, tombstones only mark it. The slot walk then skips marked
+     * slots without hashing or probing anything.
+     */
+    rhashtable_walk_enter(&table->ht, &iter);
+    rhashtable_walk_start(&iter);
+    while ((entry = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(entry))
             continue;
+
+        hits = READ_ONCE(entry->hits);
+        slot = image ? image_find(image, image_domain_hash(image, entry->domain, entry->len),
+                                  entry->domain, entry->len) : NULL;
+        if (slot) {
+            __set_bit(slot - image->slots, shadowed);
+            hits += READ_ONCE(image->hits[slot - image->slots]);
         }
+        if (entry->profiles || entry->categories)
+            fn(entry->domain, entry->len, hits, ctx);
 
-        memcpy(domain, value_start, len);
-        domain[len] = '\0';
-        add_domain_to_cache(domain);
-        
-        value_start = end + 1;
-        count_domains++;
+        if (++walked % HIT_WALK_BATCH == 0) {
+            rhashtable_walk_stop(&iter);
+            cond_resched();
+            rhashtable_walk_start(&iter);
+        }
     }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    /* The image is immutable and lives as long as the reference */
+    for (i = 0; image && i < image->nr_slots; i++) {
+        slot = &image->slots[i];
+        if (slot->len && !test_bit(i, shadowed))
+            fn(image->pool + le32_to_cpu(slot->offset), slot->len,
+               READ_ONCE(image->hits[i]), ctx);
 
-    printk(KERN_INFO MODULE_NAME ": Initialized with %d domains\n", count_domains);
-    return count_domains;
+        if ((i + 1) % HIT_WALK_BATCH == 0)
+            cond_resched();
+    }
+
+    kvfree(shadowed);
+    put_domain_table(table);
+    return 0;
 }
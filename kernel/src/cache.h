@@ -1,42 +1,128 @@
 #ifndef CACHE_H
 #define CACHE_H
 
-#include <linux/hashtable.h>
-#include <linux/spinlock.h>
-#include <linux/rculist.h>
+#include <linux/rhashtable.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/wait_bit.h>
+#include <linux/cpumask.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/seq_file.h>
+#include <linux/jump_label.h>
+#include <linux/refcount.h>
 #include "utils.h"
-#include "json_parser.h"
+#include "stats.h"
+#include "prefilter.h"
+#include "image.h"
+#include "dns_name.h"
+#include "nf_trace.h"
+#include "profiles.h"
 
-extern spinlock_t __cache_lock;
+extern struct mutex __cache_lock;
+
+/*
+ * On while some list, shared or overlay, holds a name and filtering is
+ * not paused. The hooks test it first thing, so an idle filter costs a
+ * patched jump per packet.
+ */
+DECLARE_STATIC_KEY_FALSE(filter_active);
+
+/*
+ * Lists a domain can be on. The custom list is the user's own and the
+ * only one with per-profile masks; the others are imported lists that
+ * set_enabled_categories() switches on and off as a whole.
+ */
+#define CATEGORY_CUSTOM         0
+#define CATEGORY_ADS            1
+#define CATEGORY_ADULT          2
+#define CATEGORY_MAX            8
+#define CATEGORIES_DEFAULT      BIT(CATEGORY_CUSTOM)
+
+/*
+ * Bulk frames are split into shards of at least STAGE_SHARD_MIN bytes
+ * that cache_wq inserts concurrently. At most STAGE_SHARDS_PER_CPU
+ * shards per online CPU wait on one stage at a time.
+ */
+#define STAGE_SHARD_MIN         (16 << 10)
+#define STAGE_SHARDS_PER_CPU    2
 
 /* Cache structures */
 struct domain_entry {
-    struct hlist_node node;
-    char *domain;
+    struct rhash_head node;
+    u32 hash;                /* Seeded jhash of the domain, checked before memcmp */
+    u16 len;
+    u8 categories;           /* Lists other than the custom one, BIT(CATEGORY_*) */
+    u32 profiles;            /* Profiles the custom list blocks, see profiles.h */
+    u32 hits;                /* Lookups the entry blocked, sampled once hot */
     struct rcu_head rcu;
+    char domain[];           /* Stored inline, allocated from a size-classed slab */
+};
+
+/* One generation of the cache, replaced as a whole on bulk load */
+struct domain_table {
+    struct rhashtable ht;
+    struct domain_prefilter filter;     /* Tested before every probe of ht */
+    struct blocklist_image *image;      /* Immutable base, ht then only holds later changes */
+    refcount_t users;                   /* Held while published and by cache_for_each_hit() */
+    struct rcu_work free_work;
+};
+
+/* Lookup key, hashed once per query and compared against stored entries */
+struct domain_key {
+    const char *domain;
+    u32 hash;
+    u64 image_hash;          /* image_hash_label() chain, only kept for image tables */
+    u16 len;
 };
 
+/**
+ * parse_query_name - Decode a queried name for is_domain_blocked()
+ * @name: Filled on success
+ * @src: Wire-format name
+ * @src_len: Bytes readable at @src
+ *
+ * parse_dns_name() with the cache seed and the live image's seed, so
+ * the lookup only chains the label hashes. Lists are matched in lower
+ * case, the server stores them that way.
+ *
+ * Context: Any context
+ *
+ * Return: Length of the name, -1 if it cannot be parsed
+ */
+int parse_query_name(struct dns_name *name, const unsigned char *src, unsigned int src_len);
+
 /**
  * is_domain_blocked - Check if a domain is in the blocking cache
- * @domain: Domain name to check
+ * @name: Queried name, from parse_query_name()
+ * @overlay: Per-namespace overlay checked after the shared list, may point to NULL
+ * @profile: Client's profile bit, from client_profile_mask()
  *
  * Performs an RCU-safe lookup in the domain cache to determine
- * if the specified domain is blocked.
+ * if the specified domain or any of its parent domains is blocked,
+ * e.g. an entry for "example.com" blocks "ads.example.com".
+ * Each suffix is probed in the shared list and then in @overlay,
+ * reusing the same key for both. A table is only probed when its
+ * prefilter reports that the suffix may be present. A hit counts when
+ * the entry is on an enabled category's list, or on the custom list for
+ * @profile; image and overlay entries block every profile.
  *
  * Context: Any context (RCU read lock is held internally)
  *
  * Return: true if domain is blocked, false otherwise
  */
-bool is_domain_blocked(const char *domain);
+bool is_domain_blocked(const struct dns_name *name, struct domain_table __rcu **overlay, u32 profile);
 
 /**
  * add_domain_to_cache - Add a domain to the blocking cache
  * @domain: Domain name to add
  *
- * Adds a new domain to the RCU-protected domain cache.
- * Memory allocation may fail silently.
+ * Adds a new domain to the live generation of the RCU-protected
+ * domain cache. Duplicates are ignored and allocation failure is logged.
+ * The name is stored lower-cased without a trailing dot, the form
+ * queries are looked up in.
  *
  * Context: Process context only (may sleep)
  */
@@ -47,16 +133,63 @@ void add_domain_to_cache(const char *domain);
  * @domain: Domain name to remove
  *
  * Removes a domain from the RCU-protected domain cache if it exists.
- * Handles memory cleanup after RCU grace period.
+ * The entry is freed by an RCU callback, the caller does not wait
+ * for a grace period.
  *
- * Context: Process context only (may sleep due to synchronize_rcu)
+ * Context: Process context only (may sleep on __cache_lock)
  */
 void remove_domain_from_cache(const char *domain);
 
+/**
+ * overlay_add_domain - Add a domain to a per-namespace overlay
+ * @overlay: Overlay slot of the namespace, allocated on first use
+ * @domain: Domain name, need not be NUL-terminated
+ * @len: Length of @domain
+ *
+ * Namespaces that never add a domain cost only the NULL slot.
+ * @domain is stored lower-cased without a trailing dot.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: 0 on success, -EEXIST if already present, -EINVAL if @domain is not
+ * a valid name, negative error otherwise
+ */
+int overlay_add_domain(struct domain_table __rcu **overlay, const char *domain, size_t len);
+
+/**
+ * overlay_remove_domain - Remove a domain from a per-namespace overlay
+ * @overlay: Overlay slot of the namespace
+ * @domain: Domain name, need not be NUL-terminated
+ * @len: Length of @domain
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ *
+ * Return: 0 on success, -ENOENT if the domain is not in the overlay
+ */
+int overlay_remove_domain(struct domain_table __rcu **overlay, const char *domain, size_t len);
+
+/**
+ * overlay_show - Print every domain of a per-namespace overlay
+ * @m: Sequence file to print to, one domain per line
+ * @overlay: Overlay slot of the namespace
+ */
+void overlay_show(struct seq_file *m, struct domain_table __rcu **overlay);
+
+/**
+ * overlay_release - Detach and free a per-namespace overlay
+ * @overlay: Overlay slot of the namespace, NULL afterwards
+ *
+ * The entries are freed after a grace period on the cache workqueue.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ */
+void overlay_release(struct domain_table __rcu **overlay);
+
 /**
  * init_cache - Initialize the domain cache
  *
- * Initializes the hash table for domain cache
+ * Picks the hash seed and initializes the resizable hash table
+ * for the domain cache
  *
  * Context: Process context only
  *
@@ -72,13 +205,293 @@ int init_cache(void);
  */
 void cleanup_cache(void);
 
+/*
+ * Walks a serialized domain list and calls @fn for every name, stopping
+ * early when @fn returns a negative value. frame_for_each_domain() walks
+ * binary frame and netlink records.
+ */
+typedef int (*domain_list_iter)(const char *list, size_t len,
+                                int (*fn)(const char *domain, size_t len, void *ctx),
+                                void *ctx);
+
 /**
- * parse_domains - Parse domains from JSON string
- * @buffer: JSON string containing domains
- * @example: "[ \"example.com\", \"example.org\" ]"
+ * frame_for_each_domain - Call @fn for every record of a frame payload
+ * @list: Frame payload of packed length-prefixed records
+ * @len: Length of @list
+ * @fn: Callback receiving each name (not NUL-terminated) and its length
+ * @ctx: Opaque pointer passed to @fn
  *
- * Return: 0 on success, negative error code on failure
+ * domain_list_iter for binary frames and netlink records.
+ *
+ * Return: Number of records visited on success, -EINVAL if a record runs
+ *         past the payload, the negative value returned by @fn otherwise
+ */
+int frame_for_each_domain(const char *list, size_t len,
+                          int (*fn)(const char *domain, size_t len, void *ctx),
+                          void *ctx);
+
+/**
+ * load_domain_list - Replace the blocklist with a serialized list
+ * @each: Iterator understanding the format of @list
+ * @list: Serialized domain list
+ * @len: Length of @list
+ *
+ * Stages the whole list and commits it, see commit_domain_stage().
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains loaded on success, negative error code on failure
+ */
+int load_domain_list(domain_list_iter each, const char *list, size_t len);
+
+/**
+ * load_domain_frame - Replace the blocklist with a frame payload, on every CPU
+ * @list: Frame payload of packed length-prefixed records
+ * @len: Length of @list
+ *
+ * load_domain_list() for binary frames. The payload is cut at record
+ * boundaries into a shard per online CPU, at most one per
+ * STAGE_SHARD_MIN bytes, and cache_wq inserts them into the new
+ * generation concurrently with the caller's own shard. It is still
+ * published with one pointer swap once every shard is in.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains loaded on success, negative error code on failure
+ */
+int load_domain_frame(const char *list, size_t len);
+
+struct domain_stage;
+
+/**
+ * alloc_domain_stage - Start collecting domains off to the side
+ *
+ * A stage is an unpublished table that readers never see. It ends as
+ * the new generation (commit_domain_stage()), as a set of names to
+ * remove (remove_domain_stage()) or discarded (free_domain_stage()).
+ * The owner serializes calls on one stage; shards queued by
+ * domain_stage_add_frame() are waited for by whichever ends it.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: New stage, NULL on allocation failure
+ */
+struct domain_stage *alloc_domain_stage(void);
+
+/**
+ * free_domain_stage - Discard a stage and everything collected in it
+ * @stage: Stage to free, may be NULL
+ */
+void free_domain_stage(struct domain_stage *stage);
+
+/**
+ * domain_stage_add - Add one domain to a stage
+ * @stage: Stage to add to
+ * @domain: Domain name, need not be NUL-terminated
+ * @len: Length of @domain
+ *
+ * Duplicates and invalid names are counted as skipped.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: 0 on success or skip, -ENOMEM on allocation failure
+ */
+int domain_stage_add(struct domain_stage *stage, const char *domain, size_t len);
+
+/**
+ * domain_stage_add_list - Add every domain of a serialized list to a stage
+ * @stage: Stage to add to
+ * @each: Iterator understanding the format of @list
+ * @list: Serialized domain list
+ * @len: Length of @list
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains visited on success, negative error code on failure
+ */
+int domain_stage_add_list(struct domain_stage *stage, domain_list_iter each,
+                          const char *list, size_t len);
+
+/**
+ * domain_stage_add_frame - Add the records of a frame payload to a stage
+ * @stage: Stage to add to
+ * @list: Frame payload of packed length-prefixed records
+ * @len: Length of @list
+ *
+ * Payloads of STAGE_SHARD_MIN bytes or more are checked, copied and
+ * left to cache_wq, so a list sent in chunks is inserted on several
+ * CPUs while the next chunk arrives. Their allocation failures surface
+ * when the stage is committed. Smaller ones are added at once.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of records on success, negative error code on failure
+ */
+int domain_stage_add_frame(struct domain_stage *stage, const char *list, size_t len);
+
+/**
+ * commit_domain_stage - Publish a stage as the new generation
+ * @stage: Stage to publish, consumed
+ *
+ * Waits for the stage's shards, sizes the prefilter for the collected
+ * count and replaces the live generation with a single RCU pointer
+ * swap. The old generation is freed after a grace period. A stage
+ * whose shard failed is discarded and the live generation kept.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains loaded, negative error code if a shard failed
+ */
+int commit_domain_stage(struct domain_stage *stage);
+
+/**
+ * remove_domain_stage - Remove every staged domain from the live generation
+ * @stage: Stage holding the names to remove, consumed
+ *
+ * Runs under a single acquisition of __cache_lock.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ *
+ * Return: Number of domains removed
+ */
+int remove_domain_stage(struct domain_stage *stage);
+
+/**
+ * add_domain_list - Add every domain of a serialized list to the blocklist
+ * @each: Iterator understanding the format of @list
+ * @list: Serialized domain list
+ * @len: Length of @list
+ * @profiles: Profiles to block the domains for on the custom list,
+ *            PROFILES_ALL for everyone, 0 for none
+ * @categories: Other lists to put the domains on, BIT(CATEGORY_*)
+ *              without CATEGORY_CUSTOM
+ *
+ * Inserts into the live generation under a single acquisition of
+ * __cache_lock. Duplicates and invalid names are skipped. Profile and
+ * category entries live in the generation like any other and are
+ * dropped with it by the next bulk load.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains added on success, negative error code on failure
+ */
+int add_domain_list(domain_list_iter each, const char *list, size_t len, u32 profiles,
+                    u8 categories);
+
+/**
+ * remove_domain_list - Remove every domain of a serialized list
+ * @each: Iterator understanding the format of @list
+ * @list: Serialized domain list
+ * @len: Length of @list
+ * @profiles: Profiles to unblock the domains for on the custom list,
+ *            PROFILES_ALL to take them off it, 0 to leave it
+ * @categories: Other lists to take the domains off, BIT(CATEGORY_*)
+ *
+ * Removes from the live generation under a single acquisition of
+ * __cache_lock. Entries are freed after a grace period without
+ * blocking the caller.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ *
+ * Return: Number of domains removed on success, negative error code on failure
+ */
+int remove_domain_list(domain_list_iter each, const char *list, size_t len, u32 profiles,
+                       u8 categories);
+
+/**
+ * load_domain_image - Replace the blocklist with a precompiled image
+ * @data: Image bytes, kvmalloc()ed, consumed on success and failure
+ * @size: Number of bytes at @data
+ *
+ * The image is validated (see image_parse()) and becomes the base of a
+ * new generation as is, without copying or allocating per entry. The
+ * image is never written: later adds go to the generation's hash table,
+ * and so do removals of image names, as tombstones that shadow them.
+ * The list version becomes the one stored in the image.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: Number of domains in the image on success, negative error code on failure
+ */
+int load_domain_image(void *data, size_t size);
+
+/**
+ * get_list_version - Read the server list version the cache matches
+ * @epoch: Filled with the server database epoch, 0 if unknown
+ * @version: Filled with the last change applied within @epoch
+ *
+ * Lets a reconnecting server send only the changes after @version.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ */
+void get_list_version(u32 *epoch, u64 *version);
+
+/**
+ * set_list_version - Record the server list version the cache now matches
+ * @epoch: Server database epoch
+ * @version: Last change applied
+ *
+ * Sent by the server after a batch of changes. Publishing a new
+ * generation resets the version to unknown until this is called again,
+ * except for an image, whose version is published with it.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ */
+void set_list_version(u32 epoch, u64 version);
+
+/**
+ * set_enabled_categories - Choose which lists block
+ * @categories: BIT(CATEGORY_*) of the lists to enforce
+ *
+ * Takes effect with the next lookup, no entry is touched. The mask
+ * survives bulk loads, it starts as CATEGORIES_DEFAULT.
+ *
+ * Context: Any context
+ */
+void set_enabled_categories(u8 categories);
+
+/**
+ * set_filter_paused - Stop or restart filtering without touching the lists
+ * @paused: true to let every packet through
+ *
+ * While paused filter_active is off, lists and overlays keep being
+ * edited and apply again on resume. Starts out unpaused.
+ *
+ * Context: Process context only (may sleep)
+ */
+void set_filter_paused(bool paused);
+
+/**
+ * watch_filter_active - Be told when filter_active flips
+ * @fn: Called with the new state and __cache_lock held, NULL to stop
+ *
+ * @fn must not take __cache_lock; anything heavier than queueing work
+ * belongs in that work.
+ *
+ * Context: Process context only (may sleep on __cache_lock)
+ */
+void watch_filter_active(void (*fn)(bool active));
+
+/**
+ * cache_for_each_hit - Walk the shared lists with each name's hit count
+ * @fn: Called once per name on some list, must not sleep
+ * @ctx: Passed to @fn
+ *
+ * Hits are the lookups a name blocked since its generation was
+ * published. An image name changed since then is visited once, with
+ * the hits of its slot and its entry, a removed one not at all.
+ * Namespace overlays are not walked. @domain is only valid during the
+ * call.
+ *
+ * The walk holds a reference on the generation, not __cache_lock, so
+ * list changes go on during it. A name changed meanwhile may be seen
+ * either way, and a table resize may visit an entry twice.
+ *
+ * Context: Process context only (reschedules between batches)
+ *
+ * Return: 0 on success, -ENOMEM if the image's slot map could not be allocated
  */
-int parse_domains(const char *buffer);
+int cache_for_each_hit(void (*fn)(const char *domain, size_t len, u32 hits, void *ctx),
+                       void *ctx);
 
 #endif /* CACHE_H */ 
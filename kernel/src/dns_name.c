@@ -0,0 +1,119 @@
+#include <linux/ctype.h>
+#include "dns_name.h"
+
+static char *local_suffixes = "home,local";
+module_param(local_suffixes, charp, 0444);
+MODULE_PARM_DESC(local_suffixes,
+                 "Comma-separated labels dropped from the end of queried names (default: home,local)");
+
+struct local_suffix {
+    u8 len;
+    char label[DNS_LABEL_MAX];  /* Lower case, not NUL-terminated */
+};
+
+static struct local_suffix suffixes[DNS_LOCAL_SUFFIXES_MAX] __read_mostly;
+static unsigned int nr_suffixes __read_mostly;
+
+static bool is_local_suffix(const char *label, size_t len)
+{
+    unsigned int i;
+
+    for (i = 0; i < nr_suffixes; i++)
+        if (suffixes[i].len == len && !memcmp(suffixes[i].label, label, len))
+            return true;
+    return false;
+}
+
+int parse_dns_name(struct dns_name *name, const unsigned char *src, unsigned int src_len,
+                   u32 seed, u64 image_seed)
+{
+    const unsigned char *end = src + src_len;
+    char *dst = name->domain;
+    struct dns_label *label;
+    unsigned int len = 0, labels = 0;
+
+    while (src < end && *src) {
+        unsigned int step = *src++, left;
+        const unsigned char *from = src;
+        char *to;
+        u64 hash, image_hash, word;
+
+        if ((step & 0xC0) == 0xC0)
+            break;
+        if (step > DNS_LABEL_MAX || step > end - src ||
+            len + (len ? 1 : 0) + step >= MAX_DOMAIN_LENGTH)
+            return -1;
+
+        if (len)
+            dst[len++] = '.';
+
+        /* Stores are whole words, the tail's padding lands where the next label goes */
+        to = dst + len;
+        hash = (u64)seed ^ step;
+        image_hash = image_seed ^ step;
+        for (left = step; left >= 8; left -= 8, from += 8, to += 8) {
+            word = label_word_lower(get_unaligned_le64(from));
+            put_unaligned_le64(word, to);
+            hash = label_hash_step(hash, word);
+            image_hash = label_hash_step(image_hash, word);
+        }
+        if (left) {
+            word = label_word_lower(label_load_tail(from, left));
+            put_unaligned_le64(word, to);
+            hash = label_hash_step(hash, word);
+            image_hash = label_hash_step(image_hash, word);
+        }
+
+        label = &name->labels[labels % DNS_NAME_HASHED_LABELS];
+        label->off = len;
+        label->len = step;
+        label->hash = (u32)hash;
+        label->image_hash = image_hash;
+
+        len += step;
+        src += step;
+        labels++;
+    }
+
+    if (!labels)
+        return -1;
+    name->nr_hashed = labels;
+
+    /* A lone "local" is a name of its own, only a trailing one is a suffix */
+    label = &name->labels[(labels - 1) % DNS_NAME_HASHED_LABELS];
+    if (labels > 1 && is_local_suffix(dst + label->off, label->len)) {
+        len = label->off - 1;
+        labels--;
+    }
+
+    dst[len] = '\0';
+    name->len = len;
+    name->nr_labels = labels;
+    name->image_seed = image_seed;
+    return len;
+}
+
+int init_dns_name(void) {
+    const char *p = local_suffixes ? local_suffixes : "";
+    size_t len, i;
+
+    nr_suffixes = 0;
+    while (*p) {
+        len = strcspn(p, ",");
+        if (len) {
+            if (len > DNS_LABEL_MAX || memchr(p, '.', len) ||
+                nr_suffixes == DNS_LOCAL_SUFFIXES_MAX) {
+                printk(KERN_ERR MODULE_NAME ": Invalid local_suffixes \"%s\"\n", local_suffixes);
+                return -EINVAL;
+            }
+            for (i = 0; i < len; i++)
+                suffixes[nr_suffixes].label[i] = tolower(p[i]);
+            suffixes[nr_suffixes].len = len;
+            nr_suffixes++;
+        }
+        p += len;
+        if (*p)
+            p++;
+    }
+    return 0;
+}
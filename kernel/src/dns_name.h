@@ -0,0 +1,143 @@
+#ifndef DNS_NAME_H
+#define DNS_NAME_H
+
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/module.h>
+#include <linux/unaligned.h>
+#include "utils.h"
+
+/*
+ * Per-label hashing shared by the cache, blocklist images, the XDP
+ * program and the server (server/src/image.py). A label is read as
+ * little-endian 64-bit words, zero-padded at the end, with ASCII
+ * letters folded to lower case, so the same loop that decodes a query
+ * name also hashes it. The hash of a label does not depend on its
+ * parent's, only the cheap chaining step does, which lets a name be
+ * hashed left to right and chained right to left afterwards.
+ */
+#define LABEL_HASH_MUL          0x9e3779b97f4a7c15ULL
+
+/* Labels whose hashes a parsed name keeps, deeper ones are hashed again on lookup */
+#define DNS_NAME_HASHED_LABELS  8
+
+/* Longest label and the most local suffixes the local_suffixes parameter takes */
+#define DNS_LABEL_MAX           63
+#define DNS_LOCAL_SUFFIXES_MAX  4
+
+/* Fold the ASCII capitals of eight bytes to lower case, other bytes are kept */
+static inline u64 label_word_lower(u64 word)
+{
+    u64 ascii = ~word & 0x8080808080808080ULL;
+    u64 low = word & 0x7f7f7f7f7f7f7f7fULL;
+    u64 upper = ascii & (low + 0x3f3f3f3f3f3f3f3fULL) & ~(low + 0x2525252525252525ULL);
+
+    return word | (upper >> 2);
+}
+
+static inline u64 label_hash_step(u64 hash, u64 word)
+{
+    hash = (hash ^ word) * LABEL_HASH_MUL;
+    return hash ^ (hash >> 32);
+}
+
+/* Bytes 0 to @len - 1 of @src as a zero-padded little-endian word, @len < 8 */
+static inline u64 label_load_tail(const unsigned char *src, size_t len)
+{
+    u64 word = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        word |= (u64)src[i] << (i * 8);
+    return word;
+}
+
+/**
+ * dns_label_hash - Seeded hash of one label, case-insensitive
+ * @label: Label bytes, without the dot
+ * @len: Length of @label
+ * @seed: Seed of the table or image the hash is for
+ *
+ * Return: Hash to chain onto the parent's, see image_hash_label()
+ */
+static inline u64 dns_label_hash(const char *label, size_t len, u64 seed)
+{
+    const unsigned char *src = (const unsigned char *)label;
+    u64 hash = seed ^ len;
+
+    for (; len >= 8; src += 8, len -= 8)
+        hash = label_hash_step(hash, label_word_lower(get_unaligned_le64(src)));
+    if (len)
+        hash = label_hash_step(hash, label_word_lower(label_load_tail(src, len)));
+    return hash;
+}
+
+/* One of the rightmost labels of a parsed name */
+struct dns_label {
+    u8 off;                     /* Offset in dns_name.domain */
+    u8 len;
+    u32 hash;                   /* Low bits of dns_label_hash() under the cache seed */
+    u64 image_hash;             /* dns_label_hash() under dns_name.image_seed */
+};
+
+/*
+ * A query name decoded once: lower-cased, local suffix stripped, and
+ * the rightmost labels already hashed for the cache and for the image
+ * that was live when it was parsed. @labels is a ring indexed by label
+ * number modulo DNS_NAME_HASHED_LABELS.
+ */
+struct dns_name {
+    char domain[MAX_DOMAIN_LENGTH + 8];     /* Word stores may run past the name */
+    u16 len;
+    u8 nr_labels;
+    u8 nr_hashed;                       /* Labels @labels was filled with, a stripped suffix too */
+    u64 image_seed;
+    struct dns_label labels[DNS_NAME_HASHED_LABELS];
+};
+
+/**
+ * dns_name_label - Hashed label @i of a parsed name, if still kept
+ * @name: Parsed name
+ * @i: Label number, 0 for the leftmost
+ *
+ * A stripped local suffix took a slot of the ring too, so it counts as
+ * one of the later labels.
+ *
+ * Return: The label, NULL if it was pushed out by DNS_NAME_HASHED_LABELS later ones
+ */
+static inline const struct dns_label *dns_name_label(const struct dns_name *name, unsigned int i)
+{
+    if (i + DNS_NAME_HASHED_LABELS < name->nr_hashed)
+        return NULL;
+    return &name->labels[i % DNS_NAME_HASHED_LABELS];
+}
+
+/**
+ * parse_dns_name - Decode a wire-format name in one pass
+ * @name: Filled on success
+ * @src: Wire-format name
+ * @src_len: Bytes readable at @src
+ * @seed: Cache seed of the label hashes, see parse_query_name()
+ * @image_seed: Seed of the live image, 0 without one
+ *
+ * Each label is bounds-checked, then copied a word at a time while
+ * being lower-cased and hashed under both seeds. A compression pointer
+ * ends the name. A trailing label on the local_suffixes list is dropped
+ * by comparing it as a label, so "printer.local" is looked up as
+ * "printer" while "a.localhost.com" is left alone.
+ *
+ * Context: Any context
+ *
+ * Return: Length of the name, -1 if it is empty, too long or runs past @src_len
+ */
+int parse_dns_name(struct dns_name *name, const unsigned char *src, unsigned int src_len,
+                   u32 seed, u64 image_seed);
+
+/**
+ * init_dns_name - Read the local_suffixes module parameter
+ *
+ * Return: 0 on success, -EINVAL if a suffix is not a single label or there are too many
+ */
+int init_dns_name(void);
+
+#endif /* DNS_NAME_H */
@@ -0,0 +1,79 @@
+#include "events.h"
+#include "genl.h"
+#include "stats.h"
+
+static struct rchan *event_chan;
+
+static struct dentry *create_event_file(const char *filename, struct dentry *parent,
+                                        umode_t mode, struct rchan_buf *buf,
+                                        int *is_global)
+{
+    return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int remove_event_file(struct dentry *dentry)
+{
+    debugfs_remove(dentry);
+    return 0;
+}
+
+/* Drop new events rather than overwrite unread ones */
+static int event_subbuf_start(struct rchan_buf *buf, void *subbuf,
+                              void *prev_subbuf, size_t prev_padding)
+{
+    return !relay_buf_full(buf);
+}
+
+static const struct rchan_callbacks event_callbacks = {
+    .subbuf_start    = event_subbuf_start,
+    .create_buf_file = create_event_file,
+    .remove_buf_file = remove_event_file,
+};
+
+void events_record(u8 verdict, u16 family, const void *client, const char *domain) {
+    struct nf_event event;
+    struct nf_event *slot;
+    size_t len = strnlen(domain, EVENT_NAME_LENGTH);
+
+    event.timestamp = ktime_get_real_ns();
+    memset(event.client, 0, sizeof(event.client));
+    memcpy(event.client, client, family == AF_INET6 ? 16 : 4);
+    event.family = family;
+    event.verdict = verdict;
+    event.name_len = len;
+    memcpy(event.name, domain, len);
+    memset(event.name + len, 0, EVENT_NAME_LENGTH - len);
+
+    genl_send_event(&event);
+
+    if (unlikely(!event_chan))
+        return;
+
+    local_bh_disable();
+    slot = relay_reserve(event_chan, sizeof(*slot));
+    if (slot)
+        memcpy(slot, &event, sizeof(*slot));
+    local_bh_enable();
+}
+
+int init_events(void) {
+    event_chan = relay_open("events", nf_debugfs_dir, EVENT_SUBBUF_SIZE,
+                            EVENT_SUBBUF_COUNT, &event_callbacks, NULL);
+    if (!event_chan) {
+        printk(KERN_ERR MODULE_NAME ": Failed to open event channel\n");
+        return -ENOMEM;
+    }
+
+    printk(KERN_INFO MODULE_NAME ": Event channel initialized\n");
+    return 0;
+}
+
+void cleanup_events(void) {
+    struct rchan *chan = event_chan;
+
+    event_chan = NULL;
+    if (chan) {
+        relay_flush(chan);
+        relay_close(chan);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+#include <linux/bottom_half.h>
+#include <linux/timekeeping.h>
+#include <linux/string.h>
+#include <linux/socket.h>
+#include "utils.h"
+
+#define EVENT_NAME_LENGTH       100
+#define EVENT_SUBBUF_SIZE       (128 * 512)
+#define EVENT_SUBBUF_COUNT      8
+
+/* Event verdicts, matching the server's event reader */
+enum nf_event_verdict {
+    EVENT_NXDOMAIN = 1,     /* Upstream answered NXDOMAIN */
+    EVENT_BLOCKED  = 2,     /* Response rewritten because the domain is blocked */
+};
+
+/*
+ * Fixed-size binary event, 128 bytes. Written straight into the per-CPU
+ * relay buffer and read by the server from <debugfs>/Network_Filter/eventsN.
+ */
+struct nf_event {
+    __u64 timestamp;                /* Wall clock, ns since the epoch */
+    __u8  client[16];               /* Client address, IPv4 uses the first 4 bytes */
+    __u16 family;                   /* AF_INET or AF_INET6 */
+    __u8  verdict;                  /* enum nf_event_verdict */
+    __u8  name_len;                 /* Bytes used in name, no terminator */
+    char  name[EVENT_NAME_LENGTH];  /* Queried domain, truncated if longer */
+} __packed;
+
+static_assert(sizeof(struct nf_event) == 128, "nf_event must stay 128 bytes");
+
+/**
+ * events_record - Append an event to the local CPU's ring
+ * @verdict: enum nf_event_verdict
+ * @family: Address family of @client
+ * @client: Client address, 4 or 16 bytes depending on @family
+ * @domain: Queried domain name
+ *
+ * Lockless: reserves a slot in the per-CPU relay sub-buffer with bottom
+ * halves disabled and copies the record in. Events are dropped while the
+ * reader is behind and the ring is full. The same record is multicast
+ * to netlink listeners, if any.
+ *
+ * Context: Any context except hard IRQ
+ */
+void events_record(u8 verdict, u16 family, const void *client, const char *domain);
+
+/**
+ * init_events - Open the relay channel under the module debugfs directory
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int init_events(void);
+
+/**
+ * cleanup_events - Flush and close the relay channel
+ */
+void cleanup_events(void);
+
+#endif /* EVENTS_H */
@@ -0,0 +1,451 @@
+#include "genl.h"
+
+static struct genl_family nf_genl_family;
+
+enum nf_genl_mcgrp {
+    NF_MCGRP_EVENTS,
+};
+
+static const struct nla_policy nf_genl_policy[NF_ATTR_MAX + 1] = {
+    [NF_ATTR_DOMAINS]      = { .type = NLA_BINARY },
+    [NF_ATTR_LOAD_FIRST]   = { .type = NLA_FLAG },
+    [NF_ATTR_LOAD_LAST]    = { .type = NLA_FLAG },
+    [NF_ATTR_LIST_EPOCH]   = { .type = NLA_U32 },
+    [NF_ATTR_LIST_VERSION] = { .type = NLA_U64 },
+    [NF_ATTR_PROFILE_RULES] = { .type = NLA_BINARY,
+                                .len = PROFILE_RULES_MAX * sizeof(struct nf_profile_rule) },
+    [NF_ATTR_PROFILE]      = NLA_POLICY_MAX(NLA_U8, PROFILE_MAX - 1),
+    [NF_ATTR_CATEGORIES]   = { .type = NLA_U8 },
+    [NF_ATTR_CATEGORY]     = NLA_POLICY_MAX(NLA_U8, CATEGORY_MAX - 1),
+    [NF_ATTR_PAUSED]       = NLA_POLICY_MAX(NLA_U8, 1),
+};
+
+/* frame_for_each_domain() callbacks for namespaces other than init_net */
+static int overlay_add_cb(const char *domain, size_t len, void *ctx)
+{
+    int ret = overlay_add_domain(ctx, domain, len);
+
+    return ret == -ENOMEM ? ret : 0;
+}
+
+static int overlay_remove_cb(const char *domain, size_t len, void *ctx)
+{
+    overlay_remove_domain(ctx, domain, len);
+    return 0;
+}
+
+/*
+ * Namespaces other than init_net only edit their own overlay, the
+ * shared list belongs to the host. Profiles and categories are host
+ * policy too. Profiles only apply to the custom list.
+ */
+static int nf_genl_edit(struct genl_info *info, bool add)
+{
+    const struct nlattr *attr = info->attrs[NF_ATTR_DOMAINS];
+    struct net *net = genl_info_net(info);
+    u32 profiles = PROFILES_ALL;
+    u8 categories = 0;
+    int ret;
+
+    if (!attr)
+        return -EINVAL;
+
+    if ((info->attrs[NF_ATTR_PROFILE] || info->attrs[NF_ATTR_CATEGORY]) &&
+        !net_eq(net, &init_net))
+        return -EPERM;
+
+    if (info->attrs[NF_ATTR_PROFILE])
+        profiles = BIT(nla_get_u8(info->attrs[NF_ATTR_PROFILE]));
+
+    if (info->attrs[NF_ATTR_CATEGORY] &&
+        nla_get_u8(info->attrs[NF_ATTR_CATEGORY]) != CATEGORY_CUSTOM) {
+        if (info->attrs[NF_ATTR_PROFILE])
+            return -EINVAL;
+        profiles = 0;
+        categories = BIT(nla_get_u8(info->attrs[NF_ATTR_CATEGORY]));
+    }
+
+    if (net_eq(net, &init_net)) {
+        ret = add ? add_domain_list(frame_for_each_domain, nla_data(attr), nla_len(attr),
+                                    profiles, categories)
+                  : remove_domain_list(frame_for_each_domain, nla_data(attr), nla_len(attr),
+                                       profiles, categories);
+    } else {
+        ret = frame_for_each_domain(nla_data(attr), nla_len(attr),
+                                    add ? overlay_add_cb : overlay_remove_cb,
+                                    &filter_net(net)->overlay);
+    }
+    return ret < 0 ? ret : 0;
+}
+
+static int nf_genl_add(struct sk_buff *skb, struct genl_info *info)
+{
+    return nf_genl_edit(info, true);
+}
+
+static int nf_genl_remove(struct sk_buff *skb, struct genl_info *info)
+{
+    return nf_genl_edit(info, false);
+}
+
+/*
+ * A list larger than one netlink message arrives as FIRST ... LAST
+ * chunks. doit handlers are serialized by genl_mutex (no parallel_ops),
+ * which also serializes access to the stage.
+ */
+static struct domain_stage *nf_genl_stage;
+
+static int nf_genl_load(struct sk_buff *skb, struct genl_info *info)
+{
+    const struct nlattr *attr = info->attrs[NF_ATTR_DOMAINS];
+    struct domain_stage *stage;
+    int ret;
+
+    if (!net_eq(genl_info_net(info), &init_net))
+        return -EPERM;
+
+    if (info->attrs[NF_ATTR_LOAD_FIRST]) {
+        free_domain_stage(nf_genl_stage);
+        nf_genl_stage = alloc_domain_stage();
+        if (!nf_genl_stage)
+            return -ENOMEM;
+    }
+
+    if (!nf_genl_stage)
+        return -ENOENT;
+
+    if (attr) {
+        ret = domain_stage_add_frame(nf_genl_stage, nla_data(attr), nla_len(attr));
+        if (ret < 0) {
+            free_domain_stage(nf_genl_stage);
+            nf_genl_stage = NULL;
+            return ret;
+        }
+    }
+
+    if (info->attrs[NF_ATTR_LOAD_LAST]) {
+        stage = nf_genl_stage;
+        nf_genl_stage = NULL;
+        ret = commit_domain_stage(stage);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static int nf_genl_get_stats(struct sk_buff *skb, struct genl_info *info)
+{
+    struct nf_stats sum;
+    struct sk_buff *msg;
+    struct nlattr *nest;
+    void *hdr;
+    int i;
+
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if (!msg)
+        return -ENOMEM;
+
+    hdr = genlmsg_put_reply(msg, info, &nf_genl_family, 0, NF_CMD_GET_STATS);
+    if (!hdr)
+        goto fail;
+
+    nest = nla_nest_start(msg, NF_ATTR_STATS);
+    if (!nest)
+        goto fail;
+
+    stats_read(&sum);
+    for (i = 0; i < __STAT_MAX; i++) {
+        if (nla_put_u64_64bit(msg, i + 1, sum.items[i], NF_ATTR_PAD))
+            goto fail;
+    }
+    nla_nest_end(msg, nest);
+
+    genlmsg_end(msg, hdr);
+    return genlmsg_reply(msg, info);
+
+fail:
+    nlmsg_free(msg);
+    return -EMSGSIZE;
+}
+
+static int nf_genl_get_version(struct sk_buff *skb, struct genl_info *info)
+{
+    struct sk_buff *msg;
+    u64 version;
+    u32 epoch;
+    void *hdr;
+
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+    if (!msg)
+        return -ENOMEM;
+
+    hdr = genlmsg_put_reply(msg, info, &nf_genl_family, 0, NF_CMD_GET_VERSION);
+    if (!hdr)
+        goto fail;
+
+    get_list_version(&epoch, &version);
+    if (nla_put_u32(msg, NF_ATTR_LIST_EPOCH, epoch) ||
+        nla_put_u64_64bit(msg, NF_ATTR_LIST_VERSION, version, NF_ATTR_PAD))
+        goto fail;
+
+    genlmsg_end(msg, hdr);
+    return genlmsg_reply(msg, info);
+
+fail:
+    nlmsg_free(msg);
+    return -EMSGSIZE;
+}
+
+static int nf_genl_set_version(struct sk_buff *skb, struct genl_info *info)
+{
+    if (!net_eq(genl_info_net(info), &init_net))
+        return -EPERM;
+
+    if (!info->attrs[NF_ATTR_LIST_EPOCH] || !info->attrs[NF_ATTR_LIST_VERSION])
+        return -EINVAL;
+
+    set_list_version(nla_get_u32(info->attrs[NF_ATTR_LIST_EPOCH]),
+                     nla_get_u64(info->attrs[NF_ATTR_LIST_VERSION]));
+    return 0;
+}
+
+static int nf_genl_set_profiles(struct sk_buff *skb, struct genl_info *info)
+{
+    const struct nlattr *attr = info->attrs[NF_ATTR_PROFILE_RULES];
+
+    if (!net_eq(genl_info_net(info), &init_net))
+        return -EPERM;
+
+    if (!attr)
+        return set_profile_rules(NULL, 0);
+    if (nla_len(attr) % sizeof(struct nf_profile_rule))
+        return -EINVAL;
+    return set_profile_rules(nla_data(attr), nla_len(attr) / sizeof(struct nf_profile_rule));
+}
+
+static int nf_genl_set_categories(struct sk_buff *skb, struct genl_info *info)
+{
+    if (!net_eq(genl_info_net(info), &init_net))
+        return -EPERM;
+    if (!info->attrs[NF_ATTR_CATEGORIES])
+        return -EINVAL;
+
+    set_enabled_categories(nla_get_u8(info->attrs[NF_ATTR_CATEGORIES]));
+    return 0;
+}
+
+static int nf_genl_set_paused(struct sk_buff *skb, struct genl_info *info)
+{
+    if (!net_eq(genl_info_net(info), &init_net))
+        return -EPERM;
+    if (!info->attrs[NF_ATTR_PAUSED])
+        return -EINVAL;
+
+    set_filter_paused(nla_get_u8(info->attrs[NF_ATTR_PAUSED]));
+    return 0;
+}
+
+/*
+ * The hit report, hottest names first, as many records per message as
+ * fit. Every message repeats the totals. A report rebuilt between two
+ * messages marks the dump NLM_F_DUMP_INTR, the reader starts over.
+ * cb->args[0] is the next record, args[1] set once a message went out.
+ */
+static int nf_genl_dump_hits(struct sk_buff *skb, struct netlink_callback *cb)
+{
+    const struct hit_report *report;
+    const struct hit_record *record;
+    struct nlattr *domains, *counts;
+    u32 pos = cb->args[0];
+    u32 i, n, bytes = 0;
+    int room, ret = 0;
+    char *name;
+    u32 *hits;
+    void *hdr;
+
+    rcu_read_lock();
+    report = hit_report_get();
+    if (!report)
+        goto out;
+    /* Also checked on the closing NLMSG_DONE */
+    cb->seq = report->generation;
+    if (cb->args[1] && pos >= report->nr_records)
+        goto out;
+
+    room = skb_tailroom(skb) - nlmsg_total_size(GENL_HDRLEN + 2 * nla_total_size(sizeof(u32)));
+    for (n = 0; pos + n < report->nr_records; n++) {
+        record = &report->records[pos + n];
+        if (nla_total_size(bytes + 1 + record->len) +
+            nla_total_size((n + 1) * sizeof(u32)) > room)
+            break;
+        bytes += 1 + record->len;
+    }
+
+    hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                      &nf_genl_family, NLM_F_MULTI, NF_CMD_GET_HITS);
+    if (!hdr) {
+        ret = -EMSGSIZE;
+        goto out;
+    }
+    genl_dump_check_consistent(cb, hdr);
+
+    if (nla_put_u32(skb, NF_ATTR_LISTED, report->nr_domains) ||
+        nla_put_u32(skb, NF_ATTR_COLD, report->nr_cold) ||
+        !(domains = nla_reserve(skb, NF_ATTR_DOMAINS, bytes)) ||
+        !(counts = nla_reserve(skb, NF_ATTR_HIT_COUNTS, n * sizeof(u32)))) {
+        genlmsg_cancel(skb, hdr);
+        ret = -EMSGSIZE;
+        goto out;
+    }
+
+    name = nla_data(domains);
+    hits = nla_data(counts);
+    for (i = 0; i < n; i++) {
+        record = &report->records[pos + i];
+        *name++ = record->len;
+        memcpy(name, record->domain, record->len);
+        name += record->len;
+        hits[i] = record->hits;
+    }
+    genlmsg_end(skb, hdr);
+
+    cb->args[0] = pos + n;
+    cb->args[1] = 1;
+    ret = skb->len;
+out:
+    rcu_read_unlock();
+    return ret;
+}
+
+/*
+ * Every command is timed for trace_nf_control(). Like the stage, the
+ * start needs no lock while doit handlers are serialized.
+ */
+static u64 nf_genl_start;
+
+static int nf_genl_pre_doit(const struct genl_split_ops *ops, struct sk_buff *skb,
+                            struct genl_info *info)
+{
+    nf_genl_start = nf_control_clock();
+    return 0;
+}
+
+static void nf_genl_post_doit(const struct genl_split_ops *ops, struct sk_buff *skb,
+                              struct genl_info *info)
+{
+    trace_nf_control(NF_CONTROL_GENL, info->genlhdr->cmd, genlmsg_len(info->genlhdr), nf_genl_start);
+}
+
+static const struct genl_small_ops nf_genl_ops[] = {
+    {
+        .cmd   = NF_CMD_ADD_DOMAINS,
+        .doit  = nf_genl_add,
+        .flags = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_REMOVE_DOMAINS,
+        .doit  = nf_genl_remove,
+        .flags = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_LOAD_DOMAINS,
+        .doit  = nf_genl_load,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_GET_STATS,
+        .doit  = nf_genl_get_stats,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_GET_VERSION,
+        .doit  = nf_genl_get_version,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_SET_VERSION,
+        .doit  = nf_genl_set_version,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_SET_PROFILES,
+        .doit  = nf_genl_set_profiles,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_SET_CATEGORIES,
+        .doit  = nf_genl_set_categories,
+        .flags = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd    = NF_CMD_GET_HITS,
+        .dumpit = nf_genl_dump_hits,
+        .flags  = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd   = NF_CMD_SET_PAUSED,
+        .doit  = nf_genl_set_paused,
+        .flags = GENL_ADMIN_PERM,
+    },
+};
+
+/* Events carry client addresses, so only admins may listen */
+static const struct genl_multicast_group nf_genl_mcgrps[] = {
+    [NF_MCGRP_EVENTS] = { .name = NF_GENL_MCGRP_EVENTS, .flags = GENL_MCAST_CAP_NET_ADMIN },
+};
+
+static struct genl_family nf_genl_family __ro_after_init = {
+    .name          = MODULE_NAME,
+    .version       = NF_GENL_VERSION,
+    .maxattr       = NF_ATTR_MAX,
+    .policy        = nf_genl_policy,
+    .netnsok       = true,
+    .module        = THIS_MODULE,
+    .small_ops     = nf_genl_ops,
+    .n_small_ops   = ARRAY_SIZE(nf_genl_ops),
+    .resv_start_op = NF_CMD_MAX + 1,
+    .pre_doit      = nf_genl_pre_doit,
+    .post_doit     = nf_genl_post_doit,
+    .mcgrps        = nf_genl_mcgrps,
+    .n_mcgrps      = ARRAY_SIZE(nf_genl_mcgrps),
+};
+
+void genl_send_event(const struct nf_event *event) {
+    struct sk_buff *msg;
+    void *hdr;
+
+    if (!genl_has_listeners(&nf_genl_family, &init_net, NF_MCGRP_EVENTS))
+        return;
+
+    msg = genlmsg_new(nla_total_size(sizeof(*event)), GFP_ATOMIC);
+    if (!msg)
+        return;
+
+    hdr = genlmsg_put(msg, 0, 0, &nf_genl_family, 0, NF_CMD_EVENT);
+    if (!hdr || nla_put(msg, NF_ATTR_EVENT, sizeof(*event), event)) {
+        nlmsg_free(msg);
+        return;
+    }
+
+    genlmsg_end(msg, hdr);
+    genlmsg_multicast(&nf_genl_family, msg, 0, NF_MCGRP_EVENTS, GFP_ATOMIC);
+}
+
+int init_genl(void) {
+    int ret = genl_register_family(&nf_genl_family);
+
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to register netlink family: %d\n", ret);
+        return ret;
+    }
+
+    printk(KERN_INFO MODULE_NAME ": Netlink family registered\n");
+    return 0;
+}
+
+void cleanup_genl(void) {
+    genl_unregister_family(&nf_genl_family);
+    free_domain_stage(nf_genl_stage);
+    nf_genl_stage = NULL;
+    printk(KERN_INFO MODULE_NAME ": Netlink family unregistered\n");
+}
@@ -0,0 +1,86 @@
+#ifndef GENL_H
+#define GENL_H
+
+#include <net/genetlink.h>
+#include <net/netlink.h>
+#include <net/net_namespace.h>
+#include "utils.h"
+#include "cache.h"
+#include "netns.h"
+#include "stats.h"
+#include "events.h"
+#include "profiles.h"
+#include "hits.h"
+
+/*
+ * Generic netlink control channel, family MODULE_NAME. Layout matches
+ * the server's genl_client.py. Domain lists travel as NF_ATTR_DOMAINS
+ * in the record format of binary frames (see frame_for_each_domain()).
+ */
+#define NF_GENL_VERSION         1
+#define NF_GENL_MCGRP_EVENTS    "events"
+
+enum nf_genl_cmd {
+    NF_CMD_UNSPEC,
+    NF_CMD_ADD_DOMAINS,     /* Add records, to the overlay outside init_net, NF_ATTR_PROFILE/CATEGORY optional */
+    NF_CMD_REMOVE_DOMAINS,  /* Remove records, from the overlay outside init_net, NF_ATTR_PROFILE/CATEGORY optional */
+    NF_CMD_LOAD_DOMAINS,    /* Chunk of a full list, NF_ATTR_LOAD_FIRST/LAST frame it */
+    NF_CMD_GET_STATS,       /* Reply carries NF_ATTR_STATS */
+    NF_CMD_EVENT,           /* Multicast on NF_GENL_MCGRP_EVENTS, carries NF_ATTR_EVENT */
+    NF_CMD_GET_VERSION,     /* Reply carries NF_ATTR_LIST_EPOCH/VERSION */
+    NF_CMD_SET_VERSION,     /* Record NF_ATTR_LIST_EPOCH/VERSION after a batch of changes */
+    NF_CMD_SET_PROFILES,    /* Replace the client rules with NF_ATTR_PROFILE_RULES */
+    NF_CMD_SET_CATEGORIES,  /* Enforce the lists in NF_ATTR_CATEGORIES */
+    NF_CMD_GET_HITS,        /* Dump of the hit report, NF_ATTR_DOMAINS/HIT_COUNTS/LISTED/COLD */
+    NF_CMD_SET_PAUSED,      /* Pause or resume filtering with NF_ATTR_PAUSED */
+    __NF_CMD_MAX
+};
+#define NF_CMD_MAX (__NF_CMD_MAX - 1)
+
+enum nf_genl_attr {
+    NF_ATTR_UNSPEC,
+    NF_ATTR_DOMAINS,        /* binary: packed length-prefixed records */
+    NF_ATTR_LOAD_FIRST,     /* flag: first chunk of a load */
+    NF_ATTR_LOAD_LAST,      /* flag: last chunk, publish the staged list */
+    NF_ATTR_STATS,          /* nested: u64 per enum nf_stat_item, type = item + 1 */
+    NF_ATTR_EVENT,          /* binary: struct nf_event */
+    NF_ATTR_PAD,
+    NF_ATTR_LIST_EPOCH,     /* u32: server database epoch */
+    NF_ATTR_LIST_VERSION,   /* u64: last change applied, see get_list_version() */
+    NF_ATTR_PROFILE_RULES,  /* binary: struct nf_profile_rule array, absent for none */
+    NF_ATTR_PROFILE,        /* u8: edit one profile's entries instead of the shared list */
+    NF_ATTR_CATEGORIES,     /* u8: BIT(CATEGORY_*) of the lists to enforce */
+    NF_ATTR_CATEGORY,       /* u8: CATEGORY_* list to edit, the custom list if absent */
+    NF_ATTR_HIT_COUNTS,     /* binary: u32 per record of NF_ATTR_DOMAINS, in order */
+    NF_ATTR_LISTED,         /* u32: names on the shared lists */
+    NF_ATTR_COLD,           /* u32: names without a hit */
+    NF_ATTR_PAUSED,         /* u8: 1 pauses filtering, 0 resumes it */
+    __NF_ATTR_MAX
+};
+#define NF_ATTR_MAX (__NF_ATTR_MAX - 1)
+
+/**
+ * genl_send_event - Multicast an event to subscribed listeners
+ * @event: Filled event record
+ *
+ * Costs one genl_has_listeners() check when nobody subscribed.
+ *
+ * Context: Any context except hard IRQ
+ */
+void genl_send_event(const struct nf_event *event);
+
+/**
+ * init_genl - Register the generic netlink family
+ *
+ * Context: Process context only
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int init_genl(void);
+
+/**
+ * cleanup_genl - Unregister the generic netlink family
+ */
+void cleanup_genl(void);
+
+#endif /* GENL_H */
@@ -0,0 +1,137 @@
+#include "hits.h"
+
+static struct hit_report __rcu *hit_report;
+static u32 hit_generation;
+static struct dentry *hits_file;
+
+static void hit_report_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(hit_work, hit_report_work);
+
+const struct hit_report *hit_report_get(void) {
+    return rcu_dereference(hit_report);
+}
+
+/* Restore the min-heap of kept records from @i down, after @i changed */
+static void hit_heap_down(struct hit_record *heap, u32 n, u32 i)
+{
+    for (;;) {
+        u32 child = 2 * i + 1;
+
+        if (child >= n)
+            return;
+        if (child + 1 < n && heap[child + 1].hits < heap[child].hits)
+            child++;
+        if (heap[i].hits <= heap[child].hits)
+            return;
+        swap(heap[i], heap[child]);
+        i = child;
+    }
+}
+
+static void hit_heap_up(struct hit_record *heap, u32 i)
+{
+    while (i && heap[(i - 1) / 2].hits > heap[i].hits) {
+        swap(heap[i], heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+/* cache_for_each_hit() callback, keeps the HIT_REPORT_MAX hottest names */
+static void collect_hit(const char *domain, size_t len, u32 hits, void *ctx)
+{
+    struct hit_report *report = ctx;
+    struct hit_record *record;
+    bool full = report->nr_records == HIT_REPORT_MAX;
+
+    report->nr_domains++;
+    if (!hits) {
+        report->nr_cold++;
+        return;
+    }
+
+    /* The coldest kept name sits at the root */
+    if (full && hits <= report->records[0].hits)
+        return;
+    record = full ? &report->records[0] : &report->records[report->nr_records++];
+    record->hits = hits;
+    record->len = len;
+    memcpy(record->domain, domain, len);
+
+    if (full)
+        hit_heap_down(report->records, report->nr_records, 0);
+    else
+        hit_heap_up(report->records, report->nr_records - 1);
+}
+
+static int hit_record_cmp(const void *a, const void *b)
+{
+    const struct hit_record *x = a, *y = b;
+
+    return x->hits < y->hits ? 1 : x->hits > y->hits ? -1 : 0;
+}
+
+/* Only this work writes hit_report, it never runs concurrently with itself */
+static void hit_report_work(struct work_struct *work)
+{
+    struct hit_report *report, *old;
+
+    report = kvmalloc(struct_size(report, records, HIT_REPORT_MAX), GFP_KERNEL);
+    if (!report)
+        goto out;
+
+    report->nr_domains = 0;
+    report->nr_cold = 0;
+    report->nr_records = 0;
+    if (cache_for_each_hit(collect_hit, report) < 0) {
+        /* Readers keep the previous report until the next interval */
+        kvfree(report);
+        goto out;
+    }
+    report->generation = ++hit_generation;
+    sort(report->records, report->nr_records, sizeof(*report->records),
+         hit_record_cmp, NULL);
+
+    old = rcu_replace_pointer(hit_report, report, true);
+    if (old)
+        kvfree_rcu(old, rcu);
+
+out:
+    schedule_delayed_work(&hit_work, HIT_REPORT_INTERVAL);
+}
+
+static int hits_show(struct seq_file *m, void *v)
+{
+    const struct hit_report *report;
+    u32 i;
+
+    rcu_read_lock();
+    report = hit_report_get();
+    if (report) {
+        seq_printf(m, "listed %u cold %u\n", report->nr_domains, report->nr_cold);
+        for (i = 0; i < report->nr_records; i++)
+            seq_printf(m, "%u %.*s\n", report->records[i].hits,
+                       report->records[i].len, report->records[i].domain);
+    }
+    rcu_read_unlock();
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hits);
+
+int init_hits(void) {
+    hits_file = debugfs_create_file("hits", 0444, nf_debugfs_dir, NULL, &hits_fops);
+    schedule_delayed_work(&hit_work, 0);
+
+    printk(KERN_INFO MODULE_NAME ": Hit reports scheduled every %ds\n", HIT_REPORT_INTERVAL / HZ);
+    return 0;
+}
+
+void cleanup_hits(void) {
+    struct hit_report *report;
+
+    debugfs_remove(hits_file);
+    cancel_delayed_work_sync(&hit_work);
+
+    report = rcu_replace_pointer(hit_report, NULL, true);
+    if (report)
+        kvfree_rcu(report, rcu);
+}
@@ -0,0 +1,65 @@
+#ifndef HITS_H
+#define HITS_H
+
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include "utils.h"
+#include "cache.h"
+#include "stats.h"
+
+/*
+ * Hit report, the names that blocked the most lookups. A worker rebuilds
+ * it from the cache's hit counters every HIT_REPORT_INTERVAL, so ranking
+ * and copying names stay off the packet path. Read through the
+ * NF_CMD_GET_HITS dump and <debugfs>/Network_Filter/hits.
+ */
+#define HIT_REPORT_MAX          1024
+#define HIT_REPORT_INTERVAL     (30 * HZ)
+
+struct hit_record {
+    u32 hits;
+    u8 len;
+    char domain[MAX_DOMAIN_LENGTH];     /* Not NUL-terminated */
+};
+
+struct hit_report {
+    struct rcu_head rcu;
+    u32 generation;                     /* Differs between consecutive reports */
+    u32 nr_domains;                     /* Names on the shared lists */
+    u32 nr_cold;                        /* Names without a hit */
+    u32 nr_records;                     /* Hottest names kept, at most HIT_REPORT_MAX */
+    struct hit_record records[];        /* Most hits first */
+};
+
+/**
+ * hit_report_get - The latest hit report
+ *
+ * A report lists every name with a hit unless more than HIT_REPORT_MAX
+ * have one, nr_domains - nr_cold tells.
+ *
+ * Context: Caller holds the RCU read lock for as long as it uses the report
+ *
+ * Return: Report, NULL until the first one is built
+ */
+const struct hit_report *hit_report_get(void);
+
+/**
+ * init_hits - Build the first hit report and schedule the rebuilds
+ *
+ * Context: Process context only, after init_cache()
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int init_hits(void);
+
+/**
+ * cleanup_hits - Stop the rebuilds and free the report
+ *
+ * Context: Process context only, once nothing calls hit_report_get()
+ */
+void cleanup_hits(void);
+
+#endif /* HITS_H */
@@ -0,0 +1,221 @@
+#include <linux/device.h>
+#include <linux/firmware.h>
+#include <linux/crc32.h>
+#include <linux/mutex.h>
+#include <linux/sysfs.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include "image.h"
+#include "cache.h"
+
+static char *boot_image;
+module_param(boot_image, charp, 0444);
+MODULE_PARM_DESC(boot_image,
+                 "Blocklist image under /lib/firmware to load at start, e.g. " IMAGE_FIRMWARE_NAME " (default: none)");
+
+static struct device *image_dev;
+
+/* Image being written through sysfs, assembled until total_len bytes arrived */
+static DEFINE_MUTEX(image_lock);
+static char *image_buf;
+static size_t image_len;
+static size_t image_expected;
+
+int image_parse(struct blocklist_image *image, void *data, size_t size) {
+    const struct image_header *header = data;
+    u32 slots, buckets, count, pool_len, used = 0, i;
+    const struct image_slot *slot;
+    size_t pilots_len;
+
+    if (size < sizeof(*header) ||
+        le32_to_cpu(header->magic) != IMAGE_MAGIC ||
+        le16_to_cpu(header->version) != IMAGE_FORMAT_VERSION ||
+        le16_to_cpu(header->header_len) != sizeof(*header) ||
+        le64_to_cpu(header->total_len) != size)
+        return -EINVAL;
+
+    slots = le32_to_cpu(header->slots);
+    buckets = le32_to_cpu(header->buckets);
+    count = le32_to_cpu(header->count);
+    pool_len = le32_to_cpu(header->pool_len);
+    pilots_len = ALIGN((size_t)buckets * sizeof(__le16), 8);
+
+    if (!slots || !buckets || count > slots ||
+        size != sizeof(*header) + pilots_len + (u64)slots * sizeof(struct image_slot) + pool_len)
+        return -EINVAL;
+
+    if (~crc32_le(~0, (const u8 *)data + sizeof(*header), size - sizeof(*header)) !=
+        le32_to_cpu(header->crc))
+        return -EBADMSG;
+
+    image->pilots = (const __le16 *)((u8 *)data + sizeof(*header));
+    image->slots = (const struct image_slot *)((u8 *)image->pilots + pilots_len);
+    image->pool = (const char *)(image->slots + slots);
+
+    for (i = 0, slot = image->slots; i < slots; i++, slot++) {
+        if (!slot->len)
+            continue;
+        if (slot->len >= MAX_DOMAIN_LENGTH || !slot->categories ||
+            slot->len > pool_len || le32_to_cpu(slot->offset) > pool_len - slot->len)
+            return -EINVAL;
+        used++;
+    }
+    if (used != count)
+        return -EINVAL;
+
+    image->data = data;
+    image->size = size;
+    image->nr_slots = slots;
+    image->nr_buckets = buckets;
+    image->seed = le64_to_cpu(header->seed);
+    return 0;
+}
+
+u64 image_domain_hash(const struct blocklist_image *image, const char *name, size_t len) {
+    const char *end = name + len;
+    const char *start;
+    u64 hash = 0;
+
+    for (;;) {
+        start = end;
+        while (start > name && start[-1] != '.')
+            start--;
+        hash = image_hash_label(dns_label_hash(start, end - start, image->seed), hash);
+        if (start == name)
+            return hash;
+        end = start - 1;
+    }
+}
+
+/* Drop a partially written image */
+static void reset_image_buffer(void)
+{
+    kvfree(image_buf);
+    image_buf = NULL;
+    image_len = 0;
+    image_expected = 0;
+}
+
+/*
+ * Writes must be sequential and start at offset 0 with at least the
+ * header, which tells how long the image is. The image is loaded by the
+ * write that completes it, a write at offset 0 abandons an unfinished one.
+ */
+static ssize_t image_write(struct file *file, struct kobject *kobj,
+                           const struct bin_attribute *attr, char *buf,
+                           loff_t pos, size_t count)
+{
+    const struct image_header *header = (const void *)buf;
+    ssize_t ret = count;
+
+    mutex_lock(&image_lock);
+
+    if (pos == 0) {
+        reset_image_buffer();
+
+        if (count < sizeof(*header) || le32_to_cpu(header->magic) != IMAGE_MAGIC ||
+            le64_to_cpu(header->total_len) > IMAGE_MAX_SIZE ||
+            le64_to_cpu(header->total_len) < sizeof(*header)) {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        image_expected = le64_to_cpu(header->total_len);
+        image_buf = kvmalloc(image_expected, GFP_KERNEL);
+        if (!image_buf) {
+            image_expected = 0;
+            ret = -ENOMEM;
+            goto out;
+        }
+    } else if (!image_buf || pos != image_len) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (count > image_expected - image_len) {
+        reset_image_buffer();
+        ret = -EFBIG;
+        goto out;
+    }
+
+    memcpy(image_buf + image_len, buf, count);
+    image_len += count;
+
+    if (image_len == image_expected) {
+        int err = load_domain_image(image_buf, image_len);
+
+        /* Consumed either way */
+        image_buf = NULL;
+        reset_image_buffer();
+        if (err < 0)
+            ret = err;
+    }
+out:
+    mutex_unlock(&image_lock);
+    return ret;
+}
+
+static const struct bin_attribute image_attr = {
+    .attr  = { .name = "image", .mode = 0200 },
+    .write = image_write,
+};
+
+/* Copy the firmware into a buffer of our own, it outlives the firmware request */
+static void load_boot_image(void)
+{
+    const struct firmware *fw;
+    void *data;
+    int ret;
+
+    ret = request_firmware_direct(&fw, boot_image, image_dev);
+    if (ret < 0) {
+        printk(KERN_WARNING MODULE_NAME ": No boot image %s: %d\n", boot_image, ret);
+        return;
+    }
+
+    data = fw->size <= IMAGE_MAX_SIZE ? kvmalloc(fw->size, GFP_KERNEL) : NULL;
+    if (data) {
+        memcpy(data, fw->data, fw->size);
+        ret = load_domain_image(data, fw->size);
+    } else {
+        ret = -ENOMEM;
+    }
+    release_firmware(fw);
+
+    if (ret < 0)
+        printk(KERN_WARNING MODULE_NAME ": Failed to load boot image %s: %d\n", boot_image, ret);
+}
+
+int init_image(void) {
+    int ret;
+
+    image_dev = root_device_register(MODULE_NAME);
+    if (IS_ERR(image_dev)) {
+        ret = PTR_ERR(image_dev);
+        image_dev = NULL;
+        return ret;
+    }
+
+    ret = device_create_bin_file(image_dev, &image_attr);
+    if (ret < 0) {
+        root_device_unregister(image_dev);
+        image_dev = NULL;
+        return ret;
+    }
+
+    if (boot_image && *boot_image)
+        load_boot_image();
+
+    printk(KERN_INFO MODULE_NAME ": Image loading initialized\n");
+    return 0;
+}
+
+void cleanup_image(void) {
+    device_remove_bin_file(image_dev, &image_attr);
+    root_device_unregister(image_dev);
+    image_dev = NULL;
+
+    mutex_lock(&image_lock);
+    reset_image_buffer();
+    mutex_unlock(&image_lock);
+}
@@ -0,0 +1,191 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/compiler.h>
+#include <asm/byteorder.h>
+#include "utils.h"
+#include "dns_name.h"
+
+/*
+ * Precompiled blocklist image produced by the server's image.py. It is
+ * the immutable base tier of a generation, used in place after
+ * validation: one buffer for the whole list and no allocation per
+ * entry. Little-endian throughout:
+ *
+ *   struct image_header
+ *   __le16 pilots[buckets]             padded to 8 bytes
+ *   struct image_slot[slots]
+ *   char pool[pool_len]                names back to back, no terminators
+ *
+ * The index is a perfect hash in the style of PTHash: a name's hash
+ * picks a bucket, the bucket's pilot picks the name's slot, and no two
+ * names share a slot. Slots are about 3% more than names, which keeps
+ * the pilot search short. A lookup reads one pilot and one slot, the
+ * fingerprint rejects almost every name that is not in the image
+ * before the pool is touched. Each slot also says which lists its name
+ * is on, so one image holds the custom list and every category.
+ */
+#define IMAGE_MAGIC             0x4942464e  /* "NFBI" */
+#define IMAGE_FORMAT_VERSION    4
+#define IMAGE_MAX_SIZE          (512 << 20)
+#define IMAGE_PILOT_MUL         0x9e3779b97f4a7c15ULL
+#define IMAGE_CHAIN_MUL         0xc2b2ae3d27d4eb4fULL
+
+/* Default name under /lib/firmware, see the boot_image module parameter */
+#define IMAGE_FIRMWARE_NAME     "network_filter.img"
+
+struct image_header {
+    __le32 magic;
+    __le16 version;
+    __le16 header_len;          /* sizeof(struct image_header) */
+    __le32 crc;                 /* crc32 of everything after the header */
+    __le32 count;               /* Names, one used slot each */
+    __le64 seed;                /* Seed of image_hash_label() */
+    __le32 slots;               /* At least count */
+    __le32 buckets;
+    __le32 pool_len;
+    __le32 list_epoch;          /* List version the image holds, see set_list_version() */
+    __le64 list_version;
+    __le64 total_len;           /* Header, pilots, slots and pool */
+} __attribute__((packed));
+
+struct image_slot {
+    __le32 offset;              /* Name in the pool */
+    __le16 fingerprint;         /* Low bits of the name's hash */
+    u8 len;                     /* 0 for an unused slot */
+    u8 categories;              /* BIT(CATEGORY_*) of the lists the name is on */
+};
+
+/* A validated image, the pointers point into @data */
+struct blocklist_image {
+    void *data;
+    size_t size;
+    const __le16 *pilots;
+    const struct image_slot *slots;
+    const char *pool;
+    u32 nr_slots;
+    u32 nr_buckets;
+    u64 seed;
+    u32 *hits;                  /* Blocked lookups per slot, kept by the cache, not in @data */
+};
+
+static inline u64 image_mix(u64 hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/* Map @x onto [0, @n) without a division */
+static inline u32 image_reduce(u32 x, u32 n)
+{
+    return ((u64)x * n) >> 32;
+}
+
+/*
+ * Label-chained like the cache's hash_next_label(), so every parent
+ * domain's hash is a step of the name's: the label's dns_label_hash()
+ * under the image seed, mixed with the parent's hash by the MurmurHash3
+ * finalizer. 64 bits keep distinct names apart, which a perfect hash
+ * depends on. The image carries its own seed since the server builds it
+ * without knowing the module's.
+ */
+static inline u64 image_hash_label(u64 label_hash, u64 suffix_hash)
+{
+    return image_mix(label_hash ^ (suffix_hash * IMAGE_CHAIN_MUL));
+}
+
+/**
+ * image_find - Find the slot of a name in an image
+ * @image: Validated image
+ * @hash: image_hash_label() chain of @name
+ * @name: Name, need not be NUL-terminated
+ * @len: Length of @name
+ *
+ * Context: Any context, callers hold the RCU read lock on the owning table
+ *
+ * Return: The slot holding @name, NULL if it is not in the image
+ */
+static inline const struct image_slot *image_find(const struct blocklist_image *image, u64 hash,
+                                                  const char *name, size_t len)
+{
+    u32 bucket = image_reduce(hash >> 32, image->nr_buckets);
+    u64 pilot = le16_to_cpu(image->pilots[bucket]);
+    const struct image_slot *slot;
+
+    slot = &image->slots[image_reduce(image_mix(hash ^ (pilot * IMAGE_PILOT_MUL)),
+                                      image->nr_slots)];
+    if (slot->len != len || le16_to_cpu(slot->fingerprint) != (u16)hash ||
+        memcmp(image->pool + le32_to_cpu(slot->offset), name, len))
+        return NULL;
+    return slot;
+}
+
+/**
+ * image_lookup - Check whether an image holds a name
+ * @image: Validated image
+ * @hash: image_hash_label() chain of @name
+ * @name: Name, need not be NUL-terminated
+ * @len: Length of @name
+ *
+ * Context: Any context, callers hold the RCU read lock on the owning table
+ *
+ * Return: BIT(CATEGORY_*) of the lists @name is on, 0 if it is not in the image
+ */
+static inline u8 image_lookup(const struct blocklist_image *image, u64 hash,
+                              const char *name, size_t len)
+{
+    const struct image_slot *slot = image_find(image, hash, name, len);
+
+    return slot ? slot->categories : 0;
+}
+
+/**
+ * image_parse - Validate an image and set up @image to use it in place
+ * @image: Filled on success
+ * @data: Image bytes, kvmalloc()ed, owned by @image on success
+ * @size: Number of bytes at @data
+ *
+ * Checks the header, the checksum and that every used slot points at a
+ * name inside the pool and is on some list, so lookups need no bounds
+ * checks.
+ *
+ * Return: 0 on success, -EINVAL or -EBADMSG for a malformed image
+ */
+int image_parse(struct blocklist_image *image, void *data, size_t size);
+
+/**
+ * image_domain_hash - image_hash_label() chain of a whole name
+ * @image: Image whose seed to use
+ * @name: Domain name
+ * @len: Length of @name
+ *
+ * Return: Hash to pass to image_lookup()
+ */
+u64 image_domain_hash(const struct blocklist_image *image, const char *name, size_t len);
+
+/**
+ * init_image - Create the image sysfs attribute and load the boot image
+ *
+ * Creates /sys/devices/MODULE_NAME/image. Writing a whole image there
+ * replaces the blocklist. With the image module parameter set, the named
+ * firmware file is loaded first, so filtering starts with a full list.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: 0 on success, negative error code on failure. A missing or
+ *         bad boot image only logs a warning.
+ */
+int init_image(void);
+
+/**
+ * cleanup_image - Remove the image sysfs attribute
+ */
+void cleanup_image(void);
+
+#endif /* IMAGE_H */
@@ -1,69 +1,164 @@
 #include "json_parser.h"
 
-int get_json_value(const char *buffer, const char *key, 
-                   const char **value_start, size_t *value_len)
+static void reset_message(struct json_stream *js)
 {
-    if (!buffer || !key)
-        return -EINVAL;
+    js->depth = 0;
+    js->started = false;
+    js->in_string = false;
+    js->escape = false;
+    js->want_key = false;
+    js->domains_array = false;
+    js->field = JSON_FIELD_OTHER;
+    js->broken = false;
+    js->code[0] = '\0';
+    js->operation[0] = '\0';
+    js->content[0] = '\0';
+    js->domains = 0;
+}
 
-    if (strlen(key) > 124)  // 128 - 3 (quotes + null) - 1 (safety)
-        return -EOVERFLOW;
+void json_stream_init(struct json_stream *js, const struct json_stream_ops *ops, void *ctx) {
+    js->ops = ops;
+    js->ctx = ctx;
+    reset_message(js);
+}
 
-    char key_pattern[128];
-    const char *start, *end;
-    
-    snprintf(key_pattern, sizeof(key_pattern), "\"%s\"", key);
-    
-    start = strstr(buffer, key_pattern);
-    if (!start)
-        return -ENOENT;
-    
-    start += strlen(key_pattern) + 2;  // +1 for colon and space
-    
-    switch (*start) {
-    case '"':
-        start++;
-        end = strchr(start + 1, '"');
-        break;
-    case '[':
-        end = strchr(start + 1, ']');
-        end++;
-        break;
-    default:
-        return -EINVAL;
-    }
-    
-    if (!end)
-        return -EINVAL;
-    
-    *value_start = start;
-    *value_len = (*start != '"') ? end - start : end - start + 1;
-    
-    return 0;
+static u8 match_field(const char *key, size_t len)
+{
+    if (len == strlen(STR_CODE) && !memcmp(key, STR_CODE, len))
+        return JSON_FIELD_CODE;
+    if (len == strlen(STR_OPERATION) && !memcmp(key, STR_OPERATION, len))
+        return JSON_FIELD_OPERATION;
+    if (len == strlen(STR_CONTENT) && !memcmp(key, STR_CONTENT, len))
+        return JSON_FIELD_CONTENT;
+    if (len == strlen(STR_DOMAINS) && !memcmp(key, STR_DOMAINS, len))
+        return JSON_FIELD_DOMAINS;
+    return JSON_FIELD_OTHER;
 }
 
-int get_operation_code(const char *buffer) {    
-    const char *value_start;
-    size_t value_len;
-    int ret = get_json_value(buffer, STR_OPERATION, &value_start, &value_len);
-    
-    if (ret < 0) {
-        printk(KERN_WARNING MODULE_NAME ": Failed to find operation field: %d\n", ret);
-        return ENOENT;
+static void store_string(char *dst, size_t size, const char *src, size_t len)
+{
+    len = min(len, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* A string just closed, route it by where it sits in the message */
+static void end_string(struct json_stream *js)
+{
+    if (js->depth == 1) {
+        if (js->want_key) {
+            js->field = js->bad_string ? JSON_FIELD_OTHER : match_field(js->str, js->str_len);
+            js->want_key = false;
+            return;
+        }
+
+        switch (js->field) {
+        case JSON_FIELD_CODE:
+            store_string(js->code, sizeof(js->code), js->str, js->str_len);
+            break;
+        case JSON_FIELD_OPERATION:
+            store_string(js->operation, sizeof(js->operation), js->str, js->str_len);
+            break;
+        case JSON_FIELD_CONTENT:
+            if (js->bad_string)
+                js->broken = true;
+            store_string(js->content, sizeof(js->content), js->str, js->str_len);
+            break;
+        }
+        return;
+    }
+
+    if (js->depth == 2 && js->domains_array && !js->broken && !js->bad_string) {
+        if (js->ops->domain(js->ctx, js->str, js->str_len) < 0)
+            js->broken = true;
+        else
+            js->domains++;
     }
-    
-    char num_str[8] = {0};
-    if (value_len >= sizeof(num_str)) {
-        printk(KERN_WARNING MODULE_NAME ": Operation code too long\n");
-        return EINVAL;
+}
+
+static void string_byte(struct json_stream *js, char c)
+{
+    if (js->escape) {
+        js->escape = false;
+        /* Domains and codes only ever need the literal escapes */
+        if (c != '"' && c != '\\' && c != '/')
+            js->bad_string = true;
+    } else if (c == '\\') {
+        js->escape = true;
+        return;
+    } else if (c == '"') {
+        js->in_string = false;
+        end_string(js);
+        return;
     }
-    
-    strncpy(num_str, value_start, value_len);
-    
-    int code;
-    if (kstrtoint(num_str, 10, &code) != 0) {
-        printk(KERN_WARNING MODULE_NAME ": Failed to parse operation code from: %s\n", num_str);
-        return EINVAL;
+
+    if (js->str_len < sizeof(js->str))
+        js->str[js->str_len++] = c;
+    else
+        js->bad_string = true;
+}
+
+size_t json_stream_feed(struct json_stream *js, const char *data, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\n') {
+            /* The server escapes newlines inside strings, a raw one always ends the message */
+            if (js->started) {
+                if (js->depth || js->in_string)
+                    js->broken = true;
+                js->ops->message(js->ctx, js);
+                reset_message(js);
+                return i + 1;
+            }
+            continue;
+        }
+
+        if (js->in_string) {
+            string_byte(js, c);
+            continue;
+        }
+
+        switch (c) {
+        case ' ': case '\t': case '\r':
+            break;
+        case '"':
+            js->started = true;
+            js->in_string = true;
+            js->bad_string = false;
+            js->str_len = 0;
+            break;
+        case '{':
+        case '[':
+            js->started = true;
+            if (js->depth == 0)
+                js->want_key = c == '{';
+            else if (js->depth == 1)
+                js->domains_array = c == '[' && js->field == JSON_FIELD_DOMAINS;
+            if (js->depth == U8_MAX)
+                js->broken = true;
+            else
+                js->depth++;
+            break;
+        case '}':
+        case ']':
+            if (js->depth == 0)
+                js->broken = true;
+            else if (--js->depth == 1)
+                js->domains_array = false;
+            break;
+        case ',':
+            if (js->depth == 1)
+                js->want_key = true;
+            break;
+        default:
+            /* Colons, numbers and literals carry nothing we keep */
+            js->started = true;
+            break;
+        }
     }
-    return code;
+
+    return len;
 }
@@ -1,3 +1,6 @@
+#ifndef JSON_PARSER_H
+#define JSON_PARSER_H
+
 #include <linux/errno.h>
 #include <linux/string.h>
 #include <linux/kernel.h>  
@@ -5,26 +8,93 @@
 #include <linux/module.h>
 #include "utils.h"
 
+#define JSON_CODE_LENGTH        8
+
+/* Top-level keys the stream keeps, everything else is skipped */
+enum json_field {
+    JSON_FIELD_OTHER,
+    JSON_FIELD_CODE,
+    JSON_FIELD_OPERATION,
+    JSON_FIELD_CONTENT,
+    JSON_FIELD_DOMAINS,
+};
+
+struct json_stream;
+
+/* Callbacks of a json_stream, both run from json_stream_feed() */
+struct json_stream_ops {
+    /*
+     * Element of the top-level "domains" array, @domain is not
+     * NUL-terminated. A negative return marks the message broken and
+     * stops further calls for it.
+     */
+    int (*domain)(void *ctx, const char *domain, size_t len);
+    /* A newline-terminated message ended, check @js->broken before use */
+    void (*message)(void *ctx, const struct json_stream *js);
+};
+
+/*
+ * Resumable single-pass tokenizer for the server's newline-delimited
+ * JSON messages. Bytes can be fed in any split, one message may span
+ * many receive calls and one call may carry many messages. Memory is
+ * bounded by one string, domains are handed out while scanning.
+ */
+struct json_stream {
+    const struct json_stream_ops *ops;
+    void *ctx;
+
+    /* Scanner state */
+    u8 depth;                   /* Nesting of objects and arrays */
+    bool started;               /* Non-blank byte seen in this message */
+    bool in_string;
+    bool escape;                /* Previous byte was a backslash */
+    bool want_key;              /* Next top-level string is a key */
+    bool bad_string;            /* Unsupported escape or too long */
+    bool domains_array;         /* Depth 2 is the "domains" array */
+    u8 field;                   /* enum json_field of the current top-level value */
+    char str[MAX_DOMAIN_LENGTH];
+    size_t str_len;
+
+    /* Result of the current message */
+    bool broken;                /* Malformed, or a domain callback failed */
+    char code[JSON_CODE_LENGTH];
+    char operation[JSON_CODE_LENGTH];
+    char content[MAX_DOMAIN_LENGTH];
+    unsigned int domains;       /* Domain callbacks made */
+};
+
+/**
+ * json_stream_init - Prepare a stream for its first message
+ * @js: Stream to initialize
+ * @ops: Callbacks for domains and completed messages
+ * @ctx: Opaque pointer passed to @ops
+ */
+void json_stream_init(struct json_stream *js, const struct json_stream_ops *ops, void *ctx);
+
 /**
- * get_json_value - Extract value for a given key from JSON string
- * @buffer: Input JSON string
- * @key: Key to search for (max 124 chars)
- * @value_start: Pointer to store the start position of the value
- * @value_len: Pointer to store the length of the value
+ * json_stream_feed - Scan received bytes
+ * @js: Stream
+ * @data: Received bytes
+ * @len: Number of bytes at @data
  *
- * Return: 0 on success, negative on failure
- *         -EINVAL: Invalid input parameters or malformed JSON
- *         -ENOENT: Key not found
- *         -EOVERFLOW: Key too long
+ * Stops right after a message ends, so the caller can look at what
+ * follows (see json_stream_idle()) before feeding the rest.
+ *
+ * Context: Process context only, callbacks may sleep
+ *
+ * Return: Number of bytes consumed, at least 1 when @len is not 0
  */
-int get_json_value(const char *buffer, const char *key, const char **value_start, size_t *value_len);
+size_t json_stream_feed(struct json_stream *js, const char *data, size_t len);
 
 /**
- * get_operation_code - Extract operation code from JSON string
- * @buffer: Input JSON string
+ * json_stream_idle - Check whether the stream is between messages
+ * @js: Stream
  *
- * Return: Operation code on success, negative on failure
- *         -EINVAL: Invalid input parameters or malformed JSON
- *         -ENOENT: Operation code not found
+ * Return: true if no byte of a new message has been consumed yet
  */
-int get_operation_code(const char *buffer);
+static inline bool json_stream_idle(const struct json_stream *js)
+{
+    return !js->started;
+}
+
+#endif /* JSON_PARSER_H */
@@ -2,7 +2,13 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include "utils.h"
+#include "stats.h"
+#include "events.h"
 #include "cache.h"
+#include "genl.h"
+#include "hits.h"
+#include "profiles.h"
+#include "image.h"
 #include "netfilter.h"
 #include "network.h"
 
@@ -16,10 +22,40 @@ static int __init network_filter_init(void) {
 
     printk(KERN_INFO MODULE_NAME ": Initializing module\n");
 
+    ret = init_stats();
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize statistics\n");
+        goto fail;
+    }
+
+    ret = init_events();
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize events\n");
+        goto fail_events;
+    }
+
     ret = init_cache();
     if (ret < 0) {
         printk(KERN_ERR MODULE_NAME ": Failed to initialize cache\n");
-        goto fail;
+        goto fail_cache;
+    }
+
+    ret = init_hits();
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize hit reports\n");
+        goto fail_hits;
+    }
+
+    ret = init_genl();
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize netlink\n");
+        goto fail_genl;
+    }
+
+    ret = init_image();
+    if (ret < 0) {
+        printk(KERN_ERR MODULE_NAME ": Failed to initialize image loading\n");
+        goto fail_image;
     }
 
     ret = init_netfilter();
@@ -38,7 +74,14 @@ static int __init network_filter_init(void) {
     return 0;
 
 fail_network:   cleanup_netfilter();
-fail_netfilter: cleanup_cache();
+fail_netfilter: cleanup_image();
+fail_image:     cleanup_genl();
+                /* Rules arrive over netlink, free them once it is gone */
+                cleanup_profiles();
+fail_genl:      cleanup_hits();
+fail_hits:      cleanup_cache();
+fail_cache:     cleanup_events();
+fail_events:    cleanup_stats();
 fail:           return ret;
 }
 
@@ -46,7 +89,13 @@ static void __exit network_filter_exit(void) {
     printk(KERN_INFO MODULE_NAME ": Cleaning up module\n");
     cleanup_network();
     cleanup_netfilter();
+    cleanup_image();
+    cleanup_genl();
+    cleanup_profiles();
+    cleanup_hits();
     cleanup_cache();
+    cleanup_events();
+    cleanup_stats();
     printk(KERN_INFO MODULE_NAME ": Module cleanup complete\n");
 }
 
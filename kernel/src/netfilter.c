@@ -1,215 +1,418 @@
 #include "netfilter.h"
 
-/* Netfilter hook operations */
-static struct nf_hook_ops nfho_pre_routing;
+static bool query_blocking = true;
+module_param(query_blocking, bool, 0444);
+MODULE_PARM_DESC(query_blocking,
+                 "Answer blocked queries locally instead of waiting for the upstream response (default: on)");
+
+static bool lazy_hooks;
+module_param(lazy_hooks, bool, 0444);
+MODULE_PARM_DESC(lazy_hooks,
+                 "Register the hooks only while there is something to filter (default: off)");
 
 /**
- * parse_domain_name - Parse DNS wire format domain name to string
- * @src: Source buffer containing DNS wire format name
- * @dst: Destination buffer for human-readable domain name
- * @max_len: Maximum length of destination buffer
- *
- * Converts DNS wire format domain name (length-prefixed labels) to a 
- * human-readable string. Handles DNS message compression (0xC0 pointer)
- * and removes .Home and .local suffixes. Each label is separated by dots.
+ * locate_dns - Find and read the UDP and DNS headers of a packet
+ * @skb: Socket buffer containing the packet
+ * @family: NFPROTO_IPV4 or NFPROTO_IPV6, from the hook state
+ * @pkt: Filled with the header copies and offsets on success
  *
- * Example: [3]www[7]example[3]com[0] -> www.example.com
+ * Skips IPv6 extension headers and ignores non-first fragments, which
+ * carry no UDP header. Both families end up in the same dns_packet, so
+ * everything after this point is address-family agnostic. Only the
+ * network header is assumed linear, as the stack guarantees in every
+ * hook this module uses.
  *
- * Return: Length of parsed domain name on success, -1 if destination buffer too small
+ * Return: true if the packet is UDP with room for a DNS header, false otherwise
  */
-static int parse_domain_name(unsigned char *src, char *dst, int max_len)
-{
-    int len = 0;
-    int step;
-    
-    while (*src) {
-        step = *src++;
-        if (step >= max_len - len - 1)
-            return -1;
-            
-        if (step == 0 || (step & 0xC0) == 0xC0)
-            break;
-            
-        if (len)
-            dst[len++] = '.';
-            
-        if (step > 0) {
-            memcpy(dst + len, src, step);
-            len += step;
-            src += step;
-        }
+static bool locate_dns(struct sk_buff *skb, u8 family, struct dns_packet *pkt) {
+    const struct udphdr *udp;
+    const struct dns_header *dns;
+    unsigned int offset;
+
+    if (family == NFPROTO_IPV4) {
+        const struct iphdr *ip_header = ip_hdr(skb);
+
+        if (ip_header->protocol != IPPROTO_UDP ||
+            (ip_header->frag_off & htons(IP_OFFSET)))
+            return false;
+        offset = skb_network_offset(skb) + ip_header->ihl * 4;
+    } else {
+        __be16 frag_off;
+        u8 nexthdr = ipv6_hdr(skb)->nexthdr;
+        int ext_offset;
+
+        ext_offset = ipv6_skip_exthdr(skb, skb_network_offset(skb) + sizeof(struct ipv6hdr),
+                                      &nexthdr, &frag_off);
+        if (ext_offset < 0 || nexthdr != IPPROTO_UDP || (frag_off & htons(IP6_OFFSET)))
+            return false;
+        offset = ext_offset;
     }
-    
-    dst[len] = '\0';
-    
-    char *suffix = strstr(dst, ".Home");
-    if (suffix)
-        *suffix = '\0';
-    suffix = strstr(dst, ".local");
-    if (suffix)
-        *suffix = '\0';
-        
-    return strlen(dst);
+
+    udp = skb_header_pointer(skb, offset, sizeof(pkt->udp), &pkt->udp);
+    if (!udp)
+        return false;
+    if (udp != &pkt->udp)
+        pkt->udp = *udp;
+
+    dns = skb_header_pointer(skb, offset + sizeof(pkt->udp), sizeof(pkt->dns), &pkt->dns);
+    if (!dns)
+        return false;
+    if (dns != &pkt->dns)
+        pkt->dns = *dns;
+
+    pkt->family = family;
+    pkt->udp_off = offset;
+    pkt->end_off = min_t(unsigned int, skb->len, offset + ntohs(pkt->udp.len));
+    pkt->question = NULL;
+    pkt->question_avail = 0;
+    return true;
 }
 
 /**
- * is_dns_query - Check if packet is a DNS query
+ * load_dns_question - Make the question section of a DNS packet readable
  * @skb: Socket buffer containing the packet
+ * @pkt: Located DNS packet, @question and @question_avail are set
  *
- * Validates if the packet is a DNS query by checking:
- * 1. Valid UDP header exists
- * 2. Destination port is 53 (DNS)
- * 3. Valid DNS header exists with at least one question
+ * Points into the skb without copying when the question is in the
+ * linear area, copies at most DNS_QUESTION_MAX bytes otherwise.
  *
- * Return: true if packet is a valid DNS query, false otherwise
+ * Return: true if at least one byte of question is available, false otherwise
  */
-static bool is_dns_query(struct sk_buff *skb) {
-    struct udphdr *udp;
-    struct dns_header *dns;
+static bool load_dns_question(struct sk_buff *skb, struct dns_packet *pkt) {
+    unsigned int offset = pkt->udp_off + sizeof(struct udphdr) + sizeof(struct dns_header);
 
-    udp = udp_hdr(skb);
-    if (!udp || ntohs(udp->dest) != 53)
+    if (offset >= pkt->end_off)
         return false;
 
-    dns = (struct dns_header *)(udp + 1);
-    return dns && ntohs(dns->q_count) > 0;
+    pkt->question_avail = min_t(unsigned int, pkt->end_off - offset, DNS_QUESTION_MAX);
+    pkt->question = skb_header_pointer(skb, offset, pkt->question_avail, pkt->qbuf);
+    return pkt->question != NULL;
 }
 
 /**
- * extract_domain_from_response - Extract queried domain from DNS response
- * @udp: UDP header of the packet
- * @skb: Socket buffer containing the DNS response
- * @domain: Buffer to store the extracted domain name
- * @maxlen: Maximum length of domain buffer
+ * is_dns_query - Check if packet is a DNS query
+ * @pkt: Located DNS packet
+ *
+ * Validates if the packet is a DNS query by checking:
+ * 1. Destination port is 53 (DNS)
+ * 2. Response bit is clear
+ * 3. DNS header has at least one question
+ *
+ * Return: true if packet is a valid DNS query, false otherwise
+ */
+static bool is_dns_query(const struct dns_packet *pkt) {
+    return ntohs(pkt->udp.dest) == 53 &&
+           !(ntohs(pkt->dns.flags) & DNS_RESPONSE) &&
+           ntohs(pkt->dns.q_count) > 0;
+}
+
+/**
+ * is_dns_response - Check if packet is a DNS response
+ * @pkt: Located DNS packet
+ *
+ * Return: true if the source port is 53 (DNS), false otherwise
+ */
+static bool is_dns_response(const struct dns_packet *pkt) {
+    return ntohs(pkt->udp.source) == 53;
+}
+
+/**
+ * extract_queried_domain - Extract queried domain from a DNS message
+ * @pkt: Located DNS query or response, question loaded
+ * @name: Filled with the decoded and hashed name, see parse_query_name()
  *
- * Extracts and parses the queried domain name from a DNS response packet.
- * Validates DNS header before attempting extraction.
+ * Extracts and parses the queried domain name from the question section
+ * of a DNS query or response packet.
  *
  * Return: Length of extracted domain name on success, -1 on failure
  */
-static int extract_domain_from_response(const struct udphdr *udp, struct sk_buff *skb, 
-                                      char *domain, int maxlen) {
-    struct dns_header *dns;
-    unsigned char *data;
+static int extract_queried_domain(const struct dns_packet *pkt, struct dns_name *name) {
+    int ret = parse_query_name(name, pkt->question, pkt->question_avail);
 
-    dns = (struct dns_header *)(udp + 1);
-    if (!dns)
-        return -1;
+    trace_nf_dns_parse(name, ret);
+    return ret;
+}
+
+/**
+ * dns_question_len - Length of the question section of a DNS query
+ * @pkt: Located DNS query, question loaded
+ *
+ * Return: Bytes of QNAME plus QTYPE/QCLASS following the DNS header,
+ *         -1 if the question is malformed or truncated
+ */
+static int dns_question_len(const struct dns_packet *pkt) {
+    const unsigned char *pos = pkt->question;
+    const unsigned char *end = pkt->question + pkt->question_avail;
+
+    /* Questions never use compression */
+    while (pos < end && *pos) {
+        if (*pos & 0xC0)
+            return -1;
+        pos += *pos + 1;
+    }
+    pos += 1 + sizeof(struct dns_question);
+
+    return pos <= end ? pos - pkt->question : -1;
+}
+
+/**
+ * dns_client_addr - Address of the DNS client of a packet
+ * @skb: Socket buffer containing the packet
+ * @pkt: Located DNS packet
+ * @is_query: true if @pkt travels from the client, false if towards it
+ *
+ * Return: Pointer to the 4 or 16 byte client address inside @skb
+ */
+static const void *dns_client_addr(struct sk_buff *skb, const struct dns_packet *pkt,
+                                   bool is_query) {
+    if (pkt->family == NFPROTO_IPV4)
+        return is_query ? &ip_hdr(skb)->saddr : &ip_hdr(skb)->daddr;
+    return is_query ? &ipv6_hdr(skb)->saddr : &ipv6_hdr(skb)->daddr;
+}
+
+static inline u16 dns_event_family(const struct dns_packet *pkt) {
+    return pkt->family == NFPROTO_IPV4 ? AF_INET : AF_INET6;
+}
+
+/**
+ * set_udp_checksum - Compute the UDP checksum of a packet from scratch
+ * @skb: Linear socket buffer with a valid IPv4 or IPv6 network header
+ * @udp: UDP header inside @skb
+ * @family: NFPROTO_IPV4 or NFPROTO_IPV6
+ *
+ * Only used for replies built by this module, rewrites are incremental.
+ */
+static void set_udp_checksum(struct sk_buff *skb, struct udphdr *udp, u8 family) {
+    unsigned int udp_len = ntohs(udp->len);
+    __wsum csum;
+
+    udp->check = 0;
+    csum = csum_partial((unsigned char *)udp, udp_len, 0);
+    if (family == NFPROTO_IPV4)
+        udp->check = csum_tcpudp_magic(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+                                       udp_len, IPPROTO_UDP, csum);
+    else
+        udp->check = csum_ipv6_magic(&ipv6_hdr(skb)->saddr, &ipv6_hdr(skb)->daddr,
+                                     udp_len, IPPROTO_UDP, csum);
+    if (udp->check == 0)
+        udp->check = CSUM_MANGLED_0;
+}
+
+/*
+ * Replace one 16-bit word of the DNS header and fold the difference into
+ * the UDP checksum. A checksum that is only finished by the NIC
+ * (CHECKSUM_PARTIAL) covers the payload later and needs nothing, and a
+ * CHECKSUM_COMPLETE sum stays valid because the checksum field absorbs
+ * the change. Without a UDP checksum (IPv4 only) just skb->csum moves.
+ */
+static void replace_dns_word(struct sk_buff *skb, struct udphdr *udp, bool has_csum,
+                             __be16 *word, __be16 to) {
+    __be16 from = *word;
+
+    if (from == to)
+        return;
 
-    data = (unsigned char *)(dns + 1);
-    return parse_domain_name(data, domain, maxlen);
+    *word = to;
+    if (has_csum)
+        inet_proto_csum_replace2(&udp->check, skb, from, to, false);
+    else if (skb->ip_summed == CHECKSUM_COMPLETE)
+        skb->csum = csum_add(csum_sub(skb->csum, (__force __wsum)from), (__force __wsum)to);
 }
 
 /**
- * block_dns_response - Modify DNS query to return NXDOMAIN
- * @skb: Socket buffer containing the DNS query
+ * block_dns_response - Modify DNS response to return NXDOMAIN
+ * @skb: Socket buffer containing the DNS response
+ * @pkt: Located DNS response
  *
- * Modifies the original DNS query in-place to create an NXDOMAIN response:
- * 1. Sets response and NXDOMAIN flags
- * 2. Clears all record counts
- * 3. Recalculates UDP checksum for modified packet
+ * Modifies the original DNS response in-place to create an NXDOMAIN response:
+ * 1. Makes the DNS header writable, unsharing or pulling only that much
+ * 2. Sets response and NXDOMAIN flags and clears all record counts
+ * 3. Updates the UDP checksum incrementally for the changed words
  *
- * Note: Assumes valid UDP and DNS headers, should be checked before calling
+ * Return: 0 on success, negative error code if the skb cannot be written
  */
-static void block_dns_response(struct sk_buff *skb) {
+static int block_dns_response(struct sk_buff *skb, struct dns_packet *pkt) {
+    unsigned int dns_off = pkt->udp_off + sizeof(struct udphdr);
     struct udphdr *udp;
     struct dns_header *dns;
+    bool has_csum;
+    int ret;
 
-    if (!(udp = udp_hdr(skb)) || !(dns = (struct dns_header *)(udp + 1)))
-        return;
+    ret = skb_ensure_writable(skb, dns_off + sizeof(struct dns_header));
+    if (ret)
+        return ret;
+
+    udp = (struct udphdr *)(skb->data + pkt->udp_off);
+    dns = (struct dns_header *)(skb->data + dns_off);
+    has_csum = pkt->family == NFPROTO_IPV6 || udp->check;
 
     // Set response flags for NXDOMAIN
-    dns->flags |= htons(DNS_RESPONSE | DNS_NXDOMAIN);
-    dns->ans_count = 0;
-    dns->auth_count = 0;
-    dns->add_count = 0;
+    replace_dns_word(skb, udp, has_csum, &dns->flags,
+                     dns->flags | htons(DNS_RESPONSE | DNS_NXDOMAIN));
+    replace_dns_word(skb, udp, has_csum, &dns->ans_count, 0);
+    replace_dns_word(skb, udp, has_csum, &dns->auth_count, 0);
+    replace_dns_word(skb, udp, has_csum, &dns->add_count, 0);
 
-    // Recalculate UDP checksum
-    udp->check = 0;
-    skb->csum = csum_partial((unsigned char *)udp, ntohs(udp->len), 0);
-    udp->check = csum_tcpudp_magic(ip_hdr(skb)->saddr,
-                                  ip_hdr(skb)->daddr,
-                                  ntohs(udp->len),
-                                  IPPROTO_UDP,
-                                  skb->csum);
+    if (has_csum && skb->ip_summed != CHECKSUM_PARTIAL && !udp->check)
+        udp->check = CSUM_MANGLED_0;
+
+    pkt->dns = *dns;
+    return 0;
 }
 
 /**
- * check_dns_nxdomain - Check if DNS response is NXDOMAIN
- * @udp: UDP header of the packet
- * @skb: Socket buffer containing the DNS response
+ * put_nxdomain_payload - Append the UDP header and NXDOMAIN answer to a reply
+ * @nskb: Reply being built, network header already in place
+ * @pkt: Located original query, question loaded
+ * @question_len: Length of the question section, from dns_question_len()
+ *
+ * Echoes the query ID and question, sets QR, RA and RCODE=NXDOMAIN and
+ * keeps the client's opcode and RD bit. The checksum is left to the caller.
  *
- * Return: true if packet is NXDOMAIN response, false otherwise
+ * Return: UDP header of the reply
  */
-static bool check_dns_nxdomain(const struct udphdr *udp, struct sk_buff *skb) {
+static struct udphdr *put_nxdomain_payload(struct sk_buff *nskb, const struct dns_packet *pkt,
+                                           int question_len) {
+    struct udphdr *udp;
     struct dns_header *dns;
-    uint16_t flags;
 
-    dns = (struct dns_header *)(udp + 1);
-    if (unlikely(!dns))
-        return false;
+    skb_set_transport_header(nskb, nskb->len);
+    udp = skb_put(nskb, sizeof(*udp));
+    udp->source = pkt->udp.dest;
+    udp->dest   = pkt->udp.source;
+    udp->len    = htons(sizeof(*udp) + sizeof(*dns) + question_len);
+
+    dns = skb_put(nskb, sizeof(*dns));
+    dns->id = pkt->dns.id;
+    dns->flags = htons((ntohs(pkt->dns.flags) & (DNS_OPCODE_MASK | DNS_RD)) |
+                       DNS_RESPONSE | DNS_RA | DNS_NXDOMAIN);
+    dns->q_count = htons(1);
+    dns->ans_count = 0;
+    dns->auth_count = 0;
+    dns->add_count = 0;
 
-    flags = ntohs(dns->flags);
-    // check both response bit and NXDOMAIN in one comparison
-    if ((flags & (DNS_RESPONSE | DNS_RCODE_MASK)) == (DNS_RESPONSE | DNS_NXDOMAIN)) {
-        char domain[MAX_DOMAIN_LENGTH];
+    skb_put_data(nskb, pkt->question, question_len);
+    return udp;
+}
 
-        if (extract_domain_from_response(udp, skb, domain, sizeof(domain)) > 0) {
-            printk(KERN_INFO MODULE_NAME ": NXDOMAIN response for domain: %s\n", domain);
-            return true;
-        }
-    }
+static void put_reply_ipv4_header(struct sk_buff *nskb, struct sk_buff *oskb,
+                                  unsigned int payload_len) {
+    const struct iphdr *oiph = ip_hdr(oskb);
+    struct iphdr *iph;
+
+    iph = skb_put(nskb, sizeof(*iph));
+    iph->version  = 4;
+    iph->ihl      = sizeof(*iph) / 4;
+    iph->tos      = 0;
+    iph->tot_len  = htons(sizeof(*iph) + payload_len);
+    iph->id       = 0;
+    iph->frag_off = htons(IP_DF);
+    iph->ttl      = IPDEFTTL;
+    iph->protocol = IPPROTO_UDP;
+    iph->saddr    = oiph->daddr;
+    iph->daddr    = oiph->saddr;
+    nskb->protocol = htons(ETH_P_IP);
+}
 
-    return false;
+static void put_reply_ipv6_header(struct sk_buff *nskb, struct sk_buff *oskb,
+                                  unsigned int payload_len) {
+    const struct ipv6hdr *oip6h = ipv6_hdr(oskb);
+    struct ipv6hdr *ip6h;
+
+    ip6h = skb_put(nskb, sizeof(*ip6h));
+    ip6_flow_hdr(ip6h, 0, 0);
+    ip6h->payload_len = htons(payload_len);
+    ip6h->nexthdr     = IPPROTO_UDP;
+    ip6h->hop_limit   = IPV6_DEFAULT_HOPLIMIT;
+    ip6h->saddr       = oip6h->daddr;
+    ip6h->daddr       = oip6h->saddr;
+    nskb->protocol = htons(ETH_P_IPV6);
 }
 
 /**
- * handle_dns_response - Process DNS response for domain blocking
- * @skb: Socket buffer containing the packet
- * @udp: UDP header
- * @dns: DNS header
- * @domain: Extracted domain name
+ * send_nxdomain_reply - Answer a DNS query locally with NXDOMAIN
+ * @net: Network namespace of the hook
+ * @oskb: Socket buffer containing the original query
+ * @pkt: Located original query, question loaded
+ * @question_len: Length of the question section, from dns_question_len()
  *
- * Checks if domain is blocked and modifies response if needed.
- * Logs NXDOMAIN responses for monitoring.
+ * Builds a reply from the resolver to the client and routes it like
+ * locally generated traffic, so both local and forwarded clients
+ * receive it. Routing starts from the query's dst, as nf_reject does
+ * for packets with a spoofed source.
+ *
+ * Return: 0 if the reply was sent, negative error code otherwise
  */
-static void handle_dns_response(struct sk_buff *skb, 
-                              const struct udphdr *udp,
-                              const struct dns_header *dns,
-                              const char *domain) {
-    uint16_t flags = ntohs(dns->flags);
-    bool is_blocked = is_domain_blocked(domain);
+static int send_nxdomain_reply(struct net *net, struct sk_buff *oskb,
+                               const struct dns_packet *pkt, int question_len) {
+    unsigned int payload_len = sizeof(struct udphdr) + sizeof(struct dns_header) + question_len;
+    unsigned int header_len = pkt->family == NFPROTO_IPV4 ? sizeof(struct iphdr)
+                                                           : sizeof(struct ipv6hdr);
+    struct sk_buff *nskb;
+    struct udphdr *udp;
+
+    nskb = alloc_skb(LL_MAX_HEADER + header_len + payload_len, GFP_ATOMIC);
+    if (!nskb)
+        return -ENOMEM;
+
+    skb_reserve(nskb, LL_MAX_HEADER);
+    skb_reset_network_header(nskb);
+    if (pkt->family == NFPROTO_IPV4)
+        put_reply_ipv4_header(nskb, oskb, payload_len);
+    else
+        put_reply_ipv6_header(nskb, oskb, payload_len);
+
+    udp = put_nxdomain_payload(nskb, pkt, question_len);
+    set_udp_checksum(nskb, udp, pkt->family);
+    nskb->ip_summed = CHECKSUM_NONE;
+
+    skb_dst_set_noref(nskb, skb_dst(oskb));
+    if (pkt->family == NFPROTO_IPV4) {
+        if (ip_route_me_harder(net, nskb->sk, nskb, RTN_UNSPEC))
+            goto fail_route;
+        return ip_local_out(net, nskb->sk, nskb);
+    }
 
-    if (is_blocked) 
-        block_dns_response(skb);
+    if (ip6_route_me_harder(net, nskb->sk, nskb))
+        goto fail_route;
+    return ip6_local_out(net, nskb->sk, nskb);
 
-    if (is_blocked || ((flags & (DNS_RESPONSE | DNS_RCODE_MASK)) == (DNS_RESPONSE | DNS_NXDOMAIN)))
-        printk(KERN_INFO MODULE_NAME ": NXDOMAIN response for domain: %s%s\n",
-               domain, is_blocked ? " (blocked)" : "");
+fail_route:
+    kfree_skb(nskb);
+    return -EHOSTUNREACH;
 }
 
 /**
- * is_dns_response - Check if packet is a valid DNS response
+ * handle_dns_response - Process DNS response for domain blocking
+ * @net: Network namespace the response arrived in
  * @skb: Socket buffer containing the packet
- * @udp: Pointer to store UDP header
- * @dns: Pointer to store DNS header
+ * @pkt: Located DNS response
+ * @name: Extracted domain name
  *
- * Validates packet headers and checks if it's a DNS response (port 53)
- *
- * Return: true if valid DNS response, false otherwise
+ * Checks if domain is blocked and modifies response if needed.
+ * Records blocked and NXDOMAIN responses in the event ring for the server.
  */
-static bool is_dns_response(struct sk_buff *skb, struct udphdr **udp, struct dns_header **dns) {
-    struct iphdr *ip_header;
-    
-    if (unlikely(!skb                               ||
-                 !(ip_header = ip_hdr(skb))         || 
-                 ip_header->protocol != IPPROTO_UDP ||
-                 !(*udp = udp_hdr(skb))             ||
-                 ntohs((*udp)->source) != 53        ||
-                 !(*dns = (struct dns_header *)(*udp + 1))))
-        return false;
+static void handle_dns_response(struct net *net, struct sk_buff *skb,
+                                struct dns_packet *pkt, const struct dns_name *name) {
+    uint16_t flags = ntohs(pkt->dns.flags);
+    const void *client = dns_client_addr(skb, pkt, false);
+    bool is_blocked = is_domain_blocked(name, &filter_net(net)->overlay,
+                                        client_profile_mask(dns_event_family(pkt), client));
+
+    if (is_blocked) {
+        int ret = block_dns_response(skb, pkt);
+
+        trace_nf_rewrite(name, pkt->family, false, ret);
+        if (ret < 0) {
+            stats_inc(STAT_PARSE_ERRORS);
+            return;
+        }
+        stats_inc(STAT_BLOCKED);
+    }
 
-    return true;
+    if (is_blocked || ((flags & (DNS_RESPONSE | DNS_RCODE_MASK)) == (DNS_RESPONSE | DNS_NXDOMAIN)))
+        events_record(is_blocked ? EVENT_BLOCKED : EVENT_NXDOMAIN, dns_event_family(pkt),
+                      client, name->domain);
 }
 
 /**
@@ -218,7 +421,7 @@ static bool is_dns_response(struct sk_buff *skb, struct udphdr **udp, struct dns
  * @skb: Socket buffer containing the packet
  * @state: Netfilter hook state
  *
- * Processes incoming DNS responses in pre-routing chain.
+ * Processes incoming IPv4 and IPv6 DNS responses in pre-routing chain.
  * Modifies responses for blocked domains to return NXDOMAIN.
  *
  * Return: NF_ACCEPT always (modified or unmodified packet)
@@ -226,41 +429,267 @@ static bool is_dns_response(struct sk_buff *skb, struct udphdr **udp, struct dns
 static unsigned int pre_routing_hook(void *priv,
                                    struct sk_buff *skb,
                                    const struct nf_hook_state *state) {
-    struct udphdr *udp;
-    struct dns_header *dns;
-    char domain[MAX_DOMAIN_LENGTH];
-    
-    if (!is_dns_response(skb, &udp, &dns))
-        return NF_ACCEPT;
+    struct dns_packet pkt;
+    struct dns_name name;
+    u64 start;
 
-    if (extract_domain_from_response(udp, skb, domain, MAX_DOMAIN_LENGTH) <= 0)
+    if (!static_branch_likely(&filter_active))
         return NF_ACCEPT;
 
-    handle_dns_response(skb, udp, dns, domain);
+    trace_nf_hook_entry(state->hook, state->pf, skb->len);
+    stats_inc(STAT_PACKETS);
+    if (!locate_dns(skb, state->pf, &pkt) || !is_dns_response(&pkt))
+        goto done;
+
+    /* Only DNS packets are timed, the early exit above costs a few loads */
+    start = stats_hook_clock();
+    stats_inc(STAT_DNS_RESPONSES);
+
+    if (!load_dns_question(skb, &pkt) ||
+        extract_queried_domain(&pkt, &name) <= 0) {
+        stats_inc(STAT_PARSE_ERRORS);
+        goto out;
+    }
+
+    handle_dns_response(state->net, skb, &pkt, &name);
 
+out:
+    stats_record_latency(start);
+done:
+    trace_nf_hook_exit(state->hook, state->pf, NF_ACCEPT);
     return NF_ACCEPT;
 }
 
+/**
+ * dns_query_hook - Netfilter hook answering blocked DNS queries
+ * @priv: Private data (unused)
+ * @skb: Socket buffer containing the packet
+ * @state: Netfilter hook state
+ *
+ * Runs on locally generated (LOCAL_OUT) and forwarded (FORWARD) IPv4 and
+ * IPv6 queries to port 53. A query for a blocked domain is answered with
+ * a locally synthesized NXDOMAIN and dropped, so it never reaches the
+ * upstream resolver.
+ *
+ * Return: NF_DROP for answered queries, NF_ACCEPT otherwise
+ */
+static unsigned int dns_query_hook(void *priv,
+                                   struct sk_buff *skb,
+                                   const struct nf_hook_state *state) {
+    struct dns_packet pkt;
+    struct dns_name name;
+    unsigned int verdict = NF_ACCEPT;
+    const void *client;
+    int question_len, ret;
+    u64 start;
+
+    if (!static_branch_likely(&filter_active))
+        return NF_ACCEPT;
+
+    trace_nf_hook_entry(state->hook, state->pf, skb->len);
+    stats_inc(STAT_PACKETS);
+    if (!locate_dns(skb, state->pf, &pkt) || !is_dns_query(&pkt))
+        goto done;
+
+    start = stats_hook_clock();
+    stats_inc(STAT_DNS_QUERIES);
+
+    if (!load_dns_question(skb, &pkt)) {
+        stats_inc(STAT_PARSE_ERRORS);
+        goto out;
+    }
+
+    question_len = dns_question_len(&pkt);
+    if (question_len < 0 || extract_queried_domain(&pkt, &name) <= 0) {
+        stats_inc(STAT_PARSE_ERRORS);
+        goto out;
+    }
+
+    client = dns_client_addr(skb, &pkt, true);
+    if (!is_domain_blocked(&name, &filter_net(state->net)->overlay,
+                           client_profile_mask(dns_event_family(&pkt), client)))
+        goto out;
+
+    ret = send_nxdomain_reply(state->net, skb, &pkt, question_len);
+    trace_nf_rewrite(&name, pkt.family, true, ret);
+    if (ret == 0) {
+        stats_inc(STAT_ANSWERED);
+        events_record(EVENT_BLOCKED, dns_event_family(&pkt), client, name.domain);
+        verdict = NF_DROP;
+    }
+
+out:
+    stats_record_latency(start);
+done:
+    trace_nf_hook_exit(state->hook, state->pf, verdict);
+    return verdict;
+}
+
+/*
+ * Response rewriting always runs, query answering only with query_blocking.
+ * Both families share the hook functions, which branch on state->pf.
+ */
+static const struct nf_hook_ops filter_ops[] = {
+    {
+        .hook     = pre_routing_hook,
+        .pf       = NFPROTO_IPV4,
+        .hooknum  = NF_INET_PRE_ROUTING,
+        .priority = NF_IP_PRI_FIRST,
+    },
+    {
+        .hook     = pre_routing_hook,
+        .pf       = NFPROTO_IPV6,
+        .hooknum  = NF_INET_PRE_ROUTING,
+        .priority = NF_IP6_PRI_FIRST,
+    },
+    {
+        .hook     = dns_query_hook,
+        .pf       = NFPROTO_IPV4,
+        .hooknum  = NF_INET_LOCAL_OUT,
+        .priority = NF_IP_PRI_FIRST,
+    },
+    {
+        .hook     = dns_query_hook,
+        .pf       = NFPROTO_IPV4,
+        .hooknum  = NF_INET_FORWARD,
+        .priority = NF_IP_PRI_FIRST,
+    },
+    {
+        .hook     = dns_query_hook,
+        .pf       = NFPROTO_IPV6,
+        .hooknum  = NF_INET_LOCAL_OUT,
+        .priority = NF_IP6_PRI_FIRST,
+    },
+    {
+        .hook     = dns_query_hook,
+        .pf       = NFPROTO_IPV6,
+        .hooknum  = NF_INET_FORWARD,
+        .priority = NF_IP6_PRI_FIRST,
+    },
+};
+
+#define RESPONSE_OPS_COUNT      2
+
+static unsigned int filter_ops_count(void) {
+    return query_blocking ? ARRAY_SIZE(filter_ops) : RESPONSE_OPS_COUNT;
+}
+
+/* Set up a namespace's overlay, called for every existing and new one */
+static int __net_init filter_net_init(struct net *net)
+{
+    return init_netns_overlay(net);
+}
+
+static void __net_exit filter_net_exit(struct net *net)
+{
+    cleanup_netns_overlay(net);
+}
+
+static struct pernet_operations filter_net_ops = {
+    .init = filter_net_init,
+    .exit = filter_net_exit,
+    .id   = &filter_net_id,
+    .size = sizeof(struct filter_net),
+};
+
+/*
+ * The hooks are a pernet subsystem of their own, registered after the
+ * overlays and, with lazy_hooks, only while filter_active is on. The
+ * overlays and the lists outlive the hooks either way.
+ */
+static int __net_init filter_hooks_init(struct net *net)
+{
+    return nf_register_net_hooks(net, filter_ops, filter_ops_count());
+}
+
+static void __net_exit filter_hooks_exit(struct net *net)
+{
+    nf_unregister_net_hooks(net, filter_ops, filter_ops_count());
+}
+
+static struct pernet_operations filter_hook_ops = {
+    .init = filter_hooks_init,
+    .exit = filter_hooks_exit,
+};
+
+/* Whether filter_hook_ops is registered, under filter_hooks_lock */
+static bool filter_hooks_registered;
+static DEFINE_MUTEX(filter_hooks_lock);
+
+static void filter_hooks_work_fn(struct work_struct *work);
+static DECLARE_WORK(filter_hooks_work, filter_hooks_work_fn);
+
+/*
+ * Bring the hook registration in line with filter_active. Runs as work
+ * since (un)registering pernet operations waits on every namespace,
+ * which may be tearing down an overlay under __cache_lock.
+ */
+static void filter_hooks_work_fn(struct work_struct *work)
+{
+    bool active = static_key_enabled(&filter_active);
+    int ret;
+
+    mutex_lock(&filter_hooks_lock);
+    if (active && !filter_hooks_registered) {
+        ret = register_pernet_subsys(&filter_hook_ops);
+        if (ret < 0)
+            printk(KERN_ERR MODULE_NAME ": Failed to register netfilter hooks: %d\n", ret);
+        else
+            filter_hooks_registered = true;
+    } else if (!active && filter_hooks_registered) {
+        unregister_pernet_subsys(&filter_hook_ops);
+        filter_hooks_registered = false;
+    }
+    mutex_unlock(&filter_hooks_lock);
+
+    pr_debug(MODULE_NAME ": Netfilter hooks %s\n", filter_hooks_registered ? "attached" : "detached");
+}
+
+static void filter_active_changed(bool active)
+{
+    schedule_work(&filter_hooks_work);
+}
+
 int init_netfilter(void) {
     int ret = 0;
 
-    nfho_pre_routing.hook = pre_routing_hook;
-    nfho_pre_routing.hooknum = NF_INET_PRE_ROUTING;
-    nfho_pre_routing.pf = PF_INET;
-    nfho_pre_routing.priority = NF_IP_PRI_FIRST;
+    ret = init_dns_name();
+    if (ret < 0)
+        return ret;
 
-    ret = nf_register_net_hook(&init_net, &nfho_pre_routing);
+    ret = register_pernet_subsys(&filter_net_ops);
     if (ret < 0) {
-        printk(KERN_ERR MODULE_NAME ": Failed to register pre-routing hook\n");
+        printk(KERN_ERR MODULE_NAME ": Failed to register namespace overlays\n");
         return ret;
     }
 
-    printk(KERN_INFO MODULE_NAME ": Netfilter hooks registered\n");
+    if (lazy_hooks) {
+        watch_filter_active(filter_active_changed);
+        /* The list may have been loaded before the watch was set */
+        schedule_work(&filter_hooks_work);
+    } else {
+        ret = register_pernet_subsys(&filter_hook_ops);
+        if (ret < 0) {
+            printk(KERN_ERR MODULE_NAME ": Failed to register netfilter hooks\n");
+            unregister_pernet_subsys(&filter_net_ops);
+            return ret;
+        }
+        filter_hooks_registered = true;
+    }
+
+    printk(KERN_INFO MODULE_NAME ": Netfilter hooks %s%s\n",
+           lazy_hooks ? "follow the list" : "registered",
+           query_blocking ? " (query blocking on)" : "");
 
     return 0;
 }
 
 void cleanup_netfilter(void) {
-    nf_unregister_net_hook(&init_net, &nfho_pre_routing);
+    watch_filter_active(NULL);
+    cancel_work_sync(&filter_hooks_work);
+    if (filter_hooks_registered)
+        unregister_pernet_subsys(&filter_hook_ops);
+    filter_hooks_registered = false;
+    unregister_pernet_subsys(&filter_net_ops);
     printk(KERN_INFO MODULE_NAME ": Netfilter hooks cleaned up\n");
 }
@@ -3,31 +3,66 @@
 
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/udp.h>
 #include <linux/skbuff.h>
 #include <linux/types.h>
 #include <linux/inet.h>
+#include <linux/module.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/ip6_route.h>
+#include <net/route.h>
+#include <net/dst.h>
 #include "utils.h"
 #include "cache.h"
+#include "netns.h"
+#include "events.h"
+#include "profiles.h"
 
-/* DNS packet handling structures */
+/* Longest question section we read: wire-format name plus QTYPE/QCLASS */
+#define DNS_QUESTION_MAX        (MAX_DOMAIN_LENGTH + sizeof(struct dns_question))
+
+/*
+ * DNS packet handling structures, shared by the IPv4 and IPv6 paths.
+ * Headers are read through skb_header_pointer(), so the skb may be
+ * paged or GRO'd; @question points into the skb when the bytes are
+ * linear and into @qbuf otherwise. Writers go through offsets, since
+ * making the skb writable may move its data.
+ */
 struct dns_packet {
-    struct udphdr *udp;
-    struct dns_header *dns;
-    unsigned char *data;
+    struct udphdr udp;          /* Copy of the UDP header */
+    struct dns_header dns;      /* Copy of the DNS header */
+    unsigned int udp_off;       /* UDP header offset from skb->data */
+    unsigned int end_off;       /* End of the UDP payload */
+    const unsigned char *question;  /* Question section, see load_dns_question() */
+    unsigned int question_avail;    /* Bytes readable at @question */
+    u8 family;                  /* NFPROTO_IPV4 or NFPROTO_IPV6 */
+    unsigned char qbuf[DNS_QUESTION_MAX];
 };
 
 /* DNS header flags */
 #define DNS_RESPONSE     0x8000  /* Response bit (1=response, 0=query) */
+#define DNS_OPCODE_MASK  0x7800  /* Query kind, echoed in replies */
+#define DNS_RD           0x0100  /* Recursion desired, echoed in replies */
+#define DNS_RA           0x0080  /* Recursion available */
 #define DNS_RCODE_MASK   0x000F  /* Response code mask (last 4 bits) */
 #define DNS_NXDOMAIN     0x0003  /* NXDOMAIN response code */
 
 /**
  * init_netfilter - Initialize the netfilter hooks
  *
- * This function sets up and registers netfilter hooks:
- *  Pre-routing hook for intercepting incoming DNS queries
+ * Registers a pernet subsystem, so the hooks are attached to every
+ * current and future network namespace, for both IPv4 and IPv6:
+ *  Pre-routing hook for rewriting incoming DNS responses
+ *  Local-out and forward hooks for answering blocked queries,
+ *  unless the query_blocking parameter is off
+ * Every namespace shares the one blocklist and gets its own overlay.
+ * The hooks return at once while filter_active is off; with the
+ * lazy_hooks parameter they are also only registered while it is on,
+ * the overlays stay registered throughout.
  *
  * Return: 0 on success, negative error code on failure
  */
@@ -35,6 +70,8 @@ int init_netfilter(void);
 
 /**
  * cleanup_netfilter - Clean up and unregister netfilter hooks
+ *
+ * Detaches the hooks and frees the overlay of every namespace.
  */
 void cleanup_netfilter(void);
 
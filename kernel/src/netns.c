@@ -0,0 +1,62 @@
+#include "netns.h"
+
+unsigned int filter_net_id __read_mostly;
+
+static int overlay_proc_show(struct seq_file *m, void *v)
+{
+    overlay_show(m, &filter_net(seq_file_single_net(m))->overlay);
+    return 0;
+}
+
+/* Apply one "+domain", "-domain" or bare "domain" line to @fnet's overlay */
+static int overlay_apply_line(struct filter_net *fnet, char *line)
+{
+    bool remove = false;
+    size_t len;
+
+    line = strim(line);
+    if (*line == '+' || *line == '-') {
+        remove = *line == '-';
+        line++;
+    }
+
+    len = strlen(line);
+    if (!len)
+        return 0;
+
+    if (remove)
+        return overlay_remove_domain(&fnet->overlay, line, len);
+    return overlay_add_domain(&fnet->overlay, line, len);
+}
+
+static int overlay_proc_write(struct file *file, char *buf, size_t size)
+{
+    struct net *net = seq_file_single_net(file->private_data);
+    struct filter_net *fnet = filter_net(net);
+    char *line;
+    int ret;
+
+    if (!ns_capable(net->user_ns, CAP_NET_ADMIN))
+        return -EPERM;
+
+    while ((line = strsep(&buf, "\n"))) {
+        ret = overlay_apply_line(fnet, line);
+        if (ret < 0 && ret != -EEXIST && ret != -ENOENT)
+            return ret;
+    }
+    return 0;
+}
+
+int init_netns_overlay(struct net *net) {
+    RCU_INIT_POINTER(filter_net(net)->overlay, NULL);
+
+    if (!proc_create_net_single_write(OVERLAY_PROC_NAME, 0644, net->proc_net,
+                                      overlay_proc_show, overlay_proc_write, NULL))
+        return -ENOMEM;
+    return 0;
+}
+
+void cleanup_netns_overlay(struct net *net) {
+    remove_proc_entry(OVERLAY_PROC_NAME, net->proc_net);
+    overlay_release(&filter_net(net)->overlay);
+}
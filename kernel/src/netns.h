@@ -0,0 +1,54 @@
+#ifndef NETNS_H
+#define NETNS_H
+
+#include <linux/types.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/capability.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include "utils.h"
+#include "cache.h"
+
+/* Name of the overlay file in every namespace's /proc/net */
+#define OVERLAY_PROC_NAME       "network_filter_overlay"
+
+/*
+ * Per-namespace state, allocated by the pernet subsystem registered in
+ * init_netfilter(). The shared blocklist lives in the cache, a namespace
+ * only carries its own additions.
+ */
+struct filter_net {
+    struct domain_table __rcu *overlay;   /* NULL until the first overlay add */
+};
+
+extern unsigned int filter_net_id;
+
+static inline struct filter_net *filter_net(const struct net *net)
+{
+    return net_generic(net, filter_net_id);
+}
+
+/**
+ * init_netns_overlay - Create the overlay control file of a namespace
+ * @net: Namespace being set up
+ *
+ * Creates /proc/net/network_filter_overlay. Reading it lists the
+ * namespace's extra blocked domains, writing "+domain" or "domain" adds
+ * one and "-domain" removes one (one per line, CAP_NET_ADMIN in the
+ * namespace's user namespace required). Names match in any case, a
+ * write with an invalid name fails with -EINVAL at that line.
+ *
+ * Context: Process context only
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+int init_netns_overlay(struct net *net);
+
+/**
+ * cleanup_netns_overlay - Remove the overlay control file and free the overlay
+ * @net: Namespace being torn down, its hooks are already unregistered
+ */
+void cleanup_netns_overlay(struct net *net);
+
+#endif /* NETNS_H */
@@ -1,204 +1,477 @@
 #include "network.h"
 
+static bool tcp_control;
+module_param(tcp_control, bool, 0444);
+MODULE_PARM_DESC(tcp_control,
+                 "Also connect to the server over loopback TCP, for servers without netlink support (default: off)");
+
+/* Reconnect backoff, doubled after every failed attempt */
+#define RECONNECT_MIN_DELAY     HZ
+#define RECONNECT_MAX_DELAY     (60 * HZ)
+
 /* Private definitions */
 static struct socket *server_socket = NULL;
 static struct task_struct *connection_thread = NULL;
 static bool module_running = true;
+/* Lets cleanup_network() shut down a socket the thread is blocked on */
+static DEFINE_MUTEX(server_socket_lock);
+
+/*
+ * One control connection. Domains of a message are staged while it is
+ * scanned, its operation decides at the end whether the stage becomes
+ * the new list, a set of names to remove or garbage.
+ */
+struct server_session {
+    struct json_stream stream;
+    struct domain_stage *stage;
+};
+
+static int session_domain(void *ctx, const char *domain, size_t len) {
+    struct server_session *session = ctx;
+
+    if (!session->stage) {
+        session->stage = alloc_domain_stage();
+        if (!session->stage)
+            return -ENOMEM;
+    }
+    return domain_stage_add(session->stage, domain, len);
+}
 
 /**
- * validate_message - Validates server response contains success code
- * @buffer: Null-terminated string containing JSON message
+ * session_message - Apply one complete JSON message from the server
+ * @ctx: Session the message arrived on
+ * @js: Stream holding the message's fields
  *
- * Return: true if message contains success code, false otherwise
+ * Routes on the operation code:
+ * - CODE_ADD_DOMAIN_INT: Add domain to cache
+ * - CODE_REMOVE_DOMAIN_INT: Remove domain from cache
+ * - CODE_INIT_SETTINGS_INT: Replace the list with the staged domains
+ * - CODE_REMOVE_DOMAINS_INT: Remove the staged domains from cache
+ *
+ * Anything staged and not consumed by the operation is dropped.
  */
-static bool validate_message(const char *buffer) {    
-    char code_pattern[32];
-    snprintf(code_pattern, sizeof(code_pattern), "\"%s\"", CODE_SUCCESS);
-    
-    const char *code_pos = strstr(buffer, code_pattern);
-    bool valid = (code_pos != NULL);
-    
-    if (!valid)
-        printk(KERN_DEBUG MODULE_NAME ": Message validation result: Message is invalid\n");
-    
-    return valid;
+static void session_message(void *ctx, const struct json_stream *js) {
+    struct server_session *session = ctx;
+    struct domain_stage *stage = session->stage;
+    u64 start = nf_control_clock();
+    int operation = -1;
+
+    session->stage = NULL;
+
+    if (js->broken) {
+        printk(KERN_WARNING MODULE_NAME ": Malformed message dropped\n");
+        goto drop;
+    }
+
+    if (strcmp(js->code, CODE_SUCCESS))
+        goto drop;
+
+    if (kstrtoint(js->operation, 10, &operation))
+        operation = -1;
+
+    switch (operation) {
+        case CODE_ADD_DOMAIN_INT:
+        case CODE_REMOVE_DOMAIN_INT:
+            if (!js->content[0]) {
+                printk(KERN_WARNING MODULE_NAME ": Failed to get domain content\n");
+                break;
+            }
+            if (operation == CODE_ADD_DOMAIN_INT)
+                add_domain_to_cache(js->content);
+            else
+                remove_domain_from_cache(js->content);
+            break;
+
+        case CODE_INIT_SETTINGS_INT:
+            /* No domains at all is still a list */
+            if (!stage)
+                stage = alloc_domain_stage();
+            if (!stage) {
+                printk(KERN_WARNING MODULE_NAME ": Failed to allocate domain table\n");
+                goto out;
+            }
+            commit_domain_stage(stage);
+            printk(KERN_INFO MODULE_NAME ": Successfully initialized settings and domains\n");
+            goto out;
+
+        case CODE_REMOVE_DOMAINS_INT:
+            if (stage)
+                remove_domain_stage(stage);
+            goto out;
+
+        default:
+            printk(KERN_WARNING MODULE_NAME ": Invalid or unhandled operation code\n");
+            break;
+    }
+
+drop:
+    free_domain_stage(stage);
+out:
+    trace_nf_control(NF_CONTROL_JSON, operation, js->domains, start);
 }
 
+static const struct json_stream_ops session_ops = {
+    .domain = session_domain,
+    .message = session_message,
+};
+
 /**
- * handle_domain_operation - Process domain addition/removal requests
- * @buffer: Null-terminated string containing JSON message
- * @is_add: true for domain addition, false for removal
+ * recv_exact - Receive exactly @len bytes from the server
+ * @sock: Connected server socket
+ * @buffer: Destination buffer
+ * @len: Number of bytes to receive
  *
- * Extracts domain from JSON message and performs requested cache operation
+ * Return: 0 on success, -ECONNRESET if the server closed the connection,
+ *         negative error code otherwise
+ */
+static int recv_exact(struct socket *sock, void *buffer, size_t len) {
+    struct msghdr msg;
+    struct kvec iov;
+    int ret;
+
+    while (len) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buffer;
+        iov.iov_len = len;
+
+        ret = kernel_recvmsg(sock, &msg, &iov, 1, len, MSG_WAITALL);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            return -ECONNRESET;
+
+        buffer += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/**
+ * process_server_frame - Receive and apply one binary frame
+ * @sock: Connected server socket
+ * @buffered: Bytes already received, starting with FRAME_MAGIC
+ * @avail: Number of bytes at @buffered
+ *
+ * Takes the header and as much payload as possible from @buffered and
+ * reads the rest from @sock, the payload may be far larger than
+ * MAX_PAYLOAD. All records are applied in one cache call.
  *
- * Return: true on success, false on failure
+ * Return: Number of bytes used from @buffered on success or an ignored
+ *         frame, negative error code if the stream can no longer be trusted
  */
-static bool handle_domain_operation(const char *buffer, bool is_add) {
-    const char *value_start;
-    size_t value_len;
-    int ret = get_json_value(buffer, STR_CONTENT, &value_start, &value_len);
-    
-    if (ret < 0) {
-        printk(KERN_WARNING MODULE_NAME ": Failed to get domain content: %d\n", ret);
-        return false;
+static int process_server_frame(struct socket *sock, const char *buffered, size_t avail) {
+    struct frame_header header;
+    size_t used, copied;
+    u32 length;
+    char *payload;
+    u64 start = nf_control_clock();
+    int ret;
+
+    used = min(avail, sizeof(header));
+    memcpy(&header, buffered, used);
+    ret = recv_exact(sock, (u8 *)&header + used, sizeof(header) - used);
+    if (ret < 0)
+        return ret;
+
+    length = ntohl(header.length);
+    if (length > FRAME_MAX_PAYLOAD) {
+        printk(KERN_ERR MODULE_NAME ": Frame of %u bytes exceeds limit\n", length);
+        return -EMSGSIZE;
     }
-    
-    if (value_len >= MAX_DOMAIN_LENGTH) {
-        printk(KERN_WARNING MODULE_NAME ": Domain too long\n");
-        return false;
+
+    payload = kvmalloc(max_t(u32, length, 1), GFP_KERNEL);
+    if (!payload)
+        return -ENOMEM;
+
+    copied = min_t(size_t, avail - used, length);
+    memcpy(payload, buffered + used, copied);
+    used += copied;
+
+    ret = recv_exact(sock, payload + copied, length - copied);
+    if (ret < 0)
+        goto out;
+
+    switch (header.opcode) {
+        case FRAME_OP_ADD_DOMAINS:
+            ret = add_domain_list(frame_for_each_domain, payload, length, PROFILES_ALL, 0);
+            break;
+
+        case FRAME_OP_REMOVE_DOMAINS:
+            ret = remove_domain_list(frame_for_each_domain, payload, length, PROFILES_ALL, 0);
+            break;
+
+        case FRAME_OP_LOAD_DOMAINS:
+            ret = load_domain_frame(payload, length);
+            break;
+
+        case FRAME_OP_LIST_VERSION: {
+            const struct frame_list_version *lv = (const void *)payload;
+
+            if (length != sizeof(*lv)) {
+                ret = -EINVAL;
+                break;
+            }
+            set_list_version(ntohl(lv->epoch), be64_to_cpu(lv->version));
+            break;
+        }
+
+        case FRAME_OP_SET_CATEGORIES:
+            if (length != 1) {
+                ret = -EINVAL;
+                break;
+            }
+            set_enabled_categories(payload[0]);
+            ret = 0;
+            break;
+
+        case FRAME_OP_SET_PAUSED:
+            if (length != 1) {
+                ret = -EINVAL;
+                break;
+            }
+            set_filter_paused(payload[0]);
+            ret = 0;
+            break;
+
+        default:
+            printk(KERN_WARNING MODULE_NAME ": Unknown frame opcode %u\n", header.opcode);
+            ret = 0;
+            break;
     }
-    
-    char domain[MAX_DOMAIN_LENGTH];
-    memcpy(domain, value_start, value_len);
-    domain[value_len] = '\0';
-    
-    if (is_add)
-        add_domain_to_cache(domain);
-     else 
-        remove_domain_from_cache(domain);
-
-    return true;
+
+    /* A bad record only spoils this frame, the stream stays in sync */
+    if (ret < 0)
+        printk(KERN_WARNING MODULE_NAME ": Frame opcode %u failed: %d\n", header.opcode, ret);
+    trace_nf_control(NF_CONTROL_FRAME, header.opcode, length, start);
+    ret = used;
+out:
+    kvfree(payload);
+    return ret;
 }
 
 /**
- * handle_initial_settings - Process initial settings message
- * @buffer: Null-terminated string containing JSON message
+ * send_list_version - Tell the server which list version the cache holds
+ * @sock: Freshly connected server socket
  *
- * Parses initial domain list and settings from server
+ * The server answers with the changes since that version, or the full
+ * list if it cannot.
  *
- * Return: true on success, false on failure
+ * Return: 0 on success, negative error code on failure
  */
-static bool handle_initial_settings(const char *buffer) {
-    int ret = 0;
-    ret = parse_domains(buffer);
+static int send_list_version(struct socket *sock) {
+    struct {
+        struct frame_header header;
+        struct frame_list_version body;
+    } __attribute__((packed)) frame;
+    struct msghdr msg;
+    struct kvec iov;
+    u64 version;
+    u32 epoch;
+    int ret;
+
+    get_list_version(&epoch, &version);
+
+    frame.header.magic = FRAME_MAGIC;
+    frame.header.opcode = FRAME_OP_LIST_VERSION;
+    frame.header.reserved = 0;
+    frame.header.length = htonl(sizeof(frame.body));
+    frame.body.epoch = htonl(epoch);
+    frame.body.version = cpu_to_be64(version);
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &frame;
+    iov.iov_len = sizeof(frame);
+
+    ret = kernel_sendmsg(sock, &msg, &iov, 1, sizeof(frame));
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * connect_server - Open a connection to the management server
+ * @sockp: Filled with the connected socket
+ *
+ * Return: 0 on success, negative error code on failure
+ */
+static int connect_server(struct socket **sockp) {
+    struct sockaddr_in server_addr;
+    struct socket *sock;
+    int ret;
+
+    ret = sock_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+    if (ret < 0)
+        return ret;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_addr.s_addr = in_aton(SERVER_IP);
+
+    ret = kernel_connect(sock, (struct sockaddr *)&server_addr,
+                         sizeof(server_addr), 0);
     if (ret < 0) {
-        printk(KERN_WARNING MODULE_NAME ": Failed to parse domains: %d\n", ret);
-        return false;
+        sock_release(sock);
+        return ret;
     }
 
-    printk(KERN_INFO MODULE_NAME ": Successfully initialized settings and domains\n");
-    return true;
+    *sockp = sock;
+    return 0;
 }
 
 /**
- * process_server_message - Process incoming JSON messages from server
- * @buffer: Null-terminated string containing JSON message
+ * serve_connection - Process server messages until the connection ends
+ * @sock: Connected server socket
+ * @session: Session state, reset by the caller afterwards
+ * @buffer: Receive buffer of MAX_PAYLOAD bytes
  *
- * Validates message and routes to appropriate handler based on operation code:
- * - CODE_ADD_DOMAIN_INT: Add domain to cache
- * - CODE_REMOVE_DOMAIN_INT: Remove domain from cache
- * - CODE_INIT_SETTINGS_INT: Initialize domain list
+ * Received bytes go through the JSON stream as they arrive. A byte of
+ * FRAME_MAGIC between messages starts a binary frame instead.
  *
- * Return: 0 on success, -EINVAL on validation or processing failure
+ * Return: Negative error code the connection ended with
  */
-static int process_server_message(const char *buffer) {
-    
-    if (!validate_message(buffer)) {
-        printk(KERN_WARNING MODULE_NAME ": Message validation failed\n");
-        return 0;
-    }
-    
-    switch (get_operation_code(buffer)) {
-        case CODE_ADD_DOMAIN_INT:
-            printk(KERN_DEBUG MODULE_NAME ": Handling add domain\n");
-            return handle_domain_operation(buffer, true) ? 0 : -EINVAL;
-            
-        case CODE_REMOVE_DOMAIN_INT:
-            printk(KERN_DEBUG MODULE_NAME ": Handling remove domain\n");
-            return handle_domain_operation(buffer, false) ? 0 : -EINVAL;
-            
-        case CODE_INIT_SETTINGS_INT:
-            printk(KERN_DEBUG MODULE_NAME ": Handling initial settings\n");
-            return handle_initial_settings(buffer) ? 0 : -EINVAL;
+static int serve_connection(struct socket *sock, struct server_session *session, char *buffer) {
+    struct msghdr msg;
+    struct kvec iov;
+    size_t pos;
+    int ret;
 
-        default:
-            printk(KERN_WARNING MODULE_NAME ": Invalid or unhandled operation code\n");
-            return -EINVAL;
+    while (!kthread_should_stop()) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buffer;
+        iov.iov_len = MAX_PAYLOAD;
+
+        ret = kernel_recvmsg(sock, &msg, &iov, 1, MAX_PAYLOAD, 0);
+        if (ret == 0)
+            return -ECONNRESET;
+        if (ret < 0)
+            return ret;
+
+        for (pos = 0; pos < ret; ) {
+            int used;
+
+            if (json_stream_idle(&session->stream) && (u8)buffer[pos] == FRAME_MAGIC) {
+                used = process_server_frame(sock, buffer + pos, ret - pos);
+                if (used < 0) {
+                    printk(KERN_ERR MODULE_NAME ": Frame error: %d\n", used);
+                    return used;
+                }
+            } else {
+                used = json_stream_feed(&session->stream, buffer + pos, ret - pos);
+            }
+            pos += used;
+        }
     }
+    return -ESHUTDOWN;
 }
 
 /**
  * connection_handler - Kernel thread for handling server communication
  * @data: Thread data (unused)
  *
- * Continuously listens for messages from server and processes them
- * until module_running is set to false
+ * Keeps a connection to the server until the module unloads. After
+ * every connect the server learns the list version the cache holds and
+ * sends what changed since. A lost or refused connection is retried
+ * with exponential backoff between RECONNECT_MIN_DELAY and
+ * RECONNECT_MAX_DELAY, filtering goes on with the last list meanwhile.
  *
  * Return: 0 on normal exit, -ENOMEM on memory allocation failure
  */
 static int connection_handler(void *data) {
-    struct socket *sock = server_socket;
+    unsigned long delay = RECONNECT_MIN_DELAY;
+    struct server_session *session;
+    struct socket *sock;
     char *buffer;
-    struct msghdr msg;
-    struct kvec iov;
     int ret;
 
     buffer = kmalloc(MAX_PAYLOAD, GFP_KERNEL);
-    if (!buffer)
+    session = kzalloc(sizeof(*session), GFP_KERNEL);
+    if (!buffer || !session) {
+        kfree(buffer);
+        kfree(session);
         return -ENOMEM;
+    }
 
-    while (module_running) {
-        memset(&msg, 0, sizeof(msg));
-        iov.iov_base = buffer;
-        iov.iov_len = MAX_PAYLOAD - 1;
-
-        if (server_socket)
-            printk(KERN_DEBUG MODULE_NAME ": Listening...\n");
-        ret = kernel_recvmsg(sock, &msg, &iov, 1, MAX_PAYLOAD - 1, 0);
-        if (ret > 0) {
-            buffer[ret] = '\0';
-            printk(KERN_DEBUG MODULE_NAME ": Received message from server: %s\n", buffer);
-            process_server_message(buffer);
+    while (!kthread_should_stop()) {
+        ret = connect_server(&sock);
+        if (ret < 0) {
+            printk(KERN_DEBUG MODULE_NAME ": Failed to connect to server: %d\n", ret);
+            goto backoff;
         }
-        else if (ret < 0) {
-            printk(KERN_ERR MODULE_NAME ": Connection error: %d\n", ret);
+
+        mutex_lock(&server_socket_lock);
+        if (!module_running) {
+            mutex_unlock(&server_socket_lock);
+            sock_release(sock);
             break;
         }
+        server_socket = sock;
+        mutex_unlock(&server_socket_lock);
+
+        printk(KERN_INFO MODULE_NAME ": Connected to server\n");
+        json_stream_init(&session->stream, &session_ops, session);
+
+        ret = send_list_version(sock);
+        if (!ret) {
+            delay = RECONNECT_MIN_DELAY;
+            ret = serve_connection(sock, session, buffer);
+        }
+
+        mutex_lock(&server_socket_lock);
+        server_socket = NULL;
+        mutex_unlock(&server_socket_lock);
+        sock_release(sock);
+
+        /* A message cut off by the disconnect is dropped with its domains */
+        free_domain_stage(session->stage);
+        session->stage = NULL;
+
+        printk(KERN_WARNING MODULE_NAME ": Connection error: %d\n", ret);
+
+backoff:
+        if (kthread_should_stop())
+            break;
+        schedule_timeout_interruptible(delay);
+        delay = min(delay * 2, (unsigned long)RECONNECT_MAX_DELAY);
     }
 
+    kfree(session);
     kfree(buffer);
     return 0;
 }
 
 int init_network(void) {
-    struct sockaddr_in server_addr;
-    int ret;
-
-    ret = sock_create(AF_INET, SOCK_STREAM, IPPROTO_TCP, &server_socket);
-    if (ret < 0) {
-        printk(KERN_ERR MODULE_NAME ": Failed to create socket\n");
-        return ret;
-    }
-
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = in_aton(SERVER_IP);
-
-    ret = kernel_connect(server_socket, (struct sockaddr *)&server_addr, 
-                        sizeof(server_addr), 0);
-    if (ret < 0) {
-        printk(KERN_ERR MODULE_NAME ": Failed to connect to server\n");
-        sock_release(server_socket);
-        return ret;
+    if (!tcp_control) {
+        printk(KERN_INFO MODULE_NAME ": TCP control channel disabled, using netlink\n");
+        return 0;
     }
 
-    connection_thread = kthread_run(connection_handler, NULL, MODULE_NAME "_conn");
+    connection_thread = kthread_create(connection_handler, NULL, MODULE_NAME "_conn");
     if (IS_ERR(connection_thread)) {
+        int ret = PTR_ERR(connection_thread);
+
         printk(KERN_ERR MODULE_NAME ": Failed to create connection thread\n");
-        sock_release(server_socket);
-        return PTR_ERR(connection_thread);
+        connection_thread = NULL;
+        return ret;
     }
+    /* The thread may return before kthread_stop(), which needs it still around */
+    get_task_struct(connection_thread);
+    wake_up_process(connection_thread);
     printk(KERN_INFO MODULE_NAME ": Network initialized\n");
 
     return 0;
 }
 
 void cleanup_network(void) {
+    mutex_lock(&server_socket_lock);
     module_running = false;
-    if (connection_thread)
-        kthread_stop(connection_thread);
+    /* Wakes the thread out of kernel_recvmsg() */
     if (server_socket)
-        sock_release(server_socket);
+        kernel_sock_shutdown(server_socket, SHUT_RDWR);
+    mutex_unlock(&server_socket_lock);
+
+    if (connection_thread) {
+        kthread_stop(connection_thread);
+        put_task_struct(connection_thread);
+    }
+    connection_thread = NULL;
     printk(KERN_INFO MODULE_NAME ": Network cleaned up\n");
 }
@@ -6,6 +6,8 @@
 #include <linux/tcp.h>
 #include <net/netfilter/nf_socket.h>
 #include <linux/inet.h>
+#include <linux/kthread.h>
+#include <linux/sched/task.h>
 #include "utils.h"
 #include "cache.h"
 #include "json_parser.h"
@@ -13,8 +15,11 @@
 /**
  * init_network - Initialize network connection to management server
  *
- * Creates TCP socket, connects to management server and starts
- * connection handler thread for receiving commands.
+ * Starts the connection handler thread, which connects to the
+ * management server, reconnects with backoff when the server goes
+ * away and resyncs the list from the version the cache holds. Only
+ * done with the tcp_control parameter, the server normally drives the
+ * generic netlink family instead.
  *
  * Context: Process context only (may sleep)
  *
@@ -25,7 +30,7 @@ int init_network(void);
 /**
  * cleanup_network - Clean up network resources
  *
- * Stops connection handler thread and releases socket.
+ * Shuts down the server socket and stops the connection handler thread.
  * Should be called during module cleanup.
  *
  * Context: Process context only (may sleep)
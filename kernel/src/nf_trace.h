@@ -0,0 +1,211 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM network_filter
+
+#ifndef NF_TRACE_DEFS_H
+#define NF_TRACE_DEFS_H
+
+#include <linux/ktime.h>
+#include <linux/netfilter.h>
+#include "dns_name.h"
+
+/* Where a control message came from, see trace_nf_control() */
+enum nf_control_source {
+    NF_CONTROL_JSON,            /* JSON message on the TCP channel */
+    NF_CONTROL_FRAME,           /* Binary frame on the TCP channel */
+    NF_CONTROL_GENL,            /* Generic netlink command */
+};
+
+/*
+ * Start of a control message for trace_nf_control(), 0 while the event
+ * is off so the clock is only read for someone listening.
+ */
+#define nf_control_clock() (trace_nf_control_enabled() ? ktime_get_ns() : 0)
+
+#endif /* NF_TRACE_DEFS_H */
+
+/*
+ * Static tracepoints of the packet and control paths, under
+ * events/network_filter/ in tracefs. A disabled tracepoint is a patched
+ * out branch, nothing below is evaluated unless someone listens, e.g.
+ *   perf record -e 'network_filter:*' -a
+ *   bpftrace -e 'tracepoint:network_filter:nf_cache_lookup { @[args->depth] = count(); }'
+ */
+#if !defined(NF_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define NF_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_DEFINE_ENUM(NF_INET_PRE_ROUTING);
+TRACE_DEFINE_ENUM(NF_INET_FORWARD);
+TRACE_DEFINE_ENUM(NF_INET_LOCAL_OUT);
+TRACE_DEFINE_ENUM(NFPROTO_IPV4);
+TRACE_DEFINE_ENUM(NFPROTO_IPV6);
+TRACE_DEFINE_ENUM(NF_CONTROL_JSON);
+TRACE_DEFINE_ENUM(NF_CONTROL_FRAME);
+TRACE_DEFINE_ENUM(NF_CONTROL_GENL);
+
+#define show_nf_hook(hook) __print_symbolic(hook,               \
+    { NF_INET_PRE_ROUTING, "PRE_ROUTING" },                     \
+    { NF_INET_FORWARD,     "FORWARD" },                         \
+    { NF_INET_LOCAL_OUT,   "LOCAL_OUT" })
+
+#define show_nf_pf(pf) __print_symbolic(pf,                     \
+    { NFPROTO_IPV4, "ipv4" },                                   \
+    { NFPROTO_IPV6, "ipv6" })
+
+#define show_nf_control(source) __print_symbolic(source,        \
+    { NF_CONTROL_JSON,  "json" },                               \
+    { NF_CONTROL_FRAME, "frame" },                              \
+    { NF_CONTROL_GENL,  "genl" })
+
+/* Every packet a hook sees, before it is looked at */
+TRACE_EVENT(nf_hook_entry,
+    TP_PROTO(unsigned int hook, u8 pf, unsigned int len),
+    TP_ARGS(hook, pf, len),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, hook)
+        __field(u8, pf)
+        __field(unsigned int, len)
+    ),
+
+    TP_fast_assign(
+        __entry->hook = hook;
+        __entry->pf = pf;
+        __entry->len = len;
+    ),
+
+    TP_printk("hook=%s pf=%s len=%u", show_nf_hook(__entry->hook),
+              show_nf_pf(__entry->pf), __entry->len)
+);
+
+/* The verdict a hook returns, paired with nf_hook_entry on the same CPU */
+TRACE_EVENT(nf_hook_exit,
+    TP_PROTO(unsigned int hook, u8 pf, unsigned int verdict),
+    TP_ARGS(hook, pf, verdict),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, hook)
+        __field(u8, pf)
+        __field(unsigned int, verdict)
+    ),
+
+    TP_fast_assign(
+        __entry->hook = hook;
+        __entry->pf = pf;
+        __entry->verdict = verdict;
+    ),
+
+    TP_printk("hook=%s pf=%s verdict=%s", show_nf_hook(__entry->hook),
+              show_nf_pf(__entry->pf), __entry->verdict == NF_DROP ? "DROP" : "ACCEPT")
+);
+
+/* Question name of a DNS packet, @ret as parse_dns_name() returned it */
+TRACE_EVENT(nf_dns_parse,
+    TP_PROTO(const struct dns_name *name, int ret),
+    TP_ARGS(name, ret),
+
+    TP_STRUCT__entry(
+        __string(domain, ret > 0 ? name->domain : "")
+        __field(int, ret)
+        __field(u8, labels)
+    ),
+
+    TP_fast_assign(
+        __assign_str(domain);
+        __entry->ret = ret;
+        __entry->labels = ret > 0 ? name->nr_labels : 0;
+    ),
+
+    TP_printk("domain=%s ret=%d labels=%u", __get_str(domain), __entry->ret, __entry->labels)
+);
+
+/*
+ * One is_domain_blocked() call. @hash is the cache hash of the last
+ * suffix probed, the matching one or the full name, and @depth the
+ * number of suffixes probed to reach the verdict.
+ */
+TRACE_EVENT(nf_cache_lookup,
+    TP_PROTO(const struct dns_name *name, u32 hash, unsigned int depth, bool blocked),
+    TP_ARGS(name, hash, depth, blocked),
+
+    TP_STRUCT__entry(
+        __string(domain, name->domain)
+        __field(u32, hash)
+        __field(unsigned int, depth)
+        __field(bool, blocked)
+    ),
+
+    TP_fast_assign(
+        __assign_str(domain);
+        __entry->hash = hash;
+        __entry->depth = depth;
+        __entry->blocked = blocked;
+    ),
+
+    TP_printk("domain=%s hash=%08x depth=%u verdict=%s", __get_str(domain), __entry->hash,
+              __entry->depth, __entry->blocked ? "blocked" : "allowed")
+);
+
+/*
+ * A blocked name acted on: a response rewritten to NXDOMAIN, or a query
+ * answered with one (@reply). @ret is 0 on success.
+ */
+TRACE_EVENT(nf_rewrite,
+    TP_PROTO(const struct dns_name *name, u8 pf, bool reply, int ret),
+    TP_ARGS(name, pf, reply, ret),
+
+    TP_STRUCT__entry(
+        __string(domain, name->domain)
+        __field(u8, pf)
+        __field(bool, reply)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __assign_str(domain);
+        __entry->pf = pf;
+        __entry->reply = reply;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("domain=%s pf=%s action=%s ret=%d", __get_str(domain), show_nf_pf(__entry->pf),
+              __entry->reply ? "reply" : "rewrite", __entry->ret)
+);
+
+/*
+ * A control message applied. @op is the JSON operation, frame opcode or
+ * netlink command, @len the payload bytes, or the domains of a JSON
+ * message, and @start its nf_control_clock().
+ */
+TRACE_EVENT(nf_control,
+    TP_PROTO(unsigned int source, int op, u32 len, u64 start),
+    TP_ARGS(source, op, len, start),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, source)
+        __field(int, op)
+        __field(u32, len)
+        __field(u64, duration)
+    ),
+
+    TP_fast_assign(
+        __entry->source = source;
+        __entry->op = op;
+        __entry->len = len;
+        /* Enabled while the message was being applied */
+        __entry->duration = start ? ktime_get_ns() - start : 0;
+    ),
+
+    TP_printk("source=%s op=%d len=%u duration_ns=%llu", show_nf_control(__entry->source),
+              __entry->op, __entry->len, __entry->duration)
+);
+
+#endif /* NF_TRACE_H */
+
+/* Outside the guard, define_trace.h reads the header again */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE nf_trace
+#include <trace/define_trace.h>
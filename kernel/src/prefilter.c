@@ -0,0 +1,22 @@
+#include "prefilter.h"
+
+int init_prefilter(struct domain_prefilter *filter, size_t capacity) {
+    size_t blocks = DIV_ROUND_UP(capacity * PREFILTER_BITS_PER_ENTRY, PREFILTER_BLOCK_BITS);
+
+    blocks = roundup_pow_of_two(max_t(size_t, blocks, 1));
+
+    /* Power-of-two sizes keep every block inside one cache line */
+    filter->bits = kvzalloc(blocks * (PREFILTER_BLOCK_BITS / BITS_PER_BYTE), GFP_KERNEL);
+    if (!filter->bits) {
+        filter->mask = 0;
+        return -ENOMEM;
+    }
+
+    filter->mask = blocks - 1;
+    return 0;
+}
+
+void cleanup_prefilter(struct domain_prefilter *filter) {
+    kvfree(filter->bits);
+    filter->bits = NULL;
+}
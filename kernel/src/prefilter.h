@@ -0,0 +1,108 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/cache.h>
+#include <linux/jhash.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include "utils.h"
+
+/*
+ * Blocked Bloom filter in front of the domain table. Every key maps to
+ * a single cache-line sized block and sets PREFILTER_HASHES bits inside
+ * it, so a test costs one cache line read. There are no false
+ * negatives: a clear bit means the key was never added. Removed keys
+ * keep their bits until the next rebuild.
+ */
+#define PREFILTER_BLOCK_BITS        512     /* One 64-byte cache line */
+#define PREFILTER_BITS_PER_ENTRY    12      /* About 0.5% false positives at capacity */
+#define PREFILTER_HASHES            6
+#define PREFILTER_SEED              0x5bd1e995
+
+struct domain_prefilter {
+    u32 mask;                /* Number of blocks - 1, a power of two */
+    unsigned long *bits;     /* Blocks of PREFILTER_BLOCK_BITS, zeroed at allocation */
+};
+
+/*
+ * @hash is already a seeded jhash, its low bits pick the block and a
+ * second mix of it yields the bit positions inside the block.
+ */
+static inline unsigned long *prefilter_block(const struct domain_prefilter *filter,
+                                             u32 hash, u32 *probe)
+{
+    *probe = jhash_1word(hash, PREFILTER_SEED);
+    return filter->bits + (size_t)(hash & filter->mask) *
+                          (PREFILTER_BLOCK_BITS / BITS_PER_LONG);
+}
+
+/**
+ * prefilter_test - Check whether a key may be present
+ * @filter: Filter to test, no filter means every key may be present
+ * @hash: Key hash, as stored in domain_entry.hash
+ *
+ * Context: Any context, callers hold the RCU read lock on the owning table
+ *
+ * Return: false if the key is definitely absent, true if it may be present
+ */
+static inline bool prefilter_test(const struct domain_prefilter *filter, u32 hash)
+{
+    const unsigned long *block;
+    u32 probe, step;
+    int i;
+
+    if (!filter->bits)
+        return true;
+
+    block = prefilter_block(filter, hash, &probe);
+    step = (probe >> 9) | 1;
+    for (i = 0; i < PREFILTER_HASHES; i++, probe += step) {
+        if (!test_bit(probe % PREFILTER_BLOCK_BITS, block))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * prefilter_add - Add a key to a filter
+ * @filter: Filter to update, ignored if it was never allocated
+ * @hash: Key hash, as stored in domain_entry.hash
+ *
+ * Context: Any context, concurrent readers see either the old or new bit
+ */
+static inline void prefilter_add(struct domain_prefilter *filter, u32 hash)
+{
+    unsigned long *block;
+    u32 probe, step;
+    int i;
+
+    if (!filter->bits)
+        return;
+
+    block = prefilter_block(filter, hash, &probe);
+    step = (probe >> 9) | 1;
+    for (i = 0; i < PREFILTER_HASHES; i++, probe += step)
+        set_bit(probe % PREFILTER_BLOCK_BITS, block);
+}
+
+/**
+ * init_prefilter - Allocate an empty filter
+ * @filter: Filter to initialize
+ * @capacity: Expected number of keys, the false positive rate grows beyond it
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: 0 on success, -ENOMEM on failure (@filter then accepts every key)
+ */
+int init_prefilter(struct domain_prefilter *filter, size_t capacity);
+
+/**
+ * cleanup_prefilter - Free the bits of a filter
+ * @filter: Filter to free, no longer visible to readers
+ */
+void cleanup_prefilter(struct domain_prefilter *filter);
+
+#endif /* PREFILTER_H */
@@ -0,0 +1,160 @@
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include "profiles.h"
+
+/* A prefix length some rule has, lookups try them longest first */
+struct profile_prefix {
+    u8 family;
+    u8 prefix_len;
+};
+
+/*
+ * Rules hashed by family, prefix length and masked address, one open
+ * addressing table for all of them. A lookup masks the client address
+ * to each prefix length in use and probes once per length, so its cost
+ * follows the distinct lengths, not the number of rules.
+ */
+struct profile_table {
+    struct rcu_head rcu;
+    u32 mask;                           /* Slots - 1, at most half of them used */
+    u32 nr_prefixes;
+    struct profile_prefix prefixes[33 + 129];   /* Every IPv4 and IPv6 length at most */
+    struct nf_profile_rule slots[];     /* family 0 marks a free slot */
+};
+
+static struct profile_table __rcu *profile_table;
+static DEFINE_MUTEX(profile_lock);
+
+/* @addr cut to @prefix_len bits and zero-padded to 16 bytes */
+static void prefix_key(u8 *key, const u8 *addr, unsigned int prefix_len)
+{
+    unsigned int bytes = prefix_len / 8;
+    unsigned int bits = prefix_len % 8;
+
+    memcpy(key, addr, bytes);
+    if (bits) {
+        key[bytes] = addr[bytes] & (0xff00 >> bits);
+        bytes++;
+    }
+    memset(key + bytes, 0, 16 - bytes);
+}
+
+static u32 prefix_slot(const struct profile_table *table, const u8 *key, u8 family, u8 prefix_len)
+{
+    return jhash(key, 16, ((u32)family << 8) | prefix_len) & table->mask;
+}
+
+u32 client_profile_mask(u8 family, const void *addr) {
+    const struct profile_table *table = rcu_dereference(profile_table);
+    const struct nf_profile_rule *rule;
+    u8 key[16];
+    u32 i, slot;
+
+    if (!table)
+        return BIT(PROFILE_DEFAULT);
+
+    for (i = 0; i < table->nr_prefixes; i++) {
+        const struct profile_prefix *prefix = &table->prefixes[i];
+
+        if (prefix->family != family)
+            continue;
+
+        prefix_key(key, addr, prefix->prefix_len);
+        slot = prefix_slot(table, key, family, prefix->prefix_len);
+        for (; (rule = &table->slots[slot])->family; slot = (slot + 1) & table->mask) {
+            if (rule->family == family && rule->prefix_len == prefix->prefix_len &&
+                !memcmp(rule->addr, key, sizeof(key)))
+                return BIT(rule->profile);
+        }
+    }
+    return BIT(PROFILE_DEFAULT);
+}
+
+static int compare_prefixes(const void *a, const void *b)
+{
+    const struct profile_prefix *x = a, *y = b;
+
+    return (int)y->prefix_len - (int)x->prefix_len;
+}
+
+/* Hash @rule into @table, a second rule for the same subnet is dropped */
+static void insert_rule(struct profile_table *table, const struct nf_profile_rule *rule)
+{
+    struct nf_profile_rule *slot;
+    u8 key[16];
+    u32 i;
+
+    prefix_key(key, rule->addr, rule->prefix_len);
+    i = prefix_slot(table, key, rule->family, rule->prefix_len);
+    for (; (slot = &table->slots[i])->family; i = (i + 1) & table->mask) {
+        if (slot->family == rule->family && slot->prefix_len == rule->prefix_len &&
+            !memcmp(slot->addr, key, sizeof(key)))
+            return;
+    }
+
+    *slot = *rule;
+    memcpy(slot->addr, key, sizeof(key));
+
+    for (i = 0; i < table->nr_prefixes; i++) {
+        if (table->prefixes[i].family == rule->family &&
+            table->prefixes[i].prefix_len == rule->prefix_len)
+            return;
+    }
+    table->prefixes[table->nr_prefixes].family = rule->family;
+    table->prefixes[table->nr_prefixes].prefix_len = rule->prefix_len;
+    table->nr_prefixes++;
+}
+
+int set_profile_rules(const struct nf_profile_rule *rules, u32 count) {
+    struct profile_table *table = NULL, *old;
+    u32 i, slots;
+
+    if (count > PROFILE_RULES_MAX)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if ((rules[i].family != AF_INET || rules[i].prefix_len > 32) &&
+            (rules[i].family != AF_INET6 || rules[i].prefix_len > 128))
+            return -EINVAL;
+        if (rules[i].profile >= PROFILE_MAX)
+            return -EINVAL;
+    }
+
+    if (count) {
+        slots = roundup_pow_of_two(count * 2);
+        table = kvzalloc(struct_size(table, slots, slots), GFP_KERNEL);
+        if (!table)
+            return -ENOMEM;
+
+        table->mask = slots - 1;
+        for (i = 0; i < count; i++)
+            insert_rule(table, &rules[i]);
+        sort(table->prefixes, table->nr_prefixes, sizeof(*table->prefixes),
+             compare_prefixes, NULL);
+    }
+
+    mutex_lock(&profile_lock);
+    old = rcu_replace_pointer(profile_table, table, lockdep_is_held(&profile_lock));
+    mutex_unlock(&profile_lock);
+
+    if (old)
+        kvfree_rcu(old, rcu);
+
+    printk(KERN_INFO MODULE_NAME ": Loaded %u client profile rules\n", count);
+    return 0;
+}
+
+void cleanup_profiles(void) {
+    struct profile_table *table;
+
+    mutex_lock(&profile_lock);
+    table = rcu_replace_pointer(profile_table, NULL, lockdep_is_held(&profile_lock));
+    mutex_unlock(&profile_lock);
+
+    synchronize_rcu();
+    kvfree(table);
+}
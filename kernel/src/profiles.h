@@ -0,0 +1,65 @@
+#ifndef PROFILES_H
+#define PROFILES_H
+
+#include <linux/types.h>
+#include <linux/socket.h>
+#include <linux/rcupdate.h>
+#include "utils.h"
+
+/*
+ * Per-client policy profiles. A rule maps a client subnet to one of
+ * PROFILE_MAX profiles, and every cache entry carries the mask of the
+ * profiles it blocks (see struct domain_entry), so the single hash
+ * lookup per suffix answers for all profiles at once.
+ */
+#define PROFILE_MAX             32
+#define PROFILE_DEFAULT         0           /* Clients that match no rule */
+#define PROFILE_RULES_MAX       1024
+#define PROFILES_ALL            U32_MAX     /* Shared list entries block everyone */
+
+/* One rule as sent in NF_ATTR_PROFILE_RULES, layout matches the server's */
+struct nf_profile_rule {
+    u8 family;                  /* AF_INET or AF_INET6 */
+    u8 prefix_len;
+    u8 profile;                 /* Below PROFILE_MAX */
+    u8 reserved;
+    u8 addr[16];                /* Network order, IPv4 in the first 4 bytes */
+} __attribute__((packed));
+
+/**
+ * client_profile_mask - Profile bit of a client address
+ * @family: AF_INET or AF_INET6
+ * @addr: 4 or 16 byte address in network order
+ *
+ * The longest matching prefix wins. Rules are hashed per prefix length,
+ * so a lookup costs one probe per distinct length in use, however many
+ * rules there are; with no rules this is a single pointer test.
+ *
+ * Context: Any context, callers hold the RCU read lock
+ *
+ * Return: BIT() of the client's profile, BIT(PROFILE_DEFAULT) if no rule matches
+ */
+u32 client_profile_mask(u8 family, const void *addr);
+
+/**
+ * set_profile_rules - Replace the client rules
+ * @rules: New rules, in any order
+ * @count: Number of rules, 0 puts every client in PROFILE_DEFAULT
+ *
+ * Host bits past each prefix are ignored. Readers see either the old
+ * or the new rules.
+ *
+ * Context: Process context only (may sleep)
+ *
+ * Return: 0 on success, -EINVAL for a malformed rule, -ENOMEM
+ */
+int set_profile_rules(const struct nf_profile_rule *rules, u32 count);
+
+/**
+ * cleanup_profiles - Free the client rules
+ *
+ * Context: Process context, after the hooks and the netlink family are unregistered
+ */
+void cleanup_profiles(void);
+
+#endif /* PROFILES_H */
@@ -0,0 +1,83 @@
+#include "stats.h"
+
+DEFINE_PER_CPU_ALIGNED(struct nf_stats, nf_stats);
+struct dentry *nf_debugfs_dir;
+
+static const char * const stat_names[__STAT_MAX] = {
+    [STAT_PACKETS]       = "packets",
+    [STAT_DNS_RESPONSES] = "dns_responses",
+    [STAT_DNS_QUERIES]   = "dns_queries",
+    [STAT_ANSWERED]      = "answered",
+    [STAT_PARSE_ERRORS]  = "parse_errors",
+    [STAT_LOOKUPS]       = "lookups",
+    [STAT_PROBES]        = "probes",
+    [STAT_FILTER_NEGATIVES]       = "filter_negatives",
+    [STAT_FILTER_FALSE_POSITIVES] = "filter_false_positives",
+    [STAT_HITS]          = "hits",
+    [STAT_BLOCKED]       = "blocked",
+};
+
+void stats_read(struct nf_stats *sum) {
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        const struct nf_stats *stats = per_cpu_ptr(&nf_stats, cpu);
+
+        for (i = 0; i < __STAT_MAX; i++)
+            sum->items[i] += READ_ONCE(stats->items[i]);
+        for (i = 0; i < HOOK_LATENCY_BUCKETS; i++)
+            sum->latency[i] += READ_ONCE(stats->latency[i]);
+    }
+}
+
+/*
+ * One "name value" pair per line, followed by the prefilter false
+ * positive rate in parts per million of the keys it was asked about
+ * that were not in the table.
+ */
+static int stats_show(struct seq_file *m, void *v)
+{
+    struct nf_stats sum;
+    u64 absent;
+    int i;
+
+    stats_read(&sum);
+    for (i = 0; i < __STAT_MAX; i++)
+        seq_printf(m, "%s %llu\n", stat_names[i], sum.items[i]);
+
+    absent = sum.items[STAT_FILTER_NEGATIVES] + sum.items[STAT_FILTER_FALSE_POSITIVES];
+    seq_printf(m, "filter_fp_ppm %llu\n",
+               absent ? div64_u64(sum.items[STAT_FILTER_FALSE_POSITIVES] * 1000000, absent) : 0);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/* One "upper_bound_ns count" pair per non-empty bucket */
+static int hook_latency_show(struct seq_file *m, void *v)
+{
+    struct nf_stats sum;
+    int i;
+
+    stats_read(&sum);
+    for (i = 0; i < HOOK_LATENCY_BUCKETS; i++) {
+        if (sum.latency[i])
+            seq_printf(m, "%llu %llu\n", 1ULL << i, sum.latency[i]);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hook_latency);
+
+int init_stats(void) {
+    nf_debugfs_dir = debugfs_create_dir(MODULE_NAME, NULL);
+    debugfs_create_file("stats", 0444, nf_debugfs_dir, NULL, &stats_fops);
+    debugfs_create_file("hook_latency", 0444, nf_debugfs_dir, NULL, &hook_latency_fops);
+
+    printk(KERN_INFO MODULE_NAME ": Statistics initialized\n");
+    return 0;
+}
+
+void cleanup_stats(void) {
+    debugfs_remove_recursive(nf_debugfs_dir);
+    nf_debugfs_dir = NULL;
+}
@@ -0,0 +1,100 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/sched/clock.h>
+#include <linux/string.h>
+#include "utils.h"
+
+/* Per-CPU counters, indexes into struct nf_stats.items */
+enum nf_stat_item {
+    STAT_PACKETS,           /* Packets seen by the hooks */
+    STAT_DNS_RESPONSES,     /* UDP packets from port 53 */
+    STAT_DNS_QUERIES,       /* Outgoing or forwarded queries to port 53 */
+    STAT_ANSWERED,          /* Blocked queries answered locally with NXDOMAIN */
+    STAT_PARSE_ERRORS,      /* DNS responses whose question could not be parsed */
+    STAT_LOOKUPS,           /* is_domain_blocked() calls */
+    STAT_PROBES,            /* Table probes, one per label passing the prefilter */
+    STAT_FILTER_NEGATIVES,  /* Labels the prefilter ruled out without a probe */
+    STAT_FILTER_FALSE_POSITIVES, /* Probes the prefilter let through that missed */
+    STAT_HITS,              /* Lookups that matched a blocked entry */
+    STAT_BLOCKED,           /* Responses rewritten to NXDOMAIN */
+    __STAT_MAX
+};
+
+/* log2 buckets of hook execution time in ns, bucket n holds [2^(n-1), 2^n) */
+#define HOOK_LATENCY_BUCKETS    32
+
+struct nf_stats {
+    u64 items[__STAT_MAX];
+    u64 latency[HOOK_LATENCY_BUCKETS];
+};
+
+DECLARE_PER_CPU_ALIGNED(struct nf_stats, nf_stats);
+
+/* Module debugfs directory, NULL or an error pointer if debugfs is unavailable */
+extern struct dentry *nf_debugfs_dir;
+
+/**
+ * stats_inc - Increment a counter on the local CPU
+ * @item: Counter to increment
+ *
+ * Context: Any context
+ */
+static inline void stats_inc(enum nf_stat_item item)
+{
+    this_cpu_inc(nf_stats.items[item]);
+}
+
+/**
+ * stats_hook_clock - Timestamp for stats_record_latency()
+ *
+ * Return: Local CPU clock in ns
+ */
+static inline u64 stats_hook_clock(void)
+{
+    return local_clock();
+}
+
+/**
+ * stats_record_latency - Account one hook execution in the histogram
+ * @start: Value returned by stats_hook_clock() at hook entry
+ *
+ * Context: Any context
+ */
+static inline void stats_record_latency(u64 start)
+{
+    u64 delta = local_clock() - start;
+
+    this_cpu_inc(nf_stats.latency[min(fls64(delta), HOOK_LATENCY_BUCKETS - 1)]);
+}
+
+/**
+ * stats_read - Sum the per-CPU counters
+ * @sum: Filled with the totals over all possible CPUs
+ *
+ * Counters are only aggregated here, the packet path never touches
+ * shared cache lines.
+ */
+void stats_read(struct nf_stats *sum);
+
+/**
+ * init_stats - Create the debugfs directory and statistics files
+ *
+ * Exposes <debugfs>/Network_Filter/stats and hook_latency. Missing
+ * debugfs support is not an error.
+ *
+ * Return: 0 always
+ */
+int init_stats(void);
+
+/**
+ * cleanup_stats - Remove the debugfs directory
+ */
+void cleanup_stats(void);
+
+#endif /* STATS_H */
@@ -6,8 +6,9 @@
 /* Module name definition */
 #define MODULE_NAME "Network_Filter"
 
-#define __HASH_SIZE               8
+#define CACHE_MIN_SIZE          256
 #define MAX_DOMAIN_LENGTH       256
+#define SHORT_DOMAIN_LENGTH     96      /* Inline name size of the small entry slab */
 #define MAX_PAYLOAD             1024
 #define SERVER_PORT             65433
 #define SERVER_IP               "127.0.0.1"
@@ -17,12 +18,48 @@
 #define CODE_REMOVE_DOMAIN      "53"
 #define CODE_DOMAIN_LIST_UPDATE "54"
 #define CODE_INIT_SETTINGS      "55"
+#define CODE_REMOVE_DOMAINS     "56"
 #define CODE_SUCCESS            "100"
 #define CODE_ERROR              "101"
 
 #define CODE_ADD_DOMAIN_INT    52
 #define CODE_REMOVE_DOMAIN_INT 53
 #define CODE_INIT_SETTINGS_INT 55
+#define CODE_REMOVE_DOMAINS_INT 56
+
+/*
+ * Binary frames matching server's protocol.py. A frame starts with
+ * FRAME_MAGIC, which no JSON message does, followed by the rest of
+ * struct frame_header and @length bytes of packed domain records:
+ * one length byte, then the name without terminator.
+ */
+#define FRAME_MAGIC             0xDF
+#define FRAME_MAX_PAYLOAD       (64 << 20)
+
+#define FRAME_OP_ADD_DOMAINS    1       /* Add the records to the live list */
+#define FRAME_OP_REMOVE_DOMAINS 2       /* Remove the records from the live list */
+#define FRAME_OP_LOAD_DOMAINS   3       /* Replace the list with the records */
+#define FRAME_OP_LIST_VERSION   4       /* struct frame_list_version, either direction */
+#define FRAME_OP_SET_CATEGORIES 5       /* One byte, BIT(CATEGORY_*) of the lists to enforce */
+#define FRAME_OP_SET_PAUSED     6       /* One byte, non-zero pauses filtering */
+
+struct frame_header {
+    __u8 magic;
+    __u8 opcode;
+    __be16 reserved;
+    __be32 length;
+} __attribute__((packed));
+
+/*
+ * Payload of FRAME_OP_LIST_VERSION. The server sends it after the
+ * changes that bring the list to @version, the kernel sends the last
+ * one it applied when it connects. @epoch identifies the server's
+ * database, 0 means the kernel does not know what its list matches.
+ */
+struct frame_list_version {
+    __be32 epoch;
+    __be64 version;
+} __attribute__((packed));
 
 // JSON field names matching server's utils.py
 #define STR_CODE                "code"
@@ -30,11 +67,6 @@
 #define STR_OPERATION           "operation"
 #define STR_DOMAINS             "domains"
 
-/* DNS Server configurations */
-#define ADGUARD_DNS             "94.140.14.14"
-#define CLOUDFLARE_DNS          "1.1.1.3"
-#define ADGUARD_FAMILY_DNS      "94.140.14.15"
-
 // DNS response flags
 #define DNS_RESPONSE     0x8000
 #define DNS_NXDOMAIN    0x0003
@@ -1,6 +1,8 @@
+import secrets
 import sqlite3
-from typing import List
+from typing import Iterable, List, Optional, Tuple
 from .logger import setup_logger
+from .utils import CHANGE_LOG_LIMIT, CATEGORY_CUSTOM, CATEGORY_SETTINGS, STR_PAUSE, STR_TOGGLE_ON
 
 class DatabaseManager:
     def __init__(self, db_file: str):
@@ -28,12 +30,54 @@ class DatabaseManager:
                 )
             """)
             
+            # Every list change gets the next version, kernels resync from
+            # the last one they applied
+            cursor.execute("""
+                CREATE TABLE IF NOT EXISTS domain_changes (
+                    version INTEGER PRIMARY KEY AUTOINCREMENT,
+                    domain TEXT NOT NULL,
+                    added INTEGER NOT NULL
+                )
+            """)
+            
+            # Client subnets and the profile each one filters with
+            cursor.execute("""
+                CREATE TABLE IF NOT EXISTS client_profiles (
+                    subnet TEXT PRIMARY KEY,
+                    profile INTEGER NOT NULL
+                )
+            """)
+            
+            # Domains blocked for one profile only, on top of blocked_domains
+            cursor.execute("""
+                CREATE TABLE IF NOT EXISTS profile_domains (
+                    domain TEXT NOT NULL,
+                    profile INTEGER NOT NULL,
+                    PRIMARY KEY (domain, profile)
+                )
+            """)
+            
+            # Imported lists, enforced while their category is enabled
+            cursor.execute("""
+                CREATE TABLE IF NOT EXISTS category_domains (
+                    domain TEXT NOT NULL,
+                    category INTEGER NOT NULL,
+                    PRIMARY KEY (domain, category)
+                )
+            """)
+            
             cursor.execute("""
                 INSERT OR IGNORE INTO settings (key, value) 
                 VALUES 
                     ('ad_block', 'off'),
-                    ('adult_block', 'off')
+                    ('adult_block', 'off'),
+                    ('pause', 'off'),
+                    ('list_pruned', '0')
             """)
+
+            # Versions of another database mean nothing to this one
+            cursor.execute("""INSERT OR IGNORE INTO settings (key, value)
+                              VALUES ('list_epoch', ?)""", (str(secrets.randbits(31) + 1),))
             
             conn.commit()
             self.logger.info("Database tables created/verified")
@@ -69,6 +113,7 @@ class DatabaseManager:
             try:
                 cursor.execute("""INSERT INTO blocked_domains (domain) 
                                   VALUES (?)""", (domain,))
+                self._record_change(cursor, domain, True)
                 conn.commit()
                 self.logger.info(f"Domain {domain} added to block list")
             except sqlite3.IntegrityError:
@@ -80,12 +125,34 @@ class DatabaseManager:
             cursor = conn.cursor()
             cursor.execute("""DELETE FROM blocked_domains 
                               WHERE domain = ?""", (domain,))
+            removed = cursor.rowcount
+            if removed:
+                self._record_change(cursor, domain, False)
             conn.commit()
-            if cursor.rowcount:
+            if removed:
                 self.logger.info(f"Domain {domain} removed from block list")
             else:
                 self.logger.warning(f"Domain {domain} not found in block list")
-            return bool(cursor.rowcount)
+            return bool(removed)
+
+    def remove_blocked_domains(self, domains: List[str]) -> List[str]:
+        """Remove several domains from blocked list in one transaction.
+
+        Returns:
+            The domains that were actually removed.
+        """
+        removed = []
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            for domain in domains:
+                cursor.execute("""DELETE FROM blocked_domains 
+                                  WHERE domain = ?""", (domain,))
+                if cursor.rowcount:
+                    removed.append(domain)
+                    self._record_change(cursor, domain, False)
+            conn.commit()
+        self.logger.info(f"Removed {len(removed)} of {len(domains)} domains from block list")
+        return removed
 
     def get_blocked_domains(self) -> List[str]:
         """Get list of all blocked domains."""
@@ -107,4 +174,242 @@ class DatabaseManager:
                               WHERE domain = ?""", (domain,))
             is_blocked = cursor.fetchone() is not None
             self.logger.debug(f"Domain {domain} blocked status: {is_blocked}")
-            return is_blocked
\ No newline at end of file
+            return is_blocked
+
+    def get_enabled_categories(self) -> int:
+        """Get the categories to enforce as a bitmask, the custom list always included."""
+        categories = 1 << CATEGORY_CUSTOM
+        for setting, category in CATEGORY_SETTINGS.items():
+            if self.get_setting(setting) == STR_TOGGLE_ON:
+                categories |= 1 << category
+        return categories
+
+    def is_paused(self) -> bool:
+        """Whether the kernel should let every query through, keeping its lists."""
+        return self.get_setting(STR_PAUSE) == STR_TOGGLE_ON
+
+    def add_category_domains(self, category: int, domains: List[str]) -> List[str]:
+        """Put domains on a category's list in one transaction.
+
+        Returns:
+            The domains that were not on it yet.
+        """
+        added = []
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            for domain in domains:
+                cursor.execute("""INSERT OR IGNORE INTO category_domains (domain, category) 
+                                  VALUES (?, ?)""", (domain, category))
+                if cursor.rowcount:
+                    added.append(domain)
+            conn.commit()
+        self.logger.info(f"Added {len(added)} of {len(domains)} domains to category {category}")
+        return added
+
+    def remove_category_domains(self, category: int, domains: List[str]) -> List[str]:
+        """Take domains off a category's list in one transaction.
+
+        Returns:
+            The domains that were actually removed.
+        """
+        removed = []
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            for domain in domains:
+                cursor.execute("""DELETE FROM category_domains 
+                                  WHERE domain = ? AND category = ?""", (domain, category))
+                if cursor.rowcount:
+                    removed.append(domain)
+            conn.commit()
+        self.logger.info(f"Removed {len(removed)} of {len(domains)} domains from category {category}")
+        return removed
+
+    def import_category_domains(self, category: int, domains: Iterable[str], replace: bool = False) -> int:
+        """
+        Stream a whole list onto a category in a single transaction.
+
+        Rows are inserted as they are read, so an import of hundreds of
+        thousands of names costs one commit and never holds the list in
+        memory. Readers see the old list until it commits, and a failed
+        import leaves it in place.
+
+        Args:
+            category: CATEGORY_* the list belongs to
+            domains: Normalized names, duplicates are dropped
+            replace: Drop the names the import does not hold, to refresh a subscription
+
+        Returns:
+            int: Domains on the category afterwards
+        """
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            if replace:
+                cursor.execute("""DELETE FROM category_domains 
+                                  WHERE category = ?""", (category,))
+            cursor.executemany("""INSERT OR IGNORE INTO category_domains (domain, category) 
+                                  VALUES (?, ?)""", ((domain, category) for domain in domains))
+            cursor.execute("""SELECT COUNT(*) 
+                              FROM category_domains 
+                              WHERE category = ?""", (category,))
+            count = cursor.fetchone()[0]
+            conn.commit()
+        self.logger.info(f"Category {category} imported, {count} domains")
+        return count
+
+    def get_category_domains(self) -> List[Tuple[str, int]]:
+        """Get every domain on a category's list, with its category."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""SELECT domain, category 
+                              FROM category_domains""")
+            return [(row[0], row[1]) for row in cursor.fetchall()]
+
+    def set_client_profile(self, subnet: str, profile: int) -> None:
+        """Assign a profile to a client subnet, replacing its previous one."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""INSERT OR REPLACE INTO client_profiles (subnet, profile) 
+                              VALUES (?, ?)""", (subnet, profile))
+            conn.commit()
+            self.logger.info(f"Subnet {subnet} assigned profile {profile}")
+
+    def remove_client_profile(self, subnet: str) -> bool:
+        """Return a client subnet to the default profile."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""DELETE FROM client_profiles 
+                              WHERE subnet = ?""", (subnet,))
+            removed = cursor.rowcount
+            conn.commit()
+            self.logger.info(f"Subnet {subnet} profile removed: {bool(removed)}")
+            return bool(removed)
+
+    def get_client_profiles(self) -> List[Tuple[str, int]]:
+        """Get every client subnet with its profile."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""SELECT subnet, profile 
+                              FROM client_profiles""")
+            return [(row[0], row[1]) for row in cursor.fetchall()]
+
+    def add_profile_domain(self, domain: str, profile: int) -> bool:
+        """Block a domain for one profile."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""INSERT OR IGNORE INTO profile_domains (domain, profile) 
+                              VALUES (?, ?)""", (domain, profile))
+            added = cursor.rowcount
+            conn.commit()
+            if added:
+                self.logger.info(f"Domain {domain} added to profile {profile}")
+            return bool(added)
+
+    def remove_profile_domain(self, domain: str, profile: int) -> bool:
+        """Unblock a domain for one profile."""
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""DELETE FROM profile_domains 
+                              WHERE domain = ? AND profile = ?""", (domain, profile))
+            removed = cursor.rowcount
+            conn.commit()
+            if removed:
+                self.logger.info(f"Domain {domain} removed from profile {profile}")
+            return bool(removed)
+
+    def get_profile_domains(self, domains: Optional[List[str]] = None) -> List[Tuple[str, int]]:
+        """
+        Get domains blocked for single profiles.
+
+        Args:
+            domains: Only these domains, all by default
+
+        Returns:
+            List[Tuple[str, int]]: Domain and profile pairs
+        """
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            if domains is None:
+                cursor.execute("""SELECT domain, profile 
+                                  FROM profile_domains""")
+                return [(row[0], row[1]) for row in cursor.fetchall()]
+
+            pairs: List[Tuple[str, int]] = []
+            for domain in domains:
+                cursor.execute("""SELECT domain, profile 
+                                  FROM profile_domains 
+                                  WHERE domain = ?""", (domain,))
+                pairs.extend((row[0], row[1]) for row in cursor.fetchall())
+            return pairs
+
+    def _record_change(self, cursor: sqlite3.Cursor, domain: str, added: bool) -> None:
+        """Log a list change under the next version, dropping the oldest past the limit."""
+        cursor.execute("""INSERT INTO domain_changes (domain, added)
+                          VALUES (?, ?)""", (domain, int(added)))
+        pruned = cursor.lastrowid - CHANGE_LOG_LIMIT
+        if pruned > 0 and pruned % CHANGE_LOG_LIMIT == 0:
+            cursor.execute("""DELETE FROM domain_changes 
+                              WHERE version <= ?""", (pruned,))
+            cursor.execute("""UPDATE settings 
+                              SET value = ?
+                              WHERE key = 'list_pruned'""", (str(pruned),))
+
+    def get_list_version(self) -> Tuple[int, int]:
+        """
+        Get the current domain list version.
+
+        Returns:
+            Tuple[int, int]: Database epoch and the version of the last change
+        """
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""SELECT value 
+                              FROM settings 
+                              WHERE key = 'list_epoch'""")
+            epoch = int(cursor.fetchone()[0])
+            cursor.execute("""SELECT seq 
+                              FROM sqlite_sequence 
+                              WHERE name = 'domain_changes'""")
+            result = cursor.fetchone()
+            return epoch, result[0] if result else 0
+
+    def get_changes_since(self, version: int) -> Optional[Tuple[List[str], List[str]]]:
+        """
+        Get the net list changes after a version, last change per domain wins.
+
+        Args:
+            version: Last version the caller applied
+
+        Returns:
+            Optional[Tuple[List[str], List[str]]]: Added and removed domains,
+            None if the log no longer reaches back to the version
+        """
+        with sqlite3.connect(self.db_file) as conn:
+            cursor = conn.cursor()
+            cursor.execute("""SELECT value 
+                              FROM settings 
+                              WHERE key = 'list_pruned'""")
+            pruned = int(cursor.fetchone()[0])
+            cursor.execute("""SELECT seq 
+                              FROM sqlite_sequence 
+                              WHERE name = 'domain_changes'""")
+            result = cursor.fetchone()
+            current = result[0] if result else 0
+
+            if version < pruned or version > current:
+                self.logger.info(f"No change log from version {version} (kept {pruned}-{current})")
+                return None
+
+            cursor.execute("""SELECT domain, added 
+                              FROM domain_changes 
+                              WHERE version IN (SELECT MAX(version) 
+                                                FROM domain_changes 
+                                                WHERE version > ? 
+                                                GROUP BY domain)
+                              ORDER BY version""", (version,))
+            added: List[str] = []
+            removed: List[str] = []
+            for domain, was_added in cursor.fetchall():
+                (added if was_added else removed).append(domain)
+
+            self.logger.debug(f"{len(added)} added and {len(removed)} removed since version {version}")
+            return added, removed
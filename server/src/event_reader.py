@@ -0,0 +1,105 @@
+"""Reader for the kernel module's per-CPU binary event ring."""
+
+import glob
+import os
+import socket
+import struct
+from dataclasses import dataclass
+from typing import BinaryIO, Dict, List
+from .logger import setup_logger
+from .utils import (
+    KERNEL_EVENTS_DIR, EVENT_FORMAT, EVENT_READ_SIZE, EVENT_VERDICTS
+)
+
+EVENT_SIZE: int = struct.calcsize(EVENT_FORMAT)
+
+@dataclass
+class KernelEvent:
+    """Decoded struct nf_event record."""
+    timestamp: float
+    client: str
+    verdict: str
+    domain: str
+
+class EventReader:
+    """Drains the relay files written by the kernel's events_record()."""
+
+    def __init__(self, events_dir: str = KERNEL_EVENTS_DIR) -> None:
+        """
+        Initialize the reader. Files are opened lazily on first drain.
+
+        Args:
+            events_dir: Directory holding the per-CPU events<N> relay files
+        """
+        self.events_dir = events_dir
+        self.logger = setup_logger(__name__)
+        self._files: Dict[str, BinaryIO] = {}
+        self._pending: Dict[str, bytes] = {}
+
+    @staticmethod
+    def decode(data: bytes) -> List[KernelEvent]:
+        """
+        Decode a buffer of whole binary events.
+
+        Args:
+            data: Concatenated records, length must be a multiple of EVENT_SIZE
+
+        Returns:
+            List of decoded events
+        """
+        events = []
+        for timestamp, client, family, verdict, name_len, name in struct.iter_unpack(EVENT_FORMAT, data):
+            if family == socket.AF_INET6:
+                address = socket.inet_ntop(socket.AF_INET6, client)
+            else:
+                address = socket.inet_ntop(socket.AF_INET, client[:4])
+
+            events.append(KernelEvent(
+                timestamp=timestamp / 1e9,
+                client=address,
+                verdict=EVENT_VERDICTS.get(verdict, str(verdict)),
+                domain=name[:name_len].decode(errors='replace')
+            ))
+        return events
+
+    def drain(self) -> List[KernelEvent]:
+        """
+        Read every event currently buffered on all CPUs.
+
+        Returns:
+            Events in per-CPU order, empty if the module is not loaded
+        """
+        events: List[KernelEvent] = []
+        for path in sorted(glob.glob(os.path.join(self.events_dir, "events[0-9]*"))):
+            try:
+                events.extend(self._drain_file(path))
+            except OSError as e:
+                self.logger.debug(f"Event file {path} unavailable: {e}")
+                self._close_file(path)
+        return events
+
+    def close(self) -> None:
+        """Close all open event files."""
+        for path in list(self._files):
+            self._close_file(path)
+
+    def _drain_file(self, path: str) -> List[KernelEvent]:
+        """Read one per-CPU file until it has nothing buffered."""
+        if path not in self._files:
+            self._files[path] = open(path, 'rb', buffering=0)
+
+        data = self._pending.pop(path, b'')
+        while chunk := self._files[path].read(EVENT_READ_SIZE):
+            data += chunk
+
+        whole = len(data) - len(data) % EVENT_SIZE
+        if whole != len(data):
+            self._pending[path] = data[whole:]
+        return self.decode(data[:whole])
+
+    def _close_file(self, path: str) -> None:
+        """Forget one per-CPU file and any partial record read from it."""
+        self._pending.pop(path, None)
+        events_file = self._files.pop(path, None)
+        if events_file:
+            events_file.close()
@@ -0,0 +1,436 @@
+"""Generic netlink client for the kernel module's control family."""
+
+import errno
+import ipaddress
+import os
+import socket
+import struct
+from dataclasses import dataclass
+from typing import Any, Dict, Iterable, Iterator, List, Optional, Tuple
+from .event_reader import EventReader, KernelEvent
+from .logger import setup_logger
+from .protocol import decode_domains, encode_domains, notification_records
+from .utils import (
+    GENL_FAMILY_NAME, GENL_VERSION, GENL_MCGRP_EVENTS, GENL_CHUNK_SIZE,
+    GENL_CMD_ADD_DOMAINS, GENL_CMD_REMOVE_DOMAINS, GENL_CMD_LOAD_DOMAINS,
+    GENL_CMD_GET_STATS, GENL_CMD_EVENT, GENL_CMD_GET_VERSION, GENL_CMD_SET_VERSION,
+    GENL_ATTR_DOMAINS, GENL_ATTR_LOAD_FIRST, GENL_ATTR_LOAD_LAST, GENL_ATTR_STATS,
+    GENL_ATTR_EVENT, GENL_ATTR_LIST_EPOCH, GENL_ATTR_LIST_VERSION, KERNEL_STAT_NAMES,
+    GENL_CMD_SET_PROFILES, GENL_ATTR_PROFILE_RULES, GENL_ATTR_PROFILE, PROFILE_RULE_FORMAT,
+    GENL_CMD_SET_CATEGORIES, GENL_ATTR_CATEGORIES, GENL_ATTR_CATEGORY,
+    GENL_CMD_GET_HITS, GENL_ATTR_HIT_COUNTS, GENL_ATTR_LISTED, GENL_ATTR_COLD, GENL_DUMP_RETRIES,
+    GENL_CMD_SET_PAUSED, GENL_ATTR_PAUSED,
+    FRAME_OP_ADD_DOMAINS, FRAME_OP_REMOVE_DOMAINS, FRAME_OP_LOAD_DOMAINS,
+    STR_CODE, STR_CONTENT, STR_DOMAINS, STR_OPERATION, STR_PROFILE, STR_RULES,
+    STR_CATEGORY, STR_CATEGORIES, STR_PAUSED, Codes
+)
+
+NETLINK_GENERIC = 16
+SOL_NETLINK = 270
+NETLINK_ADD_MEMBERSHIP = 1
+
+NLMSG_HEADER = "=IHHII"
+GENLMSG_HEADER = "=BBH"
+NLA_HEADER = "=HH"
+NLM_F_REQUEST = 0x1
+NLM_F_ACK = 0x4
+NLM_F_DUMP_INTR = 0x10
+NLM_F_DUMP = 0x300
+NLMSG_ERROR = 0x2
+NLMSG_DONE = 0x3
+NLA_TYPE_MASK = 0x3FFF
+
+GENL_ID_CTRL = 0x10
+CTRL_CMD_GETFAMILY = 3
+CTRL_ATTR_FAMILY_ID = 1
+CTRL_ATTR_FAMILY_NAME = 2
+CTRL_ATTR_MCAST_GROUPS = 7
+CTRL_ATTR_MCAST_GRP_NAME = 1
+CTRL_ATTR_MCAST_GRP_ID = 2
+
+def _align(length: int) -> int:
+    return (length + 3) & ~3
+
+def pack_attr(attr_type: int, data: bytes = b'') -> bytes:
+    """Pack one netlink attribute, padded to 4 bytes."""
+    length = struct.calcsize(NLA_HEADER) + len(data)
+    return struct.pack(NLA_HEADER, length, attr_type) + data + b'\0' * (_align(length) - length)
+
+def parse_attrs(data: bytes) -> Dict[int, bytes]:
+    """Parse a run of netlink attributes into a type to payload mapping."""
+    attrs: Dict[int, bytes] = {}
+    header_size = struct.calcsize(NLA_HEADER)
+    pos = 0
+    while pos + header_size <= len(data):
+        length, attr_type = struct.unpack_from(NLA_HEADER, data, pos)
+        if length < header_size:
+            break
+        attrs[attr_type & NLA_TYPE_MASK] = data[pos + header_size:pos + length]
+        pos += _align(length)
+    return attrs
+
+def pack_profile_rules(rules: Iterable[Tuple[str, int]]) -> bytes:
+    """Pack subnet and profile pairs as struct nf_profile_rule records."""
+    packed = bytearray()
+    for subnet, profile in rules:
+        network = ipaddress.ip_network(subnet, strict=False)
+        family = socket.AF_INET if network.version == 4 else socket.AF_INET6
+        packed += struct.pack(PROFILE_RULE_FORMAT, family, network.prefixlen, profile, 0,
+                              network.network_address.packed)
+    return bytes(packed)
+
+def chunk_domains(domains: List[str], chunk_size: int = GENL_CHUNK_SIZE) -> Iterator[bytes]:
+    """Split domains into encoded record runs of at most chunk_size bytes."""
+    chunk = bytearray()
+    for domain in domains:
+        record = encode_domains([domain])
+        if chunk and len(chunk) + len(record) > chunk_size:
+            yield bytes(chunk)
+            chunk = bytearray()
+        chunk += record
+    yield bytes(chunk)
+
+@dataclass
+class HitReport:
+    """The kernel's latest hit report, see kernel/src/hits.h."""
+    listed: int                     # Names on the shared lists
+    cold: int                       # Names that blocked no lookup
+    top: List[Tuple[str, int]]      # Domain and hits, most hits first
+
+    @property
+    def complete(self) -> bool:
+        """Whether every name with a hit is in top, so the others are the cold ones."""
+        return len(self.top) == self.listed - self.cold
+
+class GenlClient:
+    """Drives the kernel module over its generic netlink family."""
+
+    def __init__(self, sock: socket.socket) -> None:
+        """
+        Initialize the client on an open netlink socket.
+
+        Args:
+            sock: Bound NETLINK_GENERIC socket
+        """
+        self.sock = sock
+        self.logger = setup_logger(__name__)
+        self.seq = 0
+        self.family_id = 0
+        self.groups: Dict[str, int] = {}
+
+    @classmethod
+    def connect(cls) -> Optional["GenlClient"]:
+        """
+        Open a netlink socket and resolve the module's family.
+
+        Returns:
+            Optional[GenlClient]: Client, or None if the module is not loaded
+        """
+        try:
+            sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_GENERIC)
+            sock.bind((0, 0))
+        except (OSError, AttributeError):
+            return None
+
+        client = cls(sock)
+        try:
+            client.resolve_family()
+        except OSError:
+            sock.close()
+            return None
+        return client
+
+    def close(self) -> None:
+        """Close the netlink socket."""
+        self.sock.close()
+
+    def _send(self, msg_type: int, cmd: int, version: int, attrs: bytes, flags: int) -> int:
+        self.seq += 1
+        payload = struct.pack(GENLMSG_HEADER, cmd, version, 0) + attrs
+        header = struct.pack(NLMSG_HEADER, struct.calcsize(NLMSG_HEADER) + len(payload),
+                             msg_type, NLM_F_REQUEST | flags, self.seq, 0)
+        self.sock.send(header + payload)
+        return self.seq
+
+    def request(self, msg_type: int, cmd: int, attrs: bytes = b'',
+                version: int = GENL_VERSION, dump: bool = False) -> List[Dict[int, bytes]]:
+        """
+        Send one request and collect replies until the kernel acknowledges it.
+
+        Args:
+            msg_type: Netlink message type, the family id
+            cmd: Generic netlink command
+            attrs: Packed attributes
+            version: Family version
+            dump: Ask for a dump, which ends with NLMSG_DONE instead of an ack
+
+        Returns:
+            List[Dict[int, bytes]]: Attributes of each reply message
+
+        Raises:
+            OSError: The kernel rejected the request
+            InterruptedError: The dumped data changed while it was read
+        """
+        seq = self._send(msg_type, cmd, version, attrs, NLM_F_DUMP if dump else NLM_F_ACK)
+        header_size = struct.calcsize(NLMSG_HEADER)
+        genl_size = struct.calcsize(GENLMSG_HEADER)
+        replies: List[Dict[int, bytes]] = []
+        interrupted = False
+
+        while True:
+            data = self.sock.recv(65536)
+            pos = 0
+            while pos + header_size <= len(data):
+                length, reply_type, flags, reply_seq, _ = struct.unpack_from(NLMSG_HEADER, data, pos)
+                body = data[pos + header_size:pos + length]
+                pos += _align(length)
+                if reply_seq != seq:
+                    continue
+                interrupted |= bool(flags & NLM_F_DUMP_INTR)
+                if reply_type in (NLMSG_ERROR, NLMSG_DONE):
+                    error = struct.unpack_from("=i", body)[0] if len(body) >= 4 else 0
+                    if error:
+                        raise OSError(-error, os.strerror(-error))
+                    if interrupted:
+                        raise InterruptedError(errno.EINTR, "Dump interrupted by a change")
+                    return replies
+                replies.append(parse_attrs(body[genl_size:]))
+
+    def resolve_family(self) -> None:
+        """Look up the family id and multicast groups of the module."""
+        replies = self.request(GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+                               pack_attr(CTRL_ATTR_FAMILY_NAME, GENL_FAMILY_NAME.encode() + b'\0'),
+                               version=1)
+        attrs = replies[0]
+        self.family_id = struct.unpack("=H", attrs[CTRL_ATTR_FAMILY_ID][:2])[0]
+
+        for group in parse_attrs(attrs.get(CTRL_ATTR_MCAST_GROUPS, b'')).values():
+            group_attrs = parse_attrs(group)
+            name = group_attrs[CTRL_ATTR_MCAST_GRP_NAME].rstrip(b'\0').decode()
+            self.groups[name] = struct.unpack("=I", group_attrs[CTRL_ATTR_MCAST_GRP_ID])[0]
+
+    def _edit_domains(self, cmd: int, domains: List[str], profile: Optional[int],
+                      category: Optional[int]) -> None:
+        extra = b''
+        if profile is not None:
+            extra += pack_attr(GENL_ATTR_PROFILE, struct.pack("=B", profile))
+        if category is not None:
+            extra += pack_attr(GENL_ATTR_CATEGORY, struct.pack("=B", category))
+        for chunk in chunk_domains(domains):
+            self.request(self.family_id, cmd, pack_attr(GENL_ATTR_DOMAINS, chunk) + extra)
+
+    def add_domains(self, domains: List[str], profile: Optional[int] = None,
+                    category: Optional[int] = None) -> None:
+        """
+        Add domains to the kernel list in chunks.
+
+        Args:
+            domains: Domains to add
+            profile: Block them for this profile only, on the custom list
+            category: Add them to this CATEGORY_* list instead of the custom one
+        """
+        self._edit_domains(GENL_CMD_ADD_DOMAINS, domains, profile, category)
+
+    def remove_domains(self, domains: List[str], profile: Optional[int] = None,
+                       category: Optional[int] = None) -> None:
+        """Remove domains from the kernel list in chunks, see add_domains()."""
+        self._edit_domains(GENL_CMD_REMOVE_DOMAINS, domains, profile, category)
+
+    def set_categories(self, categories: int) -> None:
+        """Choose the lists the kernel enforces, a bitmask of CATEGORY_* values."""
+        self.request(self.family_id, GENL_CMD_SET_CATEGORIES,
+                     pack_attr(GENL_ATTR_CATEGORIES, struct.pack("=B", categories)))
+
+    def set_paused(self, paused: bool) -> None:
+        """Pause or resume filtering, the kernel keeps its lists either way."""
+        self.request(self.family_id, GENL_CMD_SET_PAUSED,
+                     pack_attr(GENL_ATTR_PAUSED, struct.pack("=B", int(paused))))
+
+    def set_profiles(self, rules: Iterable[Tuple[str, int]]) -> None:
+        """
+        Replace the kernel's client profile table.
+
+        Args:
+            rules: Subnet and profile pairs, clients outside all of them get
+                profile 0
+        """
+        packed = pack_profile_rules(rules)
+        self.request(self.family_id, GENL_CMD_SET_PROFILES,
+                     pack_attr(GENL_ATTR_PROFILE_RULES, packed) if packed else b'')
+
+    def load_domains(self, domains: List[str], chunk_size: int = GENL_CHUNK_SIZE) -> None:
+        """
+        Replace the kernel list. The kernel keeps filtering with the old
+        list until the last chunk arrives.
+
+        Args:
+            domains: Complete domain list
+            chunk_size: Largest record run per netlink message
+        """
+        chunks = list(chunk_domains(domains, chunk_size))
+        for index, chunk in enumerate(chunks):
+            attrs = pack_attr(GENL_ATTR_DOMAINS, chunk)
+            if index == 0:
+                attrs += pack_attr(GENL_ATTR_LOAD_FIRST)
+            if index == len(chunks) - 1:
+                attrs += pack_attr(GENL_ATTR_LOAD_LAST)
+            self.request(self.family_id, GENL_CMD_LOAD_DOMAINS, attrs)
+
+    def get_stats(self) -> Dict[str, int]:
+        """
+        Read the kernel counters.
+
+        Returns:
+            Dict[str, int]: Counter name to value, unknown counters by number
+        """
+        replies = self.request(self.family_id, GENL_CMD_GET_STATS)
+        stats: Dict[str, int] = {}
+        for attr_type, value in parse_attrs(replies[0].get(GENL_ATTR_STATS, b'')).items():
+            if len(value) != 8:
+                continue
+            index = attr_type - 1
+            name = KERNEL_STAT_NAMES[index] if index < len(KERNEL_STAT_NAMES) else str(attr_type)
+            stats[name] = struct.unpack("=Q", value)[0]
+        return stats
+
+    def get_hits(self) -> HitReport:
+        """
+        Read the kernel's hit report, rebuilt there every 30 seconds.
+
+        Returns:
+            HitReport: Totals and the hottest names, empty before the first report
+
+        Raises:
+            InterruptedError: The report kept being rebuilt while it was read
+        """
+        for attempt in range(GENL_DUMP_RETRIES):
+            try:
+                replies = self.request(self.family_id, GENL_CMD_GET_HITS, dump=True)
+                break
+            except InterruptedError:
+                if attempt == GENL_DUMP_RETRIES - 1:
+                    raise
+
+        report = HitReport(listed=0, cold=0, top=[])
+        for attrs in replies:
+            counts = attrs.get(GENL_ATTR_HIT_COUNTS, b'')
+            hits = struct.unpack(f"={len(counts) // 4}I", counts)
+            report.top.extend(zip(decode_domains(attrs.get(GENL_ATTR_DOMAINS, b'')), hits))
+            report.listed = struct.unpack("=I", attrs[GENL_ATTR_LISTED])[0]
+            report.cold = struct.unpack("=I", attrs[GENL_ATTR_COLD])[0]
+        return report
+
+    def get_list_version(self) -> Tuple[int, int]:
+        """
+        Read the list version the kernel holds.
+
+        Returns:
+            Tuple[int, int]: Epoch and version, epoch 0 if the list is unknown
+        """
+        attrs = self.request(self.family_id, GENL_CMD_GET_VERSION)[0]
+        return (struct.unpack("=I", attrs[GENL_ATTR_LIST_EPOCH])[0],
+                struct.unpack("=Q", attrs[GENL_ATTR_LIST_VERSION])[0])
+
+    def set_list_version(self, epoch: int, version: int) -> None:
+        """Record the list version the kernel holds after a batch of changes."""
+        self.request(self.family_id, GENL_CMD_SET_VERSION,
+                     pack_attr(GENL_ATTR_LIST_EPOCH, struct.pack("=I", epoch)) +
+                     pack_attr(GENL_ATTR_LIST_VERSION, struct.pack("=Q", version)))
+
+    def apply_records(self, opcode: int, domains: List[str]) -> None:
+        """
+        Apply one FRAME_OP_* change to the kernel list.
+
+        Args:
+            opcode: FRAME_OP_LOAD_DOMAINS, FRAME_OP_ADD_DOMAINS or FRAME_OP_REMOVE_DOMAINS
+            domains: Domains of the change
+        """
+        if opcode == FRAME_OP_LOAD_DOMAINS:
+            self.load_domains(domains)
+        elif opcode == FRAME_OP_ADD_DOMAINS:
+            self.add_domains(domains)
+        elif opcode == FRAME_OP_REMOVE_DOMAINS:
+            self.remove_domains(domains)
+
+    def apply(self, notification: Dict[str, Any]) -> bool:
+        """
+        Apply a handler response that changes the domain lists, the enabled
+        categories, the pause or the profiles.
+
+        Args:
+            notification: Response dictionary produced by a request handler
+
+        Returns:
+            bool: True if the notification was one of those changes
+        """
+        records = notification_records(notification)
+        if records is not None:
+            self.apply_records(*records)
+            return True
+
+        # Changes beyond the custom list
+        if notification.get(STR_CODE) != Codes.CODE_SUCCESS:
+            return False
+        operation = notification.get(STR_OPERATION)
+        if STR_CATEGORIES in notification:
+            self.set_categories(notification[STR_CATEGORIES])
+        elif STR_PAUSED in notification:
+            self.set_paused(notification[STR_PAUSED])
+        elif operation == Codes.CODE_ADD_CATEGORY_DOMAINS:
+            self.add_domains(notification[STR_DOMAINS], category=notification[STR_CATEGORY])
+        elif operation == Codes.CODE_REMOVE_CATEGORY_DOMAINS:
+            self.remove_domains(notification[STR_DOMAINS], category=notification[STR_CATEGORY])
+        elif operation in (Codes.CODE_SET_CLIENT_PROFILE, Codes.CODE_REMOVE_CLIENT_PROFILE):
+            self.set_profiles(notification[STR_RULES])
+        elif operation == Codes.CODE_ADD_PROFILE_DOMAIN:
+            self.add_domains([notification[STR_CONTENT]], notification[STR_PROFILE])
+        elif operation == Codes.CODE_REMOVE_PROFILE_DOMAIN:
+            self.remove_domains([notification[STR_CONTENT]], notification[STR_PROFILE])
+        else:
+            return False
+        return True
+
+    def subscribe_events(self) -> socket.socket:
+        """
+        Open a non-blocking socket joined to the event multicast group.
+
+        Returns:
+            socket.socket: Socket to pass to read_events()
+        """
+        sock = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, NETLINK_GENERIC)
+        sock.bind((0, 0))
+        sock.setsockopt(SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, self.groups[GENL_MCGRP_EVENTS])
+        sock.setblocking(False)
+        return sock
+
+    @staticmethod
+    def read_events(sock: socket.socket) -> List[KernelEvent]:
+        """
+        Decode every event queued on a subscribed socket.
+
+        Args:
+            sock: Socket returned by subscribe_events()
+
+        Returns:
+            List[KernelEvent]: Events received so far
+        """
+        header_size = struct.calcsize(NLMSG_HEADER)
+        genl_size = struct.calcsize(GENLMSG_HEADER)
+        events: List[KernelEvent] = []
+
+        while True:
+            try:
+                data = sock.recv(65536)
+            except BlockingIOError:
+                return events
+
+            pos = 0
+            while pos + header_size <= len(data):
+                length = struct.unpack_from(NLMSG_HEADER, data, pos)[0]
+                body = data[pos + header_size:pos + length]
+                pos += _align(length)
+                if len(body) < genl_size or body[0] != GENL_CMD_EVENT:
+                    continue
+                record = parse_attrs(body[genl_size:]).get(GENL_ATTR_EVENT)
+                if record:
+                    events.extend(EventReader.decode(record))
@@ -1,20 +1,21 @@
+import ipaddress
 from typing import Dict, Any
 from .db_manager import DatabaseManager
 from .utils import (
     Codes,
-    STR_AD_BLOCK, STR_ADULT_BLOCK, STR_CODE, STR_CONTENT,
-    STR_DOMAINS, STR_OPERATION, STR_SETTINGS,
+    STR_AD_BLOCK, STR_ADULT_BLOCK, STR_PAUSE, STR_PAUSED, STR_CODE, STR_CONTENT,
+    STR_DOMAINS, STR_OPERATION, STR_SETTINGS, STR_SUBNET, STR_PROFILE, STR_RULES,
+    STR_VERSION, STR_CATEGORY, STR_CATEGORIES, CATEGORY_NAMES,
+    STR_DOMAINS_NOT_FOUND_MSG, PROFILE_MAX, PROFILE_RULES_MAX,
     invalid_json_response
 )
 from .logger import setup_logger
-from .dns_manager import DNSManager
 
 class RequestHandler:
     """Base class for request handlers."""
     def __init__(self, db_manager: DatabaseManager):
-        self.db_manager  = db_manager
-        self.dns_manager = DNSManager()
-        self.logger      = setup_logger(self.__class__.__name__)
+        self.db_manager = db_manager
+        self.logger     = setup_logger(self.__class__.__name__)
 
 class AdBlockHandler(RequestHandler):
     def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
@@ -24,15 +25,13 @@ class AdBlockHandler(RequestHandler):
                 state = request_data[STR_CONTENT]
                 self.db_manager.update_setting(STR_AD_BLOCK, state)
                 
-                # Update DNS settings based on current state
-                adult_state = self.db_manager.get_setting(STR_ADULT_BLOCK)
-                self.dns_manager.update_dns_settings(state, adult_state)
-                
+                # The kernel enforces the enabled categories itself
                 self.logger.info(f"Ad blocking turned {state}")
                 return {
-                    STR_CODE:      Codes.CODE_SUCCESS,
-                    STR_CONTENT:   f"{state}",
-                    STR_OPERATION: Codes.CODE_AD_BLOCK
+                    STR_CODE:       Codes.CODE_SUCCESS,
+                    STR_CONTENT:    f"{state}",
+                    STR_CATEGORIES: self.db_manager.get_enabled_categories(),
+                    STR_OPERATION:  Codes.CODE_AD_BLOCK
                 }
                 
             return invalid_json_response()
@@ -53,15 +52,13 @@ class AdultContentBlockHandler(RequestHandler):
                 state = request_data[STR_CONTENT]
                 self.db_manager.update_setting(STR_ADULT_BLOCK, state)
                 
-                # Update DNS settings based on current state
-                ad_state = self.db_manager.get_setting(STR_AD_BLOCK)
-                self.dns_manager.update_dns_settings(ad_state, state)
-                
+                # The kernel enforces the enabled categories itself
                 self.logger.info(f"Adult content blocking turned {state}")
                 return {
-                    STR_CODE:      Codes.CODE_SUCCESS,
-                    STR_CONTENT:   f"{state}",
-                    STR_OPERATION: Codes.CODE_ADULT_BLOCK
+                    STR_CODE:       Codes.CODE_SUCCESS,
+                    STR_CONTENT:    f"{state}",
+                    STR_CATEGORIES: self.db_manager.get_enabled_categories(),
+                    STR_OPERATION:  Codes.CODE_ADULT_BLOCK
                 }
                 
             return invalid_json_response()
@@ -74,6 +71,33 @@ class AdultContentBlockHandler(RequestHandler):
                 STR_OPERATION: Codes.CODE_ADULT_BLOCK
             }
 
+class PauseHandler(RequestHandler):
+    def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
+        """Handle requests to pause or resume filtering."""
+        try:
+            if STR_CONTENT in request_data:
+                state = request_data[STR_CONTENT]
+                self.db_manager.update_setting(STR_PAUSE, state)
+
+                # The lists stay loaded, the kernel just stops consulting them
+                self.logger.info(f"Filtering pause turned {state}")
+                return {
+                    STR_CODE:      Codes.CODE_SUCCESS,
+                    STR_CONTENT:   f"{state}",
+                    STR_PAUSED:    self.db_manager.is_paused(),
+                    STR_OPERATION: Codes.CODE_PAUSE_FILTERING
+                }
+
+            return invalid_json_response()
+
+        except Exception as e:
+            self.logger.error(f"Error in pause handler: {e}")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   str(e),
+                STR_OPERATION: Codes.CODE_PAUSE_FILTERING
+            }
+
 class DomainBlockHandler(RequestHandler):
     def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
         """Handle domain blocking requests."""
@@ -83,10 +107,9 @@ class DomainBlockHandler(RequestHandler):
                 return invalid_json_response()
 
             operation_code = request_data[STR_CODE]
-            domain = request_data[STR_CONTENT]
-            
-            if not domain.startswith("www."):
-                domain = f"www.{domain}"
+            # The kernel matches parent domains, so "example.com" also covers
+            # "www.example.com" and every other subdomain.
+            domain = request_data[STR_CONTENT].strip().strip('.').lower()
 
             match operation_code:
                 case Codes.CODE_ADD_DOMAIN:
@@ -100,9 +123,12 @@ class DomainBlockHandler(RequestHandler):
                     
                     self.db_manager.add_blocked_domain(domain)
                     self.logger.info(f"Domain blocked: {domain}")
+                    # Read before anything else can write, the kernel is told
+                    # this version once the edit reaches it
                     return {
                         STR_CODE:      Codes.CODE_SUCCESS,
                         STR_CONTENT:   domain,
+                        STR_VERSION:   self.db_manager.get_list_version(),
                         STR_OPERATION: Codes.CODE_ADD_DOMAIN
                     }
 
@@ -112,6 +138,7 @@ class DomainBlockHandler(RequestHandler):
                         return {
                             STR_CODE:      Codes.CODE_SUCCESS,
                             STR_CONTENT:   domain,
+                            STR_VERSION:   self.db_manager.get_list_version(),
                             STR_OPERATION: Codes.CODE_REMOVE_DOMAIN
                         }
 
@@ -133,6 +160,161 @@ class DomainBlockHandler(RequestHandler):
                 STR_OPERATION: operation_code
             }
 
+class DomainBulkRemoveHandler(RequestHandler):
+    """Handle removal of many domains with a single kernel notification."""
+    def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
+        """Handle bulk domain unblocking requests."""
+        try:
+            domains = request_data.get(STR_DOMAINS)
+            if not isinstance(domains, list):
+                self.logger.warning("Invalid request format: missing domains")
+                return invalid_json_response()
+
+            domains = [domain.strip().strip('.').lower() for domain in domains]
+            removed = self.db_manager.remove_blocked_domains(domains)
+
+            if removed:
+                self.logger.info(f"Domains unblocked: {len(removed)}")
+                return {
+                    STR_CODE:      Codes.CODE_SUCCESS,
+                    STR_DOMAINS:   removed,
+                    STR_VERSION:   self.db_manager.get_list_version(),
+                    STR_OPERATION: Codes.CODE_REMOVE_DOMAINS
+                }
+
+            self.logger.warning("No domains found for bulk unblocking")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   STR_DOMAINS_NOT_FOUND_MSG,
+                STR_OPERATION: Codes.CODE_REMOVE_DOMAINS
+            }
+
+        except Exception as e:
+            self.logger.error(f"Error in bulk remove handler: {e}")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   str(e),
+                STR_OPERATION: Codes.CODE_REMOVE_DOMAINS
+            }
+
+def _parse_profile(value: Any) -> int:
+    """Validate a profile number from a request."""
+    profile = int(value)
+    if not 0 <= profile < PROFILE_MAX:
+        raise ValueError(f"Profile must be between 0 and {PROFILE_MAX - 1}")
+    return profile
+
+class ClientProfileHandler(RequestHandler):
+    """
+    Handle assigning client subnets to profiles.
+
+    Responses carry every rule, the kernel replaces its table with them.
+    """
+    def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
+        """Handle client profile requests."""
+        operation_code = request_data.get(STR_CODE)
+        try:
+            if STR_SUBNET not in request_data:
+                self.logger.warning("Invalid request format: missing subnet")
+                return invalid_json_response()
+
+            subnet = str(ipaddress.ip_network(request_data[STR_SUBNET], strict=False))
+
+            if operation_code == Codes.CODE_SET_CLIENT_PROFILE:
+                profile = _parse_profile(request_data.get(STR_PROFILE))
+                rules = self.db_manager.get_client_profiles()
+                if len(rules) >= PROFILE_RULES_MAX and subnet not in dict(rules):
+                    raise ValueError(f"At most {PROFILE_RULES_MAX} client subnets")
+                self.db_manager.set_client_profile(subnet, profile)
+            elif not self.db_manager.remove_client_profile(subnet):
+                self.logger.warning(f"Subnet not found: {subnet}")
+                return {
+                    STR_CODE:      Codes.CODE_ERROR,
+                    STR_CONTENT:   subnet,
+                    STR_OPERATION: operation_code
+                }
+
+            return {
+                STR_CODE:      Codes.CODE_SUCCESS,
+                STR_CONTENT:   subnet,
+                STR_RULES:     self.db_manager.get_client_profiles(),
+                STR_OPERATION: operation_code
+            }
+
+        except Exception as e:
+            self.logger.error(f"Error in client profile handler: {e}")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   str(e),
+                STR_OPERATION: operation_code
+            }
+
+class ProfileDomainHandler(RequestHandler):
+    """Handle domains blocked for a single profile."""
+    def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
+        """Handle profile domain requests."""
+        operation_code = request_data.get(STR_CODE)
+        try:
+            if STR_CONTENT not in request_data or STR_PROFILE not in request_data:
+                self.logger.warning("Invalid request format: missing content or profile")
+                return invalid_json_response()
+
+            domain = request_data[STR_CONTENT].strip().strip('.').lower()
+            profile = _parse_profile(request_data[STR_PROFILE])
+
+            if operation_code == Codes.CODE_ADD_PROFILE_DOMAIN:
+                changed = self.db_manager.add_profile_domain(domain, profile)
+            else:
+                changed = self.db_manager.remove_profile_domain(domain, profile)
+
+            return {
+                STR_CODE:      Codes.CODE_SUCCESS if changed else Codes.CODE_ERROR,
+                STR_CONTENT:   domain,
+                STR_PROFILE:   profile,
+                STR_OPERATION: operation_code
+            }
+
+        except Exception as e:
+            self.logger.error(f"Error in profile domain handler: {e}")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   str(e),
+                STR_OPERATION: operation_code
+            }
+
+class CategoryDomainsHandler(RequestHandler):
+    """Handle edits of the imported category lists, many domains at a time."""
+    def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
+        """Handle category list requests."""
+        operation_code = request_data.get(STR_CODE)
+        try:
+            domains = request_data.get(STR_DOMAINS)
+            category = CATEGORY_NAMES.get(request_data.get(STR_CATEGORY))
+            if not isinstance(domains, list) or category is None:
+                self.logger.warning("Invalid request format: missing domains or unknown category")
+                return invalid_json_response()
+
+            domains = [domain.strip().strip('.').lower() for domain in domains]
+            if operation_code == Codes.CODE_ADD_CATEGORY_DOMAINS:
+                changed = self.db_manager.add_category_domains(category, domains)
+            else:
+                changed = self.db_manager.remove_category_domains(category, domains)
+
+            return {
+                STR_CODE:      Codes.CODE_SUCCESS if changed else Codes.CODE_ERROR,
+                STR_CATEGORY:  category,
+                STR_DOMAINS:   changed,
+                STR_OPERATION: operation_code
+            }
+
+        except Exception as e:
+            self.logger.error(f"Error in category domains handler: {e}")
+            return {
+                STR_CODE:      Codes.CODE_ERROR,
+                STR_CONTENT:   str(e),
+                STR_OPERATION: operation_code
+            }
+
 class SettingsHandler(RequestHandler):
     """Handle settings and domain list requests."""
     def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
@@ -142,11 +324,10 @@ class SettingsHandler(RequestHandler):
             domains = self.db_manager.get_blocked_domains()
             settings = {
                 STR_AD_BLOCK:    self.db_manager.get_setting(STR_AD_BLOCK),
-                STR_ADULT_BLOCK: self.db_manager.get_setting(STR_ADULT_BLOCK)
+                STR_ADULT_BLOCK: self.db_manager.get_setting(STR_ADULT_BLOCK),
+                STR_PAUSE:       self.db_manager.get_setting(STR_PAUSE)
             }
 
-            self.dns_manager.update_dns_settings(settings[STR_AD_BLOCK], settings[STR_ADULT_BLOCK])
-            
             self.logger.info(f"Settings requested, returned {len(domains)} domains")
             return {
                 STR_CODE:      Codes.CODE_SUCCESS,
@@ -169,11 +350,19 @@ class RequestFactory:
         self.db_manager = db_manager
         self.logger = setup_logger(__name__)
         self.handlers = {
-            Codes.CODE_AD_BLOCK:      AdBlockHandler(db_manager),
-            Codes.CODE_ADULT_BLOCK:   AdultContentBlockHandler(db_manager),
-            Codes.CODE_ADD_DOMAIN:    DomainBlockHandler(db_manager),
-            Codes.CODE_REMOVE_DOMAIN: DomainBlockHandler(db_manager),
-            Codes.CODE_INIT_SETTINGS: SettingsHandler(db_manager)
+            Codes.CODE_AD_BLOCK:       AdBlockHandler(db_manager),
+            Codes.CODE_ADULT_BLOCK:    AdultContentBlockHandler(db_manager),
+            Codes.CODE_ADD_DOMAIN:     DomainBlockHandler(db_manager),
+            Codes.CODE_REMOVE_DOMAIN:  DomainBlockHandler(db_manager),
+            Codes.CODE_REMOVE_DOMAINS: DomainBulkRemoveHandler(db_manager),
+            Codes.CODE_INIT_SETTINGS:  SettingsHandler(db_manager),
+            Codes.CODE_SET_CLIENT_PROFILE:    ClientProfileHandler(db_manager),
+            Codes.CODE_REMOVE_CLIENT_PROFILE: ClientProfileHandler(db_manager),
+            Codes.CODE_ADD_PROFILE_DOMAIN:    ProfileDomainHandler(db_manager),
+            Codes.CODE_REMOVE_PROFILE_DOMAIN: ProfileDomainHandler(db_manager),
+            Codes.CODE_ADD_CATEGORY_DOMAINS:    CategoryDomainsHandler(db_manager),
+            Codes.CODE_REMOVE_CATEGORY_DOMAINS: CategoryDomainsHandler(db_manager),
+            Codes.CODE_PAUSE_FILTERING:         PauseHandler(db_manager)
         }
 
     def handle_request(self, request_data: Dict[str, Any]) -> Dict[str, Any]:
@@ -0,0 +1,80 @@
+"""
+Report of the listed domains that block the most lookups.
+
+The kernel counts the lookups each name on its lists blocked since the
+list was loaded and keeps the hottest ones in a report. By default the
+hottest names are printed; with --cold the names in the database that
+blocked nothing are printed instead, candidates to drop from a list.
+
+Usage: python -m My_Internet.server.src.hit_report [--top N] [--cold] [--db FILE]
+"""
+
+import argparse
+import sys
+from typing import Iterable, List
+from .db_manager import DatabaseManager
+from .genl_client import GenlClient, HitReport
+from .logger import setup_logger
+from .utils import DB_FILE
+
+def cold_domains(report: HitReport, listed: Iterable[str]) -> List[str]:
+    """
+    Find the listed domains without a hit.
+
+    Args:
+        report: Complete hit report
+        listed: Domains on the lists the kernel was given
+
+    Returns:
+        List[str]: Listed domains missing from the report, sorted
+
+    Raises:
+        ValueError: The report left out names with hits
+    """
+    if not report.complete:
+        raise ValueError(f"Report keeps {len(report.top)} of "
+                         f"{report.listed - report.cold} domains with hits")
+    hot = {domain for domain, _ in report.top}
+    return sorted(set(listed) - hot)
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Show which listed domains block lookups")
+    parser.add_argument("--top", type=int, default=20, help="number of hot domains to show")
+    parser.add_argument("--cold", action="store_true",
+                        help="show the domains in the database without a hit instead")
+    parser.add_argument("--db", default=DB_FILE, help="server database")
+    args = parser.parse_args()
+    logger = setup_logger(__name__)
+
+    genl = GenlClient.connect()
+    if genl is None:
+        logger.error("Kernel module not loaded")
+        return 1
+    try:
+        report = genl.get_hits()
+    except OSError as e:
+        logger.error(f"Cannot read hit report: {e}")
+        return 1
+    finally:
+        genl.close()
+
+    if not args.cold:
+        print(f"{report.listed} listed, {report.listed - report.cold} with hits")
+        for domain, hits in report.top[:args.top]:
+            print(f"{hits:>10} {domain}")
+        return 0
+
+    db_manager = DatabaseManager(args.db)
+    listed = db_manager.get_blocked_domains()
+    listed += [domain for domain, _ in db_manager.get_category_domains()]
+    try:
+        domains = cold_domains(report, listed)
+    except ValueError as e:
+        logger.error(f"Cannot tell the cold domains: {e}")
+        return 1
+    for domain in domains:
+        print(domain)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
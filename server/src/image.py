@@ -0,0 +1,198 @@
+"""Precompiled blocklist images the kernel module uses in place (kernel/src/image.h)."""
+
+import math
+import secrets
+import struct
+import zlib
+from typing import Dict, Iterable, List, Optional, Tuple
+from .utils import (
+    IMAGE_MAGIC, IMAGE_FORMAT_VERSION, IMAGE_HEADER_FORMAT, IMAGE_SLOT_FORMAT,
+    IMAGE_PILOT_MUL, IMAGE_CHAIN_MUL, LABEL_HASH_MUL, IMAGE_BUCKET_SIZE, IMAGE_LOAD_FACTOR, CATEGORY_CUSTOM
+)
+
+MAX_RECORD_LENGTH = 255
+MAX_PILOT = 0xFFFF
+MASK64 = 0xFFFFFFFFFFFFFFFF
+
+def _mix64(value: int) -> int:
+    value ^= value >> 33
+    value = (value * 0xff51afd7ed558ccd) & MASK64
+    value ^= value >> 33
+    value = (value * 0xc4ceb9fe1a85ec53) & MASK64
+    value ^= value >> 33
+    return value
+
+def _reduce(value: int, count: int) -> int:
+    return ((value & 0xFFFFFFFF) * count) >> 32
+
+def _slot_of(value: int, pilot: int, slots: int) -> int:
+    return _reduce(_mix64(value ^ ((pilot * IMAGE_PILOT_MUL) & MASK64)), slots)
+
+def label_hash(label: bytes, seed: int) -> int:
+    """Hash one label on its own, as dns_label_hash() does: lower-cased 8-byte words."""
+    value = seed ^ len(label)
+    label = label.lower()
+    for start in range(0, len(label), 8):
+        value = ((value ^ int.from_bytes(label[start:start + 8], 'little')) * LABEL_HASH_MUL) & MASK64
+        value ^= value >> 32
+    return value
+
+def hash_label(label: bytes, seed: int, suffix_hash: int) -> int:
+    """Hash one label onto its parent's hash, as image_hash_label() does."""
+    return _mix64(label_hash(label, seed) ^ ((suffix_hash * IMAGE_CHAIN_MUL) & MASK64))
+
+def hash_domain(name: bytes, seed: int) -> int:
+    """
+    Hash a domain from its rightmost label inward.
+
+    Args:
+        name: Encoded domain name
+        seed: Seed stored in the image header
+
+    Returns:
+        int: Hash the kernel computes for the same name
+    """
+    value = 0
+    for label in reversed(name.split(b'.')):
+        value = hash_label(label, seed, value)
+    return value
+
+def _find_pilots(hashes: List[int], slots: int, buckets: int) -> Optional[List[int]]:
+    """
+    Give every bucket a pilot that lands its names on free slots.
+
+    Returns:
+        Optional[List[int]]: Pilot per bucket, None if some bucket has none
+            below MAX_PILOT or two names hash alike
+    """
+    members: List[List[int]] = [[] for _ in range(buckets)]
+    for value in hashes:
+        members[_reduce(value >> 32, buckets)].append(value)
+
+    pilots = [0] * buckets
+    taken = bytearray(slots)
+    # Largest buckets first, while most slots are still free
+    for bucket in sorted(range(buckets), key=lambda b: len(members[b]), reverse=True):
+        values = members[bucket]
+        if not values:
+            break
+        # _slot_of() inlined, most pilots fail on the first name once slots fill up
+        for pilot in range(MAX_PILOT + 1):
+            key = (pilot * IMAGE_PILOT_MUL) & MASK64
+            positions: List[int] = []
+            for value in values:
+                value ^= key
+                value ^= value >> 33
+                value = (value * 0xff51afd7ed558ccd) & MASK64
+                value ^= value >> 33
+                value = (value * 0xc4ceb9fe1a85ec53) & MASK64
+                value ^= value >> 33
+                position = ((value & 0xFFFFFFFF) * slots) >> 32
+                if taken[position] or position in positions:
+                    break
+                positions.append(position)
+            else:
+                break
+        else:
+            return None
+        for position in positions:
+            taken[position] = 1
+        pilots[bucket] = pilot
+    return pilots
+
+def build_image(
+    domains: Iterable[str],
+    epoch: int = 0,
+    version: int = 0,
+    seed: Optional[int] = None,
+    categories: Iterable[Tuple[str, int]] = ()
+) -> bytes:
+    """
+    Compile domains into a blocklist image.
+
+    The index is a perfect hash: each name owns one slot, found from its
+    hash and its bucket's pilot. A bucket without a working pilot makes
+    the build start over with a new seed.
+
+    Args:
+        domains: Custom list, duplicates are dropped
+        epoch: Database epoch of the list
+        version: List version the image holds
+        seed: Hash seed, random by default and on retries
+        categories: Domain and CATEGORY_* pairs of the other lists
+
+    Returns:
+        bytes: Image ready for the module's image attribute or /lib/firmware
+    """
+    tags: Dict[bytes, int] = {}
+    listed = [(domain, CATEGORY_CUSTOM) for domain in domains]
+    for domain, category in listed + list(categories):
+        name = domain.encode()
+        if not name or len(name) > MAX_RECORD_LENGTH:
+            raise ValueError(f"Domain cannot be stored: {domain!r}")
+        tags[name] = tags.get(name, 0) | 1 << category
+    names = list(tags)
+
+    slots = max(1, math.ceil(len(names) / IMAGE_LOAD_FACTOR))
+    buckets = max(1, math.ceil(len(names) / IMAGE_BUCKET_SIZE))
+    while True:
+        if seed is None:
+            seed = secrets.randbits(64)
+        hashes = [hash_domain(name, seed) for name in names]
+        pilots = _find_pilots(hashes, slots, buckets)
+        if pilots is not None:
+            break
+        seed = None
+
+    index = [(0, 0, 0, 0)] * slots
+    pool = bytearray()
+    for name, value in zip(names, hashes):
+        pilot = pilots[_reduce(value >> 32, buckets)]
+        index[_slot_of(value, pilot, slots)] = (len(pool), value & 0xFFFF, len(name), tags[name])
+        pool += name
+
+    pilot_bytes = struct.pack(f'<{buckets}H', *pilots)
+    pilot_bytes += bytes(-len(pilot_bytes) % 8)
+    body = pilot_bytes + b''.join(struct.pack(IMAGE_SLOT_FORMAT, *slot) for slot in index) + bytes(pool)
+    header_size = struct.calcsize(IMAGE_HEADER_FORMAT)
+    header = struct.pack(
+        IMAGE_HEADER_FORMAT, IMAGE_MAGIC, IMAGE_FORMAT_VERSION, header_size,
+        zlib.crc32(body), len(names), seed, slots, buckets, len(pool),
+        epoch, version, header_size + len(body)
+    )
+    return header + body
+
+def image_categories(image: bytes, domain: str) -> int:
+    """
+    Look a domain up in an image the way the kernel does.
+
+    Args:
+        image: Image produced by build_image()
+        domain: Exact name to look up, parents are not tried
+
+    Returns:
+        int: Bitmask of the CATEGORY_* lists the name is on, 0 if it is
+        not in the image
+    """
+    header_size = struct.calcsize(IMAGE_HEADER_FORMAT)
+    slot_size = struct.calcsize(IMAGE_SLOT_FORMAT)
+    fields = struct.unpack_from(IMAGE_HEADER_FORMAT, image)
+    seed, slots, buckets = fields[5], fields[6], fields[7]
+    pilots_size = (2 * buckets + 7) // 8 * 8
+    slot_base = header_size + pilots_size
+    pool = slot_base + slots * slot_size
+
+    name = domain.encode()
+    value = hash_domain(name, seed)
+    pilot, = struct.unpack_from('<H', image, header_size + 2 * _reduce(value >> 32, buckets))
+    offset, fingerprint, length, listed = struct.unpack_from(
+        IMAGE_SLOT_FORMAT, image, slot_base + _slot_of(value, pilot, slots) * slot_size
+    )
+    if (length != len(name) or fingerprint != value & 0xFFFF or
+            image[pool + offset:pool + offset + length] != name):
+        return 0
+    return listed
+
+def image_contains(image: bytes, domain: str) -> bool:
+    """Check whether an image holds a domain on any list, see image_categories()."""
+    return image_categories(image, domain) != 0
@@ -0,0 +1,178 @@
+"""
+Import of public blocklists into a category and compilation of the image.
+
+Hosts files ("0.0.0.0 ads.example.com"), adblock filter lists
+("||ads.example.com^") and plain lists of names are read line by line,
+so a list is never held in memory as text. Names are normalized the way
+the kernel matches them: lower case, no trailing dot, IDNs in punycode,
+and a leading "*." dropped since a name already covers its subdomains.
+
+Usage: python -m My_Internet.server.src.list_import [--db FILE] [--image PATH] [--load]
+                                                    [--append] CATEGORY SOURCE...
+"""
+
+import argparse
+import io
+import re
+import sys
+import urllib.request
+from typing import Iterable, Iterator, Optional, TextIO
+from .db_manager import DatabaseManager
+from .image import build_image
+from .logger import setup_logger
+from .utils import (
+    CATEGORY_NAMES, DB_FILE, IMAGE_FIRMWARE_PATH, IMAGE_SYSFS_PATH, IMPORT_FETCH_TIMEOUT
+)
+
+# Hosts file entries that name the machine itself, not a blocked site
+HOSTS_RESERVED = frozenset({
+    "localhost", "localhost.localdomain", "local", "broadcasthost", "ip6-localhost",
+    "ip6-loopback", "ip6-localnet", "ip6-mcastprefix", "ip6-allnodes", "ip6-allrouters",
+    "ip6-allhosts", "0.0.0.0",
+})
+
+_LABEL = re.compile(r"(?!-)[a-z0-9_-]{1,63}(?<!-)")
+# Element hiding and scriptlet rules of adblock lists: "example.com##.banner"
+_COSMETIC = re.compile(r"#[@?$%]?#")
+
+def normalize_domain(name: str) -> Optional[str]:
+    """
+    Bring a list entry to the form the kernel matches.
+
+    Args:
+        name: Name as written in the list
+
+    Returns:
+        Optional[str]: Normalized name, None if it is no domain of two labels or more
+    """
+    name = name.strip().lower().rstrip('.')
+    if name.startswith('*.'):
+        name = name[2:]
+    if not name.isascii():
+        try:
+            name = name.encode('idna').decode('ascii')
+        except UnicodeError:
+            return None
+    labels = name.split('.')
+    if len(name) > 253 or len(labels) < 2 or not all(_LABEL.fullmatch(label) for label in labels):
+        return None
+    return name
+
+def _adblock_name(rule: str) -> Optional[str]:
+    """The domain of a "||name^" blocking rule, None for any other rule."""
+    if not rule.startswith('||'):
+        return None
+    name, _, options = rule[2:].partition('$')
+    # Options narrowing the rule to some requests do not block the name
+    if options and options not in ('important', 'all', 'document'):
+        return None
+    if name.endswith('^'):
+        name = name[:-1]
+    elif name.endswith('^|'):
+        name = name[:-2]
+    if any(c in name for c in '/*^|:'):
+        return None
+    return name
+
+def parse_list(lines: Iterable[str]) -> Iterator[str]:
+    """
+    Read domains out of a hosts file, an adblock filter list or a plain list.
+
+    The format is told per line, so concatenated lists work alike.
+    Exceptions ("@@"), cosmetic rules and rules with paths are skipped,
+    duplicates are left to the database.
+
+    Args:
+        lines: Lines of the list
+
+    Yields:
+        str: Normalized domains
+    """
+    for line in lines:
+        line = line.strip()
+        if not line or line[0] in '#![' or _COSMETIC.search(line):
+            continue
+
+        if line.startswith('||'):
+            names = [_adblock_name(line)]
+        else:
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            # Hosts entries start with the address they resolve to
+            if len(fields) > 1 and (fields[0][0].isdigit() or ':' in fields[0]):
+                fields = fields[1:]
+            names = [field for field in fields if field not in HOSTS_RESERVED]
+
+        for name in names:
+            domain = normalize_domain(name) if name else None
+            if domain:
+                yield domain
+
+def open_source(source: str) -> TextIO:
+    """
+    Open a list by path or http(s) URL, "-" for stdin.
+
+    Returns:
+        TextIO: Text stream over the list, read as it arrives
+    """
+    if source == '-':
+        return sys.stdin
+    if source.startswith(('http://', 'https://')):
+        response = urllib.request.urlopen(source, timeout=IMPORT_FETCH_TIMEOUT)
+        return io.TextIOWrapper(response, encoding='utf-8', errors='replace')
+    return open(source, encoding='utf-8', errors='replace')
+
+def compile_image(db_manager: DatabaseManager) -> bytes:
+    """
+    Compile every list in the database into an image for the kernel.
+
+    Args:
+        db_manager: Database holding the lists
+
+    Returns:
+        bytes: Image at the database's current list version
+    """
+    return build_image(db_manager.get_blocked_domains(), *db_manager.get_list_version(),
+                       categories=db_manager.get_category_domains())
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="Import blocklists into a category and compile the image")
+    parser.add_argument("category", choices=sorted(CATEGORY_NAMES), help="list the domains go on")
+    parser.add_argument("sources", nargs="+", help="hosts or adblock lists, files or URLs")
+    parser.add_argument("--db", default=DB_FILE, help="server database")
+    parser.add_argument("--append", action="store_true",
+                        help="keep domains already on the category, by default it is replaced")
+    parser.add_argument("--image", default=IMAGE_FIRMWARE_PATH, help="where to write the image")
+    parser.add_argument("--load", action="store_true", help="also hand the image to the loaded module")
+    args = parser.parse_args()
+    logger = setup_logger(__name__)
+
+    def domains() -> Iterator[str]:
+        for source in args.sources:
+            with open_source(source) as stream:
+                yield from parse_list(stream)
+
+    db_manager = DatabaseManager(args.db)
+    try:
+        count = db_manager.import_category_domains(CATEGORY_NAMES[args.category], domains(),
+                                                   replace=not args.append)
+        image = compile_image(db_manager)
+    except (OSError, ValueError) as e:
+        logger.error(f"Import failed: {e}")
+        return 1
+
+    paths = [args.image] + ([IMAGE_SYSFS_PATH] if args.load else [])
+    for path in paths:
+        try:
+            with open(path, 'wb') as output:
+                output.write(image)
+        except OSError as e:
+            logger.error(f"Cannot write image to {path}: {e}")
+            return 1
+    logger.info(f"{args.category} list holds {count} domains, image of {len(image)} bytes "
+                f"written to {', '.join(paths)}")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,105 @@
+"""Queue of kernel notifications that merges bursts of domain edits."""
+
+import asyncio
+from typing import Any, Dict, List
+from .protocol import notification_records
+from .utils import (
+    FRAME_OP_ADD_DOMAINS, NOTIFY_COALESCE_DELAY, STR_CODE, STR_DOMAINS, STR_OPERATION, STR_VERSION,
+    Codes
+)
+
+# Custom list edits, whatever else is queued keeps its place
+MERGEABLE_OPERATIONS = (
+    Codes.CODE_ADD_DOMAIN, Codes.CODE_REMOVE_DOMAIN,
+    Codes.CODE_ADD_DOMAINS, Codes.CODE_REMOVE_DOMAINS,
+)
+
+def coalesce_notifications(notifications: List[Dict[str, Any]]) -> List[Dict[str, Any]]:
+    """
+    Merge each run of custom list edits into one bulk removal and one bulk add.
+
+    The last edit of a domain in a run decides which of the two it ends
+    up in, so the kernel reaches the same list. The last of them carries
+    the newest version in the run, the kernel only holds it once the whole
+    run is applied. Any other notification ends the run and is kept in
+    order, as is a run of a single edit.
+
+    Args:
+        notifications: Successful handler responses in arrival order
+
+    Returns:
+        List[Dict[str, Any]]: Notifications to send, in order
+    """
+    merged: List[Dict[str, Any]] = []
+    run: List[Dict[str, Any]] = []
+    edits: Dict[str, bool] = {}
+
+    def end_run() -> None:
+        if len(run) == 1:
+            merged.append(run[0])
+        elif run:
+            bulk = []
+            for operation, added in ((Codes.CODE_REMOVE_DOMAINS, False),
+                                     (Codes.CODE_ADD_DOMAINS, True)):
+                domains = [domain for domain, add in edits.items() if add == added]
+                if domains:
+                    bulk.append({
+                        STR_CODE:      Codes.CODE_SUCCESS,
+                        STR_DOMAINS:   domains,
+                        STR_OPERATION: operation
+                    })
+            if bulk:
+                bulk[-1][STR_VERSION] = max(notification[STR_VERSION] for notification in run)
+            merged.extend(bulk)
+        run.clear()
+        edits.clear()
+
+    for notification in notifications:
+        if notification.get(STR_OPERATION) not in MERGEABLE_OPERATIONS:
+            end_run()
+            merged.append(notification)
+            continue
+
+        opcode, domains = notification_records(notification)
+        for domain in domains:
+            edits[domain] = opcode == FRAME_OP_ADD_DOMAINS
+        run.append(notification)
+
+    end_run()
+    return merged
+
+class NotificationQueue:
+    """Notifications for the kernel, taken off in coalesced batches."""
+
+    def __init__(self, delay: float = NOTIFY_COALESCE_DELAY) -> None:
+        """
+        Initialize an empty queue.
+
+        Args:
+            delay: How long a domain edit waits for more to merge with
+        """
+        self.delay = delay
+        self._queue: asyncio.Queue = asyncio.Queue()
+
+    def put(self, notification: Dict[str, Any]) -> None:
+        """
+        Queue a successful handler response for the kernel.
+
+        Args:
+            notification: Response dictionary produced by a request handler
+        """
+        self._queue.put_nowait(notification)
+
+    async def get_batch(self) -> List[Dict[str, Any]]:
+        """
+        Wait for the next notification and take everything queued behind it.
+
+        Returns:
+            List[Dict[str, Any]]: The batch, see coalesce_notifications()
+        """
+        batch = [await self._queue.get()]
+        if self.delay and batch[0].get(STR_OPERATION) in MERGEABLE_OPERATIONS:
+            await asyncio.sleep(self.delay)
+        while not self._queue.empty():
+            batch.append(self._queue.get_nowait())
+        return coalesce_notifications(batch)
@@ -0,0 +1,197 @@
+"""Binary framing of server to kernel notifications."""
+
+import struct
+from typing import Any, Dict, Iterable, List, Optional, Tuple
+from .utils import (
+    FRAME_MAGIC, FRAME_HEADER_FORMAT, FRAME_MAX_PAYLOAD,
+    FRAME_OP_ADD_DOMAINS, FRAME_OP_REMOVE_DOMAINS, FRAME_OP_LOAD_DOMAINS,
+    FRAME_OP_LIST_VERSION, FRAME_OP_SET_CATEGORIES, FRAME_OP_SET_PAUSED, LIST_VERSION_FORMAT,
+    STR_CONTENT, STR_DOMAINS, STR_OPERATION, STR_CATEGORIES, STR_PAUSED, Codes
+)
+
+MAX_RECORD_LENGTH = 255
+
+def encode_domains(domains: Iterable[str]) -> bytes:
+    """
+    Pack domains into length-prefixed records.
+
+    Args:
+        domains: Domain names, each at most 255 bytes once encoded
+
+    Returns:
+        bytes: Concatenated records
+    """
+    records = bytearray()
+    for domain in domains:
+        name = domain.encode()
+        if not name or len(name) > MAX_RECORD_LENGTH:
+            raise ValueError(f"Domain cannot be framed: {domain!r}")
+        records.append(len(name))
+        records += name
+    return bytes(records)
+
+def encode_frame(opcode: int, payload: bytes = b'') -> bytes:
+    """
+    Prefix a payload with a frame header.
+
+    Args:
+        opcode: One of the FRAME_OP_* values
+        payload: Frame payload
+
+    Returns:
+        bytes: Header followed by the payload
+    """
+    if len(payload) > FRAME_MAX_PAYLOAD:
+        raise ValueError(f"Frame payload too large: {len(payload)} bytes")
+    return struct.pack(FRAME_HEADER_FORMAT, FRAME_MAGIC, opcode, 0, len(payload)) + payload
+
+def decode_domains(records: bytes) -> List[str]:
+    """
+    Unpack length-prefixed records, the inverse of encode_domains().
+
+    Args:
+        records: Concatenated records
+
+    Returns:
+        List[str]: Domains in order
+    """
+    domains: List[str] = []
+    pos = 0
+    while pos < len(records):
+        size = records[pos]
+        domains.append(records[pos + 1:pos + 1 + size].decode())
+        pos += 1 + size
+    return domains
+
+def decode_frame(data: bytes) -> tuple[int, List[str]]:
+    """
+    Decode one frame back into its opcode and domains.
+
+    Args:
+        data: A complete frame
+
+    Returns:
+        tuple: Opcode and list of domains
+    """
+    header_size = struct.calcsize(FRAME_HEADER_FORMAT)
+    magic, opcode, _, length = struct.unpack_from(FRAME_HEADER_FORMAT, data)
+    if magic != FRAME_MAGIC or len(data) != header_size + length:
+        raise ValueError("Malformed frame")
+    return opcode, decode_domains(data[header_size:])
+
+def notification_records(notification: Dict[str, Any]) -> Optional[Tuple[int, List[str]]]:
+    """
+    Find the domain list change carried by a handler response.
+
+    Args:
+        notification: Response dictionary produced by a request handler
+
+    Returns:
+        Optional[Tuple[int, List[str]]]: FRAME_OP_* opcode and domains, None
+        for messages that do not change the domain list
+    """
+    operation = notification.get(STR_OPERATION)
+
+    if operation == Codes.CODE_INIT_SETTINGS:
+        return FRAME_OP_LOAD_DOMAINS, list(notification[STR_DOMAINS])
+    if operation == Codes.CODE_ADD_DOMAIN:
+        return FRAME_OP_ADD_DOMAINS, [notification[STR_CONTENT]]
+    if operation == Codes.CODE_REMOVE_DOMAIN:
+        return FRAME_OP_REMOVE_DOMAINS, [notification[STR_CONTENT]]
+    if operation == Codes.CODE_ADD_DOMAINS:
+        return FRAME_OP_ADD_DOMAINS, list(notification[STR_DOMAINS])
+    if operation == Codes.CODE_REMOVE_DOMAINS:
+        return FRAME_OP_REMOVE_DOMAINS, list(notification[STR_DOMAINS])
+    return None
+
+def encode_notification(notification: Dict[str, Any]) -> Optional[bytes]:
+    """
+    Translate a successful handler response into a kernel frame.
+
+    Args:
+        notification: Response dictionary produced by a request handler
+
+    Returns:
+        Optional[bytes]: Frame for domain list, category and pause changes,
+        None for messages the kernel still receives as JSON
+    """
+    if STR_CATEGORIES in notification:
+        return encode_categories(notification[STR_CATEGORIES])
+    if STR_PAUSED in notification:
+        return encode_paused(notification[STR_PAUSED])
+
+    records = notification_records(notification)
+    if records is None:
+        return None
+
+    opcode, domains = records
+    return encode_frame(opcode, encode_domains(domains))
+
+def encode_list_version(epoch: int, version: int) -> bytes:
+    """
+    Build the frame that tells the kernel which list version it now holds.
+
+    Args:
+        epoch: Database epoch
+        version: Version of the last change sent
+
+    Returns:
+        bytes: Complete FRAME_OP_LIST_VERSION frame
+    """
+    return encode_frame(FRAME_OP_LIST_VERSION, struct.pack(LIST_VERSION_FORMAT, epoch, version))
+
+def encode_categories(categories: int) -> bytes:
+    """
+    Build the frame that sets the categories the kernel enforces.
+
+    Args:
+        categories: Bitmask of CATEGORY_* values
+
+    Returns:
+        bytes: Complete FRAME_OP_SET_CATEGORIES frame
+    """
+    return encode_frame(FRAME_OP_SET_CATEGORIES, bytes([categories]))
+
+def encode_paused(paused: bool) -> bytes:
+    """
+    Build the frame that pauses or resumes filtering in the kernel.
+
+    Args:
+        paused: True to let every query through, the lists stay loaded
+
+    Returns:
+        bytes: Complete FRAME_OP_SET_PAUSED frame
+    """
+    return encode_frame(FRAME_OP_SET_PAUSED, bytes([int(paused)]))
+
+def decode_list_version(payload: bytes) -> Tuple[int, int]:
+    """
+    Read the epoch and version out of a FRAME_OP_LIST_VERSION payload.
+
+    Args:
+        payload: Frame payload without header
+
+    Returns:
+        Tuple[int, int]: Epoch and version, epoch 0 if the kernel list is unknown
+    """
+    if len(payload) != struct.calcsize(LIST_VERSION_FORMAT):
+        raise ValueError("Malformed list version")
+    return struct.unpack(LIST_VERSION_FORMAT, payload)
+
+def delta_records(added: List[str], removed: List[str]) -> List[Tuple[int, List[str]]]:
+    """
+    Turn a change set into the FRAME_OP_* records that apply it.
+
+    Args:
+        added: Domains to add
+        removed: Domains to remove
+
+    Returns:
+        List[Tuple[int, List[str]]]: Opcode and domains per non-empty change
+    """
+    records: List[Tuple[int, List[str]]] = []
+    if removed:
+        records.append((FRAME_OP_REMOVE_DOMAINS, removed))
+    if added:
+        records.append((FRAME_OP_ADD_DOMAINS, added))
+    return records
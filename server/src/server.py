@@ -1,16 +1,65 @@
-from typing import Dict, Any, Optional
+from typing import Dict, Any, List, Optional, Tuple
+import codecs
 import socket
-import threading
+import struct
 import json
 import asyncio
 from .utils import (
-    CLIENT_PORT, DEFAULT_ADDRESS, KERNEL_PORT,
-    STR_CODE, Codes, invalid_json_response
+    CLIENT_PORT, CLIENT_READ_SIZE, CLIENT_REQUEST_LIMIT, DEFAULT_ADDRESS, KERNEL_PORT,
+    EVENT_POLL_INTERVAL,
+    FRAME_MAGIC, FRAME_HEADER_FORMAT, FRAME_OP_LIST_VERSION, FRAME_OP_REMOVE_DOMAINS,
+    FRAME_OP_LOAD_DOMAINS, LIST_VERSION_FORMAT,
+    KERNEL_HELLO_TIMEOUT, IMAGE_SYSFS_PATH, IMAGE_FIRMWARE_PATH, XDP_INTERFACE, STR_CODE, STR_OPERATION,
+    STR_CONTENT, STR_VERSION, Codes, invalid_json_response
 )
 from .db_manager import DatabaseManager
 from .handlers import RequestFactory
+from .event_reader import EventReader
+from .protocol import (
+    encode_domains, encode_frame, encode_notification, encode_list_version, encode_categories,
+    encode_paused,
+    decode_list_version, delta_records, notification_records
+)
+from .genl_client import GenlClient
+from .notifications import NotificationQueue
+from .image import build_image
+from .xdp_filter import XdpFilter
 from .logger import setup_logger
 
+# What a JSON value cut off at the end of the buffer may still end with
+_PARTIAL_TAILS = ('', '-', 't', 'tr', 'tru', 'f', 'fa', 'fal', 'fals', 'n', 'nu', 'nul')
+
+def split_requests(text: str) -> Tuple[List[Any], str, bool]:
+    """
+    Take the complete JSON requests off the front of a client's buffer.
+
+    Clients write requests back to back with no delimiter, so one read
+    may hold several of them or part of one.
+
+    Args:
+        text: Data received and not parsed yet
+
+    Returns:
+        Tuple: Parsed requests, the incomplete rest to keep, and whether
+        the data that followed the requests was not JSON at all
+    """
+    decoder = json.JSONDecoder()
+    requests: List[Any] = []
+    pos = 0
+
+    while True:
+        while pos < len(text) and text[pos].isspace():
+            pos += 1
+        if pos == len(text):
+            return requests, '', False
+        try:
+            request, pos = decoder.raw_decode(text, pos)
+        except json.JSONDecodeError as e:
+            if e.msg.startswith("Unterminated string") or text[e.pos:].rstrip() in _PARTIAL_TAILS:
+                return requests, text[pos:], False
+            return requests, '', True
+        requests.append(request)
+
 class Server:
     """Server class handling both client and kernel connections."""
 
@@ -24,6 +73,11 @@ class Server:
         self.db_manager = db_manager
         self.request_factory = RequestFactory(self.db_manager)
         self.kernel_writer: Optional[asyncio.StreamWriter] = None
+        self.event_reader = EventReader()
+        self.genl: Optional[GenlClient] = None
+        self.genl_events: Optional[socket.socket] = None
+        self.xdp: Optional[XdpFilter] = None
+        self.notifications = NotificationQueue()
         self.running = True
         self.logger = setup_logger(__name__)
         self.logger.info("Server initialized")
@@ -32,29 +86,203 @@ class Server:
         """
         Send notification to kernel if connected.
 
+        Domain list changes go over generic netlink when the module's
+        family is available. Otherwise they go out over the TCP channel
+        as binary frames, everything else as newline-terminated JSON.
+
         Args:
             notification: Dictionary containing notification data
         """
+        if self.xdp:
+            self.xdp.apply(notification)
+
+        if self.genl:
+            try:
+                if self._shared_domain_profile_removal(notification):
+                    return
+                if self.genl.apply(notification):
+                    self._restore_profile_domains(notification)
+                    if STR_VERSION in notification:
+                        self.genl.set_list_version(*notification[STR_VERSION])
+                    self.logger.debug(f"Kernel notified over netlink: {notification.get(STR_OPERATION)}")
+                    return
+            except OSError as e:
+                self.logger.error(f"Failed to notify kernel over netlink: {e}")
+
         if not self.kernel_writer:
             return
 
+        # Category lists have no frame, the image carries them. Its pilot
+        # search takes seconds on a full category, so it runs off the loop
+        if notification.get(STR_OPERATION) in (Codes.CODE_ADD_CATEGORY_DOMAINS,
+                                               Codes.CODE_REMOVE_CATEGORY_DOMAINS):
+            await asyncio.get_running_loop().run_in_executor(None, self._rebuild_image)
+            return
+
         try:
-            self.kernel_writer.write(json.dumps(notification).encode() + b'\n')
+            frame = encode_notification(notification)
+            if frame is None:
+                frame = json.dumps(notification).encode() + b'\n'
+            elif STR_VERSION in notification:
+                frame += encode_list_version(*notification[STR_VERSION])
+            self.kernel_writer.write(frame)
             await self.kernel_writer.drain()
             self.logger.debug(f"Kernel notified: {notification}")
 
         except Exception as e:
             self.logger.error(f"Failed to notify kernel: {e}")
 
+    def _shared_domain_profile_removal(self, notification: Dict[str, Any]) -> bool:
+        """A domain on the shared list stays blocked for every profile."""
+        return (notification.get(STR_OPERATION) == Codes.CODE_REMOVE_PROFILE_DOMAIN and
+                self.db_manager.is_domain_blocked(notification[STR_CONTENT]))
+
+    def _sync_profile_domains(self, domains: Optional[List[str]] = None) -> None:
+        """
+        Send the kernel the profile bits of domains, all by default.
+
+        A shared list removal or a full load clears them in the kernel.
+        """
+        by_profile: Dict[int, List[str]] = {}
+        for domain, profile in self.db_manager.get_profile_domains(domains):
+            by_profile.setdefault(profile, []).append(domain)
+        for profile, profile_domains in by_profile.items():
+            self.genl.add_domains(profile_domains, profile)
+
+    def _sync_category_domains(self) -> None:
+        """Send the kernel every category list, a full load without an image drops them."""
+        by_category: Dict[int, List[str]] = {}
+        for domain, category in self.db_manager.get_category_domains():
+            by_category.setdefault(category, []).append(domain)
+        for category, category_domains in by_category.items():
+            self.genl.add_domains(category_domains, category=category)
+
+    def _restore_profile_domains(self, notification: Dict[str, Any]) -> None:
+        """Put back the profiles of domains just removed from the shared list."""
+        records = notification_records(notification)
+        if records and records[0] == FRAME_OP_REMOVE_DOMAINS:
+            self._sync_profile_domains(records[1])
+
+    def _resync_records(
+        self,
+        epoch: int,
+        version: int
+    ) -> Tuple[List[Tuple[int, List[str]]], Optional[Tuple[int, int]]]:
+        """
+        Work out what brings a kernel list at a given version up to date.
+
+        Only the changes since that version are sent when the change log
+        still covers it, the full list otherwise.
+
+        Args:
+            epoch: Database epoch the kernel reported, 0 if unknown
+            version: Last version the kernel applied
+
+        Returns:
+            Tuple: FRAME_OP_* records to apply in order and the version they
+            lead to, None if no list could be built
+        """
+        # Read before the list so a concurrent change is resent, never lost
+        current = self.db_manager.get_list_version()
+
+        if epoch == current[0]:
+            changes = self.db_manager.get_changes_since(version)
+            if changes is not None:
+                self.logger.info(f"Kernel list at version {version}, sending changes up to {current[1]}")
+                return delta_records(*changes), current
+
+        self.logger.info(f"Kernel list unknown or too old, sending full list at version {current[1]}")
+        settings = self._get_initial_settings()
+        if settings.get(STR_CODE) != Codes.CODE_SUCCESS:
+            return [], None
+
+        opcode, domains = notification_records(settings)
+        if self._load_image(domains, current):
+            return [], current
+        return [(opcode, domains)], current
+
+    def _load_image(self, domains: List[str], current: Tuple[int, int]) -> bool:
+        """
+        Hand the full list to the kernel as a precompiled image.
+
+        The image also holds the category lists and goes to /lib/firmware,
+        where the module's boot_image parameter picks it up on the next
+        start.
+
+        Args:
+            domains: Complete domain list
+            current: Epoch and version the list is at
+
+        Returns:
+            bool: True if the kernel loaded the image
+        """
+        try:
+            image = build_image(domains, *current, categories=self.db_manager.get_category_domains())
+        except ValueError as e:
+            self.logger.error(f"Cannot build blocklist image: {e}")
+            return False
+
+        try:
+            with open(IMAGE_FIRMWARE_PATH, 'wb') as firmware:
+                firmware.write(image)
+        except OSError as e:
+            self.logger.debug(f"Blocklist image not cached: {e}")
+
+        try:
+            with open(IMAGE_SYSFS_PATH, 'wb') as attribute:
+                attribute.write(image)
+        except OSError as e:
+            self.logger.debug(f"Kernel image attribute not available: {e}")
+            return False
+
+        self.logger.info(f"Kernel loaded image of {len(domains)} domains ({len(image)} bytes)")
+        return True
+
+    def _rebuild_image(self) -> bool:
+        """
+        Load an image of the whole database, safe to run in a worker thread.
+
+        Returns:
+            bool: True if the kernel loaded the image
+        """
+        # Read before the list so a concurrent change is resent, never lost
+        current = self.db_manager.get_list_version()
+        return self._load_image(self.db_manager.get_blocked_domains(), current)
+
+    async def _read_kernel_version(self, reader: asyncio.StreamReader) -> Tuple[int, int]:
+        """
+        Read the list version a connecting kernel reports.
+
+        Args:
+            reader: AsyncIO stream reader of the kernel connection
+
+        Returns:
+            Tuple[int, int]: Epoch and version, (0, 0) if none was reported
+        """
+        header_size = struct.calcsize(FRAME_HEADER_FORMAT)
+        try:
+            header = await asyncio.wait_for(reader.readexactly(header_size), KERNEL_HELLO_TIMEOUT)
+            magic, opcode, _, length = struct.unpack(FRAME_HEADER_FORMAT, header)
+            if (magic != FRAME_MAGIC or opcode != FRAME_OP_LIST_VERSION or
+                    length != struct.calcsize(LIST_VERSION_FORMAT)):
+                raise ValueError("Unexpected frame")
+            return decode_list_version(await reader.readexactly(length))
+
+        except (asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError) as e:
+            self.logger.warning(f"Kernel did not report its list version: {e}")
+            return 0, 0
+
     async def handle_kernel_requests(
         self,
         reader: asyncio.StreamReader,
         writer: asyncio.StreamWriter
     ) -> None:
         """
-        Handle kernel connection and send initial settings.
+        Handle kernel connection and bring its list up to date.
 
-        NOTE: This is currently only used for sending initial settings.
+        The kernel reports the list version it holds when it connects,
+        also after reconnecting to a restarted server, and gets only the
+        changes since. Nothing else is read from it yet.
         
         Args:
             reader: AsyncIO stream reader
@@ -65,8 +293,19 @@ class Server:
         self.kernel_writer = writer
         
         try:
-            initial_settings = self._get_initial_settings()
-            await self.notify_kernel(initial_settings)
+            epoch, version = await self._read_kernel_version(reader)
+
+            # With netlink the list is kept in sync there, see connect_genl()
+            if not self.genl:
+                records, current = self._resync_records(epoch, version)
+                data = b''.join(encode_frame(opcode, encode_domains(domains))
+                                for opcode, domains in records)
+                if current:
+                    data += encode_list_version(*current)
+                data += encode_categories(self.db_manager.get_enabled_categories())
+                data += encode_paused(self.db_manager.is_paused())
+                writer.write(data)
+                await writer.drain()
             
             while self.running:
                 data = await reader.read(1024) 
@@ -85,93 +324,165 @@ class Server:
             await writer.wait_closed()
             self.logger.info(f"Kernel connection closed for {addr}")
 
-    def handle_client_thread(self) -> None:
-        """Handle client connections using traditional socket."""
-        client_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-        client_socket.bind((DEFAULT_ADDRESS, CLIENT_PORT))
-        client_socket.listen(1)
-        client_socket.settimeout(1.0)
-        self.logger.info(f"Client server running on {DEFAULT_ADDRESS}:{CLIENT_PORT}")
+    def connect_genl(self) -> None:
+        """Attach to the module's netlink family and bring its list and profiles up to date."""
+        self.genl = GenlClient.connect()
+        if not self.genl:
+            self.logger.info("Kernel netlink family not available, waiting for TCP")
+            return
 
+        self.logger.info(f"Kernel netlink family resolved (id {self.genl.family_id})")
         try:
-            self._handle_client_connections(client_socket)
-        finally:
-            client_socket.close()
+            try:
+                epoch, version = self.genl.get_list_version()
+            except (OSError, KeyError):
+                epoch, version = 0, 0
 
-    def _handle_client_connections(self, client_socket: socket.socket) -> None:
-        """
-        Process incoming client connections.
+            records, current = self._resync_records(epoch, version)
+            for opcode, domains in records:
+                self.genl.apply_records(opcode, domains)
+            if any(opcode == FRAME_OP_LOAD_DOMAINS for opcode, _ in records):
+                self._sync_category_domains()
+            if current:
+                self.genl.set_list_version(*current)
+            self.genl.set_categories(self.db_manager.get_enabled_categories())
+            self.genl.set_paused(self.db_manager.is_paused())
 
-        Args:
-            client_socket: Socket for client connections
-        """
+            # Profiles are not versioned, they are small enough to resend
+            self.genl.set_profiles(self.db_manager.get_client_profiles())
+            self._sync_profile_domains()
+            self.genl_events = self.genl.subscribe_events()
+        except (OSError, KeyError) as e:
+            self.logger.error(f"Netlink setup failed: {e}")
+
+    def attach_xdp(self) -> None:
+        """Attach the XDP fast path when an interface is configured and fill its map."""
+        if not XDP_INTERFACE:
+            return
+
+        self.xdp = XdpFilter.attach(XDP_INTERFACE)
+        if not self.xdp:
+            return
+        if self.db_manager.is_paused():
+            self.xdp.configure(enabled=False, answer=self.xdp.answer)
+
+        settings = self._get_initial_settings()
+        if settings.get(STR_CODE) != Codes.CODE_SUCCESS:
+            return
+        _, domains = notification_records(settings)
+        try:
+            self.xdp.load(domains)
+            self.logger.info(f"XDP map loaded with {len(domains)} domains")
+        except OSError as e:
+            self.logger.error(f"XDP map load failed: {e}")
+
+    async def drain_kernel_events(self) -> None:
+        """Periodically drain kernel events into the server log."""
         while self.running:
-            try:
-                conn, addr = client_socket.accept()
-                self.logger.info(f"Client connected from {addr}")
-                conn.settimeout(1.0)
-                self._handle_client_communication(conn)
-            except socket.timeout:
-                continue
-            except Exception as e:
-                self.logger.error(f"Client error: {e}")
+            if self.genl_events:
+                events = GenlClient.read_events(self.genl_events)
+            else:
+                events = self.event_reader.drain()
+            for event in events:
+                self.logger.info(
+                    f"Kernel event: {event.domain} {event.verdict} for client {event.client}"
+                )
+            await asyncio.sleep(EVENT_POLL_INTERVAL)
+
+    async def forward_notifications(self) -> None:
+        """Send queued notifications to the kernel, each burst of domain edits as one."""
+        while self.running:
+            for notification in await self.notifications.get_batch():
+                try:
+                    await self.notify_kernel(notification)
+                except Exception as e:
+                    self.logger.error(f"Failed to notify kernel: {e}")
 
-    def _handle_client_communication(self, conn: socket.socket) -> None:
+    async def handle_client_requests(
+        self,
+        reader: asyncio.StreamReader,
+        writer: asyncio.StreamWriter
+    ) -> None:
         """
-        Handle communication with a connected client.
+        Serve one client connection on the server's event loop.
+
+        The client gets the initial settings, then an answer to every
+        request in the order they arrive. The kernel learns about
+        successful requests through the notification queue, which lets
+        a bulk import reach it in a few messages.
 
         Args:
-            conn: Client connection socket
+            reader: AsyncIO stream reader
+            writer: AsyncIO stream writer
         """
+        addr = writer.get_extra_info('peername')
+        self.logger.info(f"Client connected from {addr}")
+        decoder = codecs.getincrementaldecoder('utf-8')(errors='replace')
+        pending = ''
+
         try:
             initial_settings = self._get_initial_settings()
-            conn.send(json.dumps(initial_settings).encode() + b'\n')
+            writer.write(json.dumps(initial_settings).encode() + b'\n')
+            await writer.drain()
             self.logger.debug(f"Sent initial settings: {initial_settings}")
 
             while self.running:
-                try:
-                    data = conn.recv(1024)
-                    if not data:
-                        break
+                data = await reader.read(CLIENT_READ_SIZE)
+                if not data:
+                    break
 
-                    self._process_client_request(conn, data)
-                except socket.timeout:
-                    continue
+                requests, pending, invalid = split_requests(pending + decoder.decode(data))
+                for request_data in requests:
+                    self._process_client_request(writer, request_data)
+                if invalid or len(pending) > CLIENT_REQUEST_LIMIT:
+                    self.logger.error("Invalid JSON format received")
+                    writer.write(json.dumps(invalid_json_response()).encode() + b'\n')
+                    pending = ''
+                await writer.drain()
+
+        except (ConnectionError, OSError) as e:
+            self.logger.error(f"Client error: {e}")
         finally:
-            conn.close()
+            writer.close()
+            try:
+                await writer.wait_closed()
+            except (ConnectionError, OSError):
+                pass
+            self.logger.info(f"Client connection closed for {addr}")
 
-    def _process_client_request(self, conn: socket.socket, data: bytes) -> None:
+    def _process_client_request(self, writer: asyncio.StreamWriter, request_data: Any) -> None:
         """
-        Process individual client requests.
+        Answer one client request and queue its kernel notification.
 
         Args:
-            conn: Client connection socket
-            data: Received data bytes
+            writer: Client connection writer
+            request_data: Decoded request
         """
-        try:
-            request_data = json.loads(data.decode())
-            response = self.request_factory.handle_request(request_data)
-            self.logger.debug(f"Received request: {request_data}")
-            
-            conn.send(json.dumps(response).encode() + b'\n')
-            self.logger.debug(f"Sent response: {response}")
+        if not isinstance(request_data, dict):
+            self.logger.error("Invalid JSON format received")
+            writer.write(json.dumps(invalid_json_response()).encode() + b'\n')
+            return
 
-            if response.get(STR_CODE) == Codes.CODE_SUCCESS:
-                asyncio.run(self.notify_kernel(response))
+        response = self.request_factory.handle_request(request_data)
+        self.logger.debug(f"Received request: {request_data}")
 
-        except json.JSONDecodeError:
-            self.logger.error("Invalid JSON format received")
-            conn.send(json.dumps(invalid_json_response()).encode() + b'\n')
+        writer.write(json.dumps(response).encode() + b'\n')
+        self.logger.debug(f"Sent response: {response}")
+
+        if response.get(STR_CODE) == Codes.CODE_SUCCESS:
+            self.notifications.put(response)
 
     async def start_server(self) -> None:
-        """Run both client and kernel handlers."""
-        client_thread: Optional[threading.Thread] = None
+        """Run the client and kernel servers on one event loop."""
+        client_server: Optional[asyncio.Server] = None
         kernel_server: Optional[asyncio.Server] = None
+        tasks: List[asyncio.Task] = []
         
         try:
-            client_thread = threading.Thread(target=self.handle_client_thread)
-            client_thread.start()
-            self.logger.info("Client handler thread started")
+            self.connect_genl()
+            self.attach_xdp()
+            tasks.append(asyncio.create_task(self.drain_kernel_events()))
+            tasks.append(asyncio.create_task(self.forward_notifications()))
 
             kernel_server = await asyncio.start_server(
                 self.handle_kernel_requests,
@@ -179,36 +490,50 @@ class Server:
                 KERNEL_PORT
             )
             self.logger.info(f"Kernel server running on {DEFAULT_ADDRESS}:{KERNEL_PORT}")
+
+            client_server = await asyncio.start_server(
+                self.handle_client_requests,
+                DEFAULT_ADDRESS,
+                CLIENT_PORT
+            )
+            self.logger.info(f"Client server running on {DEFAULT_ADDRESS}:{CLIENT_PORT}")
             
-            async with kernel_server:
-                await kernel_server.serve_forever()
+            async with kernel_server, client_server:
+                await asyncio.gather(kernel_server.serve_forever(), client_server.serve_forever())
 
         except Exception as e:
             self.logger.error(f"Server error: {e}")
             raise
         finally:
-            self._cleanup_server(kernel_server, client_thread)
+            for task in tasks:
+                task.cancel()
+            self.event_reader.close()
+            if self.genl_events:
+                self.genl_events.close()
+            if self.genl:
+                self.genl.close()
+            if self.xdp:
+                self.xdp.detach()
+            await self._cleanup_server(kernel_server, client_server)
 
-    def _cleanup_server(
+    async def _cleanup_server(
         self,
         kernel_server: Optional[asyncio.Server],
-        client_thread: Optional[threading.Thread]
+        client_server: Optional[asyncio.Server]
     ) -> None:
         """
         Clean up server resources.
 
         Args:
             kernel_server: Kernel server instance
-            client_thread: Client handler thread
+            client_server: Client server instance
         """
         self.running = False
         
-        if kernel_server:
-            kernel_server.close()
-            asyncio.run(kernel_server.wait_closed())
-            
-        if client_thread and client_thread.is_alive():
-            client_thread.join(timeout=1.0)
+        for server in (kernel_server, client_server):
+            if server:
+                server.close()
+                await server.wait_closed()
 
     def _get_initial_settings(self) -> Dict[str, Any]:
         """Get initial settings and domain list for initialization."""
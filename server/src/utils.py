@@ -9,6 +9,117 @@ CLIENT_PORT: int     = 65432
 KERNEL_PORT: int     = 65433
 BUFFER_SIZE: int     = 1024
 
+# Binary frames to the kernel (struct frame_header in kernel/src/utils.h)
+FRAME_MAGIC: int         = 0xDF
+FRAME_HEADER_FORMAT: str = "!BBHI"
+FRAME_MAX_PAYLOAD: int   = 64 << 20
+FRAME_OP_ADD_DOMAINS     = 1
+FRAME_OP_REMOVE_DOMAINS  = 2
+FRAME_OP_LOAD_DOMAINS    = 3
+FRAME_OP_LIST_VERSION    = 4
+FRAME_OP_SET_CATEGORIES  = 5
+FRAME_OP_SET_PAUSED      = 6
+LIST_VERSION_FORMAT: str = "!IQ"
+
+# Blocklist images (kernel/src/image.h)
+IMAGE_MAGIC: int          = 0x4942464e
+IMAGE_FORMAT_VERSION: int = 4
+IMAGE_HEADER_FORMAT: str  = "<IHHIIQIIIIQQ"
+IMAGE_SLOT_FORMAT: str    = "<IHBB"
+IMAGE_PILOT_MUL: int      = 0x9e3779b97f4a7c15
+IMAGE_CHAIN_MUL: int      = 0xc2b2ae3d27d4eb4f
+LABEL_HASH_MUL: int       = 0x9e3779b97f4a7c15
+IMAGE_BUCKET_SIZE: int    = 4
+IMAGE_LOAD_FACTOR: float  = 0.97
+IMAGE_SYSFS_PATH: str     = "/sys/devices/Network_Filter/image"
+IMAGE_FIRMWARE_PATH: str  = "/lib/firmware/network_filter.img"
+
+# XDP fast path (kernel/bpf/xdp_dns.bpf.c), off unless an interface is set
+XDP_INTERFACE: str      = os.environ.get("NF_XDP_INTERFACE", "")
+XDP_OBJECT_PATH: str    = os.path.join(Path(__file__).parent.parent.parent, "kernel", "xdp_dns.bpf.o")
+XDP_PIN_DIR: str        = "/sys/fs/bpf/network_filter"
+XDP_CONFIG_FORMAT: str  = "=QII"
+XDP_FLAG_ENABLED: int   = 0x1
+XDP_FLAG_ANSWER: int    = 0x2
+
+# Client connections, served on the kernel server's event loop
+CLIENT_READ_SIZE: int         = 64 * 1024
+CLIENT_REQUEST_LIMIT: int     = 16 * 1024 * 1024
+
+# Domain edits arriving within this window reach the kernel as one bulk change
+NOTIFY_COALESCE_DELAY: float  = 0.05
+
+# Blocklist imports, see list_import.py
+IMPORT_FETCH_TIMEOUT: float   = 60.0
+
+# List versioning, see DatabaseManager.get_changes_since()
+CHANGE_LOG_LIMIT: int        = 10000
+KERNEL_HELLO_TIMEOUT: float  = 2.0
+
+# Generic netlink control family (kernel/src/genl.h)
+GENL_FAMILY_NAME: str  = "Network_Filter"
+GENL_VERSION: int      = 1
+GENL_MCGRP_EVENTS: str = "events"
+GENL_CHUNK_SIZE: int   = 32 * 1024
+GENL_CMD_ADD_DOMAINS    = 1
+GENL_CMD_REMOVE_DOMAINS = 2
+GENL_CMD_LOAD_DOMAINS   = 3
+GENL_CMD_GET_STATS      = 4
+GENL_CMD_EVENT          = 5
+GENL_CMD_GET_VERSION    = 6
+GENL_CMD_SET_VERSION    = 7
+GENL_CMD_SET_PROFILES   = 8
+GENL_CMD_SET_CATEGORIES = 9
+GENL_CMD_GET_HITS       = 10
+GENL_CMD_SET_PAUSED     = 11
+GENL_ATTR_DOMAINS       = 1
+GENL_ATTR_LOAD_FIRST    = 2
+GENL_ATTR_LOAD_LAST     = 3
+GENL_ATTR_STATS         = 4
+GENL_ATTR_EVENT         = 5
+GENL_ATTR_PAD           = 6
+GENL_ATTR_LIST_EPOCH    = 7
+GENL_ATTR_LIST_VERSION  = 8
+GENL_ATTR_PROFILE_RULES = 9
+GENL_ATTR_PROFILE       = 10
+GENL_ATTR_CATEGORIES    = 11
+GENL_ATTR_CATEGORY      = 12
+GENL_ATTR_HIT_COUNTS    = 13
+GENL_ATTR_LISTED        = 14
+GENL_ATTR_COLD          = 15
+GENL_ATTR_PAUSED        = 16
+GENL_DUMP_RETRIES       = 3
+
+# Client profiles (struct nf_profile_rule in kernel/src/profiles.h)
+PROFILE_MAX: int         = 32
+PROFILE_DEFAULT: int     = 0
+PROFILE_RULES_MAX: int   = 1024
+PROFILE_RULE_FORMAT: str = "=BBBB16s"
+
+# Lists a domain can be on (CATEGORY_* in kernel/src/cache.h), the kernel
+# enforces the enabled ones itself
+CATEGORY_CUSTOM: int = 0
+CATEGORY_ADS: int    = 1
+CATEGORY_ADULT: int  = 2
+CATEGORY_MAX: int    = 8
+
+# Names of enum nf_stat_item (kernel/src/stats.h), in order
+KERNEL_STAT_NAMES = [
+    "packets", "dns_responses", "dns_queries", "answered", "parse_errors",
+    "lookups", "probes", "filter_negatives", "filter_false_positives",
+    "hits", "blocked",
+]
+
+# Kernel event ring (relay files under the module's debugfs directory)
+KERNEL_EVENTS_DIR: str       = "/sys/kernel/debug/Network_Filter"
+EVENT_FORMAT: str            = "<Q16sHBB100s"
+EVENT_POLL_INTERVAL: float   = 1.0
+EVENT_READ_SIZE: int         = 128 * 512
+EVENT_VERDICTS = {
+    1: "nxdomain",
+    2: "blocked",
+}
+
 # Base directories
 BASE_DIR: Path = Path(__file__).parent.parent
 LOG_DIR: str   = os.path.join(BASE_DIR, "logs")
@@ -26,6 +137,16 @@ class Codes:
     CODE_ERROR              = "101"
     CODE_ACK                = "99"
     CODE_INIT_SETTINGS      = "55"
+    CODE_REMOVE_DOMAINS     = "56"
+    CODE_SET_CLIENT_PROFILE    = "57"
+    CODE_REMOVE_CLIENT_PROFILE = "58"
+    CODE_ADD_PROFILE_DOMAIN    = "59"
+    CODE_REMOVE_PROFILE_DOMAIN = "60"
+    CODE_ADD_CATEGORY_DOMAINS    = "61"
+    CODE_REMOVE_CATEGORY_DOMAINS = "62"
+    # Merged single adds, only ever sent towards the kernel
+    CODE_ADD_DOMAINS             = "63"
+    CODE_PAUSE_FILTERING         = "64"
 # Logging constants
 LOG_FORMAT = "%(asctime)s - %(name)s - %(levelname)s - %(message)s"
 LOG_DATE_FORMAT = "%Y%m%d_%H%M%S"
@@ -35,6 +156,7 @@ STR_CODE      = "code"
 STR_CONTENT   = "content"
 STR_OPERATION = "operation"
 STR_SETTINGS  = "settings"
+STR_VERSION   = "version"
 
 # Domain Related
 STR_DOMAIN  = "domain"
@@ -42,27 +164,43 @@ STR_DOMAINS = "domains"
 STR_BLOCK   = "block"
 STR_UNBLOCK = "unblock"
 
+# Client profile keys
+STR_SUBNET  = "subnet"
+STR_PROFILE = "profile"
+STR_RULES   = "rules"
+
+# Category keys
+STR_CATEGORY   = "category"
+STR_CATEGORIES = "categories"
+
 # Features and Settings
 STR_AD_BLOCK    = "ad_block"
 STR_ADULT_BLOCK = "adult_block"
+STR_PAUSE       = "pause"
+STR_PAUSED      = "paused"
 STR_TOGGLE_ON   = "on"
 STR_TOGGLE_OFF  = "off"
 
+# Category of each list by request name and of each toggle
+CATEGORY_NAMES = {
+    "ads":   CATEGORY_ADS,
+    "adult": CATEGORY_ADULT,
+}
+CATEGORY_SETTINGS = {
+    STR_AD_BLOCK:    CATEGORY_ADS,
+    STR_ADULT_BLOCK: CATEGORY_ADULT,
+}
+
 # Status and Response Keys
 STR_ERROR   = "Error"
 STR_SUCCESS = "success"
 
 # Response Messages
-STR_DOMAIN_BLOCKED_MSG   = "Domain has been successfully blocked."
-STR_DOMAIN_UNBLOCKED_MSG = "Domain has been successfully unblocked."
-STR_DOMAIN_NOT_FOUND_MSG = "Domain not found in block list."
-STR_INVALID_JSON_MSG     = "Invalid JSON format."
-
-# DNS Script Names
-STR_CLOUDFLARE_DNS_SCRIPT     = "cloudflare_dns.sh"
-STR_ADGUARD_DNS_SCRIPT        = "adguard_dns.sh"
-STR_ADGUARD_FAMILY_DNS_SCRIPT = "adguard_family_dns.sh"
-STR_RESET_DNS_SCRIPT          = "reset_dns.sh"
+STR_DOMAIN_BLOCKED_MSG    = "Domain has been successfully blocked."
+STR_DOMAIN_UNBLOCKED_MSG  = "Domain has been successfully unblocked."
+STR_DOMAIN_NOT_FOUND_MSG  = "Domain not found in block list."
+STR_DOMAINS_NOT_FOUND_MSG = "None of the domains were found in block list."
+STR_INVALID_JSON_MSG      = "Invalid JSON format."
 
 def invalid_json_response():
     return {
@@ -0,0 +1,260 @@
+"""Loader and map sync for the XDP fast path (kernel/bpf/xdp_dns.bpf.c)."""
+
+import ctypes
+import os
+import platform
+import secrets
+import shutil
+import struct
+import subprocess
+from typing import Any, Dict, Iterable, Iterator, List, Optional, Protocol
+from .image import hash_domain
+from .logger import setup_logger
+from .protocol import notification_records
+from .utils import (
+    XDP_OBJECT_PATH, XDP_PIN_DIR, XDP_CONFIG_FORMAT, XDP_FLAG_ENABLED, XDP_FLAG_ANSWER,
+    FRAME_OP_ADD_DOMAINS, FRAME_OP_REMOVE_DOMAINS, FRAME_OP_LOAD_DOMAINS, STR_PAUSED
+)
+
+BPF_SYSCALL = {"x86_64": 321, "aarch64": 280, "armv7l": 386, "riscv64": 280}
+BPF_MAP_UPDATE_ELEM = 2
+BPF_MAP_DELETE_ELEM = 3
+BPF_MAP_GET_NEXT_KEY = 4
+BPF_OBJ_GET = 7
+
+DOMAINS_MAP = "nf_domains"
+CONFIG_MAP = "nf_config"
+PROGRAM_PIN = "prog"
+KEY_FORMAT = "=Q"
+PRESENT = b'\1'
+
+class BpfMap(Protocol):
+    """The map operations XdpFilter needs, see PinnedMap."""
+
+    def update(self, key: bytes, value: bytes) -> None: ...
+    def delete(self, key: bytes) -> None: ...
+    def keys(self) -> Iterator[bytes]: ...
+
+class _MapElemAttr(ctypes.Structure):
+    _fields_ = [
+        ("map_fd", ctypes.c_uint32), ("pad", ctypes.c_uint32),
+        ("key", ctypes.c_uint64), ("value", ctypes.c_uint64), ("flags", ctypes.c_uint64),
+    ]
+
+class _ObjGetAttr(ctypes.Structure):
+    _fields_ = [
+        ("pathname", ctypes.c_uint64), ("bpf_fd", ctypes.c_uint32), ("file_flags", ctypes.c_uint32),
+    ]
+
+_libc = ctypes.CDLL(None, use_errno=True)
+
+def _bpf(cmd: int, attr: ctypes.Structure) -> int:
+    result = _libc.syscall(BPF_SYSCALL[platform.machine()], cmd, ctypes.byref(attr), ctypes.sizeof(attr))
+    if result < 0:
+        errno = ctypes.get_errno()
+        raise OSError(errno, os.strerror(errno))
+    return result
+
+class PinnedMap:
+    """A BPF map pinned under bpffs, driven through the bpf() syscall."""
+
+    def __init__(self, path: str, key_size: int, value_size: int) -> None:
+        """
+        Open a pinned map.
+
+        Args:
+            path: Pin path under /sys/fs/bpf
+            key_size: Key size the map was created with
+            value_size: Value size the map was created with
+
+        Raises:
+            OSError: The map is not pinned there
+        """
+        name = ctypes.create_string_buffer(path.encode())
+        self.fd = _bpf(BPF_OBJ_GET, _ObjGetAttr(pathname=ctypes.addressof(name)))
+        self.key_size = key_size
+        self.value_size = value_size
+
+    def close(self) -> None:
+        """Close the map descriptor, the pin keeps the map."""
+        os.close(self.fd)
+
+    def _elem(self, cmd: int, key: bytes, value: Optional[ctypes.Array] = None) -> None:
+        key_buf = ctypes.create_string_buffer(key, self.key_size)
+        attr = _MapElemAttr(map_fd=self.fd, key=ctypes.addressof(key_buf),
+                            value=ctypes.addressof(value) if value is not None else 0)
+        _bpf(cmd, attr)
+
+    def update(self, key: bytes, value: bytes) -> None:
+        """Insert or replace one element."""
+        self._elem(BPF_MAP_UPDATE_ELEM, key, ctypes.create_string_buffer(value, self.value_size))
+
+    def delete(self, key: bytes) -> None:
+        """Delete one element, missing keys are ignored."""
+        try:
+            self._elem(BPF_MAP_DELETE_ELEM, key)
+        except FileNotFoundError:
+            pass
+
+    def keys(self) -> Iterator[bytes]:
+        """Iterate over the keys, which may change during the walk."""
+        key = ctypes.create_string_buffer(self.key_size)
+        next_key = ctypes.create_string_buffer(self.key_size)
+        attr = _MapElemAttr(map_fd=self.fd, key=0, value=ctypes.addressof(next_key))
+        while True:
+            try:
+                _bpf(BPF_MAP_GET_NEXT_KEY, attr)
+            except FileNotFoundError:
+                return
+            yield next_key.raw
+            ctypes.memmove(key, next_key, self.key_size)
+            attr.key = ctypes.addressof(key)
+
+def _run(*command: str) -> bool:
+    try:
+        return subprocess.run(command, capture_output=True, check=False).returncode == 0
+    except OSError:
+        return False
+
+class XdpFilter:
+    """
+    Mirrors the domain list into the XDP program's map.
+
+    The module's netfilter hooks keep checking every query that reaches
+    the stack, so the map only has to be a subset of the module's list:
+    names are added after the module has them and a failed update only
+    costs speed.
+    """
+
+    def __init__(self, domains: BpfMap, config: BpfMap, interface: str = "",
+                 seed: Optional[int] = None) -> None:
+        """
+        Initialize the filter on open maps.
+
+        Args:
+            domains: The program's nf_domains map
+            config: The program's nf_config map
+            interface: Interface the program is attached to, "" if none
+            seed: Name hash seed, random by default
+        """
+        self.domains = domains
+        self.config = config
+        self.interface = interface
+        self.seed = secrets.randbits(64) if seed is None else seed
+        self.answer = True
+        self.logger = setup_logger(__name__)
+
+    @classmethod
+    def attach(cls, interface: str, answer: bool = True) -> Optional["XdpFilter"]:
+        """
+        Load the program, pin its maps and attach it to an interface.
+
+        Args:
+            interface: Ingress interface of the clients, e.g. the LAN bridge
+            answer: Answer blocked queries with NXDOMAIN instead of dropping them
+
+        Returns:
+            Optional[XdpFilter]: Filter with an empty enabled map, None if the
+            program could not be loaded or attached
+        """
+        logger = setup_logger(__name__)
+        if not os.path.exists(XDP_OBJECT_PATH) or not shutil.which("bpftool"):
+            logger.info("XDP program or bpftool not available, queries go through netfilter only")
+            return None
+
+        shutil.rmtree(XDP_PIN_DIR, ignore_errors=True)
+        program = os.path.join(XDP_PIN_DIR, PROGRAM_PIN)
+        if not (_run("bpftool", "prog", "load", XDP_OBJECT_PATH, program,
+                     "type", "xdp", "pinmaps", XDP_PIN_DIR) and
+                _run("ip", "link", "set", "dev", interface, "xdp", "pinned", program)):
+            logger.error(f"Cannot attach XDP program to {interface}")
+            shutil.rmtree(XDP_PIN_DIR, ignore_errors=True)
+            return None
+
+        try:
+            domains = PinnedMap(os.path.join(XDP_PIN_DIR, DOMAINS_MAP), 8, 1)
+            config = PinnedMap(os.path.join(XDP_PIN_DIR, CONFIG_MAP), 4, struct.calcsize(XDP_CONFIG_FORMAT))
+        except OSError as e:
+            logger.error(f"Cannot open XDP maps: {e}")
+            _run("ip", "link", "set", "dev", interface, "xdp", "off")
+            return None
+
+        xdp = cls(domains, config, interface)
+        xdp.configure(enabled=True, answer=answer)
+        logger.info(f"XDP fast path attached to {interface}")
+        return xdp
+
+    def configure(self, enabled: bool, answer: bool = True) -> None:
+        """Write the seed and flags the program reads for every query."""
+        self.answer = answer
+        flags = (XDP_FLAG_ENABLED if enabled else 0) | (XDP_FLAG_ANSWER if answer else 0)
+        self.config.update(struct.pack("=I", 0), struct.pack(XDP_CONFIG_FORMAT, self.seed, flags, 0))
+
+    def key(self, domain: str) -> bytes:
+        """Map key of a domain, its image hash under this filter's seed."""
+        return struct.pack(KEY_FORMAT, hash_domain(domain.encode(), self.seed))
+
+    def load(self, domains: Iterable[str]) -> None:
+        """
+        Replace the map contents with a full list.
+
+        Stale keys are deleted after the new ones are in, so names on both
+        lists are matched throughout.
+        """
+        wanted = set()
+        for domain in domains:
+            key = self.key(domain)
+            wanted.add(key)
+            self.domains.update(key, PRESENT)
+        for key in [key for key in self.domains.keys() if key not in wanted]:
+            self.domains.delete(key)
+
+    def apply_records(self, opcode: int, domains: List[str]) -> None:
+        """
+        Apply one FRAME_OP_* record run, as GenlClient.apply_records() does.
+
+        Args:
+            opcode: FRAME_OP_ADD_DOMAINS, FRAME_OP_REMOVE_DOMAINS or FRAME_OP_LOAD_DOMAINS
+            domains: Domains of the run
+        """
+        if opcode == FRAME_OP_LOAD_DOMAINS:
+            self.load(domains)
+        elif opcode == FRAME_OP_ADD_DOMAINS:
+            for domain in domains:
+                self.domains.update(self.key(domain), PRESENT)
+        elif opcode == FRAME_OP_REMOVE_DOMAINS:
+            for domain in domains:
+                self.domains.delete(self.key(domain))
+
+    def apply(self, notification: Dict[str, Any]) -> bool:
+        """
+        Mirror a domain list notification into the map, or a pause into
+        the program's flags.
+
+        Returns:
+            bool: True if the notification changed the domain list
+        """
+        if STR_PAUSED in notification:
+            try:
+                self.configure(enabled=not notification[STR_PAUSED], answer=self.answer)
+            except OSError as e:
+                self.logger.error(f"XDP config update failed: {e}")
+            return False
+
+        records = notification_records(notification)
+        if records is None:
+            return False
+        try:
+            self.apply_records(*records)
+        except OSError as e:
+            self.logger.error(f"XDP map update failed: {e}")
+        return True
+
+    def detach(self) -> None:
+        """Detach the program and drop its pins."""
+        for bpf_map in (self.domains, self.config):
+            if isinstance(bpf_map, PinnedMap):
+                bpf_map.close()
+        if self.interface:
+            _run("ip", "link", "set", "dev", self.interface, "xdp", "off")
+        shutil.rmtree(XDP_PIN_DIR, ignore_errors=True)
@@ -0,0 +1,100 @@
+import pytest
+from pathlib import Path
+from My_Internet.server.src.db_manager import DatabaseManager
+
+@pytest.fixture
+def db_manager(tmp_path: Path) -> DatabaseManager:
+    """Create a database manager on a fresh database file."""
+    return DatabaseManager(str(tmp_path / 'test.db'))
+
+def test_list_version_counts_changes(db_manager: DatabaseManager) -> None:
+    """Test every list change bumps the version and failed ones do not."""
+    epoch, version = db_manager.get_list_version()
+    assert epoch > 0
+    assert version == 0
+
+    db_manager.add_blocked_domain('a.com')
+    db_manager.add_blocked_domain('a.com')
+    db_manager.remove_blocked_domain('missing.com')
+    db_manager.remove_blocked_domains(['a.com', 'other.com'])
+
+    assert db_manager.get_list_version() == (epoch, 2)
+
+def test_changes_since_keeps_last_change(db_manager: DatabaseManager) -> None:
+    """Test the delta holds the net effect of the changes after a version."""
+    db_manager.add_blocked_domain('old.com')
+    _, version = db_manager.get_list_version()
+
+    db_manager.add_blocked_domain('new.com')
+    db_manager.add_blocked_domain('flip.com')
+    db_manager.remove_blocked_domain('flip.com')
+    db_manager.remove_blocked_domain('old.com')
+
+    assert db_manager.get_changes_since(version) == (['new.com'], ['flip.com', 'old.com'])
+    assert db_manager.get_changes_since(db_manager.get_list_version()[1]) == ([], [])
+
+def test_changes_since_unknown_version(db_manager: DatabaseManager) -> None:
+    """Test versions the log cannot serve ask for a full resync."""
+    db_manager.add_blocked_domain('a.com')
+
+    assert db_manager.get_changes_since(5) is None
+
+def test_epoch_differs_per_database(tmp_path: Path) -> None:
+    """Test two databases never share an epoch by accident of numbering."""
+    first = DatabaseManager(str(tmp_path / 'first.db')).get_list_version()[0]
+    reopened = DatabaseManager(str(tmp_path / 'first.db')).get_list_version()[0]
+    second = DatabaseManager(str(tmp_path / 'second.db')).get_list_version()[0]
+
+    assert first == reopened
+    assert first != second
+
+def test_profile_tables(db_manager: DatabaseManager) -> None:
+    """Test client subnets and profile domains are kept apart from the shared list."""
+    db_manager.set_client_profile('10.0.1.0/24', 2)
+    db_manager.set_client_profile('10.0.1.0/24', 3)
+    assert db_manager.get_client_profiles() == [('10.0.1.0/24', 3)]
+    assert db_manager.remove_client_profile('10.0.1.0/24')
+    assert not db_manager.remove_client_profile('10.0.1.0/24')
+
+    assert db_manager.add_profile_domain('games.com', 3)
+    assert not db_manager.add_profile_domain('games.com', 3)
+    db_manager.add_profile_domain('games.com', 4)
+    db_manager.add_profile_domain('video.com', 3)
+
+    assert sorted(db_manager.get_profile_domains()) == [('games.com', 3), ('games.com', 4), ('video.com', 3)]
+    assert sorted(db_manager.get_profile_domains(['games.com'])) == [('games.com', 3), ('games.com', 4)]
+    assert db_manager.remove_profile_domain('games.com', 4)
+    assert db_manager.get_list_version()[1] == 0
+    assert not db_manager.is_domain_blocked('games.com')
+
+def test_category_lists(db_manager: DatabaseManager) -> None:
+    """Test category lists and the enabled mask follow the toggles."""
+    assert db_manager.get_enabled_categories() == 0b001
+    db_manager.update_setting('adult_block', 'on')
+    assert db_manager.get_enabled_categories() == 0b101
+
+    assert db_manager.add_category_domains(1, ['ads.com', 'track.com']) == ['ads.com', 'track.com']
+    assert db_manager.add_category_domains(1, ['ads.com']) == []
+    db_manager.add_category_domains(2, ['ads.com'])
+    assert db_manager.remove_category_domains(1, ['track.com', 'missing.com']) == ['track.com']
+
+    assert sorted(db_manager.get_category_domains()) == [('ads.com', 1), ('ads.com', 2)]
+    assert db_manager.get_blocked_domains() == []
+
+def test_import_category_domains(db_manager: DatabaseManager) -> None:
+    """Test an import replaces the category's list in one go and a failed one keeps it."""
+    db_manager.add_category_domains(1, ['stale.com'])
+    db_manager.add_category_domains(2, ['adult.com'])
+
+    assert db_manager.import_category_domains(1, iter(['a.com', 'b.com', 'a.com']), replace=True) == 2
+    assert db_manager.import_category_domains(1, iter(['c.com'])) == 3
+
+    def broken():
+        yield 'd.com'
+        raise OSError("connection reset")
+
+    with pytest.raises(OSError):
+        db_manager.import_category_domains(1, broken(), replace=True)
+    assert sorted(db_manager.get_category_domains()) == [
+        ('a.com', 1), ('adult.com', 2), ('b.com', 1), ('c.com', 1)
+    ]
@@ -0,0 +1,41 @@
+import struct
+import pytest
+from pathlib import Path
+from My_Internet.server.src.event_reader import EventReader, EVENT_SIZE
+from My_Internet.server.src.utils import EVENT_FORMAT
+
+def make_event(domain: bytes, client: bytes = bytes([10, 0, 0, 5]), verdict: int = 2) -> bytes:
+    """Pack one record the way the kernel's struct nf_event lays it out."""
+    return struct.pack(EVENT_FORMAT, 1_700_000_000 * 10**9, client.ljust(16, b'\0'),
+                       2, verdict, len(domain), domain)
+
+def test_event_size_matches_kernel() -> None:
+    """Test record size matches struct nf_event."""
+    assert EVENT_SIZE == 128
+
+def test_decode_events() -> None:
+    """Test decoding a batch of binary events."""
+    events = EventReader.decode(make_event(b'ads.example.com') + make_event(b'foo.org', verdict=1))
+
+    assert len(events) == 2
+    assert events[0].domain == 'ads.example.com'
+    assert events[0].client == '10.0.0.5'
+    assert events[0].verdict == 'blocked'
+    assert events[0].timestamp == pytest.approx(1_700_000_000)
+    assert events[1].verdict == 'nxdomain'
+
+def test_drain_keeps_partial_records(tmp_path: Path) -> None:
+    """Test draining per-CPU files and carrying over a partial record."""
+    record = make_event(b'example.com')
+    (tmp_path / 'events0').write_bytes(record + record[:10])
+    (tmp_path / 'events1').write_bytes(record)
+
+    reader = EventReader(str(tmp_path))
+    assert [event.domain for event in reader.drain()] == ['example.com', 'example.com']
+    assert reader._pending[str(tmp_path / 'events0')] == record[:10]
+    reader.close()
+
+def test_drain_without_module(tmp_path: Path) -> None:
+    """Test draining when no event files exist."""
+    reader = EventReader(str(tmp_path / 'missing'))
+    assert reader.drain() == []
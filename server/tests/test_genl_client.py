@@ -0,0 +1,195 @@
+import struct
+import pytest
+from typing import List
+from My_Internet.server.src.genl_client import (
+    GenlClient, pack_attr, parse_attrs, chunk_domains,
+    NLM_F_DUMP, NLMSG_HEADER, GENLMSG_HEADER, NLMSG_ERROR, CTRL_ATTR_FAMILY_ID,
+    CTRL_ATTR_MCAST_GROUPS, CTRL_ATTR_MCAST_GRP_NAME, CTRL_ATTR_MCAST_GRP_ID
+)
+from My_Internet.server.src.protocol import encode_domains
+from My_Internet.server.src.utils import (
+    EVENT_FORMAT, GENL_ATTR_DOMAINS, GENL_ATTR_LOAD_FIRST, GENL_ATTR_LOAD_LAST,
+    GENL_ATTR_STATS, GENL_ATTR_EVENT, GENL_CMD_EVENT, GENL_ATTR_LIST_EPOCH, GENL_ATTR_LIST_VERSION,
+    GENL_ATTR_PROFILE_RULES, GENL_ATTR_PROFILE, PROFILE_RULE_FORMAT,
+    GENL_ATTR_CATEGORIES, GENL_ATTR_CATEGORY, CATEGORY_ADS,
+    GENL_ATTR_HIT_COUNTS, GENL_ATTR_LISTED, GENL_ATTR_COLD, GENL_CMD_SET_PAUSED, GENL_ATTR_PAUSED,
+    STR_CODE, STR_CONTENT, STR_DOMAINS, STR_OPERATION, STR_PROFILE, STR_RULES,
+    STR_CATEGORY, STR_CATEGORIES, STR_PAUSED, Codes
+)
+
+class FakeNetlinkSocket:
+    """Acknowledges every request, prepending any queued reply attributes."""
+
+    def __init__(self) -> None:
+        self.sent: List[bytes] = []
+        self.replies: List[bytes] = []
+        self.error = 0
+
+    def send(self, data: bytes) -> int:
+        self.sent.append(data)
+        return len(data)
+
+    def recv(self, size: int) -> bytes:
+        seq = struct.unpack_from(NLMSG_HEADER, self.sent[-1])[3]
+        data = b''
+        for attrs in self.replies:
+            data += make_message(0x20, seq, struct.pack(GENLMSG_HEADER, 1, 1, 0) + attrs)
+        self.replies = []
+        return data + make_message(NLMSG_ERROR, seq, struct.pack("=i", self.error) + self.sent[-1][:16])
+
+    def close(self) -> None:
+        pass
+
+def make_message(msg_type: int, seq: int, body: bytes) -> bytes:
+    """Build one netlink message padded to 4 bytes."""
+    length = struct.calcsize(NLMSG_HEADER) + len(body)
+    return struct.pack(NLMSG_HEADER, length, msg_type, 0, seq, 0) + body + b'\0' * (-length % 4)
+
+def sent_attrs(data: bytes) -> dict:
+    """Attributes of a request captured by the fake socket."""
+    offset = struct.calcsize(NLMSG_HEADER) + struct.calcsize(GENLMSG_HEADER)
+    return parse_attrs(data[offset:])
+
+@pytest.fixture
+def client() -> GenlClient:
+    """Create a client on a fake socket with a resolved family."""
+    genl = GenlClient(FakeNetlinkSocket())
+    genl.family_id = 0x21
+    return genl
+
+def test_attr_roundtrip() -> None:
+    """Test attributes are padded and parsed back."""
+    data = pack_attr(1, b'abc') + pack_attr(2)
+    assert len(data) == 12
+    assert parse_attrs(data) == {1: b'abc', 2: b''}
+
+def test_chunk_domains_respects_size() -> None:
+    """Test record runs are split without cutting a record."""
+    chunks = list(chunk_domains([f'site{i}.example.com' for i in range(100)], chunk_size=100))
+    assert all(len(chunk) <= 100 for chunk in chunks)
+    assert b''.join(chunks).count(b'.example.com') == 100
+
+def test_resolve_family(client: GenlClient) -> None:
+    """Test family id and multicast groups are read from the controller reply."""
+    group = pack_attr(CTRL_ATTR_MCAST_GRP_NAME, b'events\0') + pack_attr(CTRL_ATTR_MCAST_GRP_ID, struct.pack("=I", 7))
+    client.sock.replies.append(
+        pack_attr(CTRL_ATTR_FAMILY_ID, struct.pack("=H", 0x2a)) +
+        pack_attr(CTRL_ATTR_MCAST_GROUPS, pack_attr(1, group))
+    )
+
+    client.resolve_family()
+
+    assert client.family_id == 0x2a
+    assert client.groups == {'events': 7}
+
+def test_load_frames_chunks(client: GenlClient) -> None:
+    """Test a load marks its first and last chunk."""
+    client.load_domains([f'site{i}.example.com' for i in range(20)], chunk_size=64)
+
+    requests = [sent_attrs(data) for data in client.sock.sent]
+    assert len(requests) > 1
+    assert GENL_ATTR_LOAD_FIRST in requests[0] and GENL_ATTR_LOAD_LAST not in requests[0]
+    assert GENL_ATTR_LOAD_LAST in requests[-1] and GENL_ATTR_LOAD_FIRST not in requests[-1]
+    assert all(GENL_ATTR_DOMAINS in request for request in requests)
+
+def test_apply_routes_notifications(client: GenlClient) -> None:
+    """Test only domain list changes are sent."""
+    assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: 'example.com',
+                         STR_OPERATION: Codes.CODE_ADD_DOMAIN})
+    assert sent_attrs(client.sock.sent[0])[GENL_ATTR_DOMAINS] == b'\x0bexample.com'
+    assert not client.apply({STR_CONTENT: 'on', STR_OPERATION: Codes.CODE_AD_BLOCK})
+    assert len(client.sock.sent) == 1
+
+def test_profile_notifications(client: GenlClient) -> None:
+    """Test profile rules are packed as nf_profile_rule and domains carry their profile."""
+    assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: '10.0.1.0/24',
+                         STR_RULES: [('10.0.1.7/24', 2), ('2001:db8::/32', 5)],
+                         STR_OPERATION: Codes.CODE_SET_CLIENT_PROFILE})
+    rules = sent_attrs(client.sock.sent[0])[GENL_ATTR_PROFILE_RULES]
+    size = struct.calcsize(PROFILE_RULE_FORMAT)
+    assert struct.unpack(PROFILE_RULE_FORMAT, rules[:size]) == (2, 24, 2, 0, bytes([10, 0, 1, 0]).ljust(16, b'\0'))
+    assert struct.unpack(PROFILE_RULE_FORMAT, rules[size:])[:3] == (10, 32, 5)
+
+    assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: 'games.com', STR_PROFILE: 3,
+                         STR_OPERATION: Codes.CODE_REMOVE_PROFILE_DOMAIN})
+    attrs = sent_attrs(client.sock.sent[1])
+    assert attrs[GENL_ATTR_DOMAINS] == b'\x09games.com'
+    assert attrs[GENL_ATTR_PROFILE] == b'\x03'
+
+    client.set_profiles([])
+    assert GENL_ATTR_PROFILE_RULES not in sent_attrs(client.sock.sent[2])
+
+def test_category_notifications(client: GenlClient) -> None:
+    """Test toggles send the enabled mask and list edits name their category."""
+    assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: 'on', STR_CATEGORIES: 0b011,
+                         STR_OPERATION: Codes.CODE_AD_BLOCK})
+    assert sent_attrs(client.sock.sent[0])[GENL_ATTR_CATEGORIES] == b'\x03'
+
+    assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CATEGORY: CATEGORY_ADS, STR_DOMAINS: ['ads.com'],
+                         STR_OPERATION: Codes.CODE_ADD_CATEGORY_DOMAINS})
+    attrs = sent_attrs(client.sock.sent[1])
+    assert attrs[GENL_ATTR_DOMAINS] == b'\x07ads.com'
+    assert attrs[GENL_ATTR_CATEGORY] == bytes([CATEGORY_ADS])
+    assert GENL_ATTR_PROFILE not in attrs
+
+def test_pause_notifications(client: GenlClient) -> None:
+    """Test pausing and resuming send the state and leave the lists alone."""
+    for paused in (True, False):
+        assert client.apply({STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: 'on' if paused else 'off',
+                             STR_PAUSED: paused, STR_OPERATION: Codes.CODE_PAUSE_FILTERING})
+    for msg, paused in zip(client.sock.sent, (b'\x01', b'\x00')):
+        assert msg[struct.calcsize(NLMSG_HEADER)] == GENL_CMD_SET_PAUSED
+        assert sent_attrs(msg) == {GENL_ATTR_PAUSED: paused}
+
+def test_request_error_raises(client: GenlClient) -> None:
+    """Test a negative acknowledgement becomes an OSError."""
+    client.sock.error = -1
+    with pytest.raises(OSError):
+        client.add_domains(['example.com'])
+
+def test_get_stats(client: GenlClient) -> None:
+    """Test counters are named after enum nf_stat_item."""
+    client.sock.replies.append(pack_attr(GENL_ATTR_STATS, pack_attr(1, struct.pack("=Q", 42))))
+    assert client.get_stats() == {'packets': 42}
+
+def test_get_hits_joins_dump(client: GenlClient) -> None:
+    """Test a hit report dumped over several messages is read back in order."""
+    totals = pack_attr(GENL_ATTR_LISTED, struct.pack("=I", 10)) + pack_attr(GENL_ATTR_COLD, struct.pack("=I", 7))
+    client.sock.replies.append(totals + pack_attr(GENL_ATTR_DOMAINS, encode_domains(['a.com', 'b.com'])) +
+                               pack_attr(GENL_ATTR_HIT_COUNTS, struct.pack("=2I", 90, 12)))
+    client.sock.replies.append(totals + pack_attr(GENL_ATTR_DOMAINS, encode_domains(['c.com'])) +
+                               pack_attr(GENL_ATTR_HIT_COUNTS, struct.pack("=I", 1)))
+
+    report = client.get_hits()
+
+    assert struct.unpack_from(NLMSG_HEADER, client.sock.sent[0])[2] & NLM_F_DUMP == NLM_F_DUMP
+    assert report.top == [('a.com', 90), ('b.com', 12), ('c.com', 1)]
+    assert (report.listed, report.cold, report.complete) == (10, 7, True)
+
+def test_list_version_roundtrip(client: GenlClient) -> None:
+    """Test the list version is sent and read as u32 epoch and u64 version."""
+    client.set_list_version(9, 2**40)
+    attrs = sent_attrs(client.sock.sent[0])
+    assert attrs[GENL_ATTR_LIST_EPOCH] == struct.pack("=I", 9)
+    assert attrs[GENL_ATTR_LIST_VERSION] == struct.pack("=Q", 2**40)
+
+    client.sock.replies.append(pack_attr(GENL_ATTR_LIST_EPOCH, struct.pack("=I", 9)) +
+                               pack_attr(GENL_ATTR_LIST_VERSION, struct.pack("=Q", 5)))
+    assert client.get_list_version() == (9, 5)
+
+def test_read_events() -> None:
+    """Test multicast events are decoded like relay records."""
+    record = struct.pack(EVENT_FORMAT, 10**9, bytes([10, 0, 0, 5]).ljust(16, b'\0'), 2, 2, 3, b'a.b')
+
+    class EventSocket:
+        def __init__(self) -> None:
+            self.queued = [make_message(0x21, 0, struct.pack(GENLMSG_HEADER, GENL_CMD_EVENT, 1, 0) +
+                                        pack_attr(GENL_ATTR_EVENT, record))]
+
+        def recv(self, size: int) -> bytes:
+            if not self.queued:
+                raise BlockingIOError
+            return self.queued.pop()
+
+    events = GenlClient.read_events(EventSocket())
+    assert [(event.domain, event.client, event.verdict) for event in events] == [('a.b', '10.0.0.5', 'blocked')]
@@ -0,0 +1,15 @@
+import pytest
+from My_Internet.server.src.genl_client import HitReport
+from My_Internet.server.src.hit_report import cold_domains
+
+def test_cold_domains_are_listed_without_hits() -> None:
+    """Test the cold domains are the listed ones missing from a complete report."""
+    report = HitReport(listed=4, cold=2, top=[('a.com', 5), ('c.com', 1)])
+    assert cold_domains(report, ['d.com', 'a.com', 'b.com', 'c.com']) == ['b.com', 'd.com']
+
+def test_cold_domains_need_complete_report() -> None:
+    """Test a report that dropped names with hits cannot tell the cold ones."""
+    report = HitReport(listed=5000, cold=1000, top=[(f'site{i}.com', 1) for i in range(1024)])
+    assert not report.complete
+    with pytest.raises(ValueError):
+        cold_domains(report, ['a.com'])
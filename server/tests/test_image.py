@@ -0,0 +1,68 @@
+import struct
+import zlib
+from My_Internet.server.src.image import build_image, image_contains, image_categories, hash_domain, hash_label
+from My_Internet.server.src.utils import (
+    IMAGE_MAGIC, IMAGE_HEADER_FORMAT, IMAGE_SLOT_FORMAT, CATEGORY_ADS, CATEGORY_ADULT
+)
+
+def test_header_matches_kernel() -> None:
+    """Test header layout matches struct image_header."""
+    image = build_image(['example.com'], epoch=3, version=9, seed=1)
+    fields = struct.unpack_from(IMAGE_HEADER_FORMAT, image)
+
+    assert struct.calcsize(IMAGE_HEADER_FORMAT) == 56
+    assert fields[0] == IMAGE_MAGIC
+    assert fields[3] == zlib.crc32(image[56:])
+    assert fields[5] == 1
+    assert fields[9:] == (3, 9, len(image))
+
+def test_hash_is_label_chained() -> None:
+    """Test a parent's hash is an intermediate step of its child's."""
+    parent = hash_domain(b'example.com', 7)
+    assert hash_domain(b'ads.example.com', 7) == hash_label(b'ads', 7, parent)
+
+def test_hash_matches_kernel() -> None:
+    """Test names hash case-insensitively to the value dns_label_hash() chains give in C."""
+    assert hash_domain(b'eight888.Example.com', 7) == 0xb5f076818af6838d
+    assert hash_domain(b'EIGHT888.example.COM', 7) == hash_domain(b'eight888.example.com', 7)
+    assert hash_domain(b'eight888x.example.com', 7) != hash_domain(b'eight888.example.com', 7)
+
+def test_lookup_every_domain() -> None:
+    """Test every domain is found with a single probe and others are not."""
+    domains = [f'site{i}.example.com' for i in range(500)]
+    image = build_image(domains + domains[:10])
+
+    assert struct.unpack_from(IMAGE_HEADER_FORMAT, image)[4] == 500
+    assert all(image_contains(image, domain) for domain in domains)
+    assert not image_contains(image, 'example.com')
+    assert not image_contains(image, 'site500.example.com')
+
+def test_empty_list() -> None:
+    """Test an empty list still yields an image with an empty index."""
+    image = build_image([])
+    assert not image_contains(image, 'example.com')
+
+def test_index_is_near_minimal() -> None:
+    """Test the index has few spare slots and the pool no per-name overhead."""
+    domains = [f'host{i}.example.net' for i in range(2000)]
+    image = build_image(domains, seed=5)
+    fields = struct.unpack_from(IMAGE_HEADER_FORMAT, image)
+    count, slots, buckets, pool_len = fields[4], fields[6], fields[7], fields[8]
+    slot_base = 56 + (2 * buckets + 7) // 8 * 8
+    used = [struct.unpack_from(IMAGE_SLOT_FORMAT, image, slot_base + i * 8)[2] for i in range(slots)]
+
+    assert slots <= count * 1.04
+    assert sum(1 for length in used if length) == count
+    assert pool_len == sum(len(domain) for domain in domains)
+
+def test_slots_carry_categories() -> None:
+    """Test a name on several lists gets one slot tagged with all of them."""
+    image = build_image(['custom.com', 'both.com'],
+                        categories=[('both.com', CATEGORY_ADS), ('adult.com', CATEGORY_ADULT),
+                                    ('both.com', CATEGORY_ADULT)])
+
+    assert struct.unpack_from(IMAGE_HEADER_FORMAT, image)[4] == 3
+    assert image_categories(image, 'custom.com') == 0b001
+    assert image_categories(image, 'both.com') == 0b111
+    assert image_categories(image, 'adult.com') == 0b100
+    assert image_categories(image, 'other.com') == 0
@@ -0,0 +1,45 @@
+from pathlib import Path
+from My_Internet.server.src.db_manager import DatabaseManager
+from My_Internet.server.src.list_import import compile_image, normalize_domain, parse_list
+from My_Internet.server.src.utils import CATEGORY_ADS
+
+def test_parse_hosts_and_adblock_lists() -> None:
+    """Test hosts entries, adblock rules and plain names are read alike, the rest skipped."""
+    lines = [
+        "# hosts header",
+        "127.0.0.1 localhost",
+        "::1 ip6-localhost",
+        "0.0.0.0 Ads.Example.com tracker.example.net  # inline comment",
+        "0.0.0.0 0.0.0.0",
+        "! adblock comment",
+        "[Adblock Plus 2.0]",
+        "||pixel.example.org^",
+        "||cdn.example.org^$third-party",
+        "||example.org/banner.gif",
+        "@@||allowed.example.org^",
+        "example.com##.banner",
+        "*.wild.example.com",
+        "plain.example.io.",
+        "nodots",
+    ]
+
+    assert list(parse_list(lines)) == [
+        "ads.example.com", "tracker.example.net", "pixel.example.org",
+        "wild.example.com", "plain.example.io",
+    ]
+
+def test_normalize_domain() -> None:
+    """Test names are brought to the kernel's form and invalid ones refused."""
+    assert normalize_domain("Bücher.Example.") == "xn--bcher-kva.example"
+    assert normalize_domain("-bad.example.com") is None
+    assert normalize_domain("a" * 64 + ".com") is None
+    assert normalize_domain("under_score.example.com") == "under_score.example.com"
+
+def test_compile_image_holds_imported_list(tmp_path: Path) -> None:
+    """Test the image built after an import carries the category and the custom list."""
+    db_manager = DatabaseManager(str(tmp_path / 'test.db'))
+    db_manager.add_blocked_domain('custom.com')
+    db_manager.import_category_domains(CATEGORY_ADS, parse_list(["0.0.0.0 ads.example.com"]))
+
+    image = compile_image(db_manager)
+    assert b'ads.example.com' in image and b'custom.com' in image
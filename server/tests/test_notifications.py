@@ -0,0 +1,71 @@
+import asyncio
+from typing import Any, Dict
+from My_Internet.server.src.notifications import NotificationQueue, coalesce_notifications
+from My_Internet.server.src.server import split_requests
+from My_Internet.server.src.utils import (
+    STR_CODE, STR_CONTENT, STR_DOMAINS, STR_OPERATION, STR_VERSION, STR_CATEGORIES, Codes
+)
+
+def edit(operation: str, domain: str, version: int = 1) -> Dict[str, Any]:
+    """A successful single domain response."""
+    return {STR_CODE: Codes.CODE_SUCCESS, STR_CONTENT: domain,
+            STR_VERSION: (1, version), STR_OPERATION: operation}
+
+def test_coalesce_merges_edit_burst() -> None:
+    """Test a burst of edits becomes one removal and one add, the last edit winning."""
+    merged = coalesce_notifications([
+        edit(Codes.CODE_ADD_DOMAIN, 'a.com'),
+        edit(Codes.CODE_ADD_DOMAIN, 'b.com'),
+        edit(Codes.CODE_REMOVE_DOMAIN, 'a.com'),
+        {STR_CODE: Codes.CODE_SUCCESS, STR_DOMAINS: ['c.com', 'd.com'],
+         STR_VERSION: (1, 1), STR_OPERATION: Codes.CODE_REMOVE_DOMAINS},
+        edit(Codes.CODE_ADD_DOMAIN, 'd.com'),
+    ])
+
+    assert [(n[STR_OPERATION], n[STR_DOMAINS]) for n in merged] == [
+        (Codes.CODE_REMOVE_DOMAINS, ['a.com', 'c.com']),
+        (Codes.CODE_ADD_DOMAINS, ['b.com', 'd.com']),
+    ]
+
+def test_coalesce_keeps_newest_version() -> None:
+    """Test only the last bulk notification of a run carries its newest version."""
+    merged = coalesce_notifications([
+        edit(Codes.CODE_ADD_DOMAIN, 'a.com', 4),
+        edit(Codes.CODE_REMOVE_DOMAIN, 'b.com', 6),
+        edit(Codes.CODE_ADD_DOMAIN, 'c.com', 5),
+    ])
+
+    assert STR_VERSION not in merged[0]
+    assert merged[1][STR_VERSION] == (1, 6)
+
+def test_coalesce_keeps_other_notifications_in_order() -> None:
+    """Test a category change splits the runs around it and single edits pass unchanged."""
+    categories = {STR_CODE: Codes.CODE_SUCCESS, STR_CATEGORIES: 3, STR_OPERATION: Codes.CODE_AD_BLOCK}
+    first = edit(Codes.CODE_ADD_DOMAIN, 'a.com')
+    last = edit(Codes.CODE_REMOVE_DOMAIN, 'a.com')
+
+    assert coalesce_notifications([first, categories, last]) == [first, categories, last]
+
+def test_queue_batches_burst() -> None:
+    """Test edits queued within the delay come out as one bulk notification."""
+    async def run() -> list:
+        queue = NotificationQueue(delay=0.01)
+        for i in range(100):
+            queue.put(edit(Codes.CODE_ADD_DOMAIN, f'site{i}.com'))
+        return await queue.get_batch()
+
+    batch = asyncio.run(run())
+    assert len(batch) == 1
+    assert batch[0][STR_OPERATION] == Codes.CODE_ADD_DOMAINS
+    assert len(batch[0][STR_DOMAINS]) == 100
+
+def test_split_requests_back_to_back() -> None:
+    """Test requests written without delimiters are split and a cut-off one is kept."""
+    requests, rest, invalid = split_requests('{"code": "52"}{"code": "53"} {"code": "5')
+    assert requests == [{"code": "52"}, {"code": "53"}]
+    assert rest == '{"code": "5'
+    assert not invalid
+
+    requests, rest, invalid = split_requests('{"code": "52"} not json')
+    assert requests == [{"code": "52"}]
+    assert invalid
@@ -0,0 +1,82 @@
+import struct
+import pytest
+from My_Internet.server.src.protocol import (
+    encode_domains, encode_frame, decode_frame, encode_notification,
+    encode_list_version, decode_list_version, delta_records, encode_paused
+)
+from My_Internet.server.src.utils import (
+    FRAME_MAGIC, FRAME_HEADER_FORMAT, FRAME_OP_ADD_DOMAINS,
+    FRAME_OP_REMOVE_DOMAINS, FRAME_OP_LOAD_DOMAINS, FRAME_OP_LIST_VERSION, FRAME_OP_SET_CATEGORIES,
+    FRAME_OP_SET_PAUSED,
+    STR_CODE, STR_CONTENT, STR_DOMAINS, STR_OPERATION, STR_SETTINGS, STR_CATEGORIES, STR_PAUSED, Codes
+)
+
+def test_header_matches_kernel() -> None:
+    """Test header layout matches struct frame_header."""
+    assert struct.calcsize(FRAME_HEADER_FORMAT) == 8
+    assert encode_frame(FRAME_OP_ADD_DOMAINS, b'\x01a')[:4] == bytes([FRAME_MAGIC, 1, 0, 0])
+    assert encode_frame(FRAME_OP_ADD_DOMAINS, b'\x01a')[4:8] == (2).to_bytes(4, 'big')
+
+def test_encode_domains_records() -> None:
+    """Test domains are packed as length-prefixed records."""
+    assert encode_domains(['ab.com', 'x.org']) == b'\x06ab.com\x05x.org'
+
+def test_encode_domains_rejects_oversized() -> None:
+    """Test names that do not fit a record are refused."""
+    with pytest.raises(ValueError):
+        encode_domains(['a' * 256])
+    with pytest.raises(ValueError):
+        encode_domains([''])
+
+def test_initial_settings_become_load_frame() -> None:
+    """Test the whole initial list is sent as one load frame."""
+    domains = [f'site{i}.example.com' for i in range(1000)]
+    frame = encode_notification({
+        STR_CODE:      Codes.CODE_SUCCESS,
+        STR_DOMAINS:   domains,
+        STR_SETTINGS:  {},
+        STR_OPERATION: Codes.CODE_INIT_SETTINGS
+    })
+
+    assert len(frame) > 1024
+    assert decode_frame(frame) == (FRAME_OP_LOAD_DOMAINS, domains)
+
+def test_single_domain_operations() -> None:
+    """Test add and remove responses map to one-record frames."""
+    add = encode_notification({STR_CONTENT: 'example.com', STR_OPERATION: Codes.CODE_ADD_DOMAIN})
+    remove = encode_notification({STR_CONTENT: 'example.com', STR_OPERATION: Codes.CODE_REMOVE_DOMAIN})
+
+    assert decode_frame(add) == (FRAME_OP_ADD_DOMAINS, ['example.com'])
+    assert decode_frame(remove) == (FRAME_OP_REMOVE_DOMAINS, ['example.com'])
+
+def test_settings_stay_json() -> None:
+    """Test notifications without a domain list are not framed."""
+    assert encode_notification({STR_CONTENT: 'on', STR_OPERATION: Codes.CODE_AD_BLOCK}) is None
+
+def test_toggles_become_category_frame() -> None:
+    """Test a toggle response carrying the enabled categories is one byte frame."""
+    frame = encode_notification({STR_CONTENT: 'on', STR_CATEGORIES: 0b011, STR_OPERATION: Codes.CODE_AD_BLOCK})
+    assert frame == encode_frame(FRAME_OP_SET_CATEGORIES, b'\x03')
+
+def test_pause_becomes_pause_frame() -> None:
+    """Test a pause response is a one byte frame, non-zero while paused."""
+    frame = encode_notification({STR_CONTENT: 'on', STR_PAUSED: True, STR_OPERATION: Codes.CODE_PAUSE_FILTERING})
+    assert frame == encode_frame(FRAME_OP_SET_PAUSED, b'\x01')
+    assert encode_paused(False) == encode_frame(FRAME_OP_SET_PAUSED, b'\x00')
+
+def test_list_version_frame_matches_kernel() -> None:
+    """Test the version frame matches struct frame_list_version."""
+    frame = encode_list_version(0x01020304, 7)
+    header_size = struct.calcsize(FRAME_HEADER_FORMAT)
+
+    assert frame[:2] == bytes([FRAME_MAGIC, FRAME_OP_LIST_VERSION])
+    assert len(frame) == header_size + 12
+    assert decode_list_version(frame[header_size:]) == (0x01020304, 7)
+
+def test_delta_records_remove_first() -> None:
+    """Test removals are applied before additions and empty changes are skipped."""
+    assert delta_records(['a.com'], ['b.com']) == [
+        (FRAME_OP_REMOVE_DOMAINS, ['b.com']),
+        (FRAME_OP_ADD_DOMAINS, ['a.com'])
+    ]
+    assert delta_records([], []) == []
@@ -0,0 +1,70 @@
+import struct
+import pytest
+from typing import Dict, Iterator
+from My_Internet.server.src.image import hash_domain
+from My_Internet.server.src.xdp_filter import XdpFilter
+from My_Internet.server.src.utils import (
+    XDP_CONFIG_FORMAT, XDP_FLAG_ENABLED, XDP_FLAG_ANSWER, FRAME_OP_LOAD_DOMAINS,
+    STR_CODE, STR_CONTENT, STR_OPERATION, STR_PAUSED, Codes
+)
+
+class FakeMap:
+    """Dictionary standing in for a pinned BPF map."""
+
+    def __init__(self) -> None:
+        self.elems: Dict[bytes, bytes] = {}
+
+    def update(self, key: bytes, value: bytes) -> None:
+        self.elems[key] = value
+
+    def delete(self, key: bytes) -> None:
+        self.elems.pop(key, None)
+
+    def keys(self) -> Iterator[bytes]:
+        return iter(list(self.elems))
+
+def key_of(domain: str, seed: int) -> bytes:
+    """Map key the XDP program looks up for a name."""
+    return struct.pack("=Q", hash_domain(domain.encode(), seed))
+
+@pytest.fixture
+def xdp() -> XdpFilter:
+    """Create a filter on fake maps with a fixed seed."""
+    return XdpFilter(FakeMap(), FakeMap(), seed=11)
+
+def test_configure_writes_seed_and_flags(xdp: XdpFilter) -> None:
+    """Test the config element carries the seed the keys are hashed with."""
+    xdp.configure(enabled=True)
+    value = xdp.config.elems[struct.pack("=I", 0)]
+    assert struct.unpack(XDP_CONFIG_FORMAT, value) == (11, XDP_FLAG_ENABLED | XDP_FLAG_ANSWER, 0)
+
+def test_load_replaces_map(xdp: XdpFilter) -> None:
+    """Test a full load keeps shared names and drops stale ones."""
+    xdp.apply_records(FRAME_OP_LOAD_DOMAINS, ['a.com', 'b.com'])
+    xdp.apply_records(FRAME_OP_LOAD_DOMAINS, ['b.com', 'c.com'])
+    assert set(xdp.domains.elems) == {key_of('b.com', 11), key_of('c.com', 11)}
+
+def test_apply_mirrors_notifications(xdp: XdpFilter) -> None:
+    """Test single adds and removals reach the map and other messages do not."""
+    add = {STR_CODE: Codes.CODE_SUCCESS, STR_OPERATION: Codes.CODE_ADD_DOMAIN, STR_CONTENT: 'ads.net'}
+    remove = {STR_CODE: Codes.CODE_SUCCESS, STR_OPERATION: Codes.CODE_REMOVE_DOMAIN, STR_CONTENT: 'ads.net'}
+
+    assert xdp.apply(add)
+    assert key_of('ads.net', 11) in xdp.domains.elems
+    assert xdp.apply(remove)
+    assert not xdp.domains.elems
+    assert not xdp.apply({STR_CODE: Codes.CODE_SUCCESS, STR_OPERATION: Codes.CODE_AD_BLOCK})
+
+def test_pause_clears_enabled_flag(xdp: XdpFilter) -> None:
+    """Test a pause turns the program off and keeps the map and answer mode."""
+    xdp.configure(enabled=True, answer=False)
+    xdp.apply_records(FRAME_OP_LOAD_DOMAINS, ['a.com'])
+    config = struct.pack("=I", 0)
+
+    assert not xdp.apply({STR_CODE: Codes.CODE_SUCCESS, STR_PAUSED: True,
+                          STR_OPERATION: Codes.CODE_PAUSE_FILTERING})
+    assert struct.unpack(XDP_CONFIG_FORMAT, xdp.config.elems[config]) == (11, 0, 0)
+    assert key_of('a.com', 11) in xdp.domains.elems
+
+    xdp.apply({STR_CODE: Codes.CODE_SUCCESS, STR_PAUSED: False, STR_OPERATION: Codes.CODE_PAUSE_FILTERING})
+    assert struct.unpack(XDP_CONFIG_FORMAT, xdp.config.elems[config]) == (11, XDP_FLAG_ENABLED, 0)